@@ -0,0 +1 @@
+../src/cdal.h
\ No newline at end of file
@@ -11,6 +11,7 @@
  */
 
 #include "./AST.h"
+#include <climits>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -20,15 +21,391 @@
 Program::Program(string _varName, Stmts *_stmts) {
     varName = _varName;
     stmts = _stmts;
+    source = NULL;
+}
+Program::~Program() { delete source; }
+void Program::setSource(const string &filename, const char *text) {
+    delete source;
+    source = new SourceLines(filename, text);
 }
 string Program::unparse() {
     return varName + " ( ) { " + stmts->unparse() + " }";
 }
+namespace {
+
+// Matrix.h brings in everything generated code uses, and is included
+// first and alone so that a precompiled Matrix.h.gch can stand in for it
+// (see the runtime target of the Makefile)
+const char *prologue = "#include \"Matrix.h\"\n";
+
+// the CDAL source of a profiling site as a C++ string literal, on one line
+// and cut short if it is long
+string sourceLiteral(const string &source) {
+    const size_t longest = 72;
+    string text;
+    for (size_t k = 0; k != source.size(); k++) {
+        char c = isspace(static_cast<unsigned char>(source[k])) ? ' '
+                                                                : source[k];
+        if (c == ' ' && (text.empty() || text[text.size() - 1] == ' '))
+            continue;
+        text += c;
+    }
+    while (!text.empty() && text[text.size() - 1] == ' ')
+        text.erase(text.size() - 1);
+    if (text.size() > longest) text = text.substr(0, longest - 3) + "...";
+
+    string literal = "\"";
+    for (size_t k = 0; k != text.size(); k++) {
+        if (text[k] == '"' || text[k] == '\\') literal += '\\';
+        literal += text[k];
+    }
+    return literal + "\"";
+}
+
+// code with a #line directive before each of its lines that does not
+// follow a directive of its own, which the statements within it put
+// before theirs, so that every line is on the line it was translated from
+string onLine(const string &directive, const string &code) {
+    if (directive.empty()) return code;
+    string lines;
+    bool directed = false;
+    size_t start = 0;
+    while (start != code.size()) {
+        size_t end = code.find('\n', start);
+        end = end == string::npos ? code.size() : end + 1;
+        string line = code.substr(start, end - start);
+        start = end;
+        size_t first = line.find_first_not_of(' ');
+        if (first == string::npos || line[first] == '\n') {
+            lines += line;
+            directed = false;
+            continue;
+        }
+        bool isDirective = line.compare(first, 6, "#line ") == 0;
+        if (!isDirective && !directed)
+            lines += line.substr(0, first) + directive;
+        lines += line;
+        directed = isDirective;
+    }
+    return lines;
+}
+
+// a statement, each line of it after a #line directive giving its line in
+// the source; in a profiling translation it is timed as a site of its own
+string stmtCode(Stmt *stmt) {
+    string line = codeGenContext().lineDirective(stmt->offset);
+    string site = codeGenContext().profileSite("statement", stmt->unparse(),
+                                             stmt->offset);
+    string code = stmt->cppCode();
+    if (!site.empty())
+        code = "profileEnter(" + site + ");\n" + code + "\nprofileLeave();";
+    return onLine(line, code);
+}
+
+// the body of an if or a loop; in a profiling translation, one that is not
+// a block of statements, which are timed themselves, is timed in a block
+string profiledBody(Stmt *stmt) {
+    if (!codeGenContext().profiling || dynamic_cast<NestedStmt *>(stmt) != NULL)
+        return stmt->cppCode();
+    string code = stmtCode(stmt);
+    return "{\n" + indent(code) + "}";
+}
+
+// a matrix declared by name, or the transpose of one, whose products are
+// timed as kernels
+bool namedMatrix(Expr *ex) {
+    NestedOrFunctionCallExpr *call = dynamic_cast<NestedOrFunctionCallExpr *>(ex);
+    if (call != NULL && call->functionName() == "transpose")
+        ex = call->argument();
+    VarNameExpr *var = dynamic_cast<VarNameExpr *>(ex);
+    return var != NULL && codeGenContext().isMatrix(var->name());
+}
+
+// in a profiling translation, the call of a kernel timed at a site
+string profiledCall(const string &site, const string &code) {
+    if (site.empty()) return code;
+    return "profileCall(" + site + ", [&] { return " + code + "; })";
+}
+
+// the CDAL spelling of a matrix type with the given element type
+string matrixType(const string &elementType) {
+    return elementType.empty() ? "matrix" : "matrix<" + elementType + ">";
+}
+
+// the C++ type of the elements of a matrix with the given CDAL element type
+string cppElementType(const string &elementType) {
+    if (elementType == "double") return "double";
+    if (elementType == "int") return "int32_t";
+    if (elementType == "int8") return "int8_t";
+    return "float";
+}
+
+// the runtime type of a matrix with the given CDAL element type
+string cppMatrixType(const string &elementType) {
+    string element = cppElementType(elementType);
+    return element == "float" ? "matrix" : "basicMatrix<" + element + ">";
+}
+
+// strip any parentheses around an expression
+Expr *unparenthesized(Expr *ex) {
+    NestedExpr *nested;
+    while ((nested = dynamic_cast<NestedExpr *>(ex)) != NULL)
+        ex = nested->inner();
+    return ex;
+}
+
+// the CDAL element type of the matrix an expression evaluates to, as the
+// bytecode compiler types it, or the empty string if it is not a matrix
+// or its element type is not known before it runs
+string elementsOf(Expr *ex) {
+    ex = unparenthesized(ex);
+    VarNameExpr *var = dynamic_cast<VarNameExpr *>(ex);
+    if (var != NULL) return codeGenContext().elementType(var->name());
+    MatrixSliceExpr *slice = dynamic_cast<MatrixSliceExpr *>(ex);
+    if (slice != NULL) return codeGenContext().elementType(slice->name());
+    NestedOrFunctionCallExpr *call =
+        dynamic_cast<NestedOrFunctionCallExpr *>(ex);
+    if (call != NULL && call->functionName() == "matrixRead") return "float";
+    if (call != NULL && call->functionName() == "transpose")
+        return elementsOf(call->argument());
+
+    // a matrix combined with a scalar keeps its element type, and products
+    // of int8 matrices are int
+    Expr *left = NULL, *right = NULL;
+    MultiplyExpr *times = dynamic_cast<MultiplyExpr *>(ex);
+    AddExpr *plus = dynamic_cast<AddExpr *>(ex);
+    SubtractExpr *minus = dynamic_cast<SubtractExpr *>(ex);
+    DevideExpr *divide = dynamic_cast<DevideExpr *>(ex);
+    if (times != NULL) left = times->left(), right = times->right();
+    if (plus != NULL) left = plus->left(), right = plus->right();
+    if (minus != NULL) left = minus->left(), right = minus->right();
+    if (divide != NULL) left = divide->left(), right = divide->right();
+    if (left == NULL) return "";
+    string l = elementsOf(left), r = elementsOf(right);
+    if (!l.empty() && !r.empty() && l != r) return "";
+    string elements = l.empty() ? r : l;
+    return times != NULL && !l.empty() && !r.empty() && elements == "int8"
+               ? "int"
+               : elements;
+}
+
+// whether an expression is a floating scalar: a float literal or variable,
+// the mean or norm of a matrix, a reduction of a matrix of floating
+// elements, or arithmetic on scalars with a floating operand
+bool floatingScalar(Expr *ex) {
+    ex = unparenthesized(ex);
+    if (dynamic_cast<FloatExpr *>(ex) != NULL) return true;
+    VarNameExpr *var = dynamic_cast<VarNameExpr *>(ex);
+    if (var != NULL) return codeGenContext().isFloatScalar(var->name());
+    NestedOrFunctionCallExpr *call =
+        dynamic_cast<NestedOrFunctionCallExpr *>(ex);
+    if (call != NULL) {
+        string function = call->functionName();
+        string elements = elementsOf(call->argument());
+        return function == "mean" || function == "norm" ||
+               ((function == "sum" || function == "min" || function == "max") &&
+                (elements == "float" || elements == "double"));
+    }
+
+    Expr *left = NULL, *right = NULL;
+    MultiplyExpr *times = dynamic_cast<MultiplyExpr *>(ex);
+    AddExpr *plus = dynamic_cast<AddExpr *>(ex);
+    SubtractExpr *minus = dynamic_cast<SubtractExpr *>(ex);
+    DevideExpr *divide = dynamic_cast<DevideExpr *>(ex);
+    if (times != NULL) left = times->left(), right = times->right();
+    if (plus != NULL) left = plus->left(), right = plus->right();
+    if (minus != NULL) left = minus->left(), right = minus->right();
+    if (divide != NULL) left = divide->left(), right = divide->right();
+    if (left == NULL || !elementsOf(ex).empty()) return false;
+    return floatingScalar(left) || floatingScalar(right);
+}
+
+// a scalar operand of a matrix with integer elements, which must not be
+// floating: the runtime's operators reject the truncation, and the
+// interpreter reports the same error
+void checkScalar(Expr *scalar, const string &elements) {
+    if ((elements == "int" || elements == "int8") && floatingScalar(scalar))
+        throw "a float cannot be combined with a matrix with " + elements +
+            " elements";
+}
+
+// operands of an operator, which must not be matrices with different
+// element types: the runtime has no operators for those, and the
+// interpreter reports the same error
+void checkElements(Expr *ex1, Expr *ex2, const string &verb) {
+    string left = elementsOf(ex1), right = elementsOf(ex2);
+    if (!left.empty() && !right.empty() && left != right)
+        throw "matrices with " + left + " and " + right +
+            " elements cannot be " + verb;
+    checkScalar(ex1, right);
+    checkScalar(ex2, left);
+}
+
+// whether an expression is a matrix with another element type than the
+// matrix it is stored in, which the interpreter converts it to
+bool convertedTo(Expr *ex, const string &elementType) {
+    string elements = elementsOf(ex);
+    return !elements.empty() &&
+           elements != (elementType.empty() ? "float" : elementType);
+}
+
+// the value of an expression stored in a matrix with the given CDAL
+// element type; a value to be converted is first evaluated to a matrix
+// of its own type, which basicMatrix converts explicitly
+string storedValue(Expr *ex, const string &elementType) {
+    if (!convertedTo(ex, elementType) ||
+        dynamic_cast<VarNameExpr *>(unparenthesized(ex)) != NULL)
+        return ex->cppCode();
+    return cppMatrixType(elementsOf(ex)) + "(" + ex->cppCode() + ")";
+}
+
+
+// as only the sparse kernels of namedOperands take it as it is
+string densified(const string &name) {
+    return codeGenContext().isSparse(name) ? name + ".toDense()" : name;
+}
+
+// two named operands of a product, sum or difference. The sparse kernels
+// take a sparseMatrix and a dense float matrix, so a sparse matrix beside
+// anything else is made dense, and of two sparse matrices the right one is
+string namedOperands(const string &left, const string &op,
+                     const string &right) {
+    CodeGenContext &context = codeGenContext();
+    if (context.isSparse(left) &&
+        (context.isSparse(right) || context.isDenseOperand(right)))
+        return left + op + densified(right);
+    if (context.isSparse(right) && context.isDenseOperand(left))
+        return left + op + right;
+    return densified(left) + op + densified(right);
+}
+
+// the operands of a sum or difference, which may be named matrices
+string operands(Expr *ex1, const string &op, Expr *ex2) {
+    checkElements(ex1, ex2, "combined");
+    VarNameExpr *var1 = dynamic_cast<VarNameExpr *>(ex1);
+    VarNameExpr *var2 = dynamic_cast<VarNameExpr *>(ex2);
+    if (var1 == NULL || var2 == NULL)
+        return ex1->cppCode() + op + ex2->cppCode();
+    codeGenContext().noteOtherUse(var1->name());
+    codeGenContext().noteOtherUse(var2->name());
+    return namedOperands(var1->name(), op, var2->name());
+}
+
+}  // namespace
+
 string Program::cppCode() {
-    string innerStmt = stmts->cppCode();
-    return "#include <cmath>\n#include <iostream>\n#include "
-           "\"Matrix.h\"\n\nint " +
-           varName + "() {\n" + indent(innerStmt) + "}";
+    // the first pass only gathers facts about the program
+    CodeGenContext context(source);
+    ActiveContext active(context);
+    stmts->cppCode();
+    context.analyze();
+
+    // matrices are printed in large chunks, which only pays off when
+    // std::cout is not kept in step with C stdio
+    string innerStmt = "std::ios_base::sync_with_stdio(false);\n" +
+                       stmts->cppCode();
+    return string(prologue) + "\nint " + varName + "() {\n" +
+           indent(innerStmt) + "}";
+}
+
+/**
+ * The top-level statements of main are numbered from 0. Those the
+ * interpreter ran are skipped, and the variables they declared are read
+ * from the resumePoint, named resumed, by the declarations themselves.
+ */
+string Program::resumableCppCode() {
+    CodeGenContext context(source);
+    ActiveContext active(context);
+    resumableStmts();
+    context.analyze();
+
+    string innerStmt = "std::ios_base::sync_with_stdio(false);\n"
+                       "resumePoint resumed(argc, argv);\n" +
+                       resumableStmts();
+    return string(prologue) + "\nint " + varName +
+           "(int argc, char **argv) {\n" + indent(innerStmt) + "}";
+}
+
+/**
+ * Each statement, comprehension and kernel call is a profileSite in
+ * cdalSites, and the profileReport made from them reports on them when
+ * the program exits.
+ */
+string Program::profiledCppCode() {
+    CodeGenContext context(source);
+    ActiveContext active(context);
+    context.profiling = true;
+    stmts->cppCode();
+    context.analyze();
+
+    string innerStmt = "std::ios_base::sync_with_stdio(false);\n" +
+                       stmts->cppCode();
+    const vector<CodeGenContext::profiledSite> &sites = context.profileSites;
+    string table;
+    for (size_t k = 0; k != sites.size(); k++)
+        table += "{\"" + sites[k].kind + "\", " +
+                 sourceLiteral(sites[k].location) + ", " +
+                 sourceLiteral(sites[k].source) + "},\n";
+    string declarations =
+        sites.empty() ? "profileSite *cdalSites = NULL;\n"
+                      : "profileSite cdalSites[] = {\n" + indent(table) + "};\n";
+    return string(prologue) + "\n" + declarations +
+           "profileReport cdalReport(cdalSites, " + to_string(sites.size()) +
+           ");\n\nint " + varName + "() {\n" + indent(innerStmt) + "}";
+}
+
+string Program::resumableStmts() {
+    string code;
+    int statement = 0;
+    for (SeqStmts *seq = dynamic_cast<SeqStmts *>(stmts); seq != NULL;
+         seq = dynamic_cast<SeqStmts *>(seq->rest()), statement++) {
+        if (dynamic_cast<DeclStmt *>(seq->first()) != NULL) {
+            codeGenContext().resumeStatement = statement;
+            code += stmtCode(seq->first()) + "\n";
+            codeGenContext().resumeStatement = -1;
+        } else {
+            string stmt = stmtCode(seq->first());
+            code += "if (!resumed.skips(" + to_string(statement) + ")) {\n" +
+                    indent(stmt) + "}\n";
+        }
+    }
+    return code;
+}
+
+/**
+ * The program runs in a libraryCall, which gives matrixRead the host's
+ * inputs and the host what it prints; the matrices declared at top level
+ * are handed to the host once it has finished.
+ */
+string Program::libraryCppCode() {
+    CodeGenContext context(source);
+    ActiveContext active(context);
+    context.library = true;
+    libraryStmts();
+    context.analyze();
+
+    string body = libraryStmts();
+    for (size_t k = 0; k != context.exported.size(); k++) {
+        const string &name = context.exported[k];
+        body += "libraryResult(\"" + name + "\", " + name + ");\n";
+    }
+    return string(prologue) + "#include \"cdal.h\"\n\n"
+           "namespace {\n\nvoid run() {\n" +
+           indent(body) + "}\n\n}  // namespace\n\n"
+           "extern \"C\" int cdal_" + varName + "(cdal_call *call) {\n"
+           "    return libraryCall(call).run(run);\n}";
+}
+
+string Program::libraryStmts() {
+    string code;
+    for (SeqStmts *seq = dynamic_cast<SeqStmts *>(stmts); seq != NULL;
+         seq = dynamic_cast<SeqStmts *>(seq->rest())) {
+        codeGenContext().exporting =
+            dynamic_cast<DeclStmt *>(seq->first()) != NULL;
+        code += stmtCode(seq->first()) + "\n";
+        codeGenContext().exporting = false;
+    }
+    return code;
 }
 
 
@@ -46,7 +423,14 @@ SeqStmts::SeqStmts(Stmt *_st1, Stmts *_stmts) {
     stmts = _stmts;
 }
 string SeqStmts::unparse() { return st1->unparse() + "\n" + stmts->unparse(); }
-string SeqStmts::cppCode() { return st1->cppCode() + "\n" + stmts->cppCode(); }
+string SeqStmts::cppCode() {
+    // the first statement is translated first, so that profiling sites are
+    // numbered in the order of the source
+    string first = stmtCode(st1);
+    return first + "\n" + stmts->cppCode();
+}
+Stmt *SeqStmts::first() { return st1; }
+Stmts *SeqStmts::rest() { return stmts; }
 
 
 // DeclStmt, inherits from Stmt
@@ -76,7 +460,7 @@ string IfStmt::unparse() {
     return "if ( " + ex1->unparse() + " ) " + st1->unparse();
 }
 string IfStmt::cppCode() {
-    return "if (" + ex1->cppCode() + ") " + st1->cppCode();
+    return "if (" + ex1->cppCode() + ") " + profiledBody(st1);
 }
 
 
@@ -92,8 +476,8 @@ string IfElseStmt::unparse() {
            st2->unparse();
 }
 string IfElseStmt::cppCode() {
-    return "if (" + ex1->cppCode() + ") " + st1->cppCode() + " else " +
-           st2->cppCode();
+    return "if (" + ex1->cppCode() + ") " + profiledBody(st1) + " else " +
+           profiledBody(st2);
 }
 
 
@@ -105,7 +489,16 @@ AssignStmt::AssignStmt(string _varName, Expr *_ex1) {
 }
 string AssignStmt::unparse() { return varName + " = " + ex1->unparse() + ";"; }
 
-string AssignStmt::cppCode() { return varName + " = " + ex1->cppCode() + ";"; }
+string AssignStmt::cppCode() {
+    codeGenContext().noteAssignment(varName, ex1);
+    if (codeGenContext().isSparse(varName))
+        return varName + " = sparseMatrix(" + ex1->cppCode() + ");";
+    string elementType = codeGenContext().elementType(varName);
+    if (!elementType.empty() && convertedTo(ex1, elementType))
+        return varName + " = " + cppMatrixType(elementType) + "(" +
+               storedValue(ex1, elementType) + ");";
+    return varName + " = " + ex1->cppCode() + ";";
+}
 
 
 // RangeAssginStmt, inherits from Stmt
@@ -122,6 +515,7 @@ string RangeAssignStmt::unparse() {
            ex3->unparse() + ";\n";
 }
 string RangeAssignStmt::cppCode() {
+    codeGenContext().noteElementAssignment(varName);
     return varName + "[" + ex1->cppCode() + "][" + ex2->cppCode() + "] = " +
            ex3->cppCode() + ";";
 }
@@ -131,7 +525,15 @@ string RangeAssignStmt::cppCode() {
 // Stmt ::= 'print' '(' Expr ')' ';'
 PrintStmt::PrintStmt(Expr *_ex1) { ex1 = _ex1; }
 string PrintStmt::unparse() { return "print ( " + ex1->unparse() + " );"; }
-string PrintStmt::cppCode() { return "std::cout << " + ex1->cppCode() + ";"; }
+string PrintStmt::cppCode() {
+    // printing a matrix does not need it to live on the heap
+    VarNameExpr *var = dynamic_cast<VarNameExpr *>(ex1);
+    if (var != NULL) {
+        codeGenContext().notePrint(var->name());
+        return "std::cout << " + var->name() + ";";
+    }
+    return "std::cout << " + ex1->cppCode() + ";";
+}
 
 
 // RepeatStmt, inherits from Stmt
@@ -147,8 +549,13 @@ string RepeatStmt::unparse() {
            ex2->unparse() + " ) " + st1->unparse();
 }
 string RepeatStmt::cppCode() {
-    return "for (" + varName + " = " + ex1->cppCode() + "; " + varName +
-           " <= " + ex2->cppCode() + "; " + varName + "++) " + st1->cppCode();
+    codeGenContext().noteAssignment(varName);
+    codeGenContext().beginLoop();
+    string code = "for (" + varName + " = " + ex1->cppCode() + "; " +
+                  varName + " <= " + ex2->cppCode() + "; " + varName +
+                  "++) " + profiledBody(st1);
+    codeGenContext().endLoop();
+    return code;
 }
 
 
@@ -162,7 +569,10 @@ string WhileStmt::unparse() {
     return "while ( " + ex1->unparse() + " ) " + st1->unparse();
 }
 string WhileStmt::cppCode() {
-    return "while (" + ex1->cppCode() + ") " + st1->cppCode();
+    codeGenContext().beginLoop();
+    string code = "while (" + ex1->cppCode() + ") " + profiledBody(st1);
+    codeGenContext().endLoop();
+    return code;
 }
 
 
@@ -173,77 +583,287 @@ string SemicolonStmt::unparse() { return ";"; }
 string SemicolonStmt::cppCode() { return ";"; }
 
 
+namespace {
+
+// in a resumable translation, the code restoring a variable declared at
+// top level, following its declaration
+string restoredScalar(const string &varName) {
+    int statement = codeGenContext().takeResumeStatement();
+    if (statement < 0) return "";
+    return "\nresumed.restore(" + to_string(statement) + ", \"" + varName +
+           "\", " + varName + ");";
+}
+
+}  // namespace
+
 // IntDecl
 // Decl ::= 'int' varName ';'
 IntDecl::IntDecl(string _varName) { varName = _varName; }
 string IntDecl::unparse() { return "int " + varName + ";"; }
-string IntDecl::cppCode() { return "int " + varName + ";"; }
+string IntDecl::cppCode() {
+    codeGenContext().noteScalarDecl(varName, "int");
+    return "int " + varName + ";" + restoredScalar(varName);
+}
 
 
 // FloatDecl
 // Decl ::= 'float' varName ';'
 FloatDecl::FloatDecl(string _varName) { varName = _varName; }
 string FloatDecl::unparse() { return "float " + varName + ";"; }
-string FloatDecl::cppCode() { return "float " + varName + ";"; }
+string FloatDecl::cppCode() {
+    codeGenContext().noteScalarDecl(varName, "float");
+    return "float " + varName + ";" + restoredScalar(varName);
+}
 
 
 // StringDecl
 // Decl ::= 'string' varName ';'
 StringDecl::StringDecl(string _varName) { varName = _varName; }
 string StringDecl::unparse() { return "string " + varName + ";"; }
-string StringDecl::cppCode() { return "string " + varName + ";"; }
+string StringDecl::cppCode() {
+    codeGenContext().noteScalarDecl(varName, "string");
+    return "std::string " + varName + ";" + restoredScalar(varName);
+}
 
 
 // BooleanDecl
 // Decl ::= 'boolean' varName ';'
 BooleanDecl::BooleanDecl(string _varName) { varName = _varName; }
 string BooleanDecl::unparse() { return "boolean " + varName + ";"; }
-string BooleanDecl::cppCode() { return "bool " + varName + ";"; }
+string BooleanDecl::cppCode() {
+    codeGenContext().noteScalarDecl(varName, "boolean");
+    return "bool " + varName + ";" + restoredScalar(varName);
+}
 
 
+namespace {
+
+// in a resumable translation, the condition and value of a matrix that is
+// read from the resumePoint rather than computed: "c ? value", to be
+// followed by the alternative
+string restoredMatrix(int statement, const string &varName,
+                      const string &elementType) {
+    return "resumed.restores(" + to_string(statement) + ") ? resumed.read<" +
+           cppElementType(elementType) + ">(\"" + varName + "\")";
+}
+
+}  // namespace
+
 // MatrixLongDecl
 // Decl ::= 'matrix' varName '[' Expr ':' Expr ']' varName ':' varName  '=' Expr
 // ';'
+// Decl ::= 'sparse' 'matrix' varName '[' Expr ':' Expr ']' varName ':'
+// varName '=' Expr ';'
 MatrixLongDecl::MatrixLongDecl(string _varName1, string _varName2,
                                string _varName3, Expr *_ex1, Expr *_ex2,
-                               Expr *_ex3) {
+                               Expr *_ex3, bool _sparse,
+                               string _elementType) {
     varName1 = _varName1;
     varName2 = _varName2;
     varName3 = _varName3;
     ex1 = _ex1;
     ex2 = _ex2;
     ex3 = _ex3;
+    sparse = _sparse;
+    elementType = _elementType;
 }
 string MatrixLongDecl::unparse() {
-    return "matrix " + varName1 + "[ " + ex1->unparse() + " : " +
-           ex2->unparse() + " ] " + varName2 + " : " + varName3 + " = " +
-           ex3->unparse() + ";\n";
+    return string(sparse ? "sparse " : "") + matrixType(elementType) + " " +
+           varName1 + "[ " + ex1->unparse() + " : " + ex2->unparse() +
+           " ] " + varName2 + " : " + varName3 + " = " + ex3->unparse() +
+           ";\n";
 }
 string MatrixLongDecl::cppCode() {
-    string forStmt1 = "matrix " + varName1 + "(" + ex1->cppCode() + ", " +
-                      ex2->cppCode() + ");\n" + "for (int " + varName2 +
-                      " = 0; " + varName2 + " != " + varName1 + ".numRows(); " +
-                      varName2 + "++) {\n";
-    string innerStmts = varName1 + "[" + varName2 + "][" + varName3 + "] = " +
-                        ex3->cppCode() + ";";
+    // at top level in a resumable translation, the matrix stays dense and
+    // is filled from the first row the interpreter had not computed
+    int statement = codeGenContext().takeResumeStatement();
+    if (statement >= 0) codeGenContext().noteResumable(varName1);
+    if (codeGenContext().takeExporting())
+        codeGenContext().noteExported(varName1);
+
+    // the transpose is copied in tiles rather than column by column
+    string source;
+    if (statement < 0 && transposeOf(source)) {
+        codeGenContext().noteMatrixDecl(varName1, false, elementType);
+        codeGenContext().noteSlice(source);
+        string site = codeGenContext().profileSite("comprehension", unparse(), offset);
+        return cppMatrixType(elementType) + " " + varName1 + " = " +
+               profiledCall(site, "transpose(" + source + ").block(0, 0, " +
+                                      ex1->cppCode() + ", " +
+                                      ex2->cppCode() + ")") +
+               ";";
+    }
+
+    codeGenContext().noteMatrixDecl(varName1, false, elementType);
+    codeGenContext().noteSparseDecl(varName1, sparse, diagonal());
+    codeGenContext().noteMatrixDims(varName1, ex1, ex2);
+    codeGenContext().noteIndexVariable(varName2);
+    codeGenContext().noteIndexVariable(varName3);
+    bool isSparse = codeGenContext().isSparse(varName1);
+    int rows, cols;
+    bool isFixed = codeGenContext().isFixed(varName1, rows, cols);
+
+    // a sparse matrix is filled row by row, keeping only the nonzeros, and
+    // a small matrix of constant size is kept inline with constant bounds
+    string decl, rowBound, colBound;
+    if (isFixed) {
+        string args = to_string(rows) + ", " + to_string(cols);
+        if (cppElementType(elementType) != "float")
+            args += ", " + cppElementType(elementType);
+        decl = "fixedMatrix<" + args + "> " + varName1 + ";\n";
+        rowBound = to_string(rows);
+        colBound = to_string(cols);
+    } else {
+        string type = isSparse ? "sparseMatrix" : cppMatrixType(elementType);
+        string dims = ex1->cppCode() + ", " + ex2->cppCode();
+        decl = statement < 0
+                   ? type + " " + varName1 + "(" + dims + ");\n"
+                   : type + " " + varName1 + " = " +
+                         restoredMatrix(statement, varName1, elementType) +
+                         " : " + type + "(" + dims + ");\n";
+        rowBound = varName1 + ".numRows()";
+        colBound = varName1 + ".numCols()";
+    }
+    string site = codeGenContext().profileSite("comprehension", unparse(), offset);
+    if (!site.empty()) decl += "profileEnter(" + site + ");\n";
+    string firstRow = statement < 0 ? "0"
+                                    : "resumed.firstRow(" +
+                                          to_string(statement) + ", " +
+                                          rowBound + ")";
+    string forStmt1 = decl + "for (int " + varName2 + " = " + firstRow +
+                      "; " + varName2 + " != " + rowBound + "; " + varName2 +
+                      "++) {\n";
+    codeGenContext().beginComprehension(varName2);
+    string innerStmts =
+        isSparse ? varName1 + ".append(" + varName2 + ", " + varName3 + ", " +
+                       ex3->cppCode() + ");"
+                 : varName1 + "[" + varName2 + "][" + varName3 + "] = " +
+                       ex3->cppCode() + ";";
+    codeGenContext().endComprehension();
     string forStmt2 = "for (int " + varName3 + " = 0; " + varName3 + " != " +
-                      varName1 + ".numCols(); " + varName3 + "++) {\n" +
+                      colBound + "; " + varName3 + "++) {\n" +
                       indent(innerStmts) + "}";
 
-    return forStmt1 + indent(forStmt2) + "}";
+    return forStmt1 + indent(forStmt2) + "}" +
+           (site.empty() ? "" : "\nprofileLeave();");
+}
+
+namespace {
+
+// whether an expression is the literal 0 or 0.0
+bool isZero(Expr *ex) {
+    ex = unparenthesized(ex);
+    IntExpr *i = dynamic_cast<IntExpr *>(ex);
+    FloatExpr *f = dynamic_cast<FloatExpr *>(ex);
+    return (i != NULL && i->value() == 0) || (f != NULL && f->value() == 0);
+}
+
+// whether two expressions are the variables a and b, in either order
+bool areVariables(Expr *ex1, Expr *ex2, const string &a, const string &b) {
+    VarNameExpr *v1 = dynamic_cast<VarNameExpr *>(unparenthesized(ex1));
+    VarNameExpr *v2 = dynamic_cast<VarNameExpr *>(unparenthesized(ex2));
+    if (v1 == NULL || v2 == NULL || a == b) return false;
+    return (v1->name() == a && v2->name() == b) ||
+           (v1->name() == b && v2->name() == a);
+}
+
+}  // namespace
+
+/**
+ * whether the matrix is the transpose of another dense matrix with the
+ * same element type, or of its top left corner, being defined as m[j : i]
+ * for its indices i and j
+ * @param  source set to the name of m
+ */
+bool MatrixLongDecl::transposeOf(string &source) {
+    MatrixExpr *element = dynamic_cast<MatrixExpr *>(unparenthesized(ex3));
+    if (sparse || element == NULL || element->name() == varName1 ||
+        varName2 == varName3)
+        return false;
+    VarNameExpr *row = dynamic_cast<VarNameExpr *>(element->row());
+    VarNameExpr *col = dynamic_cast<VarNameExpr *>(element->col());
+    if (row == NULL || col == NULL || row->name() != varName3 ||
+        col->name() != varName2 ||
+        !codeGenContext().hasElementType(element->name(), elementType) ||
+        codeGenContext().isSparse(element->name()))
+        return false;
+    source = element->name();
+    return true;
+}
+
+/**
+ * whether the matrix is zero off its diagonal, being defined as
+ * 'if' i '==' j 'then' Expr 'else' 0 or 'if' i '!=' j 'then' 0 'else' Expr
+ * for its indices i and j. Such a matrix has at most min(rows, cols)
+ * nonzeros, so it is inferred to be sparse. Conditions like j <= i leave
+ * half the matrix nonzero, where a sparse matrix saves no memory, so they
+ * are left dense unless declared sparse.
+ */
+bool MatrixLongDecl::diagonal() {
+    IfExpr *ifExpr = dynamic_cast<IfExpr *>(unparenthesized(ex3));
+    if (ifExpr == NULL) return false;
+    Expr *cond = unparenthesized(ifExpr->condition());
+
+    EqualEqualExpr *eq = dynamic_cast<EqualEqualExpr *>(cond);
+    if (eq != NULL)
+        return isZero(ifExpr->elseExpr()) &&
+               areVariables(eq->left(), eq->right(), varName2, varName3);
+
+    NotEqualExpr *ne = dynamic_cast<NotEqualExpr *>(cond);
+    if (ne != NULL)
+        return isZero(ifExpr->thenExpr()) &&
+               areVariables(ne->left(), ne->right(), varName2, varName3);
+    return false;
 }
 
 
 // MatrixShortDecl
 // Decl ::= 'matrix' varName '=' Expr ';'
-MatrixShortDecl::MatrixShortDecl(string _varName, Expr *_ex1) {
+// Decl ::= 'sparse' 'matrix' varName '=' Expr ';'
+MatrixShortDecl::MatrixShortDecl(string _varName, Expr *_ex1, bool _sparse,
+                                 string _elementType) {
     varName = _varName;
     ex1 = _ex1;
+    sparse = _sparse;
+    elementType = _elementType;
 }
 string MatrixShortDecl::unparse() {
-    return "matrix " + varName + " = " + ex1->unparse() + ";\n";
+    return string(sparse ? "sparse " : "") + matrixType(elementType) + " " +
+           varName + " = " + ex1->unparse() + ";\n";
 }
 string MatrixShortDecl::cppCode() {
+    // matrixRead ( stringConst ) may be streamed instead, see CodeGenContext
+    NestedOrFunctionCallExpr *call =
+        dynamic_cast<NestedOrFunctionCallExpr *>(ex1);
+    bool fromFile = call != NULL && call->functionName() == "matrixRead" &&
+                    dynamic_cast<StringExpr *>(call->argument()) != NULL;
+    codeGenContext().noteMatrixDecl(varName, fromFile, elementType);
+    codeGenContext().noteSparseDecl(varName, sparse, false);
+
+    // at top level in a resumable translation, a dense matrix that is read
+    // from the resumePoint if the interpreter declared it
+    if (codeGenContext().takeExporting())
+        codeGenContext().noteExported(varName);
+    int statement = codeGenContext().takeResumeStatement();
+    if (statement >= 0) {
+        codeGenContext().noteResumable(varName);
+        string type = cppMatrixType(elementType);
+        return type + " " + varName + " = " +
+               restoredMatrix(statement, varName, elementType) + " : " +
+               type + "(" + storedValue(ex1, elementType) + ");";
+    }
+
+    if (codeGenContext().isSparse(varName))
+        return "sparseMatrix " + varName + "(" + ex1->cppCode() + ");";
+    if (fromFile && codeGenContext().isStreamed(varName))
+        return "matrixStream " + varName + "(" +
+               call->argument()->cppCode() + ");";
+    // other element types, of the matrix or of the value, convert the
+    // value explicitly
+    if (cppMatrixType(elementType) != "matrix" ||
+        convertedTo(ex1, elementType))
+        return cppMatrixType(elementType) + " " + varName + "(" +
+               storedValue(ex1, elementType) + ");";
     return "matrix " + varName + " = " + ex1->cppCode() + ";";
 }
 
@@ -252,7 +872,11 @@ string MatrixShortDecl::cppCode() {
 // Expr ::= varName
 VarNameExpr::VarNameExpr(string _varName) { varName = _varName; }
 string VarNameExpr::unparse() { return varName; }
-string VarNameExpr::cppCode() { return varName; }
+string VarNameExpr::cppCode() {
+    codeGenContext().noteOtherUse(varName);
+    return densified(varName);
+}
+string VarNameExpr::name() { return varName; }
 
 
 // IntExpr
@@ -260,6 +884,7 @@ string VarNameExpr::cppCode() { return varName; }
 IntExpr::IntExpr(int _val) { val = _val; }
 string IntExpr::unparse() { return to_string(val); }
 string IntExpr::cppCode() { return to_string(val); }
+int IntExpr::value() { return val; }
 
 
 // FloatExpr
@@ -267,6 +892,7 @@ string IntExpr::cppCode() { return to_string(val); }
 FloatExpr::FloatExpr(double _val) { val = _val; }
 string FloatExpr::unparse() { return to_string(val); }
 string FloatExpr::cppCode() { return to_string(val); }
+double FloatExpr::value() { return val; }
 
 
 // StringExpr
@@ -300,8 +926,22 @@ string MultiplyExpr::unparse() {
     return ex1->unparse() + " * " + ex2->unparse();
 }
 string MultiplyExpr::cppCode() {
-    return ex1->cppCode() + " * " + ex2->cppCode();
+    checkElements(ex1, ex2, "multiplied");
+    // a product of two named matrices may keep both fixed-size
+    VarNameExpr *var1 = dynamic_cast<VarNameExpr *>(ex1);
+    VarNameExpr *var2 = dynamic_cast<VarNameExpr *>(ex2);
+    string site = namedMatrix(ex1) && namedMatrix(ex2)
+                      ? codeGenContext().profileSite("kernel", unparse(), offset)
+                      : "";
+    if (var1 != NULL && var2 != NULL) {
+        codeGenContext().noteProduct(var1->name(), var2->name());
+        return profiledCall(site, namedOperands(var1->name(), " * ",
+                                                var2->name()));
+    }
+    return profiledCall(site, ex1->cppCode() + " * " + ex2->cppCode());
 }
+Expr *MultiplyExpr::left() { return ex1; }
+Expr *MultiplyExpr::right() { return ex2; }
 
 
 // DevideExpr
@@ -311,7 +951,12 @@ DevideExpr::DevideExpr(Expr *_ex1, Expr *_ex2) {
     ex2 = _ex2;
 }
 string DevideExpr::unparse() { return ex1->unparse() + " / " + ex2->unparse(); }
-string DevideExpr::cppCode() { return ex1->cppCode() + " / " + ex2->cppCode(); }
+string DevideExpr::cppCode() {
+    checkElements(ex1, ex2, "divided");
+    return ex1->cppCode() + " / " + ex2->cppCode();
+}
+Expr *DevideExpr::left() { return ex1; }
+Expr *DevideExpr::right() { return ex2; }
 
 
 // AddExpr
@@ -321,7 +966,9 @@ AddExpr::AddExpr(Expr *_ex1, Expr *_ex2) {
     ex2 = _ex2;
 }
 string AddExpr::unparse() { return ex1->unparse() + " + " + ex2->unparse(); }
-string AddExpr::cppCode() { return ex1->cppCode() + " + " + ex2->cppCode(); }
+string AddExpr::cppCode() { return operands(ex1, " + ", ex2); }
+Expr *AddExpr::left() { return ex1; }
+Expr *AddExpr::right() { return ex2; }
 
 
 // SubtractExpr
@@ -333,9 +980,9 @@ SubtractExpr::SubtractExpr(Expr *_ex1, Expr *_ex2) {
 string SubtractExpr::unparse() {
     return ex1->unparse() + " - " + ex2->unparse();
 }
-string SubtractExpr::cppCode() {
-    return ex1->cppCode() + " - " + ex2->cppCode();
-}
+string SubtractExpr::cppCode() { return operands(ex1, " - ", ex2); }
+Expr *SubtractExpr::left() { return ex1; }
+Expr *SubtractExpr::right() { return ex2; }
 
 
 // GreaterExpr
@@ -402,6 +1049,8 @@ string EqualEqualExpr::unparse() {
 string EqualEqualExpr::cppCode() {
     return ex1->cppCode() + " == " + ex2->cppCode();
 }
+Expr *EqualEqualExpr::left() { return ex1; }
+Expr *EqualEqualExpr::right() { return ex2; }
 
 
 // NotEqualExpr
@@ -416,6 +1065,8 @@ string NotEqualExpr::unparse() {
 string NotEqualExpr::cppCode() {
     return ex1->cppCode() + " != " + ex2->cppCode();
 }
+Expr *NotEqualExpr::left() { return ex1; }
+Expr *NotEqualExpr::right() { return ex2; }
 
 
 // AndExpr
@@ -449,8 +1100,49 @@ string MatrixExpr::unparse() {
     return varName + " [ " + ex1->unparse() + " : " + ex2->unparse() + " ]";
 }
 string MatrixExpr::cppCode() {
-    return varName + "[" + ex1->cppCode() + "][" + ex2->cppCode() + "]";
-}
+    VarNameExpr *row = dynamic_cast<VarNameExpr *>(ex1);
+    codeGenContext().noteElementAccess(varName, row ? row->name() : "");
+    if (codeGenContext().isSparse(varName))
+        return varName + ".at(" + ex1->cppCode() + ", " + ex2->cppCode() +
+               ")";
+    // int8 elements are promoted so they print as numbers, not characters
+    return string(codeGenContext().hasNarrowElements(varName) ? "+" : "") +
+           varName + "[" + ex1->cppCode() + "][" + ex2->cppCode() + "]";
+}
+string MatrixExpr::name() { return varName; }
+Expr *MatrixExpr::row() { return ex1; }
+Expr *MatrixExpr::col() { return ex2; }
+
+
+// MatrixSliceExpr
+// Expr ::= varName '[' Expr 'to' Expr ':' Expr 'to' Expr ']'
+MatrixSliceExpr::MatrixSliceExpr(string _varName, Expr *_firstRow,
+                                 Expr *_lastRow, Expr *_firstCol,
+                                 Expr *_lastCol) {
+    varName = _varName;
+    firstRow = _firstRow;
+    lastRow = _lastRow;
+    firstCol = _firstCol;
+    lastCol = _lastCol;
+}
+string MatrixSliceExpr::unparse() {
+    string rows = firstRow->unparse();
+    if (lastRow != NULL) rows += " to " + lastRow->unparse();
+    string cols = firstCol->unparse();
+    if (lastCol != NULL) cols += " to " + lastCol->unparse();
+    return varName + " [ " + rows + " : " + cols + " ]";
+}
+string MatrixSliceExpr::cppCode() {
+    codeGenContext().noteSlice(varName);
+    // a single row or column index is both ends of its range
+    string rowFirst = firstRow->cppCode();
+    string colFirst = firstCol->cppCode();
+    string rowLast = lastRow != NULL ? lastRow->cppCode() : rowFirst;
+    string colLast = lastCol != NULL ? lastCol->cppCode() : colFirst;
+    return "slice(" + densified(varName) + ", " + rowFirst + ", " +
+           rowLast + ", " + colFirst + ", " + colLast + ")";
+}
+string MatrixSliceExpr::name() { return varName; }
 
 
 // NestedOrFunctionCallExpr
@@ -464,8 +1156,27 @@ string NestedOrFunctionCallExpr::unparse() {
     return varName + "( " + ex1->unparse() + " )";
 }
 string NestedOrFunctionCallExpr::cppCode() {
-    return varName + "(" + ex1->cppCode() + ")";
+    // asking for the dimensions of a matrix is not a use of its elements
+    VarNameExpr *arg = dynamic_cast<VarNameExpr *>(ex1);
+    if (arg != NULL && (varName == "numRows" || varName == "numCols"))
+        return varName + "(" + arg->name() + ")";
+    // reading and reducing matrices are timed as kernels, while taking a
+    // transpose only makes a view
+    bool reduction = varName == "sum" || varName == "mean" ||
+                     varName == "min" || varName == "max" || varName == "norm";
+    string site = reduction || varName == "matrixRead"
+                      ? codeGenContext().profileSite("kernel", unparse(), offset)
+                      : "";
+    // transposes and reductions read a dense matrix through a view
+    if (arg != NULL && (varName == "transpose" || reduction)) {
+        codeGenContext().noteSlice(arg->name());
+        return profiledCall(site,
+                            varName + "(" + densified(arg->name()) + ")");
+    }
+    return profiledCall(site, varName + "(" + ex1->cppCode() + ")");
 }
+string NestedOrFunctionCallExpr::functionName() { return varName; }
+Expr *NestedOrFunctionCallExpr::argument() { return ex1; }
 
 
 // NestedExpr
@@ -473,6 +1184,7 @@ string NestedOrFunctionCallExpr::cppCode() {
 NestedExpr::NestedExpr(Expr *_ex1) { ex1 = _ex1; }
 string NestedExpr::unparse() { return "( " + ex1->unparse() + " )"; }
 string NestedExpr::cppCode() { return "(" + ex1->cppCode() + ")"; }
+Expr *NestedExpr::inner() { return ex1; }
 
 
 // LetExpr
@@ -504,6 +1216,9 @@ string IfExpr::unparse() {
 string IfExpr::cppCode() {
     return ex1->cppCode() + " ? " + ex2->cppCode() + " : " + ex3->cppCode();
 }
+Expr *IfExpr::condition() { return ex1; }
+Expr *IfExpr::thenExpr() { return ex2; }
+Expr *IfExpr::elseExpr() { return ex3; }
 
 
 // NotExpr
@@ -513,6 +1228,65 @@ string NotExpr::unparse() { return "!" + ex1->unparse(); }
 string NotExpr::cppCode() { return "!" + ex1->cppCode(); }
 
 
+namespace {
+
+// expressions nested deeper than this are not folded, which also stops
+// self-referential definitions such as n = n + 1
+const int maxFoldDepth = 32;
+
+bool foldConstant(Expr *ex, long long &value, int depth) {
+    if (depth > maxFoldDepth) return false;
+    if (IntExpr *literal = dynamic_cast<IntExpr *>(ex)) {
+        value = literal->value();
+        return true;
+    }
+    if (NestedExpr *nested = dynamic_cast<NestedExpr *>(ex))
+        return foldConstant(nested->inner(), value, depth + 1);
+    if (VarNameExpr *var = dynamic_cast<VarNameExpr *>(ex)) {
+        Expr *definition = codeGenContext().constantDefinition(var->name());
+        return definition != NULL && foldConstant(definition, value, depth + 1);
+    }
+
+    Expr *left, *right;
+    char op;
+    if (AddExpr *add = dynamic_cast<AddExpr *>(ex)) {
+        left = add->left(), right = add->right(), op = '+';
+    } else if (SubtractExpr *sub = dynamic_cast<SubtractExpr *>(ex)) {
+        left = sub->left(), right = sub->right(), op = '-';
+    } else if (MultiplyExpr *mul = dynamic_cast<MultiplyExpr *>(ex)) {
+        left = mul->left(), right = mul->right(), op = '*';
+    } else if (DevideExpr *div = dynamic_cast<DevideExpr *>(ex)) {
+        left = div->left(), right = div->right(), op = '/';
+    } else {
+        return false;
+    }
+
+    // both operands fit in an int, so no step overflows a long long
+    long long a, b;
+    if (!foldConstant(left, a, depth + 1) || !foldConstant(right, b, depth + 1))
+        return false;
+    switch (op) {
+        case '+': value = a + b; break;
+        case '-': value = a - b; break;
+        case '*': value = a * b; break;
+        default:
+            if (b == 0) return false;
+            value = a / b;
+    }
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+}  // namespace
+
+// fold an integer expression into value, see AST.h
+bool constantValue(Expr *ex, int &value) {
+    long long folded;
+    if (!foldConstant(ex, folded, 0)) return false;
+    value = static_cast<int>(folded);
+    return true;
+}
+
+
 /**
  * make indentation for all lines in the given input string
  * @param  input a given input string
@@ -13,12 +13,19 @@
 #ifndef Node_H
 #define Node_H
 
+#include "./codeGenContext.h"
 #include "./scanner.h"
 #include <iostream>
 #include <string>
 
 using namespace std;
 
+// see interpreter.h and bytecode.h
+class Interpreter;
+struct Value;
+class BytecodeCompiler;
+struct Operand;
+
 //===================================================================
 // Node
 
@@ -27,6 +34,12 @@ using namespace std;
  */
 class Node {
 public:
+    Node() : offset(-1) {}
+
+    // the offset in the source of the token the Node was parsed from,
+    // or -1; see SourceLines in scanner.h for its line and column
+    int offset;
+
     /**
      * Unparse Node to CDAL source code
      * @return CDAL source code
@@ -53,6 +66,16 @@ class Stmts : public Node {
 public:
     virtual string unparse() { return string("this is pure virtual"); }
     virtual string cppCode() { return string("this is pure virtual"); }
+
+    /**
+     * Run the Stmts in the interpreter
+     */
+    virtual void execute(Interpreter &interpreter) = 0;
+
+    /**
+     * Compile the Stmts to bytecode
+     */
+    virtual void compile(BytecodeCompiler &compiler) = 0;
     virtual ~Stmts() {}
 };
 
@@ -63,6 +86,16 @@ class Stmt : public Node {
 public:
     virtual string unparse() { return string("this is pure virtual"); }
     virtual string cppCode() { return string("this is pure virtual"); }
+
+    /**
+     * Run the Stmt in the interpreter
+     */
+    virtual void execute(Interpreter &interpreter) = 0;
+
+    /**
+     * Compile the Stmt to bytecode
+     */
+    virtual void compile(BytecodeCompiler &compiler) = 0;
     virtual ~Stmt() {}
 };
 
@@ -73,6 +106,16 @@ class Decl : public Node {
 public:
     virtual string unparse() { return string("this is pure virtual"); }
     virtual string cppCode() { return string("this is pure virtual"); }
+
+    /**
+     * Run the Decl in the interpreter
+     */
+    virtual void execute(Interpreter &interpreter) = 0;
+
+    /**
+     * Compile the Decl to bytecode
+     */
+    virtual void compile(BytecodeCompiler &compiler) = 0;
     virtual ~Decl() {}
 };
 
@@ -83,6 +126,18 @@ class Expr : public Node {
 public:
     virtual string unparse() { return string("this is pure virtual"); }
     virtual string cppCode() { return string("this is pure virtual"); }
+
+    /**
+     * Evaluate the Expr in the interpreter
+     * @return its value
+     */
+    virtual Value evaluate(Interpreter &interpreter) = 0;
+
+    /**
+     * Compile the Expr to bytecode
+     * @return the register holding its value
+     */
+    virtual Operand compile(BytecodeCompiler &compiler) = 0;
     virtual ~Expr() {}
 };
 
@@ -96,10 +151,57 @@ private:
     string varName;
     Stmts *stmts;
 
+    // the lines of the file the Program was parsed from, or NULL
+    SourceLines *source;
+
+    // the top-level statements of a resumable translation
+    string resumableStmts();
+
+    // the top-level statements of a translation to a shared object
+    string libraryStmts();
+
 public:
     Program(string _varName, Stmts *_stmts);
+    ~Program();
     string unparse();
+
+    /**
+     * Record the file the Program was parsed from, so that translations
+     * say which of its lines each statement comes from in #line
+     * directives, and profiling sites give their line and column
+     * @param filename the name of the file, as compilers and debuggers
+     * should find it
+     * @param text     the text that was parsed
+     */
+    void setSource(const string &filename, const char *text);
+
     string cppCode();
+
+    /**
+     * Translate the Program to C++ that can take over from an interpreter
+     * that stopped part way through it, see resumePoint in Matrix.h
+     * @return Cpp source code, whose main reads the state to resume from
+     * when given --resume <file>
+     */
+    string resumableCppCode();
+
+    /**
+     * Translate the Program to C++ for a shared object, exporting it as
+     * the function cdal_<varName> of the C interface in cdal.h
+     * @return Cpp source code, built with -shared -fPIC together with
+     * Matrix.cpp
+     */
+    string libraryCppCode();
+
+    /**
+     * Translate the Program to C++ that times each statement, comprehension
+     * and call of a matrix kernel, see profileSite in Matrix.h
+     * @return Cpp source code, which reports where the time went when it
+     * exits
+     */
+    string profiledCppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 
@@ -114,6 +216,8 @@ public:
     EmptyStmts();
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -128,6 +232,10 @@ public:
     SeqStmts(Stmt *_st1, Stmts *_stmts);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
+    Stmt *first();
+    Stmts *rest();
 };
 
 
@@ -145,6 +253,8 @@ public:
     DeclStmt(Decl *_decl);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -158,6 +268,8 @@ public:
     NestedStmt(Stmts *_stmts);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -172,6 +284,8 @@ public:
     IfStmt(Expr *_ex1, Stmt *_st1);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -187,6 +301,8 @@ public:
     IfElseStmt(Expr *_ex1, Stmt *_st1, Stmt *_st2);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -201,6 +317,8 @@ public:
     AssignStmt(string _varName, Expr *_ex1);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -215,6 +333,8 @@ public:
     RangeAssignStmt(string _varName, Expr *_ex1, Expr *_ex2, Expr *_ex3);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -228,6 +348,8 @@ public:
     PrintStmt(Expr *_ex1);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -243,6 +365,8 @@ public:
     RepeatStmt(string _varName, Expr *_ex1, Expr *_ex2, Stmt *_st1);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -257,6 +381,8 @@ public:
     WhileStmt(Expr *_ex1, Stmt *_st1);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -267,6 +393,8 @@ public:
     SemicolonStmt();
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 
@@ -283,6 +411,8 @@ public:
     IntDecl(string _varName);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -295,6 +425,8 @@ public:
     FloatDecl(string _varName);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -307,6 +439,8 @@ public:
     StringDecl(string _varName);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -319,34 +453,56 @@ public:
     BooleanDecl(string _varName);
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
  * Decl ::= 'matrix' varName '[' Expr ':' Expr ']' varName ':' varName '=' Expr
  * ';'
+ * Decl ::= 'sparse' 'matrix' varName '[' Expr ':' Expr ']' varName ':'
+ * varName '=' Expr ';'
+ * where 'matrix' may be followed by '<' ElementType '>'
  */
 class MatrixLongDecl : public Decl {
     string varName1, varName2, varName3;
     Expr *ex1, *ex2, *ex3;
+    bool sparse;
+    // float, int, double or int8; empty when not given, meaning float
+    string elementType;
+
+    bool diagonal();
+    bool transposeOf(string &source);
 
 public:
     MatrixLongDecl(string _varName1, string _varName2, string _varName3,
-                   Expr *_ex1, Expr *_ex2, Expr *_ex3);
+                   Expr *_ex1, Expr *_ex2, Expr *_ex3, bool _sparse = false,
+                   string _elementType = "");
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 /**
  * Decl ::= 'matrix' varName '=' Expr ';'
+ * Decl ::= 'sparse' 'matrix' varName '=' Expr ';'
+ * where 'matrix' may be followed by '<' ElementType '>'
  */
 class MatrixShortDecl : public Decl {
     string varName;
     Expr *ex1;
+    bool sparse;
+    // float, int, double or int8; empty when not given, meaning float
+    string elementType;
 
 public:
-    MatrixShortDecl(string _varName, Expr *_ex1);
+    MatrixShortDecl(string _varName, Expr *_ex1, bool _sparse = false,
+                    string _elementType = "");
     string unparse();
     string cppCode();
+    void execute(Interpreter &interpreter);
+    void compile(BytecodeCompiler &compiler);
 };
 
 
@@ -364,6 +520,9 @@ public:
     VarNameExpr(string _varName);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    string name();
 };
 
 /**
@@ -376,6 +535,9 @@ public:
     IntExpr(int _val);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    int value();
 };
 
 /**
@@ -388,6 +550,9 @@ public:
     FloatExpr(double _val);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    double value();
 };
 
 /**
@@ -400,6 +565,8 @@ public:
     StringExpr(string _val);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -410,6 +577,8 @@ public:
     TrueExpr();
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -420,6 +589,8 @@ public:
     FalseExpr();
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -432,6 +603,10 @@ public:
     MultiplyExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    Expr *left();
+    Expr *right();
 };
 
 /**
@@ -444,6 +619,10 @@ public:
     DevideExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    Expr *left();
+    Expr *right();
 };
 
 /**
@@ -456,6 +635,10 @@ public:
     AddExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    Expr *left();
+    Expr *right();
 };
 
 /**
@@ -468,6 +651,10 @@ public:
     SubtractExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    Expr *left();
+    Expr *right();
 };
 
 /**
@@ -480,6 +667,8 @@ public:
     GreaterExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -492,6 +681,8 @@ public:
     GreaterEqualExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -504,6 +695,8 @@ public:
     LessExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -516,6 +709,8 @@ public:
     LessEqualExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -528,6 +723,10 @@ public:
     EqualEqualExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    Expr *left();
+    Expr *right();
 };
 
 /**
@@ -540,6 +739,10 @@ public:
     NotEqualExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    Expr *left();
+    Expr *right();
 };
 
 /**
@@ -552,6 +755,8 @@ public:
     AndExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -564,6 +769,8 @@ public:
     OrExpr(Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -577,6 +784,33 @@ public:
     MatrixExpr(string _varName, Expr *_ex1, Expr *_ex2);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    string name();
+    Expr *row();
+    Expr *col();
+};
+
+/**
+ * Expr ::= varName '[' Expr 'to' Expr ':' Expr 'to' Expr ']'
+ * Expr ::= varName '[' Expr 'to' Expr ':' Expr ']'
+ * Expr ::= varName '[' Expr ':' Expr 'to' Expr ']'
+ *
+ * a view of a block of a matrix, whose ranges are inclusive; a single
+ * index selects one row or column, and has a NULL last expression
+ */
+class MatrixSliceExpr : public Expr {
+    string varName;
+    Expr *firstRow, *lastRow, *firstCol, *lastCol;
+
+public:
+    MatrixSliceExpr(string _varName, Expr *_firstRow, Expr *_lastRow,
+                    Expr *_firstCol, Expr *_lastCol);
+    string unparse();
+    string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    string name();
 };
 
 /**
@@ -590,6 +824,10 @@ public:
     NestedOrFunctionCallExpr(string _varName, Expr *_ex1);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    string functionName();
+    Expr *argument();
 };
 
 /**
@@ -602,6 +840,9 @@ public:
     NestedExpr(Expr *_ex1);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    Expr *inner();
 };
 
 /**
@@ -615,6 +856,8 @@ public:
     LetExpr(Stmts *_stmts, Expr *_ex1);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 /**
@@ -627,6 +870,11 @@ public:
     IfExpr(Expr *_ex1, Expr *_ex2, Expr *_ex3);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
+    Expr *condition();
+    Expr *thenExpr();
+    Expr *elseExpr();
 };
 
 /**
@@ -639,10 +887,16 @@ public:
     NotExpr(Expr *_ex1);
     string unparse();
     string cppCode();
+    Value evaluate(Interpreter &interpreter);
+    Operand compile(BytecodeCompiler &compiler);
 };
 
 // a helper function used to indent codes
 // making the translated cpp file more readable
 string indent(string &s);
 
+// fold an integer expression of literals and constant variables into
+// value, returning false if it is not a compile time constant
+bool constantValue(Expr *ex, int &value);
+
 #endif  // Node_H
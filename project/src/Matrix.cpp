@@ -1,39 +1,578 @@
 #include "./Matrix.h"
+#include "./cdal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-matrix::matrix(int row, int col) : rows(row), cols(col) {
-    data = new float *[rows];
-    for (int i = 0; i != rows; i++) {
-        data[i] = new float[cols];
-        for (int j = 0; j != cols; j++) data[i][j] = 0;
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Allocating matrices
+ * -------------------
+ * The values of matrices come from free lists of power-of-two size
+ * classes, from 64 bytes to 16 MB, kept by each thread. A freed buffer
+ * goes on the list of its class for the next matrix of about the same
+ * size, unless that would make the thread keep more than
+ * maxCachedPerClass buffers of the class or maxCachedBytes in all, in
+ * which case, like buffers of more than 16 MB, it goes back to malloc.
+ * Temporaries of the same shape made over and over, like the products of
+ * m1 * m2 * m3 or matrices declared in a loop, then stop calling malloc
+ * once the first ones are freed. Setting the environment variable
+ * CDAL_ALLOCATION_STATS makes each thread print its hit rate when it
+ * exits.
+ *
+ * Buffers of hugePageBytes or more are mapped directly rather than taken
+ * from malloc, aligned to a huge page and marked with MADV_HUGEPAGE, so
+ * that a large matrix is covered by a few TLB entries instead of one per
+ * 4 KB page. They are rounded up to a whole number of huge pages rather
+ * than to their class, and cached on a list of their own length, up to
+ * the largest class. With CDAL_HUGE_PAGES=explicit they come from the
+ * reserved pool of 2 MB pages when it has room, and CDAL_HUGE_PAGES=off
+ * leaves them to malloc and the classes. No page of a mapping is placed
+ * on a NUMA node until it is first written, which the constructors do
+ * from the workers of forRowBands, each writing the band of rows it
+ * computes later on; setting CDAL_NUMA_INTERLEAVE spreads the pages over
+ * all nodes instead, for matrices that every thread reads.
+ */
+
+namespace {
+
+const int minClassBits = 6;
+const int maxClassBits = 24;
+const int numClasses = maxClassBits - minClassBits + 1;
+const size_t maxCachedPerClass = 16;
+const size_t maxCachedBytes = 64 << 20;
+const size_t hugePageBytes = 2 << 20;
+
+enum hugePagePolicy { transparentHugePages, explicitHugePages, noHugePages };
+
+hugePagePolicy hugePages() {
+    static const hugePagePolicy policy = [] {
+        const char *setting = getenv("CDAL_HUGE_PAGES");
+        if (setting == NULL) return transparentHugePages;
+        if (strcmp(setting, "explicit") == 0) return explicitHugePages;
+        if (strcmp(setting, "off") == 0) return noHugePages;
+        return transparentHugePages;
+    }();
+    return policy;
+}
+
+// whether buffers of this size are mapped directly
+bool isMapped(size_t size) {
+    return size >= hugePageBytes && hugePages() != noHugePages;
+}
+
+size_t mappedLength(size_t size) {
+    return (size + hugePageBytes - 1) / hugePageBytes * hugePageBytes;
+}
+
+/**
+ * the size class of a buffer
+ * @return the smallest k such that the class of 2^k bytes holds it, or
+ * -1 if it is larger than every class
+ */
+int sizeClass(size_t bytes) {
+    int bits = minClassBits;
+    while (bits <= maxClassBits && (static_cast<size_t>(1) << bits) < bytes)
+        bits++;
+    return bits <= maxClassBits ? bits : -1;
+}
+
+// the size that a buffer of bytes is allocated with
+size_t bufferSize(size_t bytes) {
+    if (isMapped(bytes)) return mappedLength(bytes);
+    int bits = sizeClass(bytes);
+    return bits >= 0 ? static_cast<size_t>(1) << bits : bytes;
+}
+
+// spread the pages of a mapping over all NUMA nodes
+void interleave(void *values, size_t length) {
+#ifdef SYS_mbind
+    static const bool wanted = getenv("CDAL_NUMA_INTERLEAVE") != NULL;
+    if (!wanted) return;
+    const int interleavePolicy = 3;  // MPOL_INTERLEAVE in <numaif.h>
+    // every node; the kernel drops the ones this process may not use
+    unsigned long nodes[4] = {~0UL, ~0UL, ~0UL, ~0UL};
+    syscall(SYS_mbind, values, length, interleavePolicy, nodes,
+            sizeof nodes * 8, 0);
+#else
+    (void)values;
+    (void)length;
+#endif
+}
+
+/**
+ * map size bytes aligned to a huge page. The mapping is made a huge page
+ * longer than needed and trimmed, since mmap only aligns to 4 KB.
+ */
+void *mapBuffer(size_t size) {
+    size_t length = mappedLength(size);
+#ifdef MAP_HUGETLB
+    if (hugePages() == explicitHugePages) {
+        void *pages = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pages != MAP_FAILED) {
+            interleave(pages, length);
+            return pages;
+        }
+    }
+#endif
+    void *map = mmap(NULL, length + hugePageBytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) throw std::bad_alloc();
+    char *start = static_cast<char *>(map);
+    uintptr_t offset = reinterpret_cast<uintptr_t>(start) % hugePageBytes;
+    char *values = offset == 0 ? start : start + (hugePageBytes - offset);
+    if (values != start) munmap(start, values - start);
+    char *end = start + length + hugePageBytes;
+    if (values + length != end) munmap(values + length, end - values - length);
+#ifdef MADV_HUGEPAGE
+    madvise(values, length, MADV_HUGEPAGE);
+#endif
+    interleave(values, length);
+    return values;
+}
+
+void *newBuffer(size_t size) {
+    if (isMapped(size)) return mapBuffer(size);
+    void *values = malloc(size);
+    if (values == NULL) throw std::bad_alloc();
+    return values;
+}
+
+void freeBuffer(void *values, size_t size) {
+    if (isMapped(size))
+        munmap(values, mappedLength(size));
+    else
+        free(values);
+}
+
+// count a buffer of size bytes handed out by allocateValues for a request
+// of bytes, taken from a cache or not, and one given back, kept in a cache
+// or not, and one freed from a cache; see "Memory accounting"
+void noteAllocation(void *values, size_t bytes, size_t size, bool cached);
+void noteRelease(void *values, size_t bytes, size_t size, bool cached);
+void noteCacheFreed(size_t size);
+
+// set once the thread's cache is gone, for matrices destroyed after it
+thread_local bool cacheDestroyed = false;
+
+struct valueCache {
+    std::vector<void *> lists[numClasses];
+    // mapped buffers, by their length
+    std::map<size_t, std::vector<void *> > mapped;
+    allocationStats stats;
+
+    valueCache() {
+        stats.requests = 0;
+        stats.hits = 0;
+        stats.cachedBytes = 0;
     }
+
+    ~valueCache() {
+        if (getenv("CDAL_ALLOCATION_STATS") != NULL) {
+            double rate = stats.requests == 0
+                              ? 0
+                              : 100.0 * stats.hits / stats.requests;
+            std::cerr << "matrix allocations: " << stats.requests
+                      << " requests, " << stats.hits << " from the cache ("
+                      << rate << "%)" << std::endl;
+        }
+        for (int k = 0; k != numClasses; k++)
+            for (size_t n = 0; n != lists[k].size(); n++)
+                freeCached(lists[k][n],
+                           static_cast<size_t>(1) << (k + minClassBits));
+        std::map<size_t, std::vector<void *> >::iterator it;
+        for (it = mapped.begin(); it != mapped.end(); ++it)
+            for (size_t n = 0; n != it->second.size(); n++)
+                freeCached(it->second[n], it->first);
+        cacheDestroyed = true;
+    }
+
+    void freeCached(void *values, size_t size) {
+        freeBuffer(values, size);
+        noteCacheFreed(size);
+    }
+
+    // the list that buffers of bytes are cached on, or NULL if none
+    std::vector<void *> *listFor(size_t bytes) {
+        size_t size = bufferSize(bytes);
+        if (isMapped(bytes))
+            return size <= static_cast<size_t>(1) << maxClassBits
+                       ? &mapped[size]
+                       : NULL;
+        int bits = sizeClass(bytes);
+        return bits >= 0 ? &lists[bits - minClassBits] : NULL;
+    }
+};
+
+thread_local valueCache cache;
+
+}  // namespace
+
+/* A buffer is always allocated with the size of its class, or its whole
+   number of huge pages, even once the cache is gone, so that releasing it
+   frees it the same way. */
+void *allocateValues(size_t bytes) {
+    if (bytes == 0) return NULL;
+    void *values = NULL;
+    if (!cacheDestroyed) {
+        cache.stats.requests++;
+        std::vector<void *> *list = cache.listFor(bytes);
+        if (list != NULL && !list->empty()) {
+            values = list->back();
+            list->pop_back();
+            cache.stats.hits++;
+            cache.stats.cachedBytes -= bufferSize(bytes);
+        }
+    }
+    bool cached = values != NULL;
+    if (values == NULL) values = newBuffer(bufferSize(bytes));
+    noteAllocation(values, bytes, bufferSize(bytes), cached);
+    return values;
+}
+
+void releaseValues(void *values, size_t bytes) {
+    if (values == NULL) return;
+    size_t size = bufferSize(bytes);
+    std::vector<void *> *list = cacheDestroyed ? NULL : cache.listFor(bytes);
+    if (list != NULL && list->size() < maxCachedPerClass &&
+        cache.stats.cachedBytes + size <= maxCachedBytes) {
+        noteRelease(values, bytes, size, true);
+        list->push_back(values);
+        cache.stats.cachedBytes += size;
+        return;
+    }
+    noteRelease(values, bytes, size, false);
+    freeBuffer(values, size);
+}
+
+allocationStats matrixAllocationStats() { return cache.stats; }
+
+namespace {
+
+// matrices smaller than this are not worth starting threads for
+const size_t parallelRowBytes = 4 << 20;
+
+unsigned rowThreads() {
+    static const unsigned threads = [] {
+        const char *setting = getenv("CDAL_THREADS");
+        int asked = setting == NULL ? 0 : atoi(setting);
+        if (asked > 0) return static_cast<unsigned>(asked);
+        unsigned hardware = std::thread::hardware_concurrency();
+        return hardware == 0 ? 1u : hardware;
+    }();
+    return threads;
 }
 
-matrix::matrix(const matrix &m) : rows(m.rows), cols(m.cols) {
-    data = new float *[rows];
-    for (int i = 0; i != rows; i++) {
-        data[i] = new float[cols];
-        for (int j = 0; j != cols; j++) {
-            data[i][j] = m[i][j];
+// set on the workers of the pool, whose work runs on the rows it is given
+thread_local bool inRowBand = false;
+
+/**
+ * the workers that forRowBands runs bands on, started by its first call
+ * with more than one band and kept until the program exits. Worker k
+ * always computes band k, so the rows whose pages it touched first, on
+ * its NUMA node, are the rows it computes later; setting CDAL_PIN_THREADS
+ * also pins worker k to the k-th processor the process may use, so that
+ * it stays on that node. A call made while the pool is busy, from a
+ * worker or from another thread, runs on its calling thread.
+ */
+class rowBandPool {
+public:
+    explicit rowBandPool(unsigned numWorkers)
+        : work(NULL), rows(0), bands(0), round(0), busy(0), stopping(false) {
+        for (unsigned k = 0; k != numWorkers; k++)
+            workers.push_back(std::thread(&rowBandPool::serve, this, k));
+        if (getenv("CDAL_PIN_THREADS") != NULL) pin();
+    }
+
+    ~rowBandPool() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        start.notify_all();
+        for (size_t k = 0; k != workers.size(); k++) workers[k].join();
+    }
+
+    /**
+     * run work on numBands bands of rows, each on the worker of its number
+     * @return false, without running anything, if the pool is busy
+     */
+    bool run(int numRows, unsigned numBands,
+             const std::function<void(int, int)> &job) {
+        std::unique_lock<std::mutex> caller(calls, std::try_to_lock);
+        if (!caller.owns_lock()) return false;
+        std::unique_lock<std::mutex> lock(m);
+        work = &job;
+        rows = numRows;
+        bands = numBands;
+        busy = workers.size();
+        failure = std::exception_ptr();
+        round++;
+        start.notify_all();
+        done.wait(lock, [this] { return busy == 0; });
+        if (failure) std::rethrow_exception(failure);
+        return true;
+    }
+
+private:
+    void serve(unsigned k) {
+        inRowBand = true;
+        unsigned seen = 0;
+        std::unique_lock<std::mutex> lock(m);
+        for (;;) {
+            start.wait(lock, [&] { return stopping || round != seen; });
+            if (stopping) return;
+            seen = round;
+            int chunk = (rows + bands - 1) / bands;
+            int first = static_cast<int>(k) * chunk;
+            int last = std::min(first + chunk, rows);
+            if (k < bands && first < last) {
+                const std::function<void(int, int)> &job = *work;
+                lock.unlock();
+                try {
+                    job(first, last);
+                } catch (...) {
+                    lock.lock();
+                    if (!failure) failure = std::current_exception();
+                    lock.unlock();
+                }
+                lock.lock();
+            }
+            if (--busy == 0) done.notify_one();
+        }
+    }
+
+    void pin() {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof allowed, &allowed) != 0) return;
+        unsigned k = 0;
+        for (int cpu = 0; cpu != CPU_SETSIZE && k != workers.size(); cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_setaffinity_np(workers[k++].native_handle(), sizeof one,
+                                   &one);
         }
     }
+
+    std::vector<std::thread> workers;
+    std::mutex calls;
+    std::mutex m;
+    std::condition_variable start;
+    std::condition_variable done;
+    const std::function<void(int, int)> *work;
+    int rows;
+    unsigned bands;
+    unsigned round;
+    size_t busy;
+    bool stopping;
+    std::exception_ptr failure;
+};
+
+}  // namespace
+
+void forRowBands(int rows, size_t bytes,
+                 const std::function<void(int, int)> &work) {
+    unsigned numThreads = bytes < parallelRowBytes ? 1 : rowThreads();
+    if (numThreads > static_cast<unsigned>(rows)) numThreads = rows;
+    if (numThreads <= 1 || inRowBand) {
+        work(0, rows);
+        return;
+    }
+
+    static rowBandPool pool(rowThreads());
+    if (!pool.run(rows, numThreads, work)) work(0, rows);
+}
+
+template <class T>
+basicMatrix<T>::basicMatrix(int row, int col)
+    : rows(row), cols(col), mapping(NULL), mappingLength(0) {
+    size_t size = static_cast<size_t>(rows) * cols;
+    data = static_cast<T *>(allocateValues(size * sizeof(T)));
+    T *values = data;
+    size_t n = cols;
+    forRowBands(rows, size * sizeof(T), [=](int first, int last) {
+        std::fill(values + first * n, values + last * n, T());
+    });
+}
+
+template <class T>
+basicMatrix<T>::basicMatrix(const basicMatrix &m)
+    : rows(m.rows), cols(m.cols), mapping(NULL), mappingLength(0) {
+    size_t size = static_cast<size_t>(rows) * cols;
+    data = static_cast<T *>(allocateValues(size * sizeof(T)));
+    T *values = data;
+    const T *from = m.data;
+    size_t n = cols;
+    forRowBands(rows, size * sizeof(T), [=](int first, int last) {
+        std::copy(from + first * n, from + last * n, values + first * n);
+    });
+}
+
+template <class T>
+basicMatrix<T>::basicMatrix(basicMatrix &&m)
+    : rows(m.rows),
+      cols(m.cols),
+      data(m.data),
+      mapping(m.mapping),
+      mappingLength(m.mappingLength) {
+    m.rows = 0;
+    m.cols = 0;
+    m.data = NULL;
+    m.mapping = NULL;
+    m.mappingLength = 0;
+}
+
+template <class T>
+basicMatrix<T>::basicMatrix(int row, int col, T *values, void *map,
+                            size_t mapLength)
+    : rows(row),
+      cols(col),
+      data(values),
+      mapping(map),
+      mappingLength(mapLength) {}
+
+template <class T>
+basicMatrix<T>::~basicMatrix() {
+    if (mapping != NULL)
+        munmap(mapping, mappingLength);
+    else
+        releaseValues(data, static_cast<size_t>(rows) * cols * sizeof(T));
+}
+
+// takes its argument by value, so this is both copy and move assignment
+template <class T>
+basicMatrix<T> &basicMatrix<T>::operator=(basicMatrix m) {
+    std::swap(rows, m.rows);
+    std::swap(cols, m.cols);
+    std::swap(data, m.data);
+    std::swap(mapping, m.mapping);
+    std::swap(mappingLength, m.mappingLength);
+    return *this;
+}
+
+template <class T>
+int basicMatrix<T>::numRows() const {
+    return rows;
+}
+
+template <class T>
+int basicMatrix<T>::numCols() const {
+    return cols;
+}
+
+template <class T>
+T *basicMatrix<T>::operator[](int row) {
+    return data + static_cast<size_t>(row) * cols;
+}
+
+template <class T>
+const T *basicMatrix<T>::operator[](int row) const {
+    return data + static_cast<size_t>(row) * cols;
 }
 
-matrix::~matrix() {
-    for (int i = 0; i != rows; i++) {
-        delete[] data[i];
+template class basicMatrix<float>;
+template class basicMatrix<double>;
+template class basicMatrix<int32_t>;
+template class basicMatrix<int8_t>;
+
+template <class T>
+basicMatrixView<T> basicMatrixView<T>::block(int row, int col, int numRows,
+                                             int numCols) const {
+    if (row < 0 || col < 0 || numRows < 0 || numCols < 0 ||
+        row + numRows > rows || col + numCols > cols) {
+        std::cerr << "ERROR, the " << numRows << "x" << numCols
+                  << " block at (" << row << ", " << col
+                  << ") is outside a matrix with dimensions " << rows << "x"
+                  << cols << std::endl;
+        abortRun();
     }
-    delete[] data;
+    return basicMatrixView(values + row * rowStep + col * colStep, numRows,
+                           numCols, rowStep, colStep);
 }
 
-int matrix::numRows() const { return rows; }
+namespace {
+
+// blocks of at most this many rows and columns are copied directly
+const int copyTileSize = 32;
+
+/**
+ * copy the block of a view with rows [row, row + rows) and columns
+ * [col, col + cols) to the same place in m. The block is halved along its
+ * longer side until it is a tile that fits in the cache along with its
+ * copy, so a transposed view is read a few columns at a time at every
+ * level of the cache hierarchy, whatever its sizes.
+ */
+template <class T>
+void copyTiles(const basicMatrixView<T> &v, basicMatrix<T> &m, int row,
+               int col, int rows, int cols) {
+    if (rows > copyTileSize && rows >= cols) {
+        int half = rows / 2;
+        copyTiles(v, m, row, col, half, cols);
+        copyTiles(v, m, row + half, col, rows - half, cols);
+    } else if (cols > copyTileSize) {
+        int half = cols / 2;
+        copyTiles(v, m, row, col, rows, half);
+        copyTiles(v, m, row, col + half, rows, cols - half);
+    } else {
+        for (int i = row; i != row + rows; i++) {
+            typename basicMatrixView<T>::rowRef in = v[i];
+            T *out = m[i];
+            for (int j = col; j != col + cols; j++) out[j] = in[j];
+        }
+    }
+}
 
-int matrix::numCols() const { return cols; }
+}  // namespace
 
-float *matrix::operator[](int row) { return data[row]; }
+template <class T>
+basicMatrixView<T>::operator basicMatrix<T>() const {
+    basicMatrix<T> m(rows, cols);
+    copyTiles(*this, m, 0, 0, rows, cols);
+    return m;
+}
 
-const float *matrix::operator[](int row) const { return data[row]; }
+template class basicMatrixView<float>;
+template class basicMatrixView<double>;
+template class basicMatrixView<int32_t>;
+template class basicMatrixView<int8_t>;
 
 /* DEPRECATED, USE [][]
 float *matrix::access(int row, int col) const {
@@ -41,58 +580,2822 @@ float *matrix::access(int row, int col) const {
 }
  */
 
-std::ostream &operator<<(std::ostream &os, const matrix &m) {
-    os << m.numRows() << " " << m.numCols() << std::endl;
+/*
+ * Printing matrices
+ * -----------------
+ * operator<< formats the values itself into a large buffer and hands it
+ * to the stream in big chunks, ending rows with '\n' rather than
+ * std::endl, so printing no longer flushes once per row. The text is
+ * byte for byte what formatting each value through the stream gives.
+ */
+
+namespace {
+
+// bytes of text collected before each write to the stream
+const size_t printChunkBytes = 1 << 16;
+
+// enough room for any one formatted value and its separator
+const size_t maxValueChars = 32;
+
+// the format used by operator<<, once it is known
+matrixFormat printFormatSetting = textFormat;
+bool printFormatKnown = false;
+
+matrixFormat printFormat() {
+    if (!printFormatKnown) {
+        const char *env = getenv("CDAL_PRINT_FORMAT");
+        if (env != NULL && strcmp(env, "binary") == 0)
+            printFormatSetting = binaryFormat;
+        printFormatKnown = true;
+    }
+    return printFormatSetting;
+}
+
+/**
+ * whether the stream formats values the default way, %g with 6 digits
+ * for floating point, which is the only way formatValue knows
+ */
+bool defaultFormatting(std::ostream &os) {
+    std::ios_base::fmtflags special =
+        std::ios_base::floatfield | std::ios_base::showpoint |
+        std::ios_base::showpos | std::ios_base::uppercase;
+    return os.precision() == 6 && os.width() == 0 &&
+           (os.flags() & special) == 0 &&
+           os.getloc() == std::locale::classic();
+}
+
+/**
+ * write an integer
+ * @param  p where to write, with room for maxValueChars characters
+ * @param  n the value
+ * @return   a pointer past the text
+ */
+char *formatInteger(char *p, int64_t n) {
+    uint64_t u = n < 0 ? -static_cast<uint64_t>(n) : n;
+    if (n < 0) *p++ = '-';
+    char digits[20];
+    int k = 0;
+    do {
+        digits[k++] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    while (k > 0) *p++ = digits[--k];
+    return p;
+}
+
+char *formatValue(char *p, int8_t v) { return formatInteger(p, v); }
+
+char *formatValue(char *p, int32_t v) { return formatInteger(p, v); }
+
+/**
+ * write a value the way a stream with default settings does
+ * @param  p where to write, with room for maxValueChars characters
+ * @param  v the value
+ * @return   a pointer past the text
+ */
+template <class T>
+char *formatFloatingPoint(char *p, T v) {
+    // whole numbers below a million print as plain integers
+    if (v > -1e6 && v < 1e6 && v == static_cast<int>(v) &&
+        !(v == 0 && signbit(v)))
+        return formatInteger(p, static_cast<int>(v));
+#ifdef __cpp_lib_to_chars
+    if (isfinite(v))
+        return std::to_chars(p, p + maxValueChars, v,
+                             std::chars_format::general, 6)
+            .ptr;
+#endif
+    return p + snprintf(p, maxValueChars, "%g", static_cast<double>(v));
+}
+
+char *formatValue(char *p, float v) { return formatFloatingPoint(p, v); }
+
+char *formatValue(char *p, double v) { return formatFloatingPoint(p, v); }
+
+/**
+ * write a matrix in the text format
+ * @param m anything with numRows, numCols and a const operator[] giving
+ * a row that can be indexed by column
+ */
+template <class rowSource>
+void writeText(std::ostream &os, const rowSource &m) {
+    if (!defaultFormatting(os)) {
+        os << m.numRows() << " " << m.numCols() << '\n';
+        for (int i = 0; i != m.numRows(); i++) {
+            for (int j = 0; j != m.numCols(); j++) {
+                // the + prints int8 values as numbers, not characters
+                os << +m[i][j] << "  ";
+            }
+            os << '\n';
+        }
+        return;
+    }
+
+    std::vector<char> buffer(printChunkBytes + maxValueChars + 2);
+    char *start = &buffer[0];
+    char *limit = start + printChunkBytes;
+    char *p = start + snprintf(start, maxValueChars, "%d %d\n", m.numRows(),
+                               m.numCols());
     for (int i = 0; i != m.numRows(); i++) {
+        auto row = m[i];
         for (int j = 0; j != m.numCols(); j++) {
-            os << m[i][j] << "  ";
+            p = formatValue(p, row[j]);
+            *p++ = ' ';
+            *p++ = ' ';
+            if (p >= limit) {
+                os.write(start, p - start);
+                p = start;
+            }
         }
-        os << std::endl;
+        *p++ = '\n';
+    }
+    os.write(start, p - start);
+}
+
+// rows * cols values in row-major order, as rows for writeText
+template <class T>
+class valueRows {
+public:
+    valueRows(const T *v, int r, int c) : values(v), rows(r), cols(c) {}
+
+    int numRows() const { return rows; }
+    int numCols() const { return cols; }
+
+    const T *operator[](int i) const {
+        return values + static_cast<size_t>(i) * cols;
     }
+
+private:
+    const T *values;
+    int rows;
+    int cols;
+};
+
+}  // namespace
+
+void setPrintFormat(matrixFormat format) {
+    printFormatSetting = format;
+    printFormatKnown = true;
+}
+
+template <class T>
+std::ostream &operator<<(std::ostream &os, const basicMatrix<T> &m) {
+    matrixWrite(m, os, printFormat());
     return os;
 }
 
-matrix operator*(const matrix &left, const matrix &right) {
+template <class T>
+std::ostream &operator<<(std::ostream &os, const basicMatrixView<T> &v) {
+    if (printFormat() == binaryFormat)
+        matrixWrite(basicMatrix<T>(v), os, binaryFormat);
+    else
+        writeText(os, v);
+    return os;
+}
+
+template <class T>
+void printMatrix(std::ostream &os, const T *values, int rows, int cols) {
+    if (printFormat() == binaryFormat) {
+        basicMatrix<T> m(rows, cols);
+        for (int i = 0; i != rows; i++)
+            for (int j = 0; j != cols; j++)
+                m[i][j] = values[static_cast<size_t>(i) * cols + j];
+        matrixWrite(m, os, binaryFormat);
+    } else {
+        writeText(os, valueRows<T>(values, rows, cols));
+    }
+}
+
+template void printMatrix(std::ostream &, const float *, int, int);
+template void printMatrix(std::ostream &, const double *, int, int);
+template void printMatrix(std::ostream &, const int32_t *, int, int);
+template void printMatrix(std::ostream &, const int8_t *, int, int);
+
+template std::ostream &operator<<(std::ostream &, const basicMatrix<float> &);
+template std::ostream &operator<<(std::ostream &,
+                                  const basicMatrix<double> &);
+template std::ostream &operator<<(std::ostream &,
+                                  const basicMatrix<int32_t> &);
+template std::ostream &operator<<(std::ostream &,
+                                  const basicMatrix<int8_t> &);
+template std::ostream &operator<<(std::ostream &, const matrixView &);
+template std::ostream &operator<<(std::ostream &,
+                                  const basicMatrixView<double> &);
+template std::ostream &operator<<(std::ostream &,
+                                  const basicMatrixView<int32_t> &);
+template std::ostream &operator<<(std::ostream &,
+                                  const basicMatrixView<int8_t> &);
+
+/*
+ * Multiplying matrices
+ * --------------------
+ * A product is computed a row at a time, when its productExpression is
+ * evaluated, so that the row can be added to the other operands of a sum
+ * while it is in cache. Each row is summed in a row of accumulators while
+ * the rows of the right matrix stream past, which reads both matrices in
+ * order. The sums for each element are still added in increasing k, so
+ * float products come out exactly as a plain triple loop gives them.
+ * int8 products are instead computed as dot products of the rows of the
+ * left matrix and the columns of the right one, summed in int32.
+ *
+ * The kernels work on views, so products of blocks, rows, columns and
+ * transposes read the matrices in place. When the right matrix is a
+ * transpose, its columns are contiguous, and each element of the product
+ * is summed as a dot product of a row and a column instead, still in
+ * increasing k. Only a view that is contiguous in neither direction is
+ * copied, once before the first row, which takes time proportional to its
+ * size rather than to the product's.
+ */
+
+namespace {
+
+// exit unless left can be multiplied by right
+template <class leftMatrix, class rightMatrix>
+void checkProductSize(const leftMatrix &left, const rightMatrix &right) {
     if (left.numCols() != right.numRows()) {
         std::cerr << "ERROR, two matrices cannot be multiplied with dimensions "
                   << left.numRows() << "x" << left.numCols() << " and "
                   << right.numRows() << "x" << right.numCols() << std::endl;
-        exit(1);
+        abortRun();
     }
+}
 
-    matrix m(left.numRows(), right.numCols());
-    for (int i = 0; i != m.numRows(); i++) {
-        for (int j = 0; j != m.numCols(); j++) {
-            for (int k = 0; k != left.numCols(); k++) {
-                m[i][j] += left[i][k] * right[k][j];
-            }
+// row i of the product of left and a right matrix with contiguous rows
+template <class T>
+void multiplyRow(
+    const basicMatrixView<T> &left, int i, const basicMatrixView<T> &right,
+    std::vector<typename elementTraits<T>::accumulator> &sums,
+    typename elementTraits<T>::product *out) {
+    typedef typename elementTraits<T>::accumulator accumulator;
+    int n = right.numCols();
+    std::fill(sums.begin(), sums.end(), accumulator(0));
+    typename basicMatrixView<T>::rowRef in = left[i];
+    for (int k = 0; k != left.numCols(); k++) {
+        accumulator a = in[k];
+        const T *row = right.rowValues(k);
+        for (int j = 0; j != n; j++) sums[j] += a * row[j];
+    }
+    for (int j = 0; j != n; j++) out[j] = sums[j];
+}
+
+// a row of left by a right matrix with contiguous columns
+template <class T>
+void multiplyByColumns(const T *in, const basicMatrixView<T> &right,
+                       typename elementTraits<T>::product *out) {
+    typedef typename elementTraits<T>::accumulator accumulator;
+    int depth = right.numRows();
+    int n = right.numCols();
+    const T *columns = right.rowValues(0);
+    ptrdiff_t step = right.colStride();
+    // four columns at once, each summed in order on its own
+    int j = 0;
+    for (; j + 4 <= n; j += 4) {
+        const T *c0 = columns + j * step;
+        const T *c1 = c0 + step, *c2 = c1 + step, *c3 = c2 + step;
+        accumulator s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (int k = 0; k != depth; k++) {
+            accumulator a = in[k];
+            s0 += a * c0[k];
+            s1 += a * c1[k];
+            s2 += a * c2[k];
+            s3 += a * c3[k];
         }
+        out[j] = s0;
+        out[j + 1] = s1;
+        out[j + 2] = s2;
+        out[j + 3] = s3;
+    }
+    for (; j != n; j++) {
+        const T *column = columns + j * step;
+        accumulator sum = 0;
+        for (int k = 0; k != depth; k++)
+            sum += accumulator(in[k]) * column[k];
+        out[j] = sum;
     }
-    return m;
 }
 
-matrix matrixRead(const char *filename) {
-    std::ifstream is(filename, std::ifstream::in);
+/**
+ * the dot product of two int8 vectors, summed in int32. Four independent
+ * sums let neighbouring products be computed together.
+ */
+int32_t dotProduct(const int8_t *a, const int8_t *b, int n) {
+    int32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        s0 += a[k] * b[k];
+        s1 += a[k + 1] * b[k + 1];
+        s2 += a[k + 2] * b[k + 2];
+        s3 += a[k + 3] * b[k + 3];
+    }
+    for (; k != n; k++) s0 += a[k] * b[k];
+    return s0 + s1 + s2 + s3;
+}
 
-    // read nrows and ncols
-    int nrows, ncols;
-    is >> nrows >> ncols;
+}  // namespace
 
-    // initiate matrix
-    matrix m(nrows, ncols);
+namespace {
 
-    // read all values
-    for (int i = 0; i != nrows; i++)
-        for (int j = 0; j != ncols; j++) {
-            is >> m[i][j];
+/* The sizes of setStrassenSizes, with the defaults chosen by running
+   matrix_bench; see the comment at the top of matrix_bench.cpp. Products
+   on any thread read them. */
+std::atomic<int> strassenThreshold(-1);
+std::atomic<int> strassenBaseSize(256);
+
+int strassenThresholdSize() {
+    int threshold = strassenThreshold.load();
+    if (threshold < 0) {
+        const char *setting = getenv("CDAL_STRASSEN_THRESHOLD");
+        int initial = setting == NULL ? 2048 : atoi(setting);
+        if (strassenThreshold.compare_exchange_strong(threshold, initial))
+            threshold = initial;
+    }
+    return threshold;
+}
+
+// copy the rows of an expression into a block of a matrix
+template <class E, class T>
+void evaluateInto(const matrixExpression<E, T> &e,
+                  const basicMatrixView<T> &block) {
+    const E &rows = static_cast<const E &>(e);
+    for (int i = 0; i != block.numRows(); i++)
+        rows.rowInto(i, block.rowValues(i));
+}
+
+/**
+ * the Strassen-Winograd product of a and b. Each level splits both into
+ * quarters, after padding an odd dimension with a row or column of zeros,
+ * and forms the product from seven products of quarters:
+ *     S1 = A21 + A22   S2 = S1 - A11   S3 = A11 - A21   S4 = A12 - S2
+ *     T1 = B12 - B11   T2 = B22 - T1   T3 = B22 - B12   T4 = T2 - B21
+ *     P1 = A11 B11     P2 = A12 B21    P3 = S4 B22      P4 = A22 T4
+ *     P5 = S1 T1       P6 = S2 T2      P7 = S3 T3
+ *     U2 = P1 + P6     U3 = U2 + P7    U4 = U2 + P5
+ *     C11 = P1 + P2    C12 = U4 + P3   C21 = U3 - P4    C22 = U3 + P5
+ * The seven products are independent, so they are split over the workers
+ * of forRowBands as if they were rows; within them, every product and
+ * sum runs on its worker's thread.
+ */
+template <class T>
+basicMatrix<T> strassenWinograd(const basicMatrixView<T> &a,
+                                const basicMatrixView<T> &b) {
+    int n = a.numRows(), depth = a.numCols(), m = b.numCols();
+    int baseSize = strassenBaseSize.load();
+    if (n < baseSize || depth < baseSize || m < baseSize)
+        return productExpression<T>(a, b, standardProduct);
+
+    if (n % 2 != 0 || depth % 2 != 0 || m % 2 != 0) {
+        basicMatrix<T> paddedA(n + n % 2, depth + depth % 2);
+        basicMatrix<T> paddedB(depth + depth % 2, m + m % 2);
+        copyTiles(a, paddedA, 0, 0, n, depth);
+        copyTiles(b, paddedB, 0, 0, depth, m);
+        basicMatrix<T> c = strassenWinograd(wholeView(paddedA),
+                                            wholeView(paddedB));
+        return wholeView(c).block(0, 0, n, m);
+    }
+
+    int h = n / 2, g = depth / 2, f = m / 2;
+    basicMatrixView<T> a11 = a.block(0, 0, h, g), a12 = a.block(0, g, h, g);
+    basicMatrixView<T> a21 = a.block(h, 0, h, g), a22 = a.block(h, g, h, g);
+    basicMatrixView<T> b11 = b.block(0, 0, g, f), b12 = b.block(0, f, g, f);
+    basicMatrixView<T> b21 = b.block(g, 0, g, f), b22 = b.block(g, f, g, f);
+
+    basicMatrix<T> s1 = a21 + a22;
+    basicMatrix<T> s2 = s1 - a11;
+    basicMatrix<T> s3 = a11 - a21;
+    basicMatrix<T> s4 = a12 - s2;
+    basicMatrix<T> t1 = b12 - b11;
+    basicMatrix<T> t2 = b22 - t1;
+    basicMatrix<T> t3 = b22 - b12;
+    basicMatrix<T> t4 = t2 - b21;
+
+    const basicMatrixView<T> factors[7][2] = {
+        {a11, b11},           {a12, b21},           {wholeView(s4), b22},
+        {a22, wholeView(t4)}, {wholeView(s1), wholeView(t1)},
+        {wholeView(s2), wholeView(t2)}, {wholeView(s3), wholeView(t3)}};
+    std::shared_ptr<basicMatrix<T> > products[7];
+    forRowBands(7, static_cast<size_t>(n) * m * sizeof(T),
+                [&factors, &products](int first, int last) {
+                    for (int k = first; k != last; k++)
+                        products[k] = std::make_shared<basicMatrix<T> >(
+                            strassenWinograd(factors[k][0], factors[k][1]));
+                });
+    const basicMatrix<T> &p1 = *products[0], &p2 = *products[1];
+    const basicMatrix<T> &p3 = *products[2], &p4 = *products[3];
+    const basicMatrix<T> &p5 = *products[4], &p6 = *products[5];
+    const basicMatrix<T> &p7 = *products[6];
+
+    basicMatrix<T> u2 = p1 + p6;
+    basicMatrix<T> u3 = u2 + p7;
+    basicMatrix<T> c(n, m);
+    basicMatrixView<T> result = wholeView(c);
+    evaluateInto(p1 + p2, result.block(0, 0, h, f));
+    evaluateInto(u2 + p5 + p3, result.block(0, f, h, f));
+    evaluateInto(u3 - p4, result.block(h, 0, h, f));
+    evaluateInto(u3 + p5, result.block(h, f, h, f));
+    return c;
+}
+
+// the Strassen-Winograd product, for float and double elements only
+template <class T>
+std::shared_ptr<const basicMatrix<T> > strassenResult(
+    const basicMatrixView<T> &a, const basicMatrixView<T> &b,
+    std::true_type) {
+    return std::make_shared<const basicMatrix<T> >(strassenWinograd(a, b));
+}
+
+template <class T>
+std::shared_ptr<const basicMatrix<typename elementTraits<T>::product> >
+strassenResult(const basicMatrixView<T> &, const basicMatrixView<T> &,
+               std::false_type) {
+    return NULL;
+}
+
+}  // namespace
+
+void setStrassenSizes(int threshold, int baseSize) {
+    strassenThreshold.store(threshold < 0 ? 0 : threshold);
+    strassenBaseSize.store(baseSize < 16 ? 16 : baseSize);
+}
+
+template <class T>
+productExpression<T>::productExpression(const basicMatrixView<T> &l,
+                                        const basicMatrixView<T> &r,
+                                        productAlgorithm algorithm)
+    : left(l), right(r), prepared(false) {
+    checkProductSize(left, right);
+    if (!std::is_floating_point<T>::value || algorithm == standardProduct)
+        return;
+    int threshold = strassenThresholdSize();
+    if (algorithm == strassenProduct ||
+        (threshold > 0 && left.numRows() >= threshold &&
+         left.numCols() >= threshold && right.numCols() >= threshold))
+        computed = strassenResult(left, right,
+                                  typename std::is_floating_point<T>::type());
+}
+
+template <class T>
+void productExpression<T>::prepare() const {
+    if (prepared || computed) return;
+    if (right.colStride() == 1) {
+        sums.resize(right.numCols());
+    } else if (right.rowStride() == 1 && right.numRows() != 0) {
+        if (left.colStride() != 1)
+            leftCopy = std::make_shared<const basicMatrix<T> >(left);
+    } else {
+        rightCopy = std::make_shared<const basicMatrix<T> >(right);
+        sums.resize(right.numCols());
+    }
+    prepared = true;
+}
+
+template <class T>
+void productExpression<T>::rowInto(int i, element *out) const {
+    if (computed) {
+        const element *row = (*computed)[i];
+        std::copy(row, row + numCols(), out);
+        return;
+    }
+    prepare();
+    if (rightCopy) {
+        multiplyRow(left, i, wholeView(*rightCopy), sums, out);
+    } else if (right.colStride() == 1) {
+        multiplyRow(left, i, right, sums, out);
+    } else {
+        multiplyByColumns(leftCopy ? (*leftCopy)[i] : left.rowValues(i),
+                          right, out);
+    }
+}
+
+// int8 rows need to be contiguous, and so do the columns of right
+template <>
+void productExpression<int8_t>::prepare() const {
+    if (prepared) return;
+    if (left.colStride() != 1)
+        leftCopy = std::make_shared<const basicMatrix<int8_t> >(left);
+    if (right.rowStride() != 1 || right.numRows() == 0)
+        rightCopy =
+            std::make_shared<const basicMatrix<int8_t> >(right.transposed());
+    prepared = true;
+}
+
+template <>
+void productExpression<int8_t>::rowInto(int i, int32_t *out) const {
+    prepare();
+    const int8_t *in = leftCopy ? (*leftCopy)[i] : left.rowValues(i);
+    // the columns of right, which are already contiguous in a transpose
+    basicMatrixView<int8_t> columns =
+        rightCopy ? wholeView(*rightCopy).transposed() : right;
+    int depth = right.numRows();
+    const int8_t *first = columns.rowValues(0);
+    ptrdiff_t step = columns.colStride();
+    for (int j = 0; j != right.numCols(); j++)
+        out[j] = dotProduct(in, first + j * step, depth);
+}
+
+template class productExpression<float>;
+template class productExpression<double>;
+template class productExpression<int32_t>;
+template class productExpression<int8_t>;
+
+/*
+ * Reducing matrices
+ * -----------------
+ * A view is reduced as one run of values when its elements are evenly
+ * spaced, as in a whole matrix, a row or a column, and otherwise row by
+ * row. Within a run, eight partial results are kept so that neighbouring
+ * elements are combined independently of each other; runs longer than a
+ * block are split in halves whose sums are added, which is pairwise
+ * summation.
+ */
+
+namespace {
+
+const int reductionLanes = 8;
+
+// runs of at most this many values are summed directly
+const size_t pairwiseBlock = 128;
+
+// the k-th value of a run
+template <class A, class T>
+struct valueTerm {
+    const T *values;
+    ptrdiff_t step;
+
+    A operator()(size_t k) const { return values[k * step]; }
+};
+
+// the square of the k-th value of a run
+template <class A, class T>
+struct squareTerm {
+    const T *values;
+    ptrdiff_t step;
+
+    A operator()(size_t k) const {
+        A v = values[k * step];
+        return v * v;
+    }
+};
+
+// the product of the k-th values of two runs
+template <class A, class T>
+struct productTerm {
+    const T *left;
+    ptrdiff_t leftStep;
+    const T *right;
+    ptrdiff_t rightStep;
+
+    A operator()(size_t k) const {
+        return A(left[k * leftStep]) * right[k * rightStep];
+    }
+};
+
+// the sum of the terms first to first + n - 1
+template <class A, class term>
+A pairwiseSum(const term &f, size_t first, size_t n) {
+    if (n > pairwiseBlock) {
+        size_t half = n / 2 / reductionLanes * reductionLanes;
+        return pairwiseSum<A>(f, first, half) +
+               pairwiseSum<A>(f, first + half, n - half);
+    }
+    A s[reductionLanes] = {};
+    size_t k = 0;
+    for (; k + reductionLanes <= n; k += reductionLanes)
+        for (int l = 0; l != reductionLanes; l++) s[l] += f(first + k + l);
+    for (; k != n; k++) s[k % reductionLanes] += f(first + k);
+    return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+}
+
+/**
+ * whether the elements of a view are evenly spaced, and so one run
+ * @param step set to the distance between neighbouring elements
+ */
+template <class T>
+bool isRun(const basicMatrixView<T> &v, ptrdiff_t &step) {
+    if (v.numRows() == 1 || v.numCols() == 1) {
+        step = v.numRows() == 1 ? v.colStride() : v.rowStride();
+        return true;
+    }
+    step = v.colStride();
+    return v.rowStride() == v.colStride() * v.numCols();
+}
+
+// the elements of a view read along its rows, in as few runs as possible
+template <class T>
+basicMatrixView<T> rowMajor(const basicMatrixView<T> &v) {
+    // a transpose has the same elements, and its rows are the columns
+    if (v.numRows() > 1 && v.numCols() > 1 &&
+        std::abs(v.rowStride()) < std::abs(v.colStride()))
+        return v.transposed();
+    return v;
+}
+
+// the sum of a term for each element of a view
+template <class A, class T, template <class, class> class term>
+A sumTerms(const basicMatrixView<T> &view) {
+    basicMatrixView<T> v = rowMajor(view);
+    size_t count = static_cast<size_t>(v.numRows()) * v.numCols();
+    ptrdiff_t step;
+    if (count == 0) return A(0);
+    if (isRun(v, step)) {
+        term<A, T> f = {v.rowValues(0), step};
+        return pairwiseSum<A>(f, 0, count);
+    }
+    std::vector<A> rowSums(v.numRows());
+    for (int i = 0; i != v.numRows(); i++) {
+        term<A, T> f = {v.rowValues(i), v.colStride()};
+        rowSums[i] = pairwiseSum<A>(f, 0, v.numCols());
+    }
+    valueTerm<A, A> rows = {&rowSums[0], 1};
+    return pairwiseSum<A>(rows, 0, rowSums.size());
+}
+
+// exit unless a view has elements to take the minimum, maximum or mean of
+template <class T>
+void checkNotEmpty(const basicMatrixView<T> &v, const char *reduction) {
+    if (v.numRows() == 0 || v.numCols() == 0) {
+        std::cerr << "ERROR, the " << reduction
+                  << " of a matrix with dimensions " << v.numRows() << "x"
+                  << v.numCols() << " is undefined" << std::endl;
+        abortRun();
+    }
+}
+
+// the minimum, or with greater set the maximum, of a view
+template <class T>
+T extreme(const basicMatrixView<T> &view, bool greater, const char *name) {
+    checkNotEmpty(view, name);
+    basicMatrixView<T> v = rowMajor(view);
+    T best[reductionLanes];
+    std::fill(best, best + reductionLanes, v[0][0]);
+    for (int i = 0; i != v.numRows(); i++) {
+        const T *row = v.rowValues(i);
+        ptrdiff_t step = v.colStride();
+        int n = v.numCols(), j = 0;
+        for (; j + reductionLanes <= n; j += reductionLanes) {
+            for (int l = 0; l != reductionLanes; l++) {
+                T value = row[(j + l) * step];
+                if (greater ? value > best[l] : value < best[l])
+                    best[l] = value;
+            }
         }
-    return m;
+        for (; j != n; j++) {
+            T value = row[j * step];
+            if (greater ? value > best[0] : value < best[0]) best[0] = value;
+        }
+    }
+    for (int l = 1; l != reductionLanes; l++)
+        if (greater ? best[l] > best[0] : best[l] < best[0]) best[0] = best[l];
+    return best[0];
 }
 
-matrix matrixRead(std::string &filename) {
-    return matrixRead(filename.c_str());
+}  // namespace
+
+template <class T>
+typename elementTraits<T>::accumulator sum(const basicMatrixView<T> &v) {
+    return sumTerms<typename elementTraits<T>::accumulator, T, valueTerm>(v);
 }
 
-int numRows(matrix &m) { return m.numRows(); }
+template <class T>
+typename elementTraits<T>::accumulator sum(const basicMatrix<T> &m) {
+    return sum(wholeView(m));
+}
 
-int numCols(matrix &m) { return m.numCols(); }
+template <class T>
+double mean(const basicMatrixView<T> &v) {
+    checkNotEmpty(v, "mean");
+    return static_cast<double>(sum(v)) /
+           (static_cast<double>(v.numRows()) * v.numCols());
+}
+
+template <class T>
+double mean(const basicMatrix<T> &m) {
+    return mean(wholeView(m));
+}
+
+template <class T>
+T min(const basicMatrixView<T> &v) {
+    return extreme(v, false, "minimum");
+}
+
+template <class T>
+T min(const basicMatrix<T> &m) {
+    return min(wholeView(m));
+}
+
+template <class T>
+T max(const basicMatrixView<T> &v) {
+    return extreme(v, true, "maximum");
+}
+
+template <class T>
+T max(const basicMatrix<T> &m) {
+    return max(wholeView(m));
+}
+
+template <class T>
+double norm(const basicMatrixView<T> &v) {
+    typedef typename elementTraits<T>::accumulator accumulator;
+    return sqrt(static_cast<double>(sumTerms<accumulator, T, squareTerm>(v)));
+}
+
+template <class T>
+double norm(const basicMatrix<T> &m) {
+    return norm(wholeView(m));
+}
+
+template <class T>
+typename elementTraits<T>::accumulator dot(const basicMatrixView<T> &left,
+                                           const basicMatrixView<T> &right) {
+    typedef typename elementTraits<T>::accumulator accumulator;
+    if (left.numRows() != right.numRows() ||
+        left.numCols() != right.numCols()) {
+        std::cerr << "ERROR, the dot product of two matrices with dimensions "
+                  << left.numRows() << "x" << left.numCols() << " and "
+                  << right.numRows() << "x" << right.numCols()
+                  << " is undefined" << std::endl;
+        abortRun();
+    }
+    std::vector<accumulator> rowSums(left.numRows());
+    for (int i = 0; i != left.numRows(); i++) {
+        productTerm<accumulator, T> f = {left.rowValues(i), left.colStride(),
+                                         right.rowValues(i),
+                                         right.colStride()};
+        rowSums[i] = pairwiseSum<accumulator>(f, 0, left.numCols());
+    }
+    if (rowSums.empty()) return accumulator(0);
+    valueTerm<accumulator, accumulator> rows = {&rowSums[0], 1};
+    return pairwiseSum<accumulator>(rows, 0, rowSums.size());
+}
+
+template <class T>
+typename elementTraits<T>::accumulator dot(const basicMatrix<T> &left,
+                                           const basicMatrix<T> &right) {
+    return dot(wholeView(left), wholeView(right));
+}
+
+#define INSTANTIATE_REDUCTIONS(T)                                          \
+    template elementTraits<T>::accumulator sum(const basicMatrix<T> &);    \
+    template elementTraits<T>::accumulator sum(                            \
+        const basicMatrixView<T> &);                                       \
+    template double mean(const basicMatrix<T> &);                          \
+    template double mean(const basicMatrixView<T> &);                      \
+    template T min(const basicMatrix<T> &);                                \
+    template T min(const basicMatrixView<T> &);                            \
+    template T max(const basicMatrix<T> &);                                \
+    template T max(const basicMatrixView<T> &);                            \
+    template double norm(const basicMatrix<T> &);                          \
+    template double norm(const basicMatrixView<T> &);                      \
+    template elementTraits<T>::accumulator dot(const basicMatrix<T> &,     \
+                                               const basicMatrix<T> &);    \
+    template elementTraits<T>::accumulator dot(                            \
+        const basicMatrixView<T> &, const basicMatrixView<T> &);
+
+INSTANTIATE_REDUCTIONS(float)
+INSTANTIATE_REDUCTIONS(double)
+INSTANTIATE_REDUCTIONS(int32_t)
+INSTANTIATE_REDUCTIONS(int8_t)
+
+/*
+ * Reading matrices
+ * ----------------
+ * matrixRead maps the whole file into memory and parses it with the
+ * hand-rolled number parsers below instead of going through the
+ * locale-aware std::ifstream extractors. When the values are laid out one
+ * row per line, the rows are parsed in parallel once the line offsets are
+ * known; otherwise the values are parsed one after another as a
+ * whitespace separated stream, which is what the old reader accepted.
+ */
+
+namespace {
+
+// files smaller than this are not worth starting threads for
+const size_t parallelParseThreshold = 1 << 20;
+
+// powers of ten that are exactly representable as a float
+const float floatPow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                            1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+// a non-blank line of the matrix file
+struct lineSpan {
+    const char *begin;
+    const char *end;
+};
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+           c == '\f';
+}
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+const char *skipSpace(const char *p, const char *end) {
+    while (p != end && isSpace(*p)) p++;
+    return p;
+}
+
+/**
+ * parse an integer starting at p
+ * @return On success, a pointer past the integer; otherwise NULL
+ */
+const char *parseInt(const char *p, const char *end, int &value) {
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || !isDigit(*p)) return NULL;
+
+    long long v = 0;
+    while (p != end && isDigit(*p)) {
+        v = v * 10 + (*p - '0');
+        if (v > 0x7fffffff) return NULL;
+        p++;
+    }
+    if (p != end && !isSpace(*p)) return NULL;
+
+    value = static_cast<int>(negative ? -v : v);
+    return p;
+}
+
+/**
+ * parse a decimal number such as "12", "-3.5" or "1.5e-3" starting at p.
+ * Numbers with at most 24 bits of mantissa and a small exponent, which is
+ * what our data files hold, are converted exactly with a single float
+ * operation; anything else is handed to strtof.
+ * @return On success, a pointer past the number; otherwise NULL
+ */
+const char *parseFloat(const char *p, const char *end, float &value) {
+    const char *start = p;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    bool truncated = false;
+    bool sawDigit = false;
+
+    for (; p != end && isDigit(*p); p++) {
+        sawDigit = true;
+        if (numDigits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0) numDigits++;
+        } else {
+            truncated = true;
+            exponent++;
+        }
+    }
+    if (p != end && *p == '.') {
+        for (p++; p != end && isDigit(*p); p++) {
+            sawDigit = true;
+            if (numDigits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0) numDigits++;
+                exponent--;
+            } else {
+                truncated = true;
+            }
+        }
+    }
+    if (!sawDigit) return NULL;
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int exponentSign = 1;
+        if (p != end && (*p == '-' || *p == '+')) {
+            exponentSign = *p == '-' ? -1 : 1;
+            p++;
+        }
+        if (p == end || !isDigit(*p)) return NULL;
+        int e = 0;
+        for (; p != end && isDigit(*p); p++) {
+            if (e < 100000) e = e * 10 + (*p - '0');
+        }
+        exponent += exponentSign * e;
+    }
+    if (p != end && !isSpace(*p)) return NULL;
+
+    if (mantissa == 0) {
+        value = negative ? -0.0f : 0.0f;
+    } else if (!truncated && mantissa <= (1u << 24) && exponent >= -10 &&
+               exponent <= 10) {
+        float f = static_cast<float>(mantissa);
+        f = exponent < 0 ? f / floatPow10[-exponent]
+                         : f * floatPow10[exponent];
+        value = negative ? -f : f;
+    } else {
+        std::string token(start, p);
+        value = strtof(token.c_str(), NULL);
+    }
+    return p;
+}
+
+/**
+ * describe where parsing failed, for the errors reported by matrixRead and
+ * matrixStream
+ * @param  line     the line the failed token is on
+ * @param  at       where the failed token starts
+ * @param  end      one past the last character of the text
+ * @param  expected what the parser was looking for
+ * @return          a description such as "expected ... at line 3 but
+ * found 'x'"
+ */
+std::string describeError(int line, const char *at, const char *end,
+                          const std::string &expected) {
+    std::stringstream ss;
+    ss << "expected " << expected << " at line " << line;
+    if (at == end) {
+        ss << " but reached the end of the file";
+    } else {
+        const char *tokenEnd = at;
+        while (tokenEnd != end && !isSpace(*tokenEnd) && tokenEnd - at < 32)
+            tokenEnd++;
+        ss << " but found '" << std::string(at, tokenEnd) << "'";
+    }
+    return ss.str();
+}
+
+std::string describeError(const char *text, const char *end, const char *at,
+                          const std::string &expected) {
+    int line = 1;
+    for (const char *p = text; p != at; p++)
+        if (*p == '\n') line++;
+    return describeError(line, at, end, expected);
+}
+
+/**
+ * parse exactly one row of values from a line
+ * @return true if the line holds exactly ncols well formed numbers
+ */
+bool parseRow(const lineSpan &line, float *row, int ncols) {
+    const char *p = line.begin;
+    for (int j = 0; j != ncols; j++) {
+        p = skipSpace(p, line.end);
+        if (p == line.end) return false;
+        p = parseFloat(p, line.end, row[j]);
+        if (p == NULL) return false;
+    }
+    return skipSpace(p, line.end) == line.end;
+}
+
+// parse lines [first, last) into the corresponding rows of m
+void parseRows(const std::vector<lineSpan> &lines, int first, int last,
+               matrix *m, char *ok) {
+    for (int i = first; i != last; i++) {
+        if (!parseRow(lines[i], (*m)[i], m->numCols())) {
+            *ok = false;
+            return;
+        }
+    }
+}
+
+/**
+ * split the text into its non-blank lines
+ * @return false as soon as more than maxLines lines are found
+ */
+bool findLines(const char *p, const char *end, size_t maxLines,
+               std::vector<lineSpan> &lines) {
+    while (p != end) {
+        const char *eol =
+            static_cast<const char *>(memchr(p, '\n', end - p));
+        if (eol == NULL) eol = end;
+        if (skipSpace(p, eol) != eol) {
+            if (lines.size() == maxLines) return false;
+            lineSpan line = {p, eol};
+            lines.push_back(line);
+        }
+        p = eol == end ? end : eol + 1;
+    }
+    return true;
+}
+
+/**
+ * parse the rows one per line, spreading the lines over several threads
+ * for large inputs
+ * @return false if some line does not hold exactly one row
+ */
+bool parseLines(const std::vector<lineSpan> &lines, size_t length,
+                matrix &m) {
+    int nrows = m.numRows();
+    unsigned numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0 || length < parallelParseThreshold) numThreads = 1;
+    if (numThreads > static_cast<unsigned>(nrows)) numThreads = nrows;
+    if (numThreads <= 1) {
+        char ok = true;
+        parseRows(lines, 0, nrows, &m, &ok);
+        return ok;
+    }
+
+    // one flag per thread; vector<bool> would pack them into shared words
+    std::vector<char> ok(numThreads, true);
+    std::vector<std::thread> workers;
+    int chunk = (nrows + numThreads - 1) / numThreads;
+    for (unsigned t = 0; t != numThreads; t++) {
+        int first = t * chunk;
+        int last = first + chunk < nrows ? first + chunk : nrows;
+        workers.push_back(std::thread(parseRows, std::cref(lines), first,
+                                      last, &m, &ok[t]));
+    }
+    for (unsigned t = 0; t != numThreads; t++) workers[t].join();
+    for (unsigned t = 0; t != numThreads; t++)
+        if (!ok[t]) return false;
+    return true;
+}
+
+}  // namespace
+
+matrix matrixParse(const char *text, size_t length, std::string &error) {
+    const char *end = text + length;
+    error.clear();
+
+    // read nrows and ncols
+    int nrows, ncols;
+    const char *p = skipSpace(text, end);
+    const char *q = parseInt(p, end, nrows);
+    if (q == NULL || nrows < 0) {
+        error = describeError(text, end, p, "the number of rows");
+        return matrix(0, 0);
+    }
+    p = skipSpace(q, end);
+    q = parseInt(p, end, ncols);
+    if (q == NULL || ncols < 0) {
+        error = describeError(text, end, p, "the number of columns");
+        return matrix(0, 0);
+    }
+    p = q;
+
+    // initiate matrix
+    matrix m(nrows, ncols);
+
+    // fast path: one row per line
+    std::vector<lineSpan> lines;
+    if (findLines(p, end, nrows, lines) &&
+        lines.size() == static_cast<size_t>(nrows) &&
+        parseLines(lines, length, m))
+        return m;
+
+    // otherwise read all values as one whitespace separated stream
+    for (int i = 0; i != nrows; i++)
+        for (int j = 0; j != ncols; j++) {
+            p = skipSpace(p, end);
+            q = p == end ? NULL : parseFloat(p, end, m[i][j]);
+            if (q == NULL) {
+                std::stringstream expected;
+                expected << "the value at row " << i + 1 << ", column "
+                         << j + 1;
+                error = describeError(text, end, p, expected.str());
+                return matrix(0, 0);
+            }
+            p = q;
+        }
+
+    p = skipSpace(p, end);
+    if (p != end) {
+        error = describeError(text, end, p, "no more values");
+        return matrix(0, 0);
+    }
+    return m;
+}
+
+/*
+ * Binary matrix files
+ * -------------------
+ * A binary matrix file starts with a 64 byte header, followed by the
+ * values in row-major order. The payload starts on a 64 byte boundary, so
+ * a mapping of the file can be used as the storage of a matrix directly.
+ */
+
+namespace {
+
+const char binaryMagic[8] = {'C', 'D', 'A', 'L', 'M', 'T', 'X', '\0'};
+const uint32_t binaryVersion = 1;
+// written in the byte order of the machine that wrote the file
+const uint32_t byteOrderMark = 0x01020304;
+const uint32_t byteOrderMarkSwapped = 0x04030201;
+// element types
+const uint32_t float32Type = 1;
+const uint32_t float64Type = 2;
+const uint32_t int32Type = 3;
+const uint32_t int8Type = 4;
+
+// the element type code of each type a basicMatrix can hold
+uint32_t typeCode(float) { return float32Type; }
+uint32_t typeCode(double) { return float64Type; }
+uint32_t typeCode(int32_t) { return int32Type; }
+uint32_t typeCode(int8_t) { return int8Type; }
+
+// the size of the elements of a type, or 0 for unknown types
+uint32_t typeSize(uint32_t type) {
+    switch (type) {
+        case float32Type: return sizeof(float);
+        case float64Type: return sizeof(double);
+        case int32Type: return sizeof(int32_t);
+        case int8Type: return sizeof(int8_t);
+        default: return 0;
+    }
+}
+
+struct binaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t elementType;
+    uint32_t elementSize;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t payloadOffset;
+    char reserved[16];
+};
+
+uint32_t swapBytes(uint32_t v) {
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) |
+           (v << 24);
+}
+
+uint64_t swapBytes(uint64_t v) {
+    return (static_cast<uint64_t>(swapBytes(static_cast<uint32_t>(v))) << 32) |
+           swapBytes(static_cast<uint32_t>(v >> 32));
+}
+
+bool isBinary(const char *text, size_t length) {
+    return length >= sizeof(binaryMagic) &&
+           memcmp(text, binaryMagic, sizeof(binaryMagic)) == 0;
+}
+
+/**
+ * read and check the header of a binary matrix file
+ * @param  text    the start of the file
+ * @param  length  the size of the whole file
+ * @param  header  the header, converted to the native byte order
+ * @param  swapped set to true if the file was written with the other
+ * byte order
+ * @param  error   set to a description of the problem if the header is
+ * malformed or does not fit the file
+ * @return         true if the header is good
+ */
+bool decodeHeader(const char *text, size_t length, binaryHeader &header,
+                  bool &swapped, std::string &error) {
+    if (length < sizeof(header)) {
+        error = "truncated binary header";
+        return false;
+    }
+    memcpy(&header, text, sizeof(header));
+
+    swapped = header.byteOrder == byteOrderMarkSwapped;
+    if (swapped) {
+        header.version = swapBytes(header.version);
+        header.elementType = swapBytes(header.elementType);
+        header.elementSize = swapBytes(header.elementSize);
+        header.rows = swapBytes(header.rows);
+        header.cols = swapBytes(header.cols);
+        header.payloadOffset = swapBytes(header.payloadOffset);
+    } else if (header.byteOrder != byteOrderMark) {
+        error = "unknown byte order in binary header";
+        return false;
+    }
+
+    std::stringstream ss;
+    if (header.version != binaryVersion) {
+        ss << "unsupported binary format version " << header.version;
+    } else if (typeSize(header.elementType) == 0 ||
+               header.elementSize != typeSize(header.elementType)) {
+        ss << "unsupported element type " << header.elementType;
+    } else if (header.rows > 0x7fffffff || header.cols > 0x7fffffff) {
+        ss << "dimensions " << header.rows << "x" << header.cols
+           << " are too large";
+    } else if (header.payloadOffset < sizeof(header) ||
+               header.payloadOffset % header.elementSize != 0 ||
+               header.payloadOffset > length ||
+               (length - header.payloadOffset) / header.elementSize <
+                   header.rows * header.cols) {
+        ss << "the file is too short for a " << header.rows << "x"
+           << header.cols << " matrix";
+    }
+    error = ss.str();
+    return error.empty();
+}
+
+/**
+ * convert values of type U, possibly in the other byte order, to floats
+ * @param payload the values
+ * @param size    the number of values
+ * @param swapped true if the bytes of each value are reversed
+ * @param out     where to write the floats
+ */
+template <class U>
+void convertValues(const char *payload, size_t size, bool swapped,
+                   float *out) {
+    for (size_t k = 0; k != size; k++) {
+        char bytes[sizeof(U)];
+        memcpy(bytes, payload + k * sizeof(U), sizeof(U));
+        if (swapped) std::reverse(bytes, bytes + sizeof(U));
+        U value;
+        memcpy(&value, bytes, sizeof(U));
+        out[k] = static_cast<float>(value);
+    }
+}
+
+/**
+ * convert the values of a binary matrix file to floats
+ * @param payload the values
+ * @param size    the number of values
+ * @param type    their element type, which decodeHeader has checked
+ * @param swapped true if the bytes of each value are reversed
+ * @param out     where to write the floats
+ */
+void convertPayload(const char *payload, size_t size, uint32_t type,
+                    bool swapped, float *out) {
+    switch (type) {
+        case float32Type:
+            convertValues<float>(payload, size, swapped, out);
+            break;
+        case float64Type:
+            convertValues<double>(payload, size, swapped, out);
+            break;
+        case int32Type:
+            convertValues<int32_t>(payload, size, swapped, out);
+            break;
+        case int8Type:
+            convertValues<int8_t>(payload, size, swapped, out);
+            break;
+    }
+}
+
+}  // namespace
+
+/**
+ * Decodes and encodes binary matrix files. It is a friend of basicMatrix
+ * so that a matrix can take over the mapping of the file as its storage.
+ */
+class matrixFile {
+public:
+    /**
+     * decode a binary matrix file
+     * @param  text      the contents of the file
+     * @param  length    the size of the file
+     * @param  mapped    true if text is a private mapping of the whole file
+     * that the matrix may keep; it is set to false if the matrix did
+     * @param  error     set to a description of the problem if the file is
+     * malformed
+     * @return           On success, the matrix; otherwise a 0 x 0 matrix
+     */
+    static matrix decode(char *text, size_t length, bool &mapped,
+                         std::string &error) {
+        binaryHeader header;
+        bool swapped;
+        if (!decodeHeader(text, length, header, swapped, error))
+            return matrix(0, 0);
+
+        int nrows = static_cast<int>(header.rows);
+        int ncols = static_cast<int>(header.cols);
+        char *payload = text + header.payloadOffset;
+
+        // zero-copy: the matrix keeps the mapping
+        if (mapped && !swapped && header.elementType == float32Type) {
+            mapped = false;
+            return matrix(nrows, ncols, reinterpret_cast<float *>(payload),
+                          text, length);
+        }
+
+        matrix m(nrows, ncols);
+        size_t size = static_cast<size_t>(nrows) * ncols;
+        convertPayload(payload, size, header.elementType, swapped, m.data);
+        return m;
+    }
+
+    /**
+     * write a matrix in the binary format
+     */
+    template <class T>
+    static void encode(const basicMatrix<T> &m, std::ostream &os) {
+        binaryHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, binaryMagic, sizeof(binaryMagic));
+        header.version = binaryVersion;
+        header.byteOrder = byteOrderMark;
+        header.elementType = typeCode(T());
+        header.elementSize = sizeof(T);
+        header.rows = m.rows;
+        header.cols = m.cols;
+        header.payloadOffset = sizeof(header);
+
+        size_t size = static_cast<size_t>(m.rows) * m.cols;
+        os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        os.write(reinterpret_cast<const char *>(m.data), size * sizeof(T));
+    }
+};
+
+matrix matrixRead(const char *filename) {
+    matrix input(0, 0);
+    if (libraryCall::read(filename, input)) return input;
+
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "ERROR, cannot open matrix file " << filename
+                  << std::endl;
+        abortRun();
+    }
+
+    // map the whole file; fall back to a bulk read for files that cannot
+    // be mapped, like pipes. The mapping is private and writable so that
+    // a binary matrix can keep it as copy-on-write storage.
+    size_t length = st.st_size;
+    void *mapped = MAP_FAILED;
+    if (S_ISREG(st.st_mode) && length > 0)
+        mapped = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                      0);
+
+    std::vector<char> buffer;
+    char *text;
+    if (mapped != MAP_FAILED) {
+        text = static_cast<char *>(mapped);
+    } else {
+        char chunk[1 << 16];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+            buffer.insert(buffer.end(), chunk, chunk + n);
+        buffer.push_back('\0');
+        length = buffer.size() - 1;
+        text = &buffer[0];
+    }
+    close(fd);
+
+    std::string error;
+    bool keepMapping = mapped != MAP_FAILED;
+    matrix m(0, 0);
+    if (isBinary(text, length)) {
+        m = matrixFile::decode(text, length, keepMapping, error);
+    } else {
+        if (keepMapping) madvise(mapped, length, MADV_WILLNEED);
+        m = matrixParse(text, length, error);
+    }
+
+    // unless the matrix took over the mapping
+    if (keepMapping) munmap(mapped, length);
+
+    if (!error.empty()) {
+        std::cerr << "ERROR, malformed matrix file " << filename << ": "
+                  << error << std::endl;
+        abortRun();
+    }
+    return m;
+}
+
+matrix matrixRead(std::string &filename) {
+    return matrixRead(filename.c_str());
+}
+
+template <class T>
+void matrixWrite(const basicMatrix<T> &m, std::ostream &os,
+                 matrixFormat format) {
+    if (format == textFormat)
+        writeText(os, m);
+    else
+        matrixFile::encode(m, os);
+}
+
+template <class T>
+void matrixWrite(const basicMatrix<T> &m, const char *filename,
+                 matrixFormat format) {
+    std::ofstream os(filename, std::ofstream::out | std::ofstream::binary);
+    matrixWrite(m, os, format);
+    os.close();
+
+    if (!os) {
+        std::cerr << "ERROR, cannot write matrix file " << filename
+                  << std::endl;
+        abortRun();
+    }
+}
+
+template <class T>
+void matrixWrite(const basicMatrix<T> &m, std::string &filename,
+                 matrixFormat format) {
+    matrixWrite(m, filename.c_str(), format);
+}
+
+#define INSTANTIATE_MATRIX_WRITE(T)                                        \
+    template void matrixWrite(const basicMatrix<T> &, std::ostream &,      \
+                              matrixFormat);                               \
+    template void matrixWrite(const basicMatrix<T> &, const char *,        \
+                              matrixFormat);                               \
+    template void matrixWrite(const basicMatrix<T> &, std::string &,       \
+                              matrixFormat);
+
+INSTANTIATE_MATRIX_WRITE(float)
+INSTANTIATE_MATRIX_WRITE(double)
+INSTANTIATE_MATRIX_WRITE(int32_t)
+INSTANTIATE_MATRIX_WRITE(int8_t)
+
+void matrixConvert(const char *from, const char *to, matrixFormat format) {
+    matrixWrite(matrixRead(from), to, format);
+}
+
+/*
+ * Resume points
+ * -------------
+ * The state file of a resumePoint starts with the line
+ *     CDAL state <statement> <row>
+ * where row is -1 unless the interpreter stopped in a comprehension. Each
+ * variable follows as its name and kind and then its value:
+ *     <name> n <number>\n
+ *     <name> s <length>\n<characters>\n
+ *     <name> m\n<a binary matrix file, in the native byte order>
+ */
+
+resumePoint::resumePoint(int argc, char **argv) : at(0), row(-1), position(0) {
+    const char *filename = NULL;
+    for (int k = 1; k + 1 < argc; k++)
+        if (strcmp(argv[k], "--resume") == 0) filename = argv[k + 1];
+    if (filename == NULL) return;
+
+    std::ifstream in(filename, std::ifstream::in | std::ifstream::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    if (!in) {
+        std::cerr << "ERROR, cannot open state file " << filename
+                  << std::endl;
+        abortRun();
+    }
+    state = contents.str();
+    int consumed = 0;
+    if (sscanf(state.c_str(), "CDAL state %d %d\n%n", &at, &row,
+               &consumed) != 2 ||
+        consumed == 0)
+        fail("malformed header");
+    position = consumed;
+}
+
+void resumePoint::fail(const std::string &problem) {
+    std::cerr << "ERROR, cannot resume: " << problem << std::endl;
+    abortRun();
+}
+
+char resumePoint::next(const char *name) {
+    size_t length = strlen(name);
+    if (state.compare(position, length, name) != 0 ||
+        position + length + 2 > state.size() ||
+        state[position + length] != ' ')
+        fail(std::string("expected the value of ") + name);
+    position += length + 2;
+    return state[position - 1];
+}
+
+void resumePoint::restore(int statement, const char *name, int &variable) {
+    if (!restores(statement)) return;
+    if (next(name) != 'n') fail(std::string(name) + " is not a number");
+    char *end;
+    variable = static_cast<int>(strtoll(state.c_str() + position, &end, 10));
+    position = end - state.c_str() + 1;
+}
+
+void resumePoint::restore(int statement, const char *name, float &variable) {
+    if (!restores(statement)) return;
+    if (next(name) != 'n') fail(std::string(name) + " is not a number");
+    char *end;
+    variable = static_cast<float>(strtod(state.c_str() + position, &end));
+    position = end - state.c_str() + 1;
+}
+
+void resumePoint::restore(int statement, const char *name, bool &variable) {
+    int value = 0;
+    restore(statement, name, value);
+    variable = value != 0;
+}
+
+void resumePoint::restore(int statement, const char *name,
+                          std::string &variable) {
+    if (!restores(statement)) return;
+    if (next(name) != 's') fail(std::string(name) + " is not a string");
+    char *end;
+    size_t length = strtoul(state.c_str() + position, &end, 10);
+    position = end - state.c_str() + 1;
+    if (position + length > state.size()) fail("truncated string");
+    variable = state.substr(position, length);
+    position += length + 1;
+}
+
+template <class T>
+basicMatrix<T> resumePoint::read(const char *name) {
+    if (next(name) != 'm') fail(std::string(name) + " is not a matrix");
+    position++;
+
+    binaryHeader header;
+    bool swapped;
+    std::string error;
+    if (!decodeHeader(state.data() + position, state.size() - position,
+                      header, swapped, error))
+        fail(error);
+    if (swapped || header.elementType != typeCode(T()))
+        fail(std::string(name) + " has another element type");
+
+    basicMatrix<T> m(header.rows, header.cols);
+    size_t size = static_cast<size_t>(header.rows) * header.cols;
+    if (size != 0)
+        memcpy(m[0], state.data() + position + header.payloadOffset,
+               size * sizeof(T));
+    position += header.payloadOffset + size * sizeof(T);
+    return m;
+}
+
+template basicMatrix<float> resumePoint::read(const char *);
+template basicMatrix<double> resumePoint::read(const char *);
+template basicMatrix<int32_t> resumePoint::read(const char *);
+template basicMatrix<int8_t> resumePoint::read(const char *);
+
+/*
+ * Library calls
+ * -------------
+ * A libraryCall points std::cout at a hostOutput, which hands what is
+ * printed to the host a buffer at a time, and std::cerr at a string that
+ * becomes the error of a failed call. abortRun throws runAborted, which
+ * libraryCall::run catches, so the host carries on after an error.
+ */
+
+namespace {
+
+static_assert(CDAL_FLOAT32 == float32Type && CDAL_FLOAT64 == float64Type &&
+                  CDAL_INT32 == int32Type && CDAL_INT8 == int8Type,
+              "cdal.h numbers element types as binary matrix files do");
+
+// thrown by abortRun to end a libraryCall
+struct runAborted {};
+
+template <class U>
+void convertInput(const cdal_matrix &input, matrix &m) {
+    m = matrix(input.rows, input.cols);
+    size_t size = static_cast<size_t>(input.rows) * input.cols;
+    const U *values = static_cast<const U *>(input.values);
+    float *out = size == 0 ? NULL : m[0];
+    for (size_t k = 0; k != size; k++) out[k] = static_cast<float>(values[k]);
+}
+
+}  // namespace
+
+void abortRun() {
+    if (libraryCall::active != NULL) throw runAborted();
+    exit(1);
+}
+
+class libraryCall::hostOutput : public std::streambuf {
+public:
+    explicit hostOutput(cdal_call *call) : call(call) {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+
+protected:
+    int overflow(int c) {
+        sync();
+        if (c == EOF) return 0;
+        *pptr() = static_cast<char>(c);
+        pbump(1);
+        return c;
+    }
+
+    int sync() {
+        if (pptr() != pbase() && call->print != NULL)
+            call->print(call->context, pbase(), pptr() - pbase());
+        setp(buffer, buffer + sizeof(buffer));
+        return 0;
+    }
+
+private:
+    cdal_call *call;
+    char buffer[1 << 14];
+};
+
+libraryCall *libraryCall::active = NULL;
+
+libraryCall::libraryCall(cdal_call *call)
+    : call(call),
+      printed(new hostOutput(call)),
+      savedOut(std::cout.rdbuf(printed)),
+      savedErr(std::cerr.rdbuf()),
+      errors(new std::stringbuf) {
+    std::cerr.rdbuf(errors);
+    active = this;
+}
+
+libraryCall::~libraryCall() {
+    std::cout.flush();
+    std::cout.rdbuf(savedOut);
+    std::cerr.rdbuf(savedErr);
+    active = NULL;
+    delete printed;
+    delete errors;
+}
+
+int libraryCall::run(void (*program)()) {
+    int status = 0;
+    try {
+        if (call->version != CDAL_ABI_VERSION) {
+            std::cerr << "ERROR, the host was built for version "
+                      << call->version << " of cdal.h rather than "
+                      << CDAL_ABI_VERSION << std::endl;
+            abortRun();
+        }
+        program();
+    } catch (const runAborted &) {
+        status = 1;
+    } catch (const std::exception &e) {
+        std::cerr << "ERROR, " << e.what() << std::endl;
+        status = 1;
+    }
+    std::cout.flush();
+
+    std::string error = static_cast<std::stringbuf *>(errors)->str();
+    while (!error.empty() && error[error.size() - 1] == '\n')
+        error.erase(error.size() - 1);
+    snprintf(call->error, sizeof(call->error), "%s",
+             status == 0 ? "" : error.c_str());
+    return status;
+}
+
+bool libraryCall::read(const char *name, matrix &m) {
+    if (active == NULL) return false;
+    const cdal_call *call = active->call;
+    for (int k = 0; k < call->num_inputs; k++) {
+        const cdal_matrix &input = call->inputs[k];
+        if (input.name == NULL || strcmp(input.name, name) != 0) continue;
+        switch (input.element_type) {
+            case CDAL_FLOAT32: convertInput<float>(input, m); break;
+            case CDAL_FLOAT64: convertInput<double>(input, m); break;
+            case CDAL_INT32: convertInput<int32_t>(input, m); break;
+            case CDAL_INT8: convertInput<int8_t>(input, m); break;
+            default:
+                std::cerr << "ERROR, input " << name
+                          << " has unknown element type "
+                          << input.element_type << std::endl;
+                abortRun();
+        }
+        return true;
+    }
+    return false;
+}
+
+template <class T>
+void libraryResult(const char *name, const basicMatrix<T> &m) {
+    cdal_call *call = libraryCall::active == NULL ? NULL
+                                                  : libraryCall::active->call;
+    if (call == NULL || call->result == NULL) return;
+    cdal_matrix result;
+    result.name = name;
+    result.element_type = typeCode(T());
+    result.rows = m.numRows();
+    result.cols = m.numCols();
+    result.values = m.numRows() == 0 || m.numCols() == 0 ? NULL : m[0];
+    call->result(call->context, &result);
+}
+
+template void libraryResult(const char *, const basicMatrix<float> &);
+template void libraryResult(const char *, const basicMatrix<double> &);
+template void libraryResult(const char *, const basicMatrix<int32_t> &);
+template void libraryResult(const char *, const basicMatrix<int8_t> &);
+
+/*
+ * Profiling
+ * ---------
+ * The sites being timed are kept on a stack. Leaving one adds its time to
+ * its total, and to the time spent within the site below it, which leaves
+ * that out of its self time. Cycles come from the time stamp counter where
+ * there is one, and are converted to time by comparing the cycles and the
+ * steady clock time the whole run took.
+ *
+ * Hardware counters are opened as one perf_event group, counting in user
+ * space, so that one read of the group gives all of them at once. They
+ * are inherited by the threads the program starts after they are opened,
+ * which are the workers of forRowBands and the threads reading matrix
+ * files, and reading them sums what every one of those threads counted.
+ * Where the kernel does not read inherited counters as a group, each is
+ * opened and read on its own, and where it does not inherit them at all,
+ * they count only the thread running the program, which the report says.
+ * A counter the kernel or the machine refuses is left out. When there are
+ * more counters than the machine counts at once, the kernel takes turns
+ * with them, and each count is scaled up by the time it was enabled over
+ * the time it ran.
+ *
+ * A site adds what they counted while it was active to its counts,
+ * including what the sites within it counted: a comprehension is charged
+ * for everything its body does, and a product for the workers computing
+ * its bands. A thread reading a file while the program runs is charged to
+ * whatever site is active then.
+ */
+
+namespace {
+
+// a site being timed
+struct activeSite {
+    profileSite *site;
+    unsigned long long start;
+    // cycles spent in the sites within it so far
+    unsigned long long within;
+    unsigned long long startCounts[numProfileCounters];
+};
+
+// the events counted for each profileCounter
+const unsigned long long counterEvents[numProfileCounters] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+// whether any counters are open, and whether they count the threads the
+// program starts
+bool countersOpen = false;
+bool countingThreads = false;
+
+// the descriptor of each counter, or -1 if it is not counted, and of the
+// group they are read as, or -1 when they are read one by one
+int counterFds[numProfileCounters] = {-1, -1, -1, -1};
+int counterGroup = -1;
+
+// where each counter is in what reading the group gives, or -1 if it is
+// not counted
+int counterSlots[numProfileCounters] = {-1, -1, -1, -1};
+
+// a count scaled up for the time the kernel left the counter out
+unsigned long long scaled(unsigned long long value, unsigned long long enabled,
+                          unsigned long long running) {
+    if (running == 0) return 0;
+    if (running >= enabled) return value;
+    return static_cast<unsigned long long>(double(value) * enabled / running);
+}
+
+/**
+ * read what the counters counted so far
+ * @return false if the kernel would not read them
+ */
+bool readCounters(unsigned long long counts[numProfileCounters]) {
+    std::fill(counts, counts + numProfileCounters, 0ULL);
+    if (counterGroup >= 0) {
+        // the number of counters in the group, the times it was enabled and
+        // running, then their values
+        unsigned long long group[3 + numProfileCounters] = {0};
+        if (read(counterGroup, group, sizeof(group)) < 0) return false;
+        for (int k = 0; k != numProfileCounters; k++)
+            if (counterSlots[k] >= 0 &&
+                static_cast<unsigned long long>(counterSlots[k]) < group[0])
+                counts[k] = scaled(group[3 + counterSlots[k]], group[1],
+                                   group[2]);
+        return true;
+    }
+    for (int k = 0; k != numProfileCounters; k++) {
+        // the value, then the times the counter was enabled and running
+        unsigned long long one[3] = {0};
+        if (counterFds[k] < 0) continue;
+        if (read(counterFds[k], one, sizeof(one)) < 0) return false;
+        counts[k] = scaled(one[0], one[1], one[2]);
+    }
+    return true;
+}
+
+void closeCounters() {
+    for (int k = 0; k != numProfileCounters; k++) {
+        if (counterFds[k] >= 0) close(counterFds[k]);
+        counterFds[k] = -1;
+        counterSlots[k] = -1;
+    }
+    counterGroup = -1;
+    countersOpen = false;
+}
+
+/**
+ * open the counters, as one group or one by one, inherited by the threads
+ * the program starts or not
+ * @return why none could be opened or read, or 0 if some could
+ */
+int openCounterSet(bool grouped, bool inherited) {
+    int error = 0, opened = 0;
+    for (int k = 0; k != numProfileCounters; k++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = counterEvents[k];
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING |
+                           (grouped ? PERF_FORMAT_GROUP : 0);
+        attr.inherit = inherited;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = syscall(__NR_perf_event_open, &attr, 0, -1,
+                         grouped ? counterGroup : -1, 0);
+        if (fd < 0) {
+            if (error == 0) error = errno;
+            continue;
+        }
+        if (grouped && counterGroup < 0) counterGroup = fd;
+        counterFds[k] = fd;
+        counterSlots[k] = opened++;
+    }
+    countersOpen = opened != 0;
+    unsigned long long counts[numProfileCounters];
+    if (countersOpen && readCounters(counts)) return 0;
+    if (countersOpen) error = errno;
+    closeCounters();
+    return error;
+}
+
+/**
+ * open the counters
+ * @return why none could be opened, or the empty string if some were
+ */
+std::string openCounters() {
+    int error = openCounterSet(true, true);
+    if (error != 0) error = openCounterSet(false, true);
+    countingThreads = error == 0;
+    if (error != 0) error = openCounterSet(true, false);
+    if (error == 0) return "";
+    if (error == EACCES || error == EPERM)
+        return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+    if (error == ENOENT || error == EOPNOTSUPP || error == ENOSYS)
+        return "not supported on this machine";
+    return strerror(error);
+}
+
+// a rate printed in a column of the report, or "-" if it is not known
+std::string rateColumn(int width, bool known, double rate) {
+    char column[32];
+    if (known)
+        snprintf(column, sizeof(column), "%*.2f", width, rate);
+    else
+        snprintf(column, sizeof(column), "%*s", width, "-");
+    return column;
+}
+
+thread_local std::vector<activeSite> activeSites;
+
+unsigned long long cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+long long nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+bool moreSelfTime(const profileSite *a, const profileSite *b) {
+    return a->self > b->self;
+}
+
+}  // namespace
+
+void profileEnter(profileSite &site) {
+    activeSite active = {&site, 0, 0, {0}};
+    activeSites.push_back(active);
+    if (countersOpen) readCounters(activeSites.back().startCounts);
+    activeSites.back().start = cycles();
+}
+
+void profileLeave() {
+    unsigned long long now = cycles();
+    activeSite &active = activeSites.back();
+    if (countersOpen) {
+        unsigned long long counts[numProfileCounters];
+        readCounters(counts);
+        for (int k = 0; k != numProfileCounters; k++)
+            active.site->counts[k] += counts[k] - active.startCounts[k];
+    }
+    unsigned long long elapsed = now - active.start;
+    active.site->calls++;
+    active.site->total += elapsed;
+    active.site->self += elapsed - active.within;
+    activeSites.pop_back();
+    if (!activeSites.empty()) activeSites.back().within += elapsed;
+}
+
+profileReport::profileReport(profileSite *sites, int count)
+    : sites(sites),
+      count(count),
+      counting(getenv("CDAL_COUNTERS") != NULL),
+      startCycles(cycles()),
+      startTime(nanoseconds()) {
+    if (counting) countersMissing = openCounters();
+}
+
+profileReport::~profileReport() {
+    double elapsed = (nanoseconds() - startTime) / 1e6;
+    double msPerCycle = elapsed / std::max(1.0, double(cycles() - startCycles));
+
+    std::vector<const profileSite *> ran;
+    for (int k = 0; k != count; k++)
+        if (sites[k].calls != 0) ran.push_back(&sites[k]);
+    std::stable_sort(ran.begin(), ran.end(), moreSelfTime);
+
+    std::ofstream file;
+    const char *filename = getenv("CDAL_PROFILE");
+    if (filename != NULL) file.open(filename);
+    std::ostream &os = file.is_open() ? file : std::cerr;
+    char line[64];
+    snprintf(line, sizeof(line), "%.3f", elapsed);
+    os << "CDAL profile: " << line << " ms in all\n";
+    if (counting && !countersOpen)
+        os << "CDAL profile: no hardware counters, " << countersMissing
+           << "\n";
+    if (countersOpen && !countingThreads)
+        os << "CDAL profile: hardware counters count only the thread "
+              "running the program\n";
+    bool counted = countersOpen;
+    os << "       calls    total ms     self ms"
+       << (counted ? "     IPC  LLC miss/ki  br miss/ki" : "") << "  site\n";
+    for (size_t k = 0; k != ran.size(); k++) {
+        snprintf(line, sizeof(line), "%12llu %11.3f %11.3f", ran[k]->calls,
+                 ran[k]->total * msPerCycle, ran[k]->self * msPerCycle);
+        os << line;
+        if (counted) {
+            // rates over what each site counted, with the sites within it
+            const unsigned long long *counts = ran[k]->counts;
+            double kiloInstructions = counts[instructionsCounted] / 1e3;
+            bool instructions = counterSlots[instructionsCounted] >= 0 &&
+                                kiloInstructions > 0;
+            os << rateColumn(8, instructions &&
+                                    counterSlots[cyclesCounted] >= 0 &&
+                                    counts[cyclesCounted] > 0,
+                             counts[instructionsCounted] /
+                                 double(counts[cyclesCounted]))
+               << rateColumn(13, instructions &&
+                                     counterSlots[cacheMissesCounted] >= 0,
+                             counts[cacheMissesCounted] / kiloInstructions)
+               << rateColumn(12, instructions &&
+                                     counterSlots[branchMissesCounted] >= 0,
+                             counts[branchMissesCounted] / kiloInstructions);
+        }
+        os << "  " << ran[k]->kind << " ";
+        if (ran[k]->location[0] != '\0') os << ran[k]->location << " ";
+        os << ran[k]->source << "\n";
+    }
+    os.flush();
+}
+
+/*
+ * Memory accounting
+ * -----------------
+ * Every buffer allocateValues hands out is counted with relaxed atomics,
+ * so that counting costs little on any thread: the bytes matrices asked
+ * for now and at most, the number of buffers, and how many there were of
+ * each power of two size. What the process really takes is counted too:
+ * the bytes the buffers were allocated with, rounded up to their class or
+ * to huge pages, and the bytes of freed buffers the caches of the threads
+ * keep for reuse, which no matrix holds, and the most those two took at
+ * once. Matrices mapped from files take no buffer.
+ *
+ * Setting the environment variable CDAL_MEMORY also tags each buffer with
+ * the innermost profiling site active on the thread allocating it, in a
+ * translation made for profiling (see profileSite), so that the report
+ * says which declarations and kernels hold the memory. The report is
+ * written when the program exits and whenever it gets SIGUSR1, appended
+ * to the file CDAL_MEMORY names, or written on stderr when it is "-" or
+ * empty. The handler of SIGUSR1, on whichever thread gets it, only writes
+ * to a pipe that a thread of the runtime waits on to write the report,
+ * so that threads a host started before loading the runtime need not
+ * block the signal. A host that handles SIGUSR1 itself keeps its handler,
+ * and then the report is only written at exit.
+ */
+
+namespace {
+
+std::atomic<unsigned long long> liveBytes(0);
+std::atomic<unsigned long long> peakBytes(0);
+std::atomic<unsigned long long> bufferBytes(0);
+std::atomic<unsigned long long> cachedBytes(0);
+std::atomic<unsigned long long> peakHeldBytes(0);
+std::atomic<unsigned long long> allocations(0);
+std::atomic<unsigned long long> sizeCounts[64];
+
+// the k such that bytes is more than 2^(k-1) and at most 2^k
+int sizeBucket(size_t bytes) {
+    int k = 0;
+    while (k < 63 && (static_cast<size_t>(1) << k) < bytes) k++;
+    return k;
+}
+
+// raise a peak to at least value
+void raisePeak(std::atomic<unsigned long long> &peak,
+               unsigned long long value) {
+    unsigned long long old = peak.load(std::memory_order_relaxed);
+    while (value > old &&
+           !peak.compare_exchange_weak(old, value, std::memory_order_relaxed))
+        ;
+}
+
+// what the buffers tagged with a site hold
+struct siteMemory {
+    unsigned long long allocations;
+    unsigned long long liveBytes;
+    unsigned long long peakBytes;
+};
+
+bool moreAtPeak(const std::pair<const profileSite *, siteMemory> &a,
+                const std::pair<const profileSite *, siteMemory> &b) {
+    return a.second.peakBytes > b.second.peakBytes;
+}
+
+// a size as the report gives it
+std::string sizeText(unsigned long long bytes) {
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    int unit = 0;
+    while (unit < 4 && bytes >= 1024 && bytes % 1024 == 0) {
+        bytes /= 1024;
+        unit++;
+    }
+    return std::to_string(bytes) + " " + units[unit];
+}
+
+// the pipe the handler of SIGUSR1 asks for a report through
+int reportPipe[2] = {-1, -1};
+
+void requestReport(int) {
+    int saved = errno;
+    char request = 'r';
+    ssize_t written = write(reportPipe[1], &request, 1);
+    (void)written;
+    errno = saved;
+}
+
+/**
+ * the sites buffers are tagged with, and the report, when CDAL_MEMORY is
+ * set; made before main, with the thread that writes the report when
+ * SIGUSR1 asks for it, which is stopped before the accounting goes
+ */
+class memoryAccounting {
+public:
+    memoryAccounting() : tagging(false), handling(false) {
+        const char *setting = getenv("CDAL_MEMORY");
+        if (setting == NULL) return;
+        destination = setting;
+        tagging = true;
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = requestReport;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGUSR1, NULL, &previous) != 0 ||
+            previous.sa_handler != SIG_DFL || pipe(reportPipe) != 0)
+            return;
+        fcntl(reportPipe[1], F_SETFL, O_NONBLOCK);
+        reporter = std::thread([]() {
+            char request;
+            for (;;) {
+                ssize_t n = read(reportPipe[0], &request, 1);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0 || request != 'r') return;
+                writeReport();
+            }
+        });
+        sigaction(SIGUSR1, &action, NULL);
+        handling = true;
+    }
+
+    ~memoryAccounting() {
+        if (handling) {
+            sigaction(SIGUSR1, &previous, NULL);
+            char stop = 's';
+            while (write(reportPipe[1], &stop, 1) < 0 && errno == EINTR)
+                ;
+            reporter.join();
+            close(reportPipe[0]);
+            close(reportPipe[1]);
+            handling = false;
+        }
+        if (!tagging) return;
+        writeReport();
+        tagging = false;
+    }
+
+    void tag(void *values, size_t bytes) {
+        const profileSite *site =
+            activeSites.empty() ? NULL : activeSites.back().site;
+        std::lock_guard<std::mutex> lock(m);
+        buffers[values] = site;
+        siteMemory &memory = sites[site];
+        memory.allocations++;
+        memory.liveBytes += bytes;
+        memory.peakBytes = std::max(memory.peakBytes, memory.liveBytes);
+    }
+
+    void untag(void *values, size_t bytes) {
+        std::lock_guard<std::mutex> lock(m);
+        std::unordered_map<void *, const profileSite *>::iterator it =
+            buffers.find(values);
+        if (it == buffers.end()) return;
+        sites[it->second].liveBytes -= bytes;
+        buffers.erase(it);
+    }
+
+    // what the buffers tagged with each site hold, the most at peak first
+    std::vector<std::pair<const profileSite *, siteMemory> > bySite() {
+        std::lock_guard<std::mutex> lock(m);
+        std::vector<std::pair<const profileSite *, siteMemory> > memory(
+            sites.begin(), sites.end());
+        std::stable_sort(memory.begin(), memory.end(), moreAtPeak);
+        return memory;
+    }
+
+    // write the report where CDAL_MEMORY says
+    static void writeReport();
+
+    std::atomic<bool> tagging;
+    std::string destination;
+
+private:
+    // whether SIGUSR1 asks the reporter for a report, and what it did
+    // before
+    bool handling;
+    struct sigaction previous;
+    std::thread reporter;
+
+    std::mutex m;
+    std::map<const profileSite *, siteMemory> sites;
+    // the site each live tagged buffer was allocated at
+    std::unordered_map<void *, const profileSite *> buffers;
+};
+
+memoryAccounting accounting;
+
+void memoryAccounting::writeReport() {
+    if (accounting.destination.empty() || accounting.destination == "-") {
+        writeMemoryReport(std::cerr);
+        std::cerr.flush();
+        return;
+    }
+    std::ofstream file(accounting.destination.c_str(), std::ofstream::app);
+    writeMemoryReport(file);
+}
+
+void noteAllocation(void *values, size_t bytes, size_t size, bool cached) {
+    unsigned long long live =
+        liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    raisePeak(peakBytes, live);
+    unsigned long long held =
+        bufferBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    if (cached)
+        held += cachedBytes.fetch_sub(size, std::memory_order_relaxed) - size;
+    else
+        held += cachedBytes.load(std::memory_order_relaxed);
+    raisePeak(peakHeldBytes, held);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    sizeCounts[sizeBucket(bytes)].fetch_add(1, std::memory_order_relaxed);
+    if (accounting.tagging.load(std::memory_order_relaxed))
+        accounting.tag(values, bytes);
+}
+
+void noteRelease(void *values, size_t bytes, size_t size, bool cached) {
+    liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    if (cached) cachedBytes.fetch_add(size, std::memory_order_relaxed);
+    bufferBytes.fetch_sub(size, std::memory_order_relaxed);
+    if (accounting.tagging.load(std::memory_order_relaxed))
+        accounting.untag(values, bytes);
+}
+
+void noteCacheFreed(size_t size) {
+    cachedBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+memoryStats matrixMemoryStats() {
+    memoryStats stats;
+    stats.liveBytes = liveBytes.load(std::memory_order_relaxed);
+    stats.peakBytes = peakBytes.load(std::memory_order_relaxed);
+    stats.bufferBytes = bufferBytes.load(std::memory_order_relaxed);
+    stats.cachedBytes = cachedBytes.load(std::memory_order_relaxed);
+    stats.peakHeldBytes = peakHeldBytes.load(std::memory_order_relaxed);
+    stats.allocations = allocations.load(std::memory_order_relaxed);
+    for (int k = 0; k != 64; k++)
+        stats.sizes[k] = sizeCounts[k].load(std::memory_order_relaxed);
+    return stats;
+}
+
+void writeMemoryReport(std::ostream &os) {
+    memoryStats stats = matrixMemoryStats();
+    os << "CDAL memory: " << stats.allocations << " allocations, "
+       << stats.liveBytes << " bytes live, " << stats.peakBytes
+       << " bytes at peak\n"
+       << "CDAL memory: " << stats.bufferBytes << " bytes in buffers, "
+       << stats.cachedBytes << " bytes cached, " << stats.peakHeldBytes
+       << " bytes held at peak\n"
+       << "       count  size up to\n";
+    char line[64];
+    for (int k = 0; k != 64; k++) {
+        if (stats.sizes[k] == 0) continue;
+        snprintf(line, sizeof(line), "%12llu  ", stats.sizes[k]);
+        os << line << sizeText(1ULL << k) << "\n";
+    }
+    if (!accounting.tagging) return;
+
+    std::vector<std::pair<const profileSite *, siteMemory> > sites =
+        accounting.bySite();
+    os << " allocations      peak bytes      live bytes  site\n";
+    for (size_t k = 0; k != sites.size(); k++) {
+        const siteMemory &memory = sites[k].second;
+        snprintf(line, sizeof(line), "%12llu %15llu %15llu  ",
+                 memory.allocations, memory.peakBytes, memory.liveBytes);
+        os << line;
+        const profileSite *site = sites[k].first;
+        if (site == NULL) {
+            os << "-\n";
+            continue;
+        }
+        os << site->kind << " ";
+        if (site->location[0] != '\0') os << site->location << " ";
+        os << site->source << "\n";
+    }
+}
+
+/*
+ * Streaming matrices
+ * ------------------
+ * A matrixStream keeps two bands of rows. The consumer reads rows from one
+ * band while the reader thread fills the other with the rows that follow;
+ * when the consumer moves past its band, it hands the band back to the
+ * reader.
+ */
+
+// bands are sized to hold about this many bytes
+const size_t streamBandBytes = 8 << 20;
+
+// text files are read in chunks of this many bytes
+const size_t streamChunkBytes = 1 << 20;
+
+struct matrixStream::reader {
+    std::string filename;
+    int fd;
+    int rows;
+    int cols;
+    int bandRows;
+
+    // binary files, and the raw values of a band of another element
+    // type than float32
+    bool binary;
+    bool swapped;
+    uint32_t elementType;
+    uint32_t elementSize;
+    uint64_t payloadOffset;
+    std::vector<char> raw;
+
+    // text files: the unparsed text in buffer[begin, end)
+    std::vector<char> buffer;
+    size_t begin;
+    size_t end;
+    bool eof;
+    int line;
+
+    // the two bands and who holds them
+    std::vector<float> values[2];
+    int first[2];
+    int count[2];
+    bool full[2];
+    int current;
+    int released;
+    int nextRow;
+
+    std::string error;
+    bool stop;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread worker;
+
+    /**
+     * find the next whitespace separated token of a text file, reading
+     * more of the file when needed
+     * @return false at the end of the file
+     */
+    bool nextToken(const char *&tokenBegin, const char *&tokenEnd) {
+        while (true) {
+            while (begin != end && isSpace(buffer[begin])) {
+                if (buffer[begin] == '\n') line++;
+                begin++;
+            }
+            if (begin != end) {
+                size_t t = begin;
+                while (t != end && !isSpace(buffer[t])) t++;
+                if (t != end || eof) {
+                    tokenBegin = &buffer[0] + begin;
+                    tokenEnd = &buffer[0] + t;
+                    begin = t;
+                    return true;
+                }
+            } else if (eof) {
+                return false;
+            }
+
+            // keep the partial token and read more after it
+            size_t kept = end - begin;
+            memmove(&buffer[0], &buffer[0] + begin, kept);
+            begin = 0;
+            end = kept;
+            if (buffer.size() - end < streamChunkBytes)
+                buffer.resize(end + streamChunkBytes);
+            ssize_t n = read(fd, &buffer[0] + end, buffer.size() - end);
+            if (n <= 0)
+                eof = true;
+            else
+                end += n;
+        }
+    }
+
+    /**
+     * read rows [firstRow, firstRow + numRows) into band; called by the
+     * reader thread without holding the lock
+     * @return false with failure set if they cannot be read
+     */
+    bool readBand(std::vector<float> &band, int firstRow, int numRows,
+                  std::string &failure) {
+        size_t size = static_cast<size_t>(numRows) * cols;
+        if (binary) {
+            bool converted = elementType != float32Type;
+            if (converted) raw.resize(size * elementSize);
+            char *p = converted ? &raw[0] : reinterpret_cast<char *>(&band[0]);
+            size_t length = size * elementSize;
+            off_t offset = payloadOffset + static_cast<uint64_t>(firstRow) *
+                                               cols * elementSize;
+            while (length > 0) {
+                ssize_t n = pread(fd, p, length, offset);
+                if (n <= 0) {
+                    failure = "the file is shorter than its header says";
+                    return false;
+                }
+                p += n;
+                offset += n;
+                length -= n;
+            }
+            if (converted) {
+                convertPayload(&raw[0], size, elementType, swapped, &band[0]);
+            } else if (swapped) {
+                uint32_t *words = reinterpret_cast<uint32_t *>(&band[0]);
+                for (size_t k = 0; k != size; k++)
+                    words[k] = swapBytes(words[k]);
+            }
+            return true;
+        }
+
+        const char *tokenBegin, *tokenEnd;
+        for (int i = 0; i != numRows; i++)
+            for (int j = 0; j != cols; j++) {
+                float &value = band[static_cast<size_t>(i) * cols + j];
+                bool found = nextToken(tokenBegin, tokenEnd);
+                if (!found || parseFloat(tokenBegin, tokenEnd, value) == NULL) {
+                    std::stringstream expected;
+                    expected << "the value at row " << firstRow + i + 1
+                             << ", column " << j + 1;
+                    if (!found) tokenBegin = tokenEnd = NULL;
+                    failure = describeError(line, tokenBegin, tokenEnd,
+                                            expected.str());
+                    return false;
+                }
+            }
+
+        if (firstRow + numRows == rows && nextToken(tokenBegin, tokenEnd)) {
+            failure =
+                describeError(line, tokenBegin, tokenEnd, "no more values");
+            return false;
+        }
+        return true;
+    }
+
+    // a band that is neither held by the consumer nor waiting for it
+    int freeBand() {
+        for (int b = 0; b != 2; b++)
+            if (!full[b] && b != current) return b;
+        return -1;
+    }
+
+    // the reader thread
+    void run() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            while (!stop && (nextRow == rows || freeBand() < 0))
+                changed.wait(guard);
+            if (stop) return;
+
+            int b = freeBand();
+            int firstRow = nextRow;
+            int numRows = rows - firstRow < bandRows ? rows - firstRow
+                                                     : bandRows;
+            guard.unlock();
+            std::string failure;
+            bool ok = readBand(values[b], firstRow, numRows, failure);
+            guard.lock();
+
+            if (!ok) {
+                error = failure;
+                changed.notify_all();
+                return;
+            }
+            first[b] = firstRow;
+            count[b] = numRows;
+            full[b] = true;
+            nextRow += numRows;
+            changed.notify_all();
+        }
+    }
+};
+
+matrixStream::matrixStream(const char *filename, int bandRows) {
+    open(filename, bandRows);
+}
+
+matrixStream::matrixStream(std::string &filename, int bandRows) {
+    open(filename.c_str(), bandRows);
+}
+
+void matrixStream::open(const char *filename, int bandRows) {
+    state = new reader();
+    reader &r = *state;
+    r.filename = filename;
+    r.fd = ::open(filename, O_RDONLY);
+    struct stat st;
+    if (r.fd < 0 || fstat(r.fd, &st) != 0) {
+        std::cerr << "ERROR, cannot open matrix file " << filename
+                  << std::endl;
+        abortRun();
+    }
+
+    // read the dimensions from the header
+    r.buffer.resize(streamChunkBytes);
+    ssize_t n = read(r.fd, &r.buffer[0], r.buffer.size());
+    r.begin = 0;
+    r.end = n > 0 ? n : 0;
+    r.eof = n <= 0;
+    r.line = 1;
+    r.binary = isBinary(&r.buffer[0], r.end);
+
+    std::string error;
+    if (r.binary) {
+        binaryHeader header;
+        if (decodeHeader(&r.buffer[0], st.st_size, header, r.swapped,
+                         error)) {
+            r.rows = static_cast<int>(header.rows);
+            r.cols = static_cast<int>(header.cols);
+            r.elementType = header.elementType;
+            r.elementSize = header.elementSize;
+            r.payloadOffset = header.payloadOffset;
+        }
+        std::vector<char>().swap(r.buffer);
+    } else {
+        const char *tokenBegin, *tokenEnd;
+        if (!r.nextToken(tokenBegin, tokenEnd) ||
+            parseInt(tokenBegin, tokenEnd, r.rows) == NULL || r.rows < 0) {
+            error = "expected the number of rows at line 1";
+        } else if (!r.nextToken(tokenBegin, tokenEnd) ||
+                   parseInt(tokenBegin, tokenEnd, r.cols) == NULL ||
+                   r.cols < 0) {
+            error = "expected the number of columns at line 1";
+        }
+    }
+    if (!error.empty()) {
+        std::cerr << "ERROR, malformed matrix file " << filename << ": "
+                  << error << std::endl;
+        abortRun();
+    }
+
+    rows = r.rows;
+    cols = r.cols;
+    if (bandRows <= 0) {
+        size_t rowBytes = cols > 0 ? cols * sizeof(float) : 1;
+        bandRows = static_cast<int>(streamBandBytes / rowBytes);
+        if (bandRows < 1) bandRows = 1;
+    }
+    r.bandRows = bandRows;
+    for (int b = 0; b != 2; b++) {
+        r.values[b].resize(static_cast<size_t>(bandRows) * cols + 1);
+        r.full[b] = false;
+    }
+    r.current = -1;
+    r.released = 0;
+    r.nextRow = 0;
+    r.stop = false;
+
+    bandValues = NULL;
+    bandFirst = 0;
+    bandCount = 0;
+    r.worker = std::thread(&reader::run, state);
+}
+
+matrixStream::~matrixStream() {
+    {
+        std::lock_guard<std::mutex> guard(state->lock);
+        state->stop = true;
+    }
+    state->changed.notify_all();
+    state->worker.join();
+    close(state->fd);
+    delete state;
+}
+
+int matrixStream::numRows() const { return rows; }
+
+int matrixStream::numCols() const { return cols; }
+
+const float *matrixStream::fetch(int row) {
+    reader &r = *state;
+    std::unique_lock<std::mutex> guard(r.lock);
+
+    if (row < 0 || row >= rows || row < r.released ||
+        (r.current >= 0 && row < r.first[r.current])) {
+        std::cerr << "ERROR, cannot access row " << row
+                  << " of streamed matrix " << r.filename
+                  << "; rows must be read in increasing order" << std::endl;
+        abortRun();
+    }
+
+    // hand the current band back to the reader
+    if (r.current >= 0) {
+        r.released = r.first[r.current] + r.count[r.current];
+        r.current = -1;
+        r.changed.notify_all();
+    }
+
+    while (true) {
+        // look at the waiting bands in row order
+        int b = -1;
+        for (int k = 0; k != 2; k++)
+            if (r.full[k] && (b < 0 || r.first[k] < r.first[b])) b = k;
+
+        if (b >= 0 && row < r.first[b] + r.count[b]) {
+            r.full[b] = false;
+            r.current = b;
+            bandValues = &r.values[b][0];
+            bandFirst = r.first[b];
+            bandCount = r.count[b];
+            return bandValues + static_cast<size_t>(row - bandFirst) * cols;
+        }
+        if (b >= 0) {
+            // skip a band the consumer has no use for
+            r.released = r.first[b] + r.count[b];
+            r.full[b] = false;
+            r.changed.notify_all();
+            continue;
+        }
+        if (!r.error.empty()) {
+            std::cerr << "ERROR, malformed matrix file " << r.filename << ": "
+                      << r.error << std::endl;
+            abortRun();
+        }
+        r.changed.wait(guard);
+    }
+}
+
+/*
+ * Sparse matrices
+ * ---------------
+ */
+
+sparseMatrix::sparseMatrix(int row, int col, sparseLayout layout)
+    : rows(row), cols(col), order(layout), lastGroup(-1) {
+    starts.resize((layout == compressedRows ? rows : cols) + 1, 0);
+}
+
+sparseMatrix::sparseMatrix(const matrix &m, sparseLayout layout)
+    : rows(m.numRows()), cols(m.numCols()), order(layout), lastGroup(-1) {
+    starts.resize((layout == compressedRows ? rows : cols) + 1, 0);
+    if (layout == compressedRows) {
+        for (int i = 0; i != rows; i++) {
+            const float *row = m[i];
+            for (int j = 0; j != cols; j++)
+                if (row[j] != 0) append(i, j, row[j]);
+        }
+    } else {
+        for (int j = 0; j != cols; j++)
+            for (int i = 0; i != rows; i++)
+                if (m[i][j] != 0) append(i, j, m[i][j]);
+    }
+}
+
+int sparseMatrix::numRows() const { return rows; }
+
+int sparseMatrix::numCols() const { return cols; }
+
+int sparseMatrix::numNonZeros() const { return size(); }
+
+sparseLayout sparseMatrix::layout() const { return order; }
+
+float sparseMatrix::at(int row, int col) const {
+    int k = outer(row, col);
+    const int *first = indices.data() + groupBegin(k);
+    const int *last = indices.data() + groupEnd(k);
+    const int *found = std::lower_bound(first, last, inner(row, col));
+    if (found == last || *found != inner(row, col)) return 0;
+    return values[found - indices.data()];
+}
+
+void sparseMatrix::append(int row, int col, float value) {
+    int k = outer(row, col);
+    int index = inner(row, col);
+    if (k < lastGroup || (k == lastGroup && groupEnd(k) != groupBegin(k) &&
+                          index <= indices.back())) {
+        std::cerr << "ERROR, sparse matrix elements appended out of order"
+                  << std::endl;
+        abortRun();
+    }
+    if (value == 0) return;
+
+    while (lastGroup < k) starts[++lastGroup] = size();
+    indices.push_back(index);
+    values.push_back(value);
+}
+
+matrix sparseMatrix::toDense() const {
+    matrix m(rows, cols);
+    for (int k = 0; k <= lastGroup; k++) {
+        for (int p = groupBegin(k); p != groupEnd(k); p++) {
+            if (order == compressedRows)
+                m[k][indices[p]] = values[p];
+            else
+                m[indices[p]][k] = values[p];
+        }
+    }
+    return m;
+}
+
+sparseMatrix sparseMatrix::toLayout(sparseLayout layout) const {
+    if (layout == order) return *this;
+
+    // count the values of each new group, then place them, visiting the
+    // old groups in order so each new group comes out sorted
+    int numGroups = layout == compressedRows ? rows : cols;
+    sparseMatrix t(rows, cols, layout);
+    std::vector<int> counts(numGroups + 1, 0);
+    for (int p = 0; p != size(); p++) counts[indices[p] + 1]++;
+    for (int k = 0; k != numGroups; k++) counts[k + 1] += counts[k];
+
+    t.starts = counts;
+    t.lastGroup = numGroups - 1;
+    t.indices.resize(size());
+    t.values.resize(size());
+    for (int k = 0; k <= lastGroup; k++) {
+        for (int p = groupBegin(k); p != groupEnd(k); p++) {
+            int q = counts[indices[p]]++;
+            t.indices[q] = k;
+            t.values[q] = values[p];
+        }
+    }
+    return t;
+}
+
+namespace {
+
+// the rows of a sparseMatrix in compressedRows layout, made dense one at
+// a time for writeText
+class denseRows {
+public:
+    explicit denseRows(const sparseMatrix &m)
+        : rows(m.toLayout(compressedRows)), row(m.numCols()) {}
+
+    int numRows() const { return rows.numRows(); }
+    int numCols() const { return rows.numCols(); }
+
+    const float *operator[](int i) const {
+        for (int j = 0; j != numCols(); j++) row[j] = rows.at(i, j);
+        return row.data();
+    }
+
+private:
+    sparseMatrix rows;
+    mutable std::vector<float> row;
+};
+
+// exit unless left and right have the same dimensions
+template <class leftMatrix, class rightMatrix>
+void checkSameSize(const leftMatrix &left, const rightMatrix &right) {
+    if (left.numRows() != right.numRows() ||
+        left.numCols() != right.numCols()) {
+        std::cerr << "ERROR, element-wise operation on " << left.numRows()
+                  << " x " << left.numCols() << " and " << right.numRows()
+                  << " x " << right.numCols() << " matrices" << std::endl;
+        abortRun();
+    }
+}
+
+
+}  // namespace
+
+std::ostream &operator<<(std::ostream &os, const sparseMatrix &m) {
+    if (printFormat() == binaryFormat)
+        matrixWrite(m.toDense(), os, binaryFormat);
+    else
+        writeText(os, denseRows(m));
+    return os;
+}
+
+matrix operator*(const sparseMatrix &left, const matrix &right) {
+    checkProductSize(left, right);
+    int n = right.numCols();
+    matrix result(left.rows, n);
+    for (int k = 0; k <= left.lastGroup; k++) {
+        for (int p = left.groupBegin(k); p != left.groupEnd(k); p++) {
+            // CSR: row k of the result gains value * row index of right;
+            // CSC: row index of the result gains value * row k of right
+            int i = left.order == compressedRows ? k : left.indices[p];
+            int r = left.order == compressedRows ? left.indices[p] : k;
+            float v = left.values[p];
+            float *out = result[i];
+            const float *in = right[r];
+            for (int j = 0; j != n; j++) out[j] += v * in[j];
+        }
+    }
+    return result;
+}
+
+matrix operator*(const matrix &left, const sparseMatrix &right) {
+    checkProductSize(left, right);
+    matrix result(left.numRows(), right.cols);
+    for (int i = 0; i != left.numRows(); i++) {
+        const float *in = left[i];
+        float *out = result[i];
+        for (int k = 0; k <= right.lastGroup; k++) {
+            if (right.order == compressedRows) {
+                // row k of right, scaled by left[i][k]
+                float a = in[k];
+                if (a == 0) continue;
+                for (int p = right.groupBegin(k); p != right.groupEnd(k); p++)
+                    out[right.indices[p]] += a * right.values[p];
+            } else {
+                // column k of right, dotted with row i of left
+                float sum = 0;
+                for (int p = right.groupBegin(k); p != right.groupEnd(k); p++)
+                    sum += in[right.indices[p]] * right.values[p];
+                out[k] = sum;
+            }
+        }
+    }
+    return result;
+}
+
+void sparseMatrix::addTo(matrix &m, float sign) const {
+    for (int k = 0; k <= lastGroup; k++) {
+        for (int p = groupBegin(k); p != groupEnd(k); p++) {
+            if (order == compressedRows)
+                m[k][indices[p]] += sign * values[p];
+            else
+                m[indices[p]][k] += sign * values[p];
+        }
+    }
+}
+
+matrix operator+(const sparseMatrix &left, const matrix &right) {
+    checkSameSize(left, right);
+    matrix result(right);
+    left.addTo(result, 1);
+    return result;
+}
+
+matrix operator+(const matrix &left, const sparseMatrix &right) {
+    return right + left;
+}
+
+matrix operator-(const sparseMatrix &left, const matrix &right) {
+    checkSameSize(left, right);
+    matrix result(right.numRows(), right.numCols());
+    for (int i = 0; i != result.numRows(); i++)
+        for (int j = 0; j != result.numCols(); j++)
+            result[i][j] = 0 - right[i][j];  // not -0 where right is 0
+    left.addTo(result, 1);
+    return result;
+}
+
+matrix operator-(const matrix &left, const sparseMatrix &right) {
+    checkSameSize(left, right);
+    matrix result(left);
+    right.addTo(result, -1);
+    return result;
+}
+
+sparseMatrix hadamard(const sparseMatrix &left, const matrix &right) {
+    checkSameSize(left, right);
+    sparseMatrix result(left.rows, left.cols, left.order);
+    for (int k = 0; k <= left.lastGroup; k++) {
+        for (int p = left.groupBegin(k); p != left.groupEnd(k); p++) {
+            int i = left.order == compressedRows ? k : left.indices[p];
+            int j = left.order == compressedRows ? left.indices[p] : k;
+            result.append(i, j, left.values[p] * right[i][j]);
+        }
+    }
+    return result;
+}
+
+sparseMatrix hadamard(const matrix &left, const sparseMatrix &right) {
+    return hadamard(right, left);
+}
+
+int numRows(matrix &m) { return m.numRows(); }
+
+int numCols(matrix &m) { return m.numCols(); }
+
+int numRows(matrixStream &m) { return m.numRows(); }
+
+int numCols(matrixStream &m) { return m.numCols(); }
+
+int numRows(sparseMatrix &m) { return m.numRows(); }
+
+int numCols(sparseMatrix &m) { return m.numCols(); }
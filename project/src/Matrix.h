@@ -1,47 +1,1447 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
 
-class matrix {
+/**
+ * the element types a basicMatrix can hold, and the types used when
+ * multiplying them. Integer products are summed in a wider type so that
+ * long dot products do not overflow part way; int8 products are kept as
+ * int32, since a single product of two int8 values needs 15 bits. An
+ * int32 product is summed in int64 but kept as int32, so an element whose
+ * sum is outside the range of int32 wraps around modulo 2^32.
+ */
+template <class T>
+struct elementTraits;
+
+template <>
+struct elementTraits<float> {
+    typedef float accumulator;
+    typedef float product;
+};
+
+template <>
+struct elementTraits<double> {
+    typedef double accumulator;
+    typedef double product;
+};
+
+template <>
+struct elementTraits<int32_t> {
+    typedef int64_t accumulator;
+    typedef int32_t product;
+};
+
+template <>
+struct elementTraits<int8_t> {
+    typedef int32_t accumulator;
+    typedef int32_t product;
+};
+
+/**
+ * storage for the values of matrices, taken from and returned to a cache
+ * of recently freed buffers kept by each thread; see "Allocating
+ * matrices" in Matrix.cpp. A buffer may be released by another thread
+ * than the one that allocated it.
+ * @param  bytes the size of the buffer
+ * @return       the buffer, or NULL if bytes is 0
+ */
+void *allocateValues(size_t bytes);
+
+/**
+ * give back a buffer from allocateValues
+ * @param values the buffer, or NULL
+ * @param bytes  the size it was allocated with
+ */
+void releaseValues(void *values, size_t bytes);
+
+/**
+ * how well the calling thread's cache of matrix storage is doing
+ */
+struct allocationStats {
+    // requests for storage, and how many were served by a cached buffer
+    unsigned long long requests;
+    unsigned long long hits;
+    // the size of the buffers kept for reuse
+    size_t cachedBytes;
+};
+
+allocationStats matrixAllocationStats();
+
+/**
+ * what the values of matrices take, over all threads; see "Memory
+ * accounting" in Matrix.cpp. Sizes are the bytes asked of allocateValues,
+ * but for those of the buffers and caches that hold them.
+ */
+struct memoryStats {
+    // bytes held by matrices now, and the most they held at once
+    unsigned long long liveBytes;
+    unsigned long long peakBytes;
+    // bytes the buffers of those matrices were allocated with, bytes of
+    // freed buffers kept for reuse, and the most both took at once
+    unsigned long long bufferBytes;
+    unsigned long long cachedBytes;
+    unsigned long long peakHeldBytes;
+    // buffers allocated since the program started
+    unsigned long long allocations;
+    // how many of those had more than 2^(k-1) and at most 2^k bytes
+    unsigned long long sizes[64];
+};
+
+memoryStats matrixMemoryStats();
+
+/**
+ * write what matrixMemoryStats returns, and with CDAL_MEMORY set what
+ * the buffers allocated at each profiling site hold, as the memory report
+ * written on exit and on SIGUSR1
+ */
+void writeMemoryReport(std::ostream &os);
+
+/**
+ * end the program after an error has been reported on std::cerr: the
+ * process exits with status 1, or, within a libraryCall, the call fails
+ */
+[[noreturn]] void abortRun();
+
+/**
+ * call work(first, last) on bands of the rows [0, rows) of a matrix of
+ * this many bytes, each band on a worker thread of its own when the
+ * matrix is large enough. The workers are kept for the life of the
+ * program, one per hardware thread, or as many as the environment
+ * variable CDAL_THREADS asks for; CDAL_THREADS=1 keeps all the work on
+ * the calling thread, as does a call made within work. The bands depend
+ * only on the number of rows and of threads, and band k always runs on
+ * worker k, so work on a matrix's rows runs on the threads whose writes
+ * first touched its pages.
+ */
+void forRowBands(int rows, size_t bytes,
+                 const std::function<void(int, int)> &work);
+
+/**
+ * A dense matrix of elements of type T: float, double, int32_t or int8_t.
+ * The members are defined in Matrix.cpp and instantiated there for those
+ * four types.
+ */
+template <class T>
+class basicMatrix {
 public:
-    matrix(int row, int col);
-    matrix(const matrix &m);
-    ~matrix();
+    typedef T element;
+
+    basicMatrix(int row, int col);
+    basicMatrix(const basicMatrix &m);
+    basicMatrix(basicMatrix &&m);
+    ~basicMatrix();
+
+    /**
+     * convert a matrix of another element type, element by element
+     */
+    template <class U>
+    explicit basicMatrix(const basicMatrix<U> &m)
+        : rows(m.numRows()), cols(m.numCols()), mapping(NULL),
+          mappingLength(0) {
+        size_t size = static_cast<size_t>(rows) * cols;
+        data = static_cast<T *>(allocateValues(size * sizeof(T)));
+        const U *values = size == 0 ? NULL : m[0];
+        for (size_t k = 0; k != size; k++)
+            data[k] = static_cast<T>(values[k]);
+    }
+
+    basicMatrix &operator=(basicMatrix m);
 
     int numRows() const;
     int numCols() const;
 
-    float *operator[](int row);
-
-    const float *operator[](int row) const;
+    T *operator[](int row);
 
-    friend std::ostream &operator<<(std::ostream &os, const matrix &m);
+    const T *operator[](int row) const;
 
-    friend matrix operator*(const matrix &left, const matrix &right);
+    friend class matrixFile;
+    template <class E, class U>
+    friend class matrixExpression;
 
 private:
     // we don't implement matrix() {} ??
-    matrix() {}
+    basicMatrix() {}
+
+    /**
+     * make a matrix whose values live in a file mapping, which is
+     * unmapped when the matrix is destroyed, or when map is NULL in
+     * uninitialized storage from allocateValues
+     */
+    basicMatrix(int row, int col, T *values, void *map, size_t mapLength);
+
     int rows;
     int cols;
 
-    /* Your implementation of "data" may vary.  There are ways in
-       which data can be an array of arrays and thus simplify the
-       access method, at the cost of complicating the process of
-       allocating space for data.  The choice is entirely up to
-       you. */
-    float **data;
+    /* The values are stored in one row-major block, so that a whole
+       matrix can be mapped straight from a binary matrix file. The
+       block either comes from allocateValues or, when mapping is not
+       NULL, lies inside a private file mapping of mappingLength bytes. */
+    T *data;
+    void *mapping;
+    size_t mappingLength;
+};
+
+// the matrix of the CDAL language, and of all generated code
+typedef basicMatrix<float> matrix;
+
+/**
+ * A view of part of a basicMatrix that shares its values rather than
+ * copying them: a block of it, a row, a column or its transpose. Element
+ * (i, j) of a view is at values + i * rowStride + j * colStride, so any
+ * view is made in constant time without allocating. The matrix must
+ * outlive its views, and writes through a view change the matrix.
+ */
+template <class T>
+class basicMatrixView {
+public:
+    typedef T element;
+
+    // a row of a view, indexed by column
+    class rowRef {
+    public:
+        rowRef(T *v, ptrdiff_t stride) : values(v), colStep(stride) {}
+
+        T &operator[](int col) const { return values[col * colStep]; }
+
+    private:
+        T *values;
+        ptrdiff_t colStep;
+    };
+
+    /**
+     * view a whole matrix
+     */
+    basicMatrixView(basicMatrix<T> &m)
+        : values(m[0]), rows(m.numRows()), cols(m.numCols()),
+          rowStep(m.numCols()), colStep(1) {}
+
+    basicMatrixView(T *v, int row, int col, ptrdiff_t rowStride,
+                    ptrdiff_t colStride)
+        : values(v), rows(row), cols(col), rowStep(rowStride),
+          colStep(colStride) {}
+
+    int numRows() const { return rows; }
+    int numCols() const { return cols; }
+    ptrdiff_t rowStride() const { return rowStep; }
+    ptrdiff_t colStride() const { return colStep; }
+
+    rowRef operator[](int row) const {
+        return rowRef(values + row * rowStep, colStep);
+    }
+
+    /**
+     * the first value of a row, whose values are next to each other when
+     * colStride() is 1
+     */
+    T *rowValues(int row) const { return values + row * rowStep; }
+
+    /**
+     * the block of numRows x numCols elements whose first element is
+     * (row, col), exiting with an error unless it lies inside this view
+     */
+    basicMatrixView block(int row, int col, int numRows, int numCols) const;
+
+    basicMatrixView row(int i) const { return block(i, 0, 1, cols); }
+    basicMatrixView column(int j) const { return block(0, j, rows, 1); }
+
+    basicMatrixView transposed() const {
+        return basicMatrixView(values, cols, rows, colStep, rowStep);
+    }
+
+    /**
+     * copy the viewed values into a matrix of their own
+     */
+    operator basicMatrix<T>() const;
+
+private:
+    T *values;
+    int rows;
+    int cols;
+    ptrdiff_t rowStep;
+    ptrdiff_t colStep;
+};
+
+typedef basicMatrixView<float> matrixView;
+
+/**
+ * the rows firstRow to lastRow and columns firstCol to lastCol of a
+ * matrix, both ranges inclusive like those of CDAL's repeat ... to
+ */
+template <class T>
+basicMatrixView<T> slice(basicMatrix<T> &m, int firstRow, int lastRow,
+                         int firstCol, int lastCol) {
+    return basicMatrixView<T>(m).block(firstRow, firstCol,
+                                       lastRow - firstRow + 1,
+                                       lastCol - firstCol + 1);
+}
+
+template <class T>
+basicMatrixView<T> transpose(basicMatrix<T> &m) {
+    return basicMatrixView<T>(m).transposed();
+}
+
+template <class T>
+basicMatrixView<T> transpose(const basicMatrixView<T> &v) {
+    return v.transposed();
+}
+
+/**
+ * a slice or transpose of a constant or temporary matrix, such as one made
+ * dense from a sparseMatrix, which may not outlive a view of it, so the
+ * viewed values are copied
+ */
+template <class T>
+basicMatrix<T> slice(const basicMatrix<T> &m, int firstRow, int lastRow,
+                     int firstCol, int lastCol) {
+    return basicMatrixView<T>(const_cast<basicMatrix<T> &>(m))
+        .block(firstRow, firstCol, lastRow - firstRow + 1,
+               lastCol - firstCol + 1);
+}
+
+template <class T>
+basicMatrix<T> transpose(const basicMatrix<T> &m) {
+    return basicMatrixView<T>(const_cast<basicMatrix<T> &>(m)).transposed();
+}
+
+/**
+ * a view of a whole matrix for code that only reads it
+ */
+template <class T>
+basicMatrixView<T> wholeView(const basicMatrix<T> &m) {
+    return basicMatrixView<T>(const_cast<T *>(m[0]), m.numRows(),
+                              m.numCols(), m.numCols(), 1);
+}
+
+template <class T>
+std::ostream &operator<<(std::ostream &os, const basicMatrix<T> &m);
+
+template <class T>
+std::ostream &operator<<(std::ostream &os, const basicMatrixView<T> &v);
+
+/**
+ * Products of matrices, and their element-wise sums, differences,
+ * products and quotients with each other and with scalars, are not
+ * computed by their operators, which build an expression object instead.
+ * The expression is evaluated a row at a time when it is converted to a
+ * matrix: each row of a product is summed and then has the other operands
+ * added to or subtracted from it while it is still in cache, so
+ * m1 * m2 + m3 - m4 makes one pass over its operands and one matrix
+ * rather than three. Large results are evaluated in bands of rows on
+ * several threads. The expression is prepared once, and each band copies
+ * it only for its own scratch rows, sharing the prepared operands.
+ * Expressions refer to their operands rather than copying them, so they
+ * are to be evaluated, as by assigning them to a matrix, in the statement
+ * that makes them.
+ *
+ * E is the type of the expression and T the type of its elements. Every
+ * expression has numRows(), numCols(), prepare(), which makes what its
+ * rows read before the first one, and rowInto(i, out), which writes row i
+ * to out. Copies of a prepared expression share what prepare() made.
+ */
+template <class E, class T>
+class matrixExpression {
+public:
+    typedef T element;
+
+    /**
+     * evaluate the expression
+     */
+    operator basicMatrix<T>() const {
+        const E &e = static_cast<const E &>(*this);
+        size_t bytes = static_cast<size_t>(e.numRows()) * e.numCols() *
+                       sizeof(T);
+        basicMatrix<T> m(e.numRows(), e.numCols(),
+                         static_cast<T *>(allocateValues(bytes)), NULL, 0);
+        basicMatrix<T> *result = &m;
+        e.prepare();
+        forRowBands(e.numRows(), bytes, [&e, result](int first, int last) {
+            E band(e);
+            for (int i = first; i != last; i++) band.rowInto(i, (*result)[i]);
+        });
+        return m;
+    }
+
+    /**
+     * row i, computed when it is indexed, so that (a * b)[i][j] computes
+     * one row of the product rather than all of it
+     */
+    std::vector<T> operator[](int i) const {
+        std::vector<T> row;
+        rowValues(i, row);
+        return row;
+    }
+
+    /**
+     * the values of row i, computed in buffer
+     */
+    const T *rowValues(int i, std::vector<T> &buffer) const {
+        const E &e = static_cast<const E &>(*this);
+        buffer.resize(e.numCols());
+        e.rowInto(i, buffer.data());
+        return buffer.data();
+    }
+};
+
+template <class E, class T>
+std::ostream &operator<<(std::ostream &os, const matrixExpression<E, T> &e) {
+    return os << basicMatrix<T>(e);
+}
+
+/**
+ * how a product of float or double matrices is computed. The standard
+ * product sums each element in order. strassenProduct uses the
+ * Strassen-Winograd recursion, which does 7 half-sized products and 15
+ * additions of half-sized matrices instead of 8 products, down to blocks
+ * smaller than the base size set by setStrassenSizes, so it takes
+ * O(n^2.81) time instead of O(n^3). Its error is only bounded in norm:
+ * with unit roundoff u and the base size n0,
+ *     max |C' - C| <= ((n/n0)^log2(18) (n0^2 + 6 n0) - 6n) u max|A| max|B|
+ * to first order (Higham, Accuracy and Stability of Numerical Algorithms,
+ * ch. 23), against n u |A| |B| element by element for the standard
+ * product. Elements of C much smaller than the largest of A times the
+ * largest of B may lose all their digits. Both run on the workers of
+ * forRowBands: the standard product by bands of rows, the recursion by
+ * its seven sub-products. automaticProduct, what the operators use,
+ * chooses strassenProduct when every dimension is at least the threshold
+ * set by setStrassenSizes. Integer products are always standard, as the
+ * reordered sums could overflow where the standard ones do not.
+ */
+enum productAlgorithm { automaticProduct, standardProduct, strassenProduct };
+
+/**
+ * set the sizes for Strassen-Winograd products, for products on every
+ * thread; matrix_bench measures the best ones for a machine
+ * @param threshold the smallest dimension of products that
+ * automaticProduct computes with the recursion, or 0 for none. The
+ * default is 2048, or the environment variable CDAL_STRASSEN_THRESHOLD.
+ * @param baseSize  blocks with a dimension below this are multiplied with
+ * the standard product; at least 16, 256 by default
+ */
+void setStrassenSizes(int threshold, int baseSize);
+
+/**
+ * the product of two views, summing the products of elements in
+ * elementTraits<T>::accumulator; its elements are of type
+ * elementTraits<T>::product. The kernels are in Matrix.cpp. A
+ * Strassen-Winograd product is computed whole when it is made, and its
+ * rows are copied from the result.
+ */
+template <class T>
+class productExpression
+    : public matrixExpression<productExpression<T>,
+                              typename elementTraits<T>::product> {
+public:
+    typedef typename elementTraits<T>::product element;
+
+    /**
+     * exits with an error unless left can be multiplied by right
+     */
+    productExpression(const basicMatrixView<T> &left,
+                      const basicMatrixView<T> &right,
+                      productAlgorithm algorithm = automaticProduct);
+
+    int numRows() const { return left.numRows(); }
+    int numCols() const { return right.numCols(); }
+
+    // strassenProduct if the product was computed whole by the recursion
+    productAlgorithm algorithm() const {
+        return computed ? strassenProduct : standardProduct;
+    }
+
+    // lay out the operands the way the kernel reads them
+    void prepare() const;
+
+    void rowInto(int i, element *out) const;
+
+private:
+    basicMatrixView<T> left;
+    basicMatrixView<T> right;
+
+    /* Made by prepare, before the first row: the row of sums, and copies
+       of operands that are not contiguous where the kernel reads them,
+       which copies of the expression share and only read. */
+    mutable bool prepared;
+    mutable std::vector<typename elementTraits<T>::accumulator> sums;
+    mutable std::shared_ptr<const basicMatrix<T> > leftCopy;
+    mutable std::shared_ptr<const basicMatrix<T> > rightCopy;
+
+    // the whole product, shared by copies, when it is not made by rows
+    std::shared_ptr<const basicMatrix<element> > computed;
+};
+
+/**
+ * the product of two matrices or views, computed the given way
+ */
+template <class T>
+productExpression<T> multiply(const basicMatrixView<T> &left,
+                              const basicMatrixView<T> &right,
+                              productAlgorithm algorithm) {
+    return productExpression<T>(left, right, algorithm);
+}
+
+template <class T>
+productExpression<T> multiply(const basicMatrix<T> &left,
+                              const basicMatrix<T> &right,
+                              productAlgorithm algorithm) {
+    return productExpression<T>(wholeView(left), wholeView(right), algorithm);
+}
+
+template <class T>
+productExpression<T> operator*(const basicMatrixView<T> &left,
+                               const basicMatrixView<T> &right) {
+    return productExpression<T>(left, right);
+}
+
+template <class T>
+productExpression<T> operator*(const basicMatrix<T> &left,
+                               const basicMatrix<T> &right) {
+    return productExpression<T>(wholeView(left), wholeView(right));
+}
+
+template <class T>
+productExpression<T> operator*(const basicMatrixView<T> &left,
+                               const basicMatrix<T> &right) {
+    return productExpression<T>(left, wholeView(right));
+}
+
+template <class T>
+productExpression<T> operator*(const basicMatrix<T> &left,
+                               const basicMatrixView<T> &right) {
+    return productExpression<T>(wholeView(left), right);
+}
+
+/* A product with an expression as an operand is evaluated when it is
+   made, since the operand has no rows to read until it is itself
+   evaluated into a matrix. */
+template <class E, class T>
+basicMatrix<typename elementTraits<T>::product> operator*(
+    const matrixExpression<E, T> &left, const basicMatrixView<T> &right) {
+    basicMatrix<T> rows(left);
+    return productExpression<T>(wholeView(rows), right);
+}
+
+template <class E, class T>
+basicMatrix<typename elementTraits<T>::product> operator*(
+    const basicMatrixView<T> &left, const matrixExpression<E, T> &right) {
+    basicMatrix<T> rows(right);
+    return productExpression<T>(left, wholeView(rows));
+}
+
+template <class E, class T>
+basicMatrix<typename elementTraits<T>::product> operator*(
+    const matrixExpression<E, T> &left, const basicMatrix<T> &right) {
+    return left * wholeView(right);
+}
+
+template <class E, class T>
+basicMatrix<typename elementTraits<T>::product> operator*(
+    const basicMatrix<T> &left, const matrixExpression<E, T> &right) {
+    return wholeView(left) * right;
+}
+
+template <class E, class F, class T>
+basicMatrix<typename elementTraits<T>::product> operator*(
+    const matrixExpression<E, T> &left, const matrixExpression<F, T> &right) {
+    basicMatrix<T> rows(left);
+    return wholeView(rows) * right;
+}
+
+// a matrix or view as the operand of an element-wise operation
+template <class T>
+class viewOperand {
+public:
+    typedef T element;
+
+    explicit viewOperand(const basicMatrixView<T> &v) : view(v) {}
+
+    int numRows() const { return view.numRows(); }
+    int numCols() const { return view.numCols(); }
+
+    void prepare() const {}
+
+    void rowInto(int i, T *out) const {
+        typename basicMatrixView<T>::rowRef row = view[i];
+        for (int j = 0; j != view.numCols(); j++) out[j] = row[j];
+    }
+
+    // the values of row i, in place when they are contiguous
+    const T *rowValues(int i, std::vector<T> &buffer) const {
+        if (view.colStride() == 1) return view.rowValues(i);
+        buffer.resize(view.numCols());
+        rowInto(i, buffer.data());
+        return buffer.data();
+    }
+
+private:
+    basicMatrixView<T> view;
+};
+
+// a scalar broadcast to every element of a matrix of the other operand's size
+template <class T>
+class scalarOperand {
+public:
+    typedef T element;
+
+    scalarOperand(T v, int row, int col) : value(v), rows(row), cols(col) {}
+
+    int numRows() const { return rows; }
+    int numCols() const { return cols; }
+
+    void prepare() const {}
+
+    void rowInto(int, T *out) const { std::fill(out, out + cols, value); }
+
+    const T *rowValues(int i, std::vector<T> &buffer) const {
+        buffer.resize(cols);
+        rowInto(i, buffer.data());
+        return buffer.data();
+    }
+
+private:
+    T value;
+    int rows;
+    int cols;
+};
+
+struct plusOp {
+    static const char *verb() { return "added"; }
+    template <class T>
+    static T apply(T a, T b) {
+        return static_cast<T>(a + b);
+    }
+};
+
+struct minusOp {
+    static const char *verb() { return "subtracted"; }
+    template <class T>
+    static T apply(T a, T b) {
+        return static_cast<T>(a - b);
+    }
+};
+
+struct timesOp {
+    static const char *verb() { return "multiplied element by element"; }
+    template <class T>
+    static T apply(T a, T b) {
+        return static_cast<T>(a * b);
+    }
+};
+
+struct divideOp {
+    static const char *verb() { return "divided element by element"; }
+    template <class T>
+    static T apply(T a, T b) {
+        return static_cast<T>(a / b);
+    }
+};
+
+/**
+ * an element-wise operation on two expressions, matrices or scalars of
+ * the same element type; op is plusOp, minusOp, timesOp or divideOp. The
+ * elements are combined in the order the expression is written, so they
+ * round as they would if each operator made a matrix.
+ */
+template <class L, class R, class op>
+class elementwiseExpression
+    : public matrixExpression<elementwiseExpression<L, R, op>,
+                              typename L::element> {
+public:
+    typedef typename L::element element;
+
+    elementwiseExpression(const L &l, const R &r) : left(l), right(r) {
+        static_assert(std::is_same<element, typename R::element>::value,
+                      "matrices combined element by element must have the "
+                      "same element type");
+        if (left.numRows() != right.numRows() ||
+            left.numCols() != right.numCols()) {
+            std::cerr << "ERROR, two matrices cannot be " << op::verb()
+                      << " with dimensions " << left.numRows() << "x"
+                      << left.numCols() << " and " << right.numRows() << "x"
+                      << right.numCols() << std::endl;
+            abortRun();
+        }
+    }
+
+    int numRows() const { return left.numRows(); }
+    int numCols() const { return left.numCols(); }
+
+    void prepare() const {
+        left.prepare();
+        right.prepare();
+    }
+
+    void rowInto(int i, element *out) const {
+        left.rowInto(i, out);
+        const element *values = right.rowValues(i, scratch);
+        int n = numCols();
+        for (int j = 0; j != n; j++) out[j] = op::apply(out[j], values[j]);
+    }
+
+private:
+    L left;
+    R right;
+    mutable std::vector<element> scratch;
+};
+
+/**
+ * what may be combined element by element: matrices, views and
+ * expressions. node is the type stored in an elementwiseExpression, made
+ * by operand(), and scalar the type of a scalar combined with it. Other
+ * types have no node, so the operators below do not apply to them.
+ */
+template <class X>
+struct operandTraits {};
+
+template <class T>
+struct operandTraits<basicMatrix<T> > {
+    typedef viewOperand<T> node;
+    typedef scalarOperand<T> scalar;
+    static node operand(const basicMatrix<T> &m) {
+        return viewOperand<T>(wholeView(m));
+    }
+};
+
+template <class T>
+struct operandTraits<basicMatrixView<T> > {
+    typedef viewOperand<T> node;
+    typedef scalarOperand<T> scalar;
+    static node operand(const basicMatrixView<T> &v) {
+        return viewOperand<T>(v);
+    }
+};
+
+template <class T>
+struct operandTraits<productExpression<T> > {
+    typedef productExpression<T> node;
+    typedef scalarOperand<typename node::element> scalar;
+    static node operand(const node &e) { return e; }
 };
 
+template <class L, class R, class op>
+struct operandTraits<elementwiseExpression<L, R, op> > {
+    typedef elementwiseExpression<L, R, op> node;
+    typedef scalarOperand<typename node::element> scalar;
+    static node operand(const node &e) { return e; }
+};
+
+template <class op, class L, class R>
+elementwiseExpression<L, R, op> combine(const L &left, const R &right) {
+    return elementwiseExpression<L, R, op>(left, right);
+}
+
+// function(left, right) of two matrices, views or expressions
+#define ELEMENTWISE_OPERATION(function, op)                                \
+    template <class L, class R>                                            \
+    elementwiseExpression<typename operandTraits<L>::node,                 \
+                          typename operandTraits<R>::node, op>             \
+    function(const L &left, const R &right) {                              \
+        return combine<op>(operandTraits<L>::operand(left),                \
+                           operandTraits<R>::operand(right));              \
+    }
+
+// a floating scalar would be truncated to the integral elements of M
+template <class M, class S>
+struct narrowingScalar {
+    typedef typename operandTraits<M>::scalar::element element;
+    static const bool value = std::is_floating_point<S>::value &&
+                              std::is_integral<element>::value;
+};
+
+// function(m, s) and function(s, m) of a matrix and an arithmetic scalar,
+// which must not be floating if the elements are integers
+#define SCALAR_OPERATIONS(function, op)                                    \
+    template <class M, class S>                                            \
+    typename std::enable_if<                                               \
+        std::is_arithmetic<S>::value,                                      \
+        elementwiseExpression<typename operandTraits<M>::node,             \
+                              typename operandTraits<M>::scalar, op> >::type \
+    function(const M &m, S s) {                                            \
+        static_assert(!narrowingScalar<M, S>::value,                       \
+                      "a floating scalar cannot be broadcast to integers"); \
+        typename operandTraits<M>::node left = operandTraits<M>::operand(m); \
+        return combine<op>(left, typename operandTraits<M>::scalar(        \
+                                     s, left.numRows(), left.numCols()));  \
+    }                                                                      \
+                                                                           \
+    template <class S, class M>                                            \
+    typename std::enable_if<                                               \
+        std::is_arithmetic<S>::value,                                      \
+        elementwiseExpression<typename operandTraits<M>::scalar,           \
+                              typename operandTraits<M>::node, op> >::type \
+    function(S s, const M &m) {                                            \
+        static_assert(!narrowingScalar<M, S>::value,                       \
+                      "a floating scalar cannot be broadcast to integers"); \
+        typename operandTraits<M>::node right = operandTraits<M>::operand(m); \
+        return combine<op>(typename operandTraits<M>::scalar(             \
+                               s, right.numRows(), right.numCols()),       \
+                           right);                                         \
+    }
+
+ELEMENTWISE_OPERATION(operator+, plusOp)
+ELEMENTWISE_OPERATION(operator-, minusOp)
+ELEMENTWISE_OPERATION(operator/, divideOp)
+// the element-wise (Hadamard) product, since operator* is the matrix product
+ELEMENTWISE_OPERATION(hadamard, timesOp)
+
+SCALAR_OPERATIONS(operator+, plusOp)
+SCALAR_OPERATIONS(operator-, minusOp)
+SCALAR_OPERATIONS(operator*, timesOp)
+SCALAR_OPERATIONS(operator/, divideOp)
+
+#undef ELEMENTWISE_OPERATION
+#undef SCALAR_OPERATIONS
+
+/**
+ * reductions of all the elements of a matrix or view; rows and columns
+ * are reduced through their views. Sums are added pairwise, in blocks
+ * with eight independent partial sums, so they vectorize and their
+ * rounding error grows with the logarithm of the number of elements
+ * rather than with the number itself. Sums, and the dot product of two
+ * matrices of the same dimensions, are of elementTraits<T>::accumulator.
+ * The minimum, maximum and mean of a matrix without elements are an
+ * error.
+ */
+template <class T>
+typename elementTraits<T>::accumulator sum(const basicMatrix<T> &m);
+
+template <class T>
+typename elementTraits<T>::accumulator sum(const basicMatrixView<T> &v);
+
+template <class T>
+double mean(const basicMatrix<T> &m);
+
+template <class T>
+double mean(const basicMatrixView<T> &v);
+
+template <class T>
+T min(const basicMatrix<T> &m);
+
+template <class T>
+T min(const basicMatrixView<T> &v);
+
+template <class T>
+T max(const basicMatrix<T> &m);
+
+template <class T>
+T max(const basicMatrixView<T> &v);
+
+// the Frobenius norm, the square root of the sum of the squares
+template <class T>
+double norm(const basicMatrix<T> &m);
+
+template <class T>
+double norm(const basicMatrixView<T> &v);
+
+template <class T>
+typename elementTraits<T>::accumulator dot(const basicMatrix<T> &left,
+                                           const basicMatrix<T> &right);
+
+template <class T>
+typename elementTraits<T>::accumulator dot(const basicMatrixView<T> &left,
+                                           const basicMatrixView<T> &right);
+
+/**
+ * the transpose of an expression, evaluated first as it has no elements to
+ * view
+ */
+template <class E, class T>
+basicMatrix<T> transpose(const matrixExpression<E, T> &e) {
+    return transpose(basicMatrix<T>(e));
+}
+
+// reductions of expressions, which evaluate them first
+template <class E, class T>
+typename elementTraits<T>::accumulator sum(const matrixExpression<E, T> &e) {
+    return sum(basicMatrix<T>(e));
+}
+
+template <class E, class T>
+double mean(const matrixExpression<E, T> &e) {
+    return mean(basicMatrix<T>(e));
+}
+
+template <class E, class T>
+T min(const matrixExpression<E, T> &e) {
+    return min(basicMatrix<T>(e));
+}
+
+template <class E, class T>
+T max(const matrixExpression<E, T> &e) {
+    return max(basicMatrix<T>(e));
+}
+
+template <class E, class T>
+double norm(const matrixExpression<E, T> &e) {
+    return norm(basicMatrix<T>(e));
+}
+
+/**
+ * print rows * cols values, stored in row-major order, exactly as
+ * operator<< prints a matrix of them
+ */
+template <class T>
+void printMatrix(std::ostream &os, const T *values, int rows, int cols);
+
+/**
+ * A matrix whose dimensions are known at compile time, which the
+ * translator uses when they are constants. The values live inside the
+ * object, so fixed-size matrices declared in loops are made on the stack
+ * without touching the allocator, and the loops over them have constant
+ * trip counts that the compiler unrolls for small sizes.
+ */
+template <int R, int C, class T = float>
+class fixedMatrix {
+public:
+    typedef T element;
+
+    fixedMatrix() : values() {}
+
+    int numRows() const { return R; }
+    int numCols() const { return C; }
+
+    T *operator[](int row) { return values[row]; }
+
+    const T *operator[](int row) const { return values[row]; }
+
+    /**
+     * copy to a matrix on the heap, for code that takes a basicMatrix
+     */
+    operator basicMatrix<T>() const {
+        basicMatrix<T> m(R, C);
+        for (int i = 0; i != R; i++)
+            for (int j = 0; j != C; j++) m[i][j] = values[i][j];
+        return m;
+    }
+
+private:
+    T values[R][C];
+};
+
+template <int R, int C, class T>
+std::ostream &operator<<(std::ostream &os, const fixedMatrix<R, C, T> &m) {
+    printMatrix(os, m[0], R, C);
+    return os;
+}
+
+/**
+ * multiply two fixed-size matrices, adding the products in the same order
+ * as the product of basicMatrix
+ */
+template <int R, int K, int C, class T>
+fixedMatrix<R, C, typename elementTraits<T>::product> operator*(
+    const fixedMatrix<R, K, T> &left, const fixedMatrix<K, C, T> &right) {
+    typedef typename elementTraits<T>::accumulator accumulator;
+    fixedMatrix<R, C, typename elementTraits<T>::product> result;
+    for (int i = 0; i != R; i++) {
+        accumulator sums[C] = {};
+        for (int k = 0; k != K; k++) {
+            accumulator a = left[i][k];
+            for (int j = 0; j != C; j++) sums[j] += a * right[k][j];
+        }
+        for (int j = 0; j != C; j++) result[i][j] = sums[j];
+    }
+    return result;
+}
+
+// products with a matrix whose size is not fixed
+template <int R, int C, class T>
+basicMatrix<typename elementTraits<T>::product> operator*(
+    const fixedMatrix<R, C, T> &left, const basicMatrix<T> &right) {
+    return basicMatrix<T>(left) * right;
+}
+
+template <int R, int C, class T>
+basicMatrix<typename elementTraits<T>::product> operator*(
+    const basicMatrix<T> &left, const fixedMatrix<R, C, T> &right) {
+    return left * basicMatrix<T>(right);
+}
+
+/**
+ * the formats matrixWrite can produce. The text format is the one printed
+ * by operator<<; the binary format is a 64 byte header holding the
+ * dimensions, element type and byte order, followed by the values in
+ * row-major order. matrixRead reads files of any element type, converting
+ * the values to float. Within a libraryCall, it reads the input the host
+ * passed under the file name instead, if there is one.
+ */
+enum matrixFormat { textFormat, binaryFormat };
+
+/**
+ * read a matrix from a file in either format, telling them apart by the
+ * magic number at the start of binary files. Binary files in the native
+ * byte order are mapped rather than read, so loading them takes constant
+ * time; the mapping is private, so writes to the matrix never reach the
+ * file.
+ */
 matrix matrixRead(std::string &filename);
 
 matrix matrixRead(const char *filename);
 
-int numRows(matrix &m);
+/**
+ * parse a matrix in the text format read by matrixRead: the number of rows
+ * and columns followed by the values in row-major order
+ * @param  text   the first character of the text
+ * @param  length the number of characters in the text
+ * @param  error  set to a description of the problem if the text is
+ * malformed, cleared otherwise
+ * @return        On success, the parsed matrix; otherwise a 0 x 0 matrix
+ */
+matrix matrixParse(const char *text, size_t length, std::string &error);
+
+/**
+ * write a matrix to a file, exiting with an error if it cannot be written
+ * @param m        the matrix to write
+ * @param filename path to the target file
+ * @param format   binaryFormat, or textFormat for a file like sample_8.data
+ */
+template <class T>
+void matrixWrite(const basicMatrix<T> &m, std::string &filename,
+                 matrixFormat format = binaryFormat);
+
+template <class T>
+void matrixWrite(const basicMatrix<T> &m, const char *filename,
+                 matrixFormat format = binaryFormat);
+
+/**
+ * write a matrix to a stream
+ * @param m      the matrix to write
+ * @param os     the stream to write to
+ * @param format the format to write in
+ */
+template <class T>
+void matrixWrite(const basicMatrix<T> &m, std::ostream &os,
+                 matrixFormat format);
+
+/**
+ * choose the format operator<<, and so print, writes matrices in. It is
+ * the text format unless the environment variable CDAL_PRINT_FORMAT is
+ * "binary", which dumps matrices in the binary format instead.
+ * @param format the format to print matrices in
+ */
+void setPrintFormat(matrixFormat format);
+
+/**
+ * convert a matrix file in either format to the given format
+ * @param from   path to the matrix file to read
+ * @param to     path to the matrix file to write
+ * @param format the format of the new file
+ */
+void matrixConvert(const char *from, const char *to,
+                   matrixFormat format = binaryFormat);
+
+/**
+ * A read-only matrix that is read from a file one band of rows at a time,
+ * so that matrices larger than memory can be processed with bounded
+ * memory. Rows must be visited in increasing order. While the rows of one
+ * band are in use, a background thread reads the next band, so at most two
+ * bands are held at once.
+ */
+class matrixStream {
+public:
+    /**
+     * open a matrix file in either format, exiting with an error if it
+     * cannot be opened
+     * @param filename path to the matrix file
+     * @param bandRows the number of rows per band, or 0 to use bands of
+     * about 8 MB
+     */
+    matrixStream(const char *filename, int bandRows = 0);
+    matrixStream(std::string &filename, int bandRows = 0);
+    ~matrixStream();
+
+    int numRows() const;
+    int numCols() const;
+
+    /**
+     * access a row, waiting for its band to be read if needed. Rows before
+     * the current band are gone, so asking for one is an error.
+     */
+    const float *operator[](int row) {
+        if (static_cast<unsigned>(row - bandFirst) <
+            static_cast<unsigned>(bandCount))
+            return bandValues + static_cast<size_t>(row - bandFirst) * cols;
+        return fetch(row);
+    }
+
+private:
+    matrixStream(const matrixStream &);
+    matrixStream &operator=(const matrixStream &);
+
+    void open(const char *filename, int bandRows);
+    const float *fetch(int row);
+
+    int rows;
+    int cols;
+
+    // the band in use
+    const float *bandValues;
+    int bandFirst;
+    int bandCount;
+
+    // the file and the background thread that reads it
+    struct reader;
+    reader *state;
+};
+
+/**
+ * the layouts a sparseMatrix can store its values in: compressed sparse
+ * rows (CSR) or compressed sparse columns (CSC)
+ */
+enum sparseLayout { compressedRows, compressedColumns };
+
+/**
+ * A matrix that stores only its nonzero values, for masks and comparison
+ * matrices that are mostly zeros. Memory and the work of the kernels below
+ * grow with the number of nonzeros rather than rows * cols.
+ *
+ * The values are grouped by row (compressedRows) or by column
+ * (compressedColumns); within a group they are sorted by their column or
+ * row index.
+ */
+class sparseMatrix {
+public:
+    /**
+     * make a matrix of zeros, to be filled by append
+     */
+    sparseMatrix(int row, int col, sparseLayout layout = compressedRows);
+
+    /**
+     * convert a dense matrix, keeping its nonzero values
+     */
+    explicit sparseMatrix(const matrix &m,
+                          sparseLayout layout = compressedRows);
+
+    int numRows() const;
+    int numCols() const;
+    int numNonZeros() const;
+    sparseLayout layout() const;
+
+    /**
+     * read an element, searching the values of its row or column
+     */
+    float at(int row, int col) const;
+
+    /**
+     * set the next element. Elements must be appended in the order of the
+     * layout: row by row for compressedRows, column by column for
+     * compressedColumns. Zeros are dropped.
+     */
+    void append(int row, int col, float value);
+
+    matrix toDense() const;
+
+    /**
+     * the same matrix stored in the given layout
+     */
+    sparseMatrix toLayout(sparseLayout layout) const;
+
+    friend std::ostream &operator<<(std::ostream &os, const sparseMatrix &m);
+
+    // sparse-dense products (SpMV when the dense matrix has one column)
+    friend matrix operator*(const sparseMatrix &left, const matrix &right);
+    friend matrix operator*(const matrix &left, const sparseMatrix &right);
+
+    // element-wise sums and differences, which are dense
+    friend matrix operator+(const sparseMatrix &left, const matrix &right);
+    friend matrix operator+(const matrix &left, const sparseMatrix &right);
+    friend matrix operator-(const sparseMatrix &left, const matrix &right);
+    friend matrix operator-(const matrix &left, const sparseMatrix &right);
+
+    // element-wise products, which are as sparse as the sparse operand
+    friend sparseMatrix hadamard(const sparseMatrix &left,
+                                 const matrix &right);
+    friend sparseMatrix hadamard(const matrix &left,
+                                 const sparseMatrix &right);
+
+private:
+    // add sign * this matrix to m, which has the same dimensions
+    void addTo(matrix &m, float sign) const;
+
+    // the row or column an element is grouped by, and its index within it
+    int outer(int row, int col) const {
+        return order == compressedRows ? row : col;
+    }
+    int inner(int row, int col) const {
+        return order == compressedRows ? col : row;
+    }
+
+    // the range of values of a row or column
+    int groupBegin(int k) const { return k <= lastGroup ? starts[k] : size(); }
+    int groupEnd(int k) const {
+        return k < lastGroup ? starts[k + 1] : size();
+    }
+    int size() const { return static_cast<int>(values.size()); }
+
+    int rows;
+    int cols;
+    sparseLayout order;
+
+    /* starts[k] is the position in indices and values of the first value
+       of row or column k, for k up to lastGroup, the last one appended
+       to; the groups after it are empty. */
+    std::vector<int> starts;
+    int lastGroup;
+    std::vector<int> indices;
+    std::vector<float> values;
+};
+
+/**
+ * Where a program that was started in an interpreter is carried on by its
+ * translation, for tiered runs (see tiered.h in the translator). The
+ * interpreter stops before a top-level statement of main, or before a row
+ * of a comprehension at top level, and writes a state file: the index of
+ * that statement, the row, and the values of the top-level variables
+ * declared so far in the order they were declared.
+ *
+ * A translation made for tiered runs makes a resumePoint from its command
+ * line, skips the statements the interpreter ran, and reads the variables
+ * they declared from the state instead. Without a state file it runs from
+ * the beginning.
+ */
+class resumePoint {
+public:
+    /**
+     * read the state file given by "--resume <file>" on the command line,
+     * exiting with an error if it cannot be read
+     */
+    resumePoint(int argc, char **argv);
+
+    // whether top-level statement s ran before the switch
+    bool skips(int statement) const { return statement < at; }
+
+    // whether the variable declared by top-level statement s is read
+    bool restores(int statement) const {
+        return statement < at || (statement == at && row >= 0);
+    }
+
+    /**
+     * read the value of a scalar declared by top-level statement s, if
+     * restores(s); the name is checked against the state
+     */
+    void restore(int statement, const char *name, int &variable);
+    void restore(int statement, const char *name, float &variable);
+    void restore(int statement, const char *name, bool &variable);
+    void restore(int statement, const char *name, std::string &variable);
+
+    /**
+     * read the next variable, a matrix, of the state
+     */
+    template <class T>
+    basicMatrix<T> read(const char *name);
+
+    // the first row left to compute of the comprehension of statement s
+    int firstRow(int statement, int rows) const {
+        return statement < at ? rows : statement == at && row >= 0 ? row : 0;
+    }
+
+private:
+    // the kind of the next variable, checking that it has the given name
+    char next(const char *name);
+    void fail(const std::string &problem);
+
+    int at;
+    int row;
+    std::string state;
+    size_t position;
+};
+
+struct cdal_call;
+
+/**
+ * A call into a program translated to a shared object, made through the C
+ * interface in cdal.h (see Program::libraryCppCode in the translator).
+ * While the call lasts, matrixRead takes the matrices the host passed in
+ * by name, what the program prints is passed to the host, and abortRun
+ * ends the call rather than the process.
+ */
+class libraryCall {
+public:
+    explicit libraryCall(cdal_call *call);
+    ~libraryCall();
+
+    /**
+     * run a program, which hands its matrices to the host with
+     * libraryResult
+     * @return 0, or 1 if it failed, with the error in the cdal_call
+     */
+    int run(void (*program)());
+
+    /**
+     * convert the input the host of the active call passed under a name,
+     * for matrixRead
+     * @return false if there is no such input
+     */
+    static bool read(const char *name, basicMatrix<float> &m);
+
+    // the call being run, or NULL
+    static libraryCall *active;
+
+    cdal_call *call;
+
+private:
+    libraryCall(const libraryCall &);
+
+    // passes what is written to the print callback of the call
+    class hostOutput;
+    hostOutput *printed;
+    std::streambuf *savedOut;
+    std::streambuf *savedErr;
+    std::streambuf *errors;
+};
+
+/**
+ * hand a matrix declared at top level to the host of the active
+ * libraryCall, if it asked for results
+ */
+template <class T>
+void libraryResult(const char *name, const basicMatrix<T> &m);
+
+// the hardware counters a profileReport can count at each site
+enum profileCounter {
+    cyclesCounted,
+    instructionsCounted,
+    // misses in the last level cache
+    cacheMissesCounted,
+    branchMissesCounted,
+    numProfileCounters
+};
+
+/**
+ * A place in a CDAL program that a translation made for profiling times
+ * (see Program::profiledCppCode in the translator): a statement, a
+ * comprehension or a call of a matrix kernel. The counts are kept in the
+ * site itself, so timing it costs two reads of the time stamp counter.
+ */
+struct profileSite {
+    // "statement", "comprehension" or "kernel"
+    const char *kind;
+    // file:line:column in the CDAL source, or "" if it is not known
+    const char *location;
+    // its CDAL source
+    const char *source;
+    unsigned long long calls;
+    // time stamp counter cycles spent in it, with and without those spent
+    // in the sites within it
+    unsigned long long total;
+    unsigned long long self;
+    // what the hardware counters counted in it and the sites within it,
+    // as numbered by profileCounter, when they are counted
+    unsigned long long counts[numProfileCounters];
+};
+
+/**
+ * start and stop timing a site. Sites nest, and profileLeave stops the
+ * innermost one; they are only timed on the thread running the program.
+ */
+void profileEnter(profileSite &site);
+void profileLeave();
+
+// what profileCall returns for a kernel returning R: R, or the matrix
+// that R evaluates to if it is an expression
+template <class R>
+struct profiledResult {
+    template <class E, class T>
+    static basicMatrix<T> evaluated(const matrixExpression<E, T> *);
+    static R evaluated(...);
+    typedef decltype(evaluated(static_cast<R *>(NULL))) type;
+};
+
+/* time a call of a kernel, returning what it returns. An expression is
+   evaluated within the site, since its elements are only computed when it
+   is, so the kernel is charged for them rather than the statement using
+   it, at the cost of fusing it with the expressions around it. */
+template <class F>
+auto profileCall(profileSite &site, F kernel) ->
+    typename profiledResult<decltype(kernel())>::type {
+    profileEnter(site);
+    typename profiledResult<decltype(kernel())>::type result(kernel());
+    profileLeave();
+    return result;
+}
+
+/**
+ * The report of the sites of a program, written when it is destroyed as
+ * the program exits: the calls, total and self time of each site that
+ * ran, the most self time first, on stderr or in the file named by the
+ * environment variable CDAL_PROFILE.
+ *
+ * When the environment variable CDAL_COUNTERS is set, the report also
+ * gives the instructions per cycle of each site, and its last level cache
+ * and branch misses per thousand instructions, from perf_event counters
+ * opened on the thread running the program and inherited by the threads
+ * it starts after the report is made, such as the workers of forRowBands;
+ * where the kernel does not inherit them, the report says they count only
+ * the thread running the program. Counts are scaled up for the time the
+ * kernel took turns with other counters. Reading them costs a system
+ * call as each site is entered and left. Where they are not permitted or
+ * not supported the report says so, and sites are only timed.
+ */
+class profileReport {
+public:
+    profileReport(profileSite *sites, int count);
+    ~profileReport();
+
+private:
+    profileSite *sites;
+    int count;
+    // whether CDAL_COUNTERS asked for hardware counters, and why none
+    // could be opened, if none could
+    bool counting;
+    std::string countersMissing;
+    // when the program started, in cycles and in nanoseconds, to convert
+    // cycles to time
+    unsigned long long startCycles;
+    long long startTime;
+};
+
+template <class T>
+int numRows(basicMatrix<T> &m) {
+    return m.numRows();
+}
+
+template <class T>
+int numCols(basicMatrix<T> &m) {
+    return m.numCols();
+}
+
+template <int R, int C, class T>
+int numRows(fixedMatrix<R, C, T> &) {
+    return R;
+}
+
+template <int R, int C, class T>
+int numCols(fixedMatrix<R, C, T> &) {
+    return C;
+}
+
+template <class T>
+int numRows(const basicMatrixView<T> &v) {
+    return v.numRows();
+}
+
+template <class T>
+int numCols(const basicMatrixView<T> &v) {
+    return v.numCols();
+}
+
+int numRows(matrixStream &m);
+
+int numCols(matrixStream &m);
+
+int numRows(sparseMatrix &m);
 
-int numCols(matrix &m);
+int numCols(sparseMatrix &m);
 
 #endif  // MATRIX_H
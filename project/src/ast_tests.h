@@ -140,6 +140,42 @@ public:
      * test parser using forest_loss_v2.dsl
      */
     void test_forest_loss(void) { unparse_tests("forest_loss_v2.dsl"); }
+    /**
+     * test parser using sparse_masks.dsl
+     */
+    void test_sparse_masks(void) { unparse_tests("sparse_masks.dsl"); }
+    /**
+     * test parser using sparse_operations.dsl
+     */
+    void test_sparse_operations(void) {
+        unparse_tests("sparse_operations.dsl");
+    }
+    /**
+     * test parser using element_types.dsl
+     */
+    void test_element_types(void) { unparse_tests("element_types.dsl"); }
+    /**
+     * test parser using fixed_sizes.dsl
+     */
+    void test_fixed_sizes(void) { unparse_tests("fixed_sizes.dsl"); }
+    /**
+     * test parser using matrix_views.dsl
+     */
+    void test_matrix_views(void) { unparse_tests("matrix_views.dsl"); }
+    /**
+     * test parser using reductions.dsl
+     */
+    void test_reductions(void) { unparse_tests("reductions.dsl"); }
+    /**
+     * test parser using fused_expressions.dsl
+     */
+    void test_fused_expressions(void) {
+        unparse_tests("fused_expressions.dsl");
+    }
+    /**
+     * test parser using elementwise.dsl
+     */
+    void test_elementwise(void) { unparse_tests("elementwise.dsl"); }
 
     // void test_easy_sample(void) { unparse_tests("easysample.dsl"); }
 };
@@ -0,0 +1,126 @@
+/***
+ * BuildGraph: writes the build of a batch of translated CDAL programs; see
+ * buildGraph.h.
+ */
+
+#include "./buildGraph.h"
+#include "./AST.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// the flags of the runtime target of the Makefile, so that translations
+// can use a Matrix.h.gch made by either
+const char *flags = "-O2 -std=c++0x -pthread -fPIC";
+
+// a path in a ninja build statement, or in a variable
+string ninjaPath(const string &path) {
+    string escaped;
+    for (size_t k = 0; k != path.size(); k++) {
+        if (path[k] == '$' || path[k] == ' ' || path[k] == ':')
+            escaped += '$';
+        escaped += path[k];
+    }
+    return escaped;
+}
+
+// a path in a Makefile rule, or in a variable
+string makePath(const string &path) {
+    string escaped;
+    for (size_t k = 0; k != path.size(); k++) {
+        if (path[k] == '$') escaped += '$';
+        if (path[k] == ' ') escaped += '\\';
+        escaped += path[k];
+    }
+    return escaped;
+}
+
+// what the build file says about itself
+void writeHeader(ostream &os, size_t count, const char *howToRun) {
+    os << "# The build of the translations of " << count
+       << " CDAL programs, written by BuildGraph.\n"
+       << "# Run " << howToRun << " in this directory to build them.\n\n";
+}
+
+}  // namespace
+
+BuildGraph::BuildGraph(const string &directory, const string &runtime)
+    : directory(directory), runtime(runtime), profile(false) {
+    char absolute[PATH_MAX];
+    if (realpath(runtime.c_str(), absolute) != NULL) this->runtime = absolute;
+}
+
+bool BuildGraph::add(const string &name, Program *program) {
+    string path = directory + "/" + name + ".cpp";
+    string code =
+        (profile ? program->profiledCppCode() : program->cppCode()) + "\n";
+    programs.push_back(name);
+
+    ifstream in(path.c_str(), ifstream::binary);
+    stringstream old;
+    old << in.rdbuf();
+    if (in && old.str() == code) return true;
+
+    ofstream out(path.c_str(), ofstream::binary);
+    out << code;
+    return static_cast<bool>(out);
+}
+
+void BuildGraph::writeNinja(ostream &os) const {
+    writeHeader(os, programs.size(), "ninja");
+    os << "cxx = g++\n"
+       << "flags = " << flags << "\n"
+       << "runtime = " << ninjaPath(runtime) << "\n\n"
+       << "rule pch\n"
+       << "  command = $cxx $flags -x c++-header $in -o $out\n"
+       << "  description = PCH $out\n\n"
+       << "rule cxx\n"
+       << "  command = $cxx $flags -I$runtime -MMD -MF $out.d -c $in -o $out\n"
+       << "  depfile = $out.d\n"
+       << "  deps = gcc\n"
+       << "  description = CXX $out\n\n"
+       << "rule link\n"
+       << "  command = $cxx $flags -o $out $in\n"
+       << "  description = LINK $out\n\n"
+       << "build $runtime/Matrix.h.gch: pch $runtime/Matrix.h\n"
+       << "build cdal_runtime.o: cxx $runtime/Matrix.cpp"
+       << " | $runtime/Matrix.h.gch\n\n";
+
+    string all;
+    for (size_t k = 0; k != programs.size(); k++) {
+        string name = ninjaPath(programs[k]);
+        os << "build " << name << ".o: cxx " << name << ".cpp"
+           << " | $runtime/Matrix.h.gch\n"
+           << "build " << name << ": link " << name << ".o cdal_runtime.o\n";
+        all += " " + name;
+    }
+    os << "\ndefault" << all << "\n";
+}
+
+void BuildGraph::writeMakefile(ostream &os) const {
+    writeHeader(os, programs.size(), "make -j");
+    os << "CXX = g++\n"
+       << "FLAGS = " << flags << "\n"
+       << "RUNTIME = " << makePath(runtime) << "\n"
+       << "PROGRAMS =";
+    for (size_t k = 0; k != programs.size(); k++)
+        os << " " << makePath(programs[k]);
+    os << "\n\n"
+       << ".PHONY: all clean\n"
+       << "all: $(PROGRAMS)\n\n"
+       << "$(RUNTIME)/Matrix.h.gch: $(RUNTIME)/Matrix.h\n"
+       << "\t$(CXX) $(FLAGS) -x c++-header $< -o $@\n\n"
+       << "cdal_runtime.o: $(RUNTIME)/Matrix.cpp $(RUNTIME)/Matrix.h.gch\n"
+       << "\t$(CXX) $(FLAGS) -MMD -MP -c $< -o $@\n\n"
+       << "%.o: %.cpp $(RUNTIME)/Matrix.h.gch\n"
+       << "\t$(CXX) $(FLAGS) -I$(RUNTIME) -MMD -MP -c $< -o $@\n\n"
+       << "$(PROGRAMS): %: %.o cdal_runtime.o\n"
+       << "\t$(CXX) $(FLAGS) -o $@ $^\n\n"
+       << "clean:\n"
+       << "\trm -f $(PROGRAMS) $(PROGRAMS:=.o) $(PROGRAMS:=.d) "
+          "cdal_runtime.o cdal_runtime.d\n\n"
+       << "-include $(PROGRAMS:=.d) cdal_runtime.d\n";
+}
@@ -0,0 +1,62 @@
+/***
+ * BuildGraph: the build of a batch of translated CDAL programs, written as
+ * a ninja file or a Makefile so that the batch is compiled in parallel and
+ * incrementally.
+ *
+ * The runtime is compiled once, into an object every program links with,
+ * and Matrix.h is precompiled into Matrix.h.gch beside it in the runtime
+ * directory, with the flags the runtime target of the Makefile uses. Each
+ * program then has an edge compiling its translation and one linking it.
+ * g++ lists the headers a compile read in a depfile, but leaves out a
+ * precompiled header, so every compile also depends on Matrix.h.gch, which
+ * depends on Matrix.h: changing the runtime rebuilds everything using it.
+ */
+
+#ifndef BUILDGRAPH_H
+#define BUILDGRAPH_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Program;
+
+class BuildGraph {
+public:
+    /**
+     * @param directory where the translations and the build file go, and
+     *                  where the build is run
+     * @param runtime   the directory holding Matrix.h and Matrix.cpp
+     */
+    BuildGraph(const string &directory, const string &runtime);
+
+    /**
+     * translate a program to <directory>/<name>.cpp, to be built into
+     * <directory>/<name>. A translation that has not changed is not
+     * written again, so that it is not recompiled.
+     * @return false if the translation could not be written
+     */
+    bool add(const string &name, Program *program);
+
+    // write the graph as a ninja file, for ninja -C <directory>
+    void writeNinja(ostream &os) const;
+
+    // write the graph as a Makefile, for make -j -C <directory>
+    void writeMakefile(ostream &os) const;
+
+    string directory;
+
+    // the runtime directory, made absolute
+    string runtime;
+
+    // the names of the programs added, in order
+    vector<string> programs;
+
+    // whether programs are translated to time themselves, see
+    // Program::profiledCppCode; false unless set
+    bool profile;
+};
+
+#endif  // BUILDGRAPH_H
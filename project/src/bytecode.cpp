@@ -0,0 +1,1357 @@
+/***
+ * Bytecode: compiling CDAL programs to register machine code and running
+ * it; see bytecode.h.
+ *
+ * The compile members of the AST nodes are defined here, next to the
+ * compiler they drive.
+ *
+ * Operands of the instructions, where n, s and m are the files of number,
+ * string and matrix registers and target is the index of an instruction:
+ *  moveNumber, conversions      n[a] = n[b]
+ *  moveString                   s[a] = s[b]
+ *  copyMatrix, takeMatrix       m[a] = m[b], copied or taken over
+ *  convertMatrix                m[a] = m[b] with element type c
+ *  clearString                  s[a] = ""
+ *  arithmetic, comparisons      n[a] = n[b] op n[c]
+ *  notBool                      n[a] = !n[b]
+ *  compareString                n[a] = s[b] compared with s[c] as in d
+ *  concatString                 s[a] = s[b] + s[c]
+ *  jump                         goto c
+ *  jumpIfTrue, jumpIfFalse      if n[a] (or not) goto c
+ *  jumpIf..., jumpUnless...     if n[a] op n[b] (or not) goto c
+ *  incrementInt                 n[a]++
+ *  incrementJumpIf...           n[a]++, then if n[a] op n[b] goto c
+ *  newMatrix                    m[a] = zeros(n[b], n[c]) of element type d
+ *  load...Element               n[a] = m[b][n[c], n[d]]
+ *  store...Element              m[a][n[b], n[c]] = n[d]
+ *  add/subtractFloatElement     n[a] = n[b] op m[c][n[d], n[e]]
+ *  multiplyMatrix               m[a] = m[b] * m[c]
+ *  combineMatrix                m[a] = m[b] op m[c], for the character op d
+ *  scalarMatrix                 m[a] = m[b] op n[c], for the character op
+ *                               d; e has bit 0 set for n[c] op m[b] and
+ *                               bit 1 set when n[c] is real
+ *  transposeMatrix              m[a] = transpose(m[b])
+ *  sliceMatrix                  m[a] = m[b][n[c] to n[d] : n[e] to n[f]]
+ *  reduceMatrix                 n[a] = reduction c of m[b], real if d
+ *  numRows, numCols             n[a] = numRows(m[b])
+ *  readMatrix                   m[a] = matrixRead(s[b])
+ *  callMath                     n[a] = function c (n[b])
+ *  print...                     print n[a], s[a] or m[a]
+ *  safePoint                    safe point a, where the program may stop
+ * Element types are numbered as in elementNames, below.
+ */
+
+#include "./bytecode.h"
+#include "./AST.h"
+#include <stdint.h>
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+
+const char *const opcodeNames[] = {
+#define BYTECODE_NAME(name) #name,
+    BYTECODE_OPERATIONS(BYTECODE_NAME)
+#undef BYTECODE_NAME
+};
+
+const char *const elementNames[] = {"float", "double", "int", "int8"};
+
+const char *const reductions[] = {"sum", "mean", "min", "max", "norm"};
+
+int elementCode(const string &elements) {
+    for (int k = 0; k != 4; k++)
+        if (elements == elementNames[k]) return k;
+    return 0;
+}
+
+// the element type of a declared matrix, where no type means float
+string declaredElements(const string &elementType) {
+    return elementType.empty() ? "float" : elementType;
+}
+
+// the type of the elements of a matrix as scalars; int8 elements are
+// promoted to int
+ValueType scalarType(const string &elements) {
+    if (elements == "float") return floatType;
+    if (elements == "double") return doubleType;
+    return intType;
+}
+
+bool isInteger(ValueType type) { return type <= longType; }
+
+bool isNumber(ValueType type) { return type <= doubleType; }
+
+// whether an instruction writes the number register a
+bool writesNumber(Opcode op) {
+    return (op >= moveNumber && op <= notEqualReal && op != moveString &&
+            op != copyMatrix && op != takeMatrix && op != convertMatrix &&
+            op != clearString) ||
+           op == compareString ||
+           (op >= loadFloatElement && op <= loadInt8Element) ||
+           op == addFloatElement || op == subtractFloatElement ||
+           op == reduceMatrix || op == numRows || op == numCols ||
+           op == callMath;
+}
+
+}  // namespace
+
+
+//===================================================================
+// Bytecode
+
+void Bytecode::disassemble(ostream &os) const {
+    for (size_t k = 0; k != code.size(); k++) {
+        const Instruction &in = code[k];
+        int operands[] = {in.a, in.b, in.c, in.d, in.e, in.f};
+        int used = 6;
+        while (used > 0 && operands[used - 1] == 0) used--;
+        os << setw(4) << k << "  " << opcodeNames[in.op];
+        for (int p = 0; p != used; p++) os << " " << operands[p];
+        os << "\n";
+    }
+}
+
+
+//===================================================================
+// BytecodeCompiler
+
+Bytecode BytecodeCompiler::compile(Program *program, bool safePoints) {
+    this->program = Bytecode();
+    this->program.matrices = 0;
+    markSafePoints = safePoints;
+    statement = -1;
+    integers.clear();
+    reals.clear();
+    texts.clear();
+    names.clear();
+    scopes.clear();
+    labels.clear();
+    jumps.clear();
+    boundAt = static_cast<size_t>(-1);
+
+    program->compile(*this);
+    emit(halt);
+    for (size_t k = 0; k != jumps.size(); k++)
+        this->program.code[jumps[k].first].c = labels[jumps[k].second];
+    return this->program;
+}
+
+void BytecodeCompiler::beginStatement(int statement) {
+    this->statement = statement;
+    if (markSafePoints) safePoint(statement);
+}
+
+int BytecodeCompiler::takeStatement() {
+    int taken = markSafePoints && scopes.size() == 1 ? statement : -1;
+    statement = -1;
+    return taken;
+}
+
+void BytecodeCompiler::safePoint(int statement, int row) {
+    SafePoint point;
+    point.statement = statement;
+    point.row = row;
+    size_t topLevel = scopes.size() > 1 ? scopes[1] : names.size();
+    point.variables.assign(names.begin(), names.begin() + topLevel);
+    emit(::safePoint, program.safePoints.size());
+    program.safePoints.push_back(point);
+}
+
+void BytecodeCompiler::beginScope() { scopes.push_back(names.size()); }
+
+void BytecodeCompiler::endScope() {
+    names.resize(scopes.back());
+    scopes.pop_back();
+}
+
+Operand BytecodeCompiler::declare(const string &name, ValueType type,
+                                  const string &elements) {
+    size_t first = scopes.empty() ? 0 : scopes.back();
+    for (size_t k = first; k != names.size(); k++)
+        if (names[k].first == name) throw name + " is declared twice";
+    Operand variable = temporary(type, elements);
+    variable.temporary = false;
+    names.push_back(make_pair(name, variable));
+    return variable;
+}
+
+Operand BytecodeCompiler::lookup(const string &name) {
+    for (size_t k = names.size(); k != 0; k--)
+        if (names[k - 1].first == name) return names[k - 1].second;
+    throw name + " is not declared";
+}
+
+Operand BytecodeCompiler::temporary(ValueType type, const string &elements) {
+    Operand value;
+    value.type = type;
+    value.elements = elements;
+    value.temporary = true;
+    if (type == matrixType) {
+        value.reg = program.matrices++;
+    } else if (type == stringType) {
+        value.reg = program.strings.size();
+        program.strings.push_back("");
+    } else {
+        value.reg = program.numbers.size();
+        Bytecode::number zero;
+        zero.i = 0;
+        program.numbers.push_back(zero);
+    }
+    return value;
+}
+
+Operand BytecodeCompiler::integer(long long value, ValueType type) {
+    Operand constant;
+    constant.type = type;
+    constant.temporary = false;
+    pair<int, long long> key(type, value);
+    if (integers.count(key) == 0) {
+        integers[key] = program.numbers.size();
+        Bytecode::number n;
+        n.i = value;
+        program.numbers.push_back(n);
+    }
+    constant.reg = integers[key];
+    return constant;
+}
+
+Operand BytecodeCompiler::real(double value, ValueType type) {
+    Operand constant;
+    constant.type = type;
+    constant.temporary = false;
+    pair<int, double> key(type, value);
+    if (reals.count(key) == 0) {
+        reals[key] = program.numbers.size();
+        Bytecode::number n;
+        n.d = value;
+        program.numbers.push_back(n);
+    }
+    constant.reg = reals[key];
+    return constant;
+}
+
+Operand BytecodeCompiler::text(const string &value) {
+    Operand constant;
+    constant.type = stringType;
+    constant.temporary = false;
+    if (texts.count(value) == 0) {
+        texts[value] = program.strings.size();
+        program.strings.push_back(value);
+    }
+    constant.reg = texts[value];
+    return constant;
+}
+
+int BytecodeCompiler::addFunction(mathFunction function) {
+    vector<mathFunction> &functions = program.functions;
+    size_t k = find(functions.begin(), functions.end(), function) -
+               functions.begin();
+    if (k == functions.size()) functions.push_back(function);
+    return k;
+}
+
+bool BytecodeCompiler::isConstant(const Operand &value) const {
+    if (!isNumber(value.type)) return false;
+    pair<int, long long> key(value.type, program.numbers[value.reg].i);
+    map<pair<int, long long>, int>::const_iterator i = integers.find(key);
+    if (i != integers.end() && i->second == value.reg) return true;
+    pair<int, double> realKey(value.type, program.numbers[value.reg].d);
+    map<pair<int, double>, int>::const_iterator r = reals.find(realKey);
+    return r != reals.end() && r->second == value.reg;
+}
+
+Operand BytecodeCompiler::convert(const Operand &value, ValueType type) {
+    if (value.type == type) return value;
+    if (!isNumber(value.type) || !isNumber(type))
+        throw "cannot convert a " + typeName(value.type) + " to a " +
+            typeName(type);
+
+    // constants are converted now, with the conversions of the Interpreter
+    if (isConstant(value)) {
+        const Bytecode::number &n = program.numbers[value.reg];
+        Value v;
+        v.type = value.type;
+        v.integer = n.i;
+        v.real = n.d;
+        Value converted = v.convertTo(type);
+        return isInteger(type) ? integer(converted.integer, type)
+                               : real(converted.real, type);
+    }
+
+    // bool, int and long values are all held as long longs, and floats as
+    // doubles, so widening them needs no instruction
+    Operand widened = value;
+    widened.type = type;
+    if ((isInteger(value.type) && type == longType) ||
+        (value.type == boolType && type == intType) ||
+        (value.type == floatType && type == doubleType))
+        return widened;
+
+    Opcode op;
+    if (isInteger(value.type)) {
+        op = type == floatType ? intToFloat
+                               : type == doubleType ? intToDouble
+                                                    : type == boolType
+                                                          ? intToBool
+                                                          : longToInt;
+    } else {
+        op = type == intType ? realToInt
+                             : type == longType ? realToLong
+                                                : type == boolType
+                                                      ? realToBool
+                                                      : doubleToFloat;
+    }
+    Operand converted = temporary(type);
+    emit(op, converted.reg, value.reg);
+    return converted;
+}
+
+Operand BytecodeCompiler::condition(const Operand &value) {
+    if (!isNumber(value.type))
+        throw "a " + typeName(value.type) + " is used as a condition";
+    return convert(value, boolType);
+}
+
+Operand BytecodeCompiler::arithmetic(char op, const Operand &a,
+                                     const Operand &b) {
+    if (a.type == matrixType && b.type == matrixType) {
+        if (a.elements != b.elements)
+            throw "matrices with " + a.elements + " and " + b.elements +
+                " elements cannot be " +
+                (op == '*' ? "multiplied" : "combined");
+        if (op == '*') {
+            // products of int8 matrices are summed in int
+            Operand product = temporary(
+                matrixType, a.elements == "int8" ? "int" : a.elements);
+            emit(multiplyMatrix, product.reg, a.reg, b.reg);
+            return product;
+        }
+        Operand result = temporary(matrixType, a.elements);
+        emit(combineMatrix, result.reg, a.reg, b.reg, op);
+        return result;
+    }
+    if ((a.type == matrixType && isNumber(b.type)) ||
+        (isNumber(a.type) && b.type == matrixType)) {
+        bool scalarLeft = b.type == matrixType;
+        const Operand &m = scalarLeft ? b : a;
+        const Operand &s = scalarLeft ? a : b;
+        if ((m.elements == "int" || m.elements == "int8") &&
+            !isInteger(s.type))
+            throw "a " + typeName(s.type) +
+                " cannot be combined with a matrix with " + m.elements +
+                " elements";
+        Operand result = temporary(matrixType, m.elements);
+        emit(scalarMatrix, result.reg, m.reg, s.reg, op,
+             (scalarLeft ? 1 : 0) | (isInteger(s.type) ? 0 : 2));
+        return result;
+    }
+    if (op == '+' && a.type == stringType && b.type == stringType) {
+        Operand result = temporary(stringType);
+        emit(concatString, result.reg, a.reg, b.reg);
+        return result;
+    }
+    if (!isNumber(a.type) || !isNumber(b.type))
+        throw string("cannot apply ") + op + " to a " + typeName(a.type) +
+            " and a " + typeName(b.type);
+
+    ValueType type = std::max(std::max(a.type, b.type), intType);
+    Operand x = convert(a, type), y = convert(b, type);
+    int offset = op == '+' ? 0 : op == '-' ? 1 : op == '*' ? 2 : 3;
+    Opcode base = type == intType ? addInt
+                                  : type == longType ? addLong
+                                                     : type == floatType
+                                                           ? addFloat
+                                                           : addDouble;
+
+    // s + m[i : j] and s - m[i : j] on float elements read the element
+    // in the same instruction
+    Instruction *last = size() == 0 ? NULL : &program.code.back();
+    if (type == floatType && offset < 2 && y.temporary && last != NULL &&
+        last->op == loadFloatElement && last->a == y.reg &&
+        boundAt != size()) {
+        Instruction load = *last;
+        last->op = offset == 0 ? addFloatElement : subtractFloatElement;
+        last->b = x.reg;
+        last->c = load.b;
+        last->d = load.c;
+        last->e = load.d;
+        return y;
+    }
+
+    Operand result = temporary(type);
+    emit(static_cast<Opcode>(base + offset), result.reg, x.reg, y.reg);
+    return result;
+}
+
+Operand BytecodeCompiler::compare(comparison kind, const Operand &a,
+                                  const Operand &b) {
+    Operand result = temporary(boolType);
+    if (a.type == stringType && b.type == stringType) {
+        emit(compareString, result.reg, a.reg, b.reg, kind);
+        return result;
+    }
+    if (!isNumber(a.type) || !isNumber(b.type))
+        throw "cannot compare a " + typeName(a.type) + " and a " +
+            typeName(b.type);
+
+    ValueType type = std::max(std::max(a.type, b.type), intType);
+    Operand x = convert(a, type), y = convert(b, type);
+    Opcode base = isInteger(type) ? lessInt : lessReal;
+    emit(static_cast<Opcode>(base + kind), result.reg, x.reg, y.reg);
+    return result;
+}
+
+void BytecodeCompiler::assign(const Operand &target, const Operand &value) {
+    if (target.type == matrixType) {
+        if (value.type != matrixType)
+            throw "cannot convert a " + typeName(value.type) + " to a matrix";
+        if (value.elements != target.elements)
+            emit(convertMatrix, target.reg, value.reg,
+                 elementCode(target.elements));
+        else if (value.reg != target.reg)
+            emit(value.temporary ? takeMatrix : copyMatrix, target.reg,
+                 value.reg);
+        return;
+    }
+    if (target.type == stringType) {
+        if (value.type != stringType)
+            throw "cannot convert a " + typeName(value.type) + " to a string";
+        if (value.reg != target.reg) emit(moveString, target.reg, value.reg);
+        return;
+    }
+
+    Operand converted = convert(value, target.type);
+    if (converted.reg == target.reg) return;
+    // the instruction that computed a temporary can write the target instead
+    Instruction *last = size() == 0 ? NULL : &program.code.back();
+    if (converted.temporary && last != NULL && writesNumber(last->op) &&
+        last->a == converted.reg && boundAt != size()) {
+        last->a = target.reg;
+        return;
+    }
+    emit(moveNumber, target.reg, converted.reg);
+}
+
+int BytecodeCompiler::newLabel() {
+    labels.push_back(-1);
+    return labels.size() - 1;
+}
+
+void BytecodeCompiler::bind(int label) {
+    labels[label] = size();
+    boundAt = size();
+}
+
+void BytecodeCompiler::branch(const Operand &condition, bool sense,
+                              int label) {
+    Instruction *last = size() == 0 ? NULL : &program.code.back();
+    if (condition.temporary && last != NULL && last->a == condition.reg &&
+        boundAt != size() && last->op >= lessInt &&
+        last->op <= notEqualReal) {
+        fuseBranch(size() - 1, sense, label);
+        return;
+    }
+    emitJump(sense ? jumpIfTrue : jumpIfFalse, condition.reg, 0, label);
+}
+
+/**
+ * turn the comparison at the given position into a jump if its result,
+ * or its negation when sense is false, is true. Integer comparisons are
+ * negated by reversing them; real ones are not, as comparisons with NaN
+ * are all false, so they have jumpUnless instructions of their own.
+ */
+void BytecodeCompiler::fuseBranch(size_t at, bool sense, int label) {
+    static const int reversed[] = {greaterEqual, greater, lessEqual,
+                                   less,         notEqual, equal};
+    Instruction &in = program.code[at];
+    bool integers = in.op <= notEqualInt;
+    int kind = in.op - (integers ? lessInt : lessReal);
+    Opcode op;
+    if (integers)
+        op = static_cast<Opcode>(jumpIfLessInt +
+                                 (sense ? kind : reversed[kind]));
+    else
+        op = static_cast<Opcode>((sense ? jumpIfLessReal : jumpUnlessLessReal) +
+                                 kind);
+    in.op = op;
+    in.a = in.b;
+    in.b = in.c;
+    in.c = 0;
+    jumps.push_back(make_pair(at, label));
+}
+
+void BytecodeCompiler::emit(Opcode op, int a, int b, int c, int d, int e,
+                            int f) {
+    Instruction in = {op, a, b, c, d, e, f};
+    program.code.push_back(in);
+}
+
+void BytecodeCompiler::emitJump(Opcode op, int a, int b, int label) {
+    jumps.push_back(make_pair(size(), label));
+    emit(op, a, b);
+}
+
+
+//===================================================================
+// VirtualMachine
+
+namespace {
+
+void outside(long long i, long long j, long long rows, long long cols) {
+    throw "element (" + to_string(i) + ", " + to_string(j) +
+        ") is outside a matrix with dimensions " + to_string(rows) + "x" +
+        to_string(cols);
+}
+
+}  // namespace
+
+VirtualMachine::VirtualMachine(ostream &output) : out(output) {}
+
+int VirtualMachine::run(Program *program) {
+    try {
+        BytecodeCompiler compiler;
+        execute(compiler.compile(program));
+    } catch (string error) {
+        out.flush();
+        cerr << "ERROR, " << error << endl;
+        return 1;
+    }
+    out.flush();
+    return 0;
+}
+
+Value VirtualMachine::value(const Operand &reg) const {
+    switch (reg.type) {
+        case boolType: return Value::ofBool(numbers[reg.reg].i != 0);
+        case intType: return Value::ofInt(numbers[reg.reg].i);
+        case longType: return Value::ofLong(numbers[reg.reg].i);
+        case floatType: return Value::ofFloat(numbers[reg.reg].d);
+        case doubleType: return Value::ofDouble(numbers[reg.reg].d);
+        case stringType: return Value::ofString(strings[reg.reg]);
+        default: return Value::ofMatrix(matrices[reg.reg].value);
+    }
+}
+
+void VirtualMachine::setMatrix(matrixRegister &reg,
+                               const shared_ptr<MatrixValue> &m) {
+    reg.value = m;
+    reg.values = m->values();
+    reg.rows = m->numRows();
+    reg.cols = m->numCols();
+}
+
+const SafePoint *VirtualMachine::execute(
+    const Bytecode &program,
+    const function<bool(const SafePoint &)> &stopAt) {
+    numbers = program.numbers;
+    strings = program.strings;
+    matrices.assign(program.matrices, matrixRegister());
+    Bytecode::number *n = numbers.data();
+    string *s = strings.data();
+    matrixRegister *m = matrices.data();
+    const Instruction *code = program.code.data();
+    const Instruction *pc = code;
+
+    static const void *const targets[] = {
+#define BYTECODE_TARGET(name) &&op_##name,
+        BYTECODE_OPERATIONS(BYTECODE_TARGET)
+#undef BYTECODE_TARGET
+    };
+#define NEXT goto *targets[(++pc)->op]
+#define JUMP(target)                  \
+    do {                              \
+        pc = code + (target);         \
+        goto *targets[pc->op];        \
+    } while (0)
+#define INT32(value) static_cast<int32_t>(static_cast<unsigned long long>(value))
+#define ELEMENT(type, reg, i, j)                                           \
+    ({                                                                     \
+        const matrixRegister &e = m[reg];                                  \
+        long long row = (i), col = (j);                                    \
+        if (static_cast<unsigned long long>(row) >=                        \
+                static_cast<unsigned long long>(e.rows) ||                 \
+            static_cast<unsigned long long>(col) >=                        \
+                static_cast<unsigned long long>(e.cols))                   \
+            outside(row, col, e.rows, e.cols);                             \
+        static_cast<type *>(e.values) + row * e.cols + col;                \
+    })
+
+    goto *targets[pc->op];
+
+op_halt:
+    return NULL;
+op_moveNumber:
+    n[pc->a] = n[pc->b];
+    NEXT;
+op_moveString:
+    s[pc->a] = s[pc->b];
+    NEXT;
+op_copyMatrix:
+    setMatrix(m[pc->a], m[pc->b].value->copy());
+    NEXT;
+op_takeMatrix:
+    m[pc->a] = m[pc->b];
+    m[pc->b] = matrixRegister();
+    NEXT;
+op_convertMatrix:
+    setMatrix(m[pc->a], m[pc->b].value->convertTo(elementNames[pc->c]));
+    NEXT;
+op_clearString:
+    s[pc->a].clear();
+    NEXT;
+
+op_intToFloat:
+    n[pc->a].d = static_cast<float>(n[pc->b].i);
+    NEXT;
+op_intToDouble:
+    n[pc->a].d = static_cast<double>(n[pc->b].i);
+    NEXT;
+op_realToInt:
+    n[pc->a].i = INT32(static_cast<long long>(n[pc->b].d));
+    NEXT;
+op_realToLong:
+    n[pc->a].i = static_cast<long long>(n[pc->b].d);
+    NEXT;
+op_realToBool:
+    n[pc->a].i = n[pc->b].d != 0;
+    NEXT;
+op_intToBool:
+    n[pc->a].i = n[pc->b].i != 0;
+    NEXT;
+op_longToInt:
+    n[pc->a].i = INT32(n[pc->b].i);
+    NEXT;
+op_doubleToFloat:
+    n[pc->a].d = static_cast<float>(n[pc->b].d);
+    NEXT;
+
+    // ints are computed as unsigned long longs, which wrap around, and
+    // then cut to 32 bits
+op_addInt:
+    n[pc->a].i = INT32(static_cast<unsigned long long>(n[pc->b].i) + n[pc->c].i);
+    NEXT;
+op_subtractInt:
+    n[pc->a].i = INT32(static_cast<unsigned long long>(n[pc->b].i) - n[pc->c].i);
+    NEXT;
+op_multiplyInt:
+    n[pc->a].i = INT32(static_cast<unsigned long long>(n[pc->b].i) * n[pc->c].i);
+    NEXT;
+op_divideInt:
+    if (n[pc->c].i == 0) throw string("integer division by zero");
+    n[pc->a].i = INT32(n[pc->b].i / n[pc->c].i);
+    NEXT;
+op_addLong:
+    n[pc->a].i = static_cast<long long>(
+        static_cast<unsigned long long>(n[pc->b].i) + n[pc->c].i);
+    NEXT;
+op_subtractLong:
+    n[pc->a].i = static_cast<long long>(
+        static_cast<unsigned long long>(n[pc->b].i) - n[pc->c].i);
+    NEXT;
+op_multiplyLong:
+    n[pc->a].i = static_cast<long long>(
+        static_cast<unsigned long long>(n[pc->b].i) * n[pc->c].i);
+    NEXT;
+op_divideLong:
+    if (n[pc->c].i == 0) throw string("integer division by zero");
+    n[pc->a].i = n[pc->b].i / n[pc->c].i;
+    NEXT;
+
+    // floats are exact in doubles, and rounding the double result to float
+    // gives the float result for these operations
+op_addFloat:
+    n[pc->a].d = static_cast<float>(n[pc->b].d + n[pc->c].d);
+    NEXT;
+op_subtractFloat:
+    n[pc->a].d = static_cast<float>(n[pc->b].d - n[pc->c].d);
+    NEXT;
+op_multiplyFloat:
+    n[pc->a].d = static_cast<float>(n[pc->b].d * n[pc->c].d);
+    NEXT;
+op_divideFloat:
+    n[pc->a].d = static_cast<float>(n[pc->b].d / n[pc->c].d);
+    NEXT;
+op_addDouble:
+    n[pc->a].d = n[pc->b].d + n[pc->c].d;
+    NEXT;
+op_subtractDouble:
+    n[pc->a].d = n[pc->b].d - n[pc->c].d;
+    NEXT;
+op_multiplyDouble:
+    n[pc->a].d = n[pc->b].d * n[pc->c].d;
+    NEXT;
+op_divideDouble:
+    n[pc->a].d = n[pc->b].d / n[pc->c].d;
+    NEXT;
+op_notBool:
+    n[pc->a].i = !n[pc->b].i;
+    NEXT;
+
+op_lessInt:
+    n[pc->a].i = n[pc->b].i < n[pc->c].i;
+    NEXT;
+op_lessEqualInt:
+    n[pc->a].i = n[pc->b].i <= n[pc->c].i;
+    NEXT;
+op_greaterInt:
+    n[pc->a].i = n[pc->b].i > n[pc->c].i;
+    NEXT;
+op_greaterEqualInt:
+    n[pc->a].i = n[pc->b].i >= n[pc->c].i;
+    NEXT;
+op_equalInt:
+    n[pc->a].i = n[pc->b].i == n[pc->c].i;
+    NEXT;
+op_notEqualInt:
+    n[pc->a].i = n[pc->b].i != n[pc->c].i;
+    NEXT;
+op_lessReal:
+    n[pc->a].i = n[pc->b].d < n[pc->c].d;
+    NEXT;
+op_lessEqualReal:
+    n[pc->a].i = n[pc->b].d <= n[pc->c].d;
+    NEXT;
+op_greaterReal:
+    n[pc->a].i = n[pc->b].d > n[pc->c].d;
+    NEXT;
+op_greaterEqualReal:
+    n[pc->a].i = n[pc->b].d >= n[pc->c].d;
+    NEXT;
+op_equalReal:
+    n[pc->a].i = n[pc->b].d == n[pc->c].d;
+    NEXT;
+op_notEqualReal:
+    n[pc->a].i = n[pc->b].d != n[pc->c].d;
+    NEXT;
+op_compareString: {
+    int order = s[pc->b].compare(s[pc->c]);
+    static const int results[][3] = {{1, 0, 0}, {1, 1, 0}, {0, 0, 1},
+                                     {0, 1, 1}, {0, 1, 0}, {1, 0, 1}};
+    n[pc->a].i = results[pc->d][order < 0 ? 0 : order == 0 ? 1 : 2];
+    NEXT;
+}
+op_concatString:
+    s[pc->a] = s[pc->b] + s[pc->c];
+    NEXT;
+
+op_jump:
+    JUMP(pc->c);
+op_jumpIfTrue:
+    if (n[pc->a].i) JUMP(pc->c);
+    NEXT;
+op_jumpIfFalse:
+    if (!n[pc->a].i) JUMP(pc->c);
+    NEXT;
+op_jumpIfLessInt:
+    if (n[pc->a].i < n[pc->b].i) JUMP(pc->c);
+    NEXT;
+op_jumpIfLessEqualInt:
+    if (n[pc->a].i <= n[pc->b].i) JUMP(pc->c);
+    NEXT;
+op_jumpIfGreaterInt:
+    if (n[pc->a].i > n[pc->b].i) JUMP(pc->c);
+    NEXT;
+op_jumpIfGreaterEqualInt:
+    if (n[pc->a].i >= n[pc->b].i) JUMP(pc->c);
+    NEXT;
+op_jumpIfEqualInt:
+    if (n[pc->a].i == n[pc->b].i) JUMP(pc->c);
+    NEXT;
+op_jumpIfNotEqualInt:
+    if (n[pc->a].i != n[pc->b].i) JUMP(pc->c);
+    NEXT;
+op_jumpIfLessReal:
+    if (n[pc->a].d < n[pc->b].d) JUMP(pc->c);
+    NEXT;
+op_jumpIfLessEqualReal:
+    if (n[pc->a].d <= n[pc->b].d) JUMP(pc->c);
+    NEXT;
+op_jumpIfGreaterReal:
+    if (n[pc->a].d > n[pc->b].d) JUMP(pc->c);
+    NEXT;
+op_jumpIfGreaterEqualReal:
+    if (n[pc->a].d >= n[pc->b].d) JUMP(pc->c);
+    NEXT;
+op_jumpIfEqualReal:
+    if (n[pc->a].d == n[pc->b].d) JUMP(pc->c);
+    NEXT;
+op_jumpIfNotEqualReal:
+    if (n[pc->a].d != n[pc->b].d) JUMP(pc->c);
+    NEXT;
+op_jumpUnlessLessReal:
+    if (!(n[pc->a].d < n[pc->b].d)) JUMP(pc->c);
+    NEXT;
+op_jumpUnlessLessEqualReal:
+    if (!(n[pc->a].d <= n[pc->b].d)) JUMP(pc->c);
+    NEXT;
+op_jumpUnlessGreaterReal:
+    if (!(n[pc->a].d > n[pc->b].d)) JUMP(pc->c);
+    NEXT;
+op_jumpUnlessGreaterEqualReal:
+    if (!(n[pc->a].d >= n[pc->b].d)) JUMP(pc->c);
+    NEXT;
+op_jumpUnlessEqualReal:
+    if (!(n[pc->a].d == n[pc->b].d)) JUMP(pc->c);
+    NEXT;
+op_jumpUnlessNotEqualReal:
+    if (!(n[pc->a].d != n[pc->b].d)) JUMP(pc->c);
+    NEXT;
+
+op_incrementInt:
+    n[pc->a].i = INT32(n[pc->a].i + 1);
+    NEXT;
+op_incrementJumpIfLessEqualInt: {
+    long long k = INT32(n[pc->a].i + 1);
+    n[pc->a].i = k;
+    if (k <= n[pc->b].i) JUMP(pc->c);
+    NEXT;
+}
+op_incrementJumpIfLessInt: {
+    long long k = INT32(n[pc->a].i + 1);
+    n[pc->a].i = k;
+    if (k < n[pc->b].i) JUMP(pc->c);
+    NEXT;
+}
+
+op_newMatrix:
+    setMatrix(m[pc->a], makeMatrix(elementNames[pc->d], n[pc->b].i,
+                                   n[pc->c].i));
+    NEXT;
+op_loadFloatElement:
+    n[pc->a].d = *ELEMENT(float, pc->b, n[pc->c].i, n[pc->d].i);
+    NEXT;
+op_loadDoubleElement:
+    n[pc->a].d = *ELEMENT(double, pc->b, n[pc->c].i, n[pc->d].i);
+    NEXT;
+op_loadIntElement:
+    n[pc->a].i = *ELEMENT(int32_t, pc->b, n[pc->c].i, n[pc->d].i);
+    NEXT;
+op_loadInt8Element:
+    n[pc->a].i = *ELEMENT(int8_t, pc->b, n[pc->c].i, n[pc->d].i);
+    NEXT;
+op_storeFloatElement:
+    *ELEMENT(float, pc->a, n[pc->b].i, n[pc->c].i) = n[pc->d].d;
+    NEXT;
+op_storeDoubleElement:
+    *ELEMENT(double, pc->a, n[pc->b].i, n[pc->c].i) = n[pc->d].d;
+    NEXT;
+op_storeIntElement:
+    *ELEMENT(int32_t, pc->a, n[pc->b].i, n[pc->c].i) = n[pc->d].i;
+    NEXT;
+op_storeInt8Element:
+    *ELEMENT(int8_t, pc->a, n[pc->b].i, n[pc->c].i) = n[pc->d].i;
+    NEXT;
+op_addFloatElement:
+    n[pc->a].d = static_cast<float>(
+        n[pc->b].d + *ELEMENT(float, pc->c, n[pc->d].i, n[pc->e].i));
+    NEXT;
+op_subtractFloatElement:
+    n[pc->a].d = static_cast<float>(
+        n[pc->b].d - *ELEMENT(float, pc->c, n[pc->d].i, n[pc->e].i));
+    NEXT;
+
+op_multiplyMatrix:
+    setMatrix(m[pc->a], m[pc->b].value->multiply(*m[pc->c].value));
+    NEXT;
+op_combineMatrix:
+    setMatrix(m[pc->a], m[pc->b].value->combine(static_cast<char>(pc->d),
+                                                *m[pc->c].value));
+    NEXT;
+op_scalarMatrix: {
+    Value scalar = pc->e & 2 ? Value::ofDouble(n[pc->c].d)
+                             : Value::ofLong(n[pc->c].i);
+    setMatrix(m[pc->a], m[pc->b].value->combine(static_cast<char>(pc->d),
+                                                scalar, pc->e & 1));
+    NEXT;
+}
+op_transposeMatrix:
+    setMatrix(m[pc->a], m[pc->b].value->transpose());
+    NEXT;
+op_sliceMatrix:
+    setMatrix(m[pc->a], m[pc->b].value->slice(n[pc->c].i, n[pc->d].i,
+                                              n[pc->e].i, n[pc->f].i));
+    NEXT;
+op_reduceMatrix: {
+    Value result = m[pc->b].value->reduce(reductions[pc->c]);
+    if (pc->d)
+        n[pc->a].d = result.real;
+    else
+        n[pc->a].i = result.integer;
+    NEXT;
+}
+op_numRows:
+    n[pc->a].i = m[pc->b].rows;
+    NEXT;
+op_numCols:
+    n[pc->a].i = m[pc->b].cols;
+    NEXT;
+op_readMatrix:
+    setMatrix(m[pc->a], readMatrixFile(s[pc->b]));
+    NEXT;
+op_callMath:
+    n[pc->a].d = program.functions[pc->c](n[pc->b].d);
+    NEXT;
+
+op_printInt:
+    out << n[pc->a].i;
+    NEXT;
+op_printReal:
+    out << n[pc->a].d;
+    NEXT;
+op_printString:
+    out << s[pc->a];
+    NEXT;
+op_printMatrix:
+    m[pc->a].value->print(out);
+    NEXT;
+op_safePoint:
+    if (stopAt && stopAt(program.safePoints[pc->a]))
+        return &program.safePoints[pc->a];
+    NEXT;
+
+#undef NEXT
+#undef JUMP
+#undef INT32
+#undef ELEMENT
+}
+
+
+//===================================================================
+// Compiling the AST
+
+void Program::compile(BytecodeCompiler &compiler) {
+    compiler.beginScope();
+    int statement = 0;
+    for (SeqStmts *seq = dynamic_cast<SeqStmts *>(stmts); seq != NULL;
+         seq = dynamic_cast<SeqStmts *>(seq->rest()), statement++) {
+        compiler.beginStatement(statement);
+        seq->first()->compile(compiler);
+    }
+    compiler.endScope();
+}
+
+void EmptyStmts::compile(BytecodeCompiler &) {}
+
+void SeqStmts::compile(BytecodeCompiler &compiler) {
+    st1->compile(compiler);
+    stmts->compile(compiler);
+}
+
+void DeclStmt::compile(BytecodeCompiler &compiler) { decl->compile(compiler); }
+
+void NestedStmt::compile(BytecodeCompiler &compiler) {
+    compiler.beginScope();
+    stmts->compile(compiler);
+    compiler.endScope();
+}
+
+void IfStmt::compile(BytecodeCompiler &compiler) {
+    int end = compiler.newLabel();
+    compiler.branch(compiler.condition(ex1->compile(compiler)), false, end);
+    st1->compile(compiler);
+    compiler.bind(end);
+}
+
+void IfElseStmt::compile(BytecodeCompiler &compiler) {
+    int otherwise = compiler.newLabel(), end = compiler.newLabel();
+    compiler.branch(compiler.condition(ex1->compile(compiler)), false,
+                    otherwise);
+    st1->compile(compiler);
+    compiler.emitJump(jump, 0, 0, end);
+    compiler.bind(otherwise);
+    st2->compile(compiler);
+    compiler.bind(end);
+}
+
+void AssignStmt::compile(BytecodeCompiler &compiler) {
+    Operand value = ex1->compile(compiler);
+    compiler.assign(compiler.lookup(varName), value);
+}
+
+void RangeAssignStmt::compile(BytecodeCompiler &compiler) {
+    Operand m = compiler.lookup(varName);
+    if (m.type != matrixType) throw varName + " is not a matrix";
+    Operand i = compiler.convert(ex1->compile(compiler), intType);
+    Operand j = compiler.convert(ex2->compile(compiler), intType);
+    Operand value = compiler.convert(ex3->compile(compiler),
+                                     scalarType(m.elements));
+    compiler.emit(static_cast<Opcode>(storeFloatElement +
+                                      elementCode(m.elements)),
+                  m.reg, i.reg, j.reg, value.reg);
+}
+
+void PrintStmt::compile(BytecodeCompiler &compiler) {
+    Operand value = ex1->compile(compiler);
+    Opcode op = isInteger(value.type)
+                    ? printInt
+                    : isNumber(value.type)
+                          ? printReal
+                          : value.type == stringType ? printString
+                                                     : printMatrix;
+    compiler.emit(op, value.reg);
+}
+
+/**
+ * for (k = ex1; k <= ex2; k++), with ex2 evaluated before each iteration.
+ * An int counter is tested at the bottom of the loop, with one
+ * incrementJumpIfLessEqualInt when ex2 is a variable or constant.
+ */
+void RepeatStmt::compile(BytecodeCompiler &compiler) {
+    Operand k = compiler.lookup(varName);
+    compiler.assign(k, ex1->compile(compiler));
+    int top = compiler.newLabel(), body = compiler.newLabel(),
+        exit = compiler.newLabel();
+    compiler.bind(top);
+    size_t start = compiler.size();
+    Operand bound = ex2->compile(compiler);
+
+    if (k.type == intType && isInteger(bound.type)) {
+        bool simple = compiler.size() == start;
+        compiler.emitJump(jumpIfGreaterInt, k.reg, bound.reg, exit);
+        compiler.bind(body);
+        st1->compile(compiler);
+        if (simple) {
+            compiler.emitJump(incrementJumpIfLessEqualInt, k.reg, bound.reg,
+                              body);
+        } else {
+            compiler.emit(incrementInt, k.reg);
+            bound = ex2->compile(compiler);
+            compiler.emitJump(jumpIfLessEqualInt, k.reg, bound.reg, body);
+        }
+        compiler.bind(exit);
+        return;
+    }
+
+    compiler.branch(compiler.compare(BytecodeCompiler::lessEqual, k, bound),
+                    false, exit);
+    st1->compile(compiler);
+    compiler.assign(k, compiler.arithmetic('+', k, compiler.integer(1)));
+    compiler.emitJump(jump, 0, 0, top);
+    compiler.bind(exit);
+}
+
+void WhileStmt::compile(BytecodeCompiler &compiler) {
+    int body = compiler.newLabel(), test = compiler.newLabel();
+    compiler.emitJump(jump, 0, 0, test);
+    compiler.bind(body);
+    st1->compile(compiler);
+    compiler.bind(test);
+    compiler.branch(compiler.condition(ex1->compile(compiler)), true, body);
+}
+
+void SemicolonStmt::compile(BytecodeCompiler &) {}
+
+void IntDecl::compile(BytecodeCompiler &compiler) {
+    compiler.assign(compiler.declare(varName, intType), compiler.integer(0));
+}
+
+void FloatDecl::compile(BytecodeCompiler &compiler) {
+    compiler.assign(compiler.declare(varName, floatType),
+                    compiler.real(0, floatType));
+}
+
+void StringDecl::compile(BytecodeCompiler &compiler) {
+    compiler.emit(clearString, compiler.declare(varName, stringType).reg);
+}
+
+void BooleanDecl::compile(BytecodeCompiler &compiler) {
+    compiler.assign(compiler.declare(varName, boolType),
+                    compiler.integer(0, boolType));
+}
+
+// the loops over i and j test their bounds at the bottom, with one
+// incrementJumpIfLessInt each
+void MatrixLongDecl::compile(BytecodeCompiler &compiler) {
+    int statement = compiler.takeStatement();
+    Operand rows = compiler.convert(ex1->compile(compiler), intType);
+    Operand cols = compiler.convert(ex2->compile(compiler), intType);
+    string elements = sparse ? "float" : declaredElements(elementType);
+    Operand m = compiler.declare(varName1, matrixType, elements);
+    compiler.emit(newMatrix, m.reg, rows.reg, cols.reg, elementCode(elements));
+    Operand numRows = compiler.temporary(intType);
+    Operand numCols = compiler.temporary(intType);
+    compiler.emit(::numRows, numRows.reg, m.reg);
+    compiler.emit(::numCols, numCols.reg, m.reg);
+
+    compiler.beginScope();
+    Operand i = compiler.declare(varName2, intType);
+    compiler.assign(i, compiler.integer(0));
+    int rowLoop = compiler.newLabel(), rowExit = compiler.newLabel();
+    compiler.emitJump(jumpIfGreaterEqualInt, i.reg, numRows.reg, rowExit);
+    compiler.bind(rowLoop);
+    if (statement >= 0) compiler.safePoint(statement, i.reg);
+
+    compiler.beginScope();
+    Operand j = compiler.declare(varName3, intType);
+    compiler.assign(j, compiler.integer(0));
+    int colLoop = compiler.newLabel(), colExit = compiler.newLabel();
+    compiler.emitJump(jumpIfGreaterEqualInt, j.reg, numCols.reg, colExit);
+    compiler.bind(colLoop);
+    Operand value =
+        compiler.convert(ex3->compile(compiler), scalarType(elements));
+    compiler.emit(static_cast<Opcode>(storeFloatElement +
+                                      elementCode(elements)),
+                  m.reg, i.reg, j.reg, value.reg);
+    compiler.emitJump(incrementJumpIfLessInt, j.reg, numCols.reg, colLoop);
+    compiler.bind(colExit);
+    compiler.endScope();
+
+    compiler.emitJump(incrementJumpIfLessInt, i.reg, numRows.reg, rowLoop);
+    compiler.bind(rowExit);
+    compiler.endScope();
+}
+
+void MatrixShortDecl::compile(BytecodeCompiler &compiler) {
+    Operand value = ex1->compile(compiler);
+    string elements = sparse ? "float" : declaredElements(elementType);
+    compiler.assign(compiler.declare(varName, matrixType, elements), value);
+}
+
+Operand VarNameExpr::compile(BytecodeCompiler &compiler) {
+    return compiler.lookup(varName);
+}
+
+Operand IntExpr::compile(BytecodeCompiler &compiler) {
+    return compiler.integer(val);
+}
+
+// the constant is read back as generated code writes it, with six digits
+// after the point
+Operand FloatExpr::compile(BytecodeCompiler &compiler) {
+    return compiler.real(stod(to_string(val)));
+}
+
+Operand StringExpr::compile(BytecodeCompiler &compiler) {
+    return compiler.text(literalText(val));
+}
+
+Operand TrueExpr::compile(BytecodeCompiler &compiler) {
+    return compiler.integer(1, boolType);
+}
+
+Operand FalseExpr::compile(BytecodeCompiler &compiler) {
+    return compiler.integer(0, boolType);
+}
+
+Operand MultiplyExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.arithmetic('*', a, ex2->compile(compiler));
+}
+
+Operand DevideExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.arithmetic('/', a, ex2->compile(compiler));
+}
+
+Operand AddExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.arithmetic('+', a, ex2->compile(compiler));
+}
+
+Operand SubtractExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.arithmetic('-', a, ex2->compile(compiler));
+}
+
+Operand GreaterExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.compare(BytecodeCompiler::greater, a,
+                            ex2->compile(compiler));
+}
+
+Operand GreaterEqualExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.compare(BytecodeCompiler::greaterEqual, a,
+                            ex2->compile(compiler));
+}
+
+Operand LessExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.compare(BytecodeCompiler::less, a,
+                            ex2->compile(compiler));
+}
+
+Operand LessEqualExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.compare(BytecodeCompiler::lessEqual, a,
+                            ex2->compile(compiler));
+}
+
+Operand EqualEqualExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.compare(BytecodeCompiler::equal, a,
+                            ex2->compile(compiler));
+}
+
+Operand NotEqualExpr::compile(BytecodeCompiler &compiler) {
+    Operand a = ex1->compile(compiler);
+    return compiler.compare(BytecodeCompiler::notEqual, a,
+                            ex2->compile(compiler));
+}
+
+namespace {
+
+// a && b or a || b, skipping b when a decides the result
+Operand shortCircuit(BytecodeCompiler &compiler, Expr *a, Expr *b,
+                     bool skipIf) {
+    Operand result = compiler.temporary(boolType);
+    int end = compiler.newLabel();
+    compiler.assign(result, compiler.condition(a->compile(compiler)));
+    Operand decided = result;
+    decided.temporary = false;
+    compiler.branch(decided, skipIf, end);
+    compiler.assign(result, compiler.condition(b->compile(compiler)));
+    compiler.bind(end);
+    return result;
+}
+
+}  // namespace
+
+Operand AndExpr::compile(BytecodeCompiler &compiler) {
+    return shortCircuit(compiler, ex1, ex2, false);
+}
+
+Operand OrExpr::compile(BytecodeCompiler &compiler) {
+    return shortCircuit(compiler, ex1, ex2, true);
+}
+
+Operand MatrixExpr::compile(BytecodeCompiler &compiler) {
+    Operand m = compiler.lookup(varName);
+    if (m.type != matrixType) throw varName + " is not a matrix";
+    Operand i = compiler.convert(ex1->compile(compiler), intType);
+    Operand j = compiler.convert(ex2->compile(compiler), intType);
+    Operand element = compiler.temporary(scalarType(m.elements));
+    compiler.emit(static_cast<Opcode>(loadFloatElement +
+                                      elementCode(m.elements)),
+                  element.reg, m.reg, i.reg, j.reg);
+    return element;
+}
+
+Operand MatrixSliceExpr::compile(BytecodeCompiler &compiler) {
+    Operand m = compiler.lookup(varName);
+    if (m.type != matrixType) throw varName + " is not a matrix";
+    Operand rowFirst = compiler.convert(firstRow->compile(compiler), intType);
+    Operand rowLast =
+        lastRow != NULL ? compiler.convert(lastRow->compile(compiler), intType)
+                        : rowFirst;
+    Operand colFirst = compiler.convert(firstCol->compile(compiler), intType);
+    Operand colLast =
+        lastCol != NULL ? compiler.convert(lastCol->compile(compiler), intType)
+                        : colFirst;
+    Operand block = compiler.temporary(matrixType, m.elements);
+    compiler.emit(sliceMatrix, block.reg, m.reg, rowFirst.reg, rowLast.reg,
+                  colFirst.reg, colLast.reg);
+    return block;
+}
+
+// the builtins of generated code: the dimensions, transpose and
+// reductions of matrices, matrixRead, and functions of <cmath>
+Operand NestedOrFunctionCallExpr::compile(BytecodeCompiler &compiler) {
+    Operand arg = ex1->compile(compiler);
+    if (varName == "matrixRead") {
+        if (arg.type != stringType)
+            throw string("matrixRead needs a file name");
+        Operand m = compiler.temporary(matrixType, "float");
+        compiler.emit(readMatrix, m.reg, arg.reg);
+        return m;
+    }
+
+    int reduction = -1;
+    for (int k = 0; k != 5; k++)
+        if (varName == reductions[k]) reduction = k;
+    if (varName == "numRows" || varName == "numCols" ||
+        varName == "transpose" || reduction >= 0) {
+        if (arg.type != matrixType)
+            throw varName + " needs a matrix, not a " + typeName(arg.type);
+        if (varName == "transpose") {
+            Operand t = compiler.temporary(matrixType, arg.elements);
+            compiler.emit(transposeMatrix, t.reg, arg.reg);
+            return t;
+        }
+        if (reduction < 0) {
+            Operand size = compiler.temporary(intType);
+            compiler.emit(varName == "numRows" ? numRows : numCols, size.reg,
+                          arg.reg);
+            return size;
+        }
+        // sums are accumulated as in elementTraits; means and norms are
+        // double, and minima and maxima have the type of the elements
+        ValueType type;
+        if (varName == "mean" || varName == "norm")
+            type = doubleType;
+        else if (varName == "sum" && arg.elements == "int")
+            type = longType;
+        else
+            type = scalarType(arg.elements);
+        Operand result = compiler.temporary(type);
+        compiler.emit(reduceMatrix, result.reg, arg.reg, reduction,
+                      !isInteger(type));
+        return result;
+    }
+
+    mathFunction function = findMathFunction(varName);
+    if (function == NULL) throw varName + " is not a function";
+    Operand x = compiler.convert(arg, doubleType);
+    Operand result = compiler.temporary(doubleType);
+    compiler.emit(callMath, result.reg, x.reg,
+                  compiler.addFunction(function));
+    return result;
+}
+
+Operand NestedExpr::compile(BytecodeCompiler &compiler) {
+    return ex1->compile(compiler);
+}
+
+Operand LetExpr::compile(BytecodeCompiler &compiler) {
+    compiler.beginScope();
+    stmts->compile(compiler);
+    Operand value = ex1->compile(compiler);
+    compiler.endScope();
+    return value;
+}
+
+/**
+ * c ? a : b converts the value of either branch to the type of both,
+ * which is only known once both are compiled, so the then branch is
+ * converted after the else branch:
+ *   if not c goto otherwise; a; goto convert;
+ *   otherwise: b; result = b; goto end;
+ *   convert: result = a; end:
+ */
+Operand IfExpr::compile(BytecodeCompiler &compiler) {
+    int otherwise = compiler.newLabel(), convert = compiler.newLabel(),
+        end = compiler.newLabel();
+    compiler.branch(compiler.condition(ex1->compile(compiler)), false,
+                    otherwise);
+    Operand a = ex2->compile(compiler);
+    compiler.emitJump(jump, 0, 0, convert);
+    compiler.bind(otherwise);
+    Operand b = ex3->compile(compiler);
+
+    ValueType type = a.type;
+    if (a.type != b.type) {
+        if (!isNumber(a.type) || !isNumber(b.type))
+            throw "the branches of an if have types " + typeName(a.type) +
+                " and " + typeName(b.type);
+        type = std::max(std::max(a.type, b.type), intType);
+    }
+    if (type == matrixType && a.elements != b.elements)
+        throw "the branches of an if are matrices with " + a.elements +
+            " and " + b.elements + " elements";
+
+    Operand result = compiler.temporary(type, a.elements);
+    compiler.assign(result, b);
+    compiler.emitJump(jump, 0, 0, end);
+    compiler.bind(convert);
+    compiler.assign(result, a);
+    compiler.bind(end);
+    return result;
+}
+
+Operand NotExpr::compile(BytecodeCompiler &compiler) {
+    Operand value = compiler.condition(ex1->compile(compiler));
+    Operand result = compiler.temporary(boolType);
+    compiler.emit(notBool, result.reg, value.reg);
+    return result;
+}
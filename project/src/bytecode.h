@@ -0,0 +1,318 @@
+/***
+ * Bytecode: a CDAL program compiled to instructions for a register
+ * machine, which runs scalar code several times faster than walking the
+ * AST with an Interpreter.
+ *
+ * The types of all CDAL expressions are known when compiling, as they are
+ * when translating to C++, so each instruction works on one type: addInt
+ * wraps like int, addFloat rounds like float, and loadFloatElement reads
+ * a float matrix element. Variables are resolved to registers when
+ * compiling, constants are preloaded into registers of their own, and no
+ * instruction looks up a name or tests a type while running.
+ *
+ * Common sequences are fused into superinstructions:
+ *  - m[i : j] is one load, reading its indices straight from the
+ *    registers of i and j, and s = s + m[i : j] on float matrices is one
+ *    addFloatElement;
+ *  - comparisons followed by a conditional jump are one compare and jump;
+ *  - the back edge of a repeat or comprehension loop over an int is one
+ *    increment, compare and jump;
+ *  - an instruction that computes the value of an assignment writes the
+ *    variable itself rather than a temporary that is then moved.
+ * Matrix operations other than element access call the same kernels as
+ * the Interpreter, through MatrixValue.
+ *
+ * The machine dispatches with computed gotos, a GCC and Clang extension
+ * that the rest of the runtime's compilers also support.
+ */
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "./interpreter.h"
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+class Program;
+
+// the instructions; the operands a to f are described in bytecode.cpp
+#define BYTECODE_OPERATIONS(X)                                             \
+    X(halt) X(moveNumber) X(moveString) X(copyMatrix) X(takeMatrix)        \
+    X(convertMatrix) X(clearString) X(intToFloat) X(intToDouble)           \
+    X(realToInt) X(realToLong) X(realToBool) X(intToBool) X(longToInt)     \
+    X(doubleToFloat) X(addInt) X(subtractInt) X(multiplyInt) X(divideInt)  \
+    X(addLong) X(subtractLong) X(multiplyLong) X(divideLong) X(addFloat)   \
+    X(subtractFloat) X(multiplyFloat) X(divideFloat) X(addDouble)          \
+    X(subtractDouble) X(multiplyDouble) X(divideDouble) X(notBool)         \
+    X(lessInt) X(lessEqualInt) X(greaterInt) X(greaterEqualInt)            \
+    X(equalInt) X(notEqualInt) X(lessReal) X(lessEqualReal)                \
+    X(greaterReal) X(greaterEqualReal) X(equalReal) X(notEqualReal)        \
+    X(compareString) X(concatString) X(jump) X(jumpIfTrue) X(jumpIfFalse)  \
+    X(jumpIfLessInt) X(jumpIfLessEqualInt) X(jumpIfGreaterInt)             \
+    X(jumpIfGreaterEqualInt) X(jumpIfEqualInt) X(jumpIfNotEqualInt)        \
+    X(jumpIfLessReal) X(jumpIfLessEqualReal) X(jumpIfGreaterReal)          \
+    X(jumpIfGreaterEqualReal) X(jumpIfEqualReal) X(jumpIfNotEqualReal)     \
+    X(jumpUnlessLessReal) X(jumpUnlessLessEqualReal)                       \
+    X(jumpUnlessGreaterReal) X(jumpUnlessGreaterEqualReal)                 \
+    X(jumpUnlessEqualReal) X(jumpUnlessNotEqualReal) X(incrementInt)       \
+    X(incrementJumpIfLessEqualInt) X(incrementJumpIfLessInt)               \
+    X(newMatrix) X(loadFloatElement) X(loadDoubleElement)                  \
+    X(loadIntElement) X(loadInt8Element) X(storeFloatElement)              \
+    X(storeDoubleElement) X(storeIntElement) X(storeInt8Element)           \
+    X(addFloatElement) X(subtractFloatElement) X(multiplyMatrix)           \
+    X(combineMatrix) X(scalarMatrix) X(transposeMatrix) X(sliceMatrix)     \
+    X(reduceMatrix) X(numRows) X(numCols) X(readMatrix) X(callMath)        \
+    X(printInt) X(printReal) X(printString) X(printMatrix) X(safePoint)
+
+#define BYTECODE_ENUM(name) name,
+enum Opcode { BYTECODE_OPERATIONS(BYTECODE_ENUM) numOpcodes };
+#undef BYTECODE_ENUM
+
+struct Instruction {
+    Opcode op;
+    int a, b, c, d, e, f;
+};
+
+/**
+ * a register holding the value of an expression, and the type of that
+ * value. Bool, int and long values are held in integer registers, float
+ * and double ones in real registers, which share a file of numbers;
+ * strings and matrices have files of their own.
+ */
+struct Operand {
+    ValueType type;
+    // the element type of a matrix
+    string elements;
+    int reg;
+    // whether the register holds nothing but this value, so that it can
+    // be taken over instead of copied
+    bool temporary;
+};
+
+/**
+ * a point where a program compiled with safe points can be stopped and
+ * carried on by its translation, see resumePoint in Matrix.h: before a
+ * top-level statement of main, or before a row of a comprehension at top
+ * level
+ */
+struct SafePoint {
+    // the index of the top-level statement
+    int statement;
+    // the top-level variables in scope, in the order they were declared
+    vector<pair<string, Operand> > variables;
+    // the register of the row index of the comprehension, or -1
+    int row;
+};
+
+/**
+ * a compiled program: its instructions and the initial values of its
+ * registers, which hold its constants
+ */
+struct Bytecode {
+    union number {
+        long long i;
+        double d;
+    };
+
+    vector<Instruction> code;
+    vector<number> numbers;
+    vector<string> strings;
+    int matrices;
+    // the functions called by callMath
+    vector<mathFunction> functions;
+    vector<SafePoint> safePoints;
+
+    /**
+     * write the instructions, one per line, for finding out which
+     * superinstructions a program uses
+     */
+    void disassemble(ostream &os) const;
+};
+
+/**
+ * compiles a program to Bytecode. The AST nodes compile themselves with
+ * the members below, as they translate themselves with cppCode.
+ */
+class BytecodeCompiler {
+public:
+    /**
+     * @param  safePoints whether to mark the SafePoints of the program
+     * @return the compiled program, or throws a string describing a type
+     * error, an undeclared variable or an unknown function
+     */
+    Bytecode compile(Program *program, bool safePoints = false);
+
+    /**
+     * mark the start of a top-level statement, with a safe point if they
+     * are marked; a comprehension it declares takes the statement for
+     * the safe points of its rows
+     */
+    void beginStatement(int statement);
+
+    /**
+     * the top-level statement whose declaration is being compiled, or -1
+     * if safe points are not marked or the declaration is nested in
+     * another scope; taking it resets it
+     */
+    int takeStatement();
+
+    // mark a safe point before a row, whose index is in register row
+    void safePoint(int statement, int row = -1);
+
+    // mark the start and end of a C++ scope, a block or a let
+    void beginScope();
+    void endScope();
+
+    /**
+     * give a variable a register of its own in the innermost scope
+     * @param elements the element type of a matrix
+     */
+    Operand declare(const string &name, ValueType type,
+                    const string &elements = "");
+
+    // the register of a variable, throwing an error if none is in scope
+    Operand lookup(const string &name);
+
+    // a new register for an intermediate value
+    Operand temporary(ValueType type, const string &elements = "");
+
+    // registers holding constants
+    Operand integer(long long value, ValueType type = intType);
+    Operand real(double value, ValueType type = doubleType);
+    Operand text(const string &value);
+
+    /**
+     * the value converted to type, as C++ converts implicitly; converting
+     * a constant makes a new constant
+     */
+    Operand convert(const Operand &value, ValueType type);
+
+    // the value converted to bool, for a condition
+    Operand condition(const Operand &value);
+
+    /**
+     * a op b for op one of + - * /, on numbers converted to the larger of
+     * their types, on matrices, a matrix and a scalar, or two strings
+     */
+    Operand arithmetic(char op, const Operand &a, const Operand &b);
+
+    // kinds of comparisons, in the order of their opcodes
+    enum comparison { less, lessEqual, greater, greaterEqual, equal, notEqual };
+
+    Operand compare(comparison kind, const Operand &a, const Operand &b);
+
+    /**
+     * store a value in a register, converting it to the register's type,
+     * copying a matrix held by a variable and taking over a temporary one
+     */
+    void assign(const Operand &target, const Operand &value);
+
+    // labels name positions in the code, which jumps refer to
+    int newLabel();
+    void bind(int label);
+
+    /**
+     * jump to label if the condition is true, or if it is false when
+     * sense is false
+     */
+    void branch(const Operand &condition, bool sense, int label);
+
+    void emit(Opcode op, int a = 0, int b = 0, int c = 0, int d = 0, int e = 0,
+              int f = 0);
+
+    // the number of instructions emitted so far
+    size_t size() const { return program.code.size(); }
+
+    // a jump to label, resolved once the label is bound
+    void emitJump(Opcode op, int a, int b, int label);
+
+    // the number of a function for callMath
+    int addFunction(mathFunction function);
+
+private:
+    Bytecode program;
+    bool markSafePoints;
+    int statement;
+    // registers of numbers and strings holding constants
+    map<pair<int, long long>, int> integers;
+    map<pair<int, double>, int> reals;
+    map<string, int> texts;
+
+    // the variables in scope, innermost last, and where each scope began
+    vector<pair<string, Operand> > names;
+    vector<size_t> scopes;
+
+    // the position of each label, and the jumps to patch with it
+    vector<int> labels;
+    vector<pair<size_t, int> > jumps;
+    // the position of the last label bound, which no instruction may be
+    // fused across
+    size_t boundAt;
+
+    bool isConstant(const Operand &value) const;
+    void fuseBranch(size_t at, bool sense, int label);
+};
+
+/**
+ * runs Bytecode
+ */
+class VirtualMachine {
+public:
+    /**
+     * @param output where print statements write
+     */
+    VirtualMachine(ostream &output = cout);
+
+    /**
+     * compile a program and run it, reporting errors on cerr as
+     * Interpreter::run does
+     * @return 0, or 1 if the program could not be compiled or run to its
+     * end
+     */
+    int run(Program *program);
+
+    /**
+     * run compiled code, throwing a string if an error stops it
+     * @param  stopAt called at each safe point, stopping the program
+     * there if it returns true
+     * @return the safe point the program stopped at, or NULL if it ran to
+     * its end
+     */
+    const SafePoint *execute(
+        const Bytecode &program,
+        const function<bool(const SafePoint &)> &stopAt = nullptr);
+
+    /**
+     * the value in a register of the program last run, for reading the
+     * variables of a program stopped at a safe point
+     */
+    Value value(const Operand &reg) const;
+
+    ostream &out;
+
+private:
+    // a matrix register, with the location of its elements at hand for
+    // the element instructions
+    struct matrixRegister {
+        shared_ptr<MatrixValue> value;
+        void *values;
+        long long rows;
+        long long cols;
+    };
+
+    void setMatrix(matrixRegister &reg, const shared_ptr<MatrixValue> &m);
+
+    // the registers of the program last run
+    vector<Bytecode::number> numbers;
+    vector<string> strings;
+    vector<matrixRegister> matrices;
+};
+
+#endif  // BYTECODE_H
@@ -0,0 +1,74 @@
+/***
+ * cdal.h: the C interface of a CDAL program translated to a shared object
+ * by Program::libraryCppCode.
+ *
+ * The shared object exports one function, cdal_<program name>, most often
+ * cdal_main, of type cdal_entry. A host loads it with dlopen and may call
+ * it any number of times; each call runs the program from the start. The
+ * host passes the matrices the program reads in memory, and is handed what
+ * it prints and the matrices it declares at top level, so that no call
+ * starts a process or touches a file.
+ *
+ * Calls must not overlap, even into different shared objects, since each
+ * redirects std::cout while it runs.
+ */
+
+#ifndef CDAL_H
+#define CDAL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the version of this interface; a cdal_call of another version fails */
+#define CDAL_ABI_VERSION 1
+
+/* element types, numbered as in binary matrix files */
+#define CDAL_FLOAT32 1
+#define CDAL_FLOAT64 2
+#define CDAL_INT32 3
+#define CDAL_INT8 4
+
+/* a matrix passed between the host and a program */
+typedef struct cdal_matrix {
+    const char *name;
+    int element_type;
+    int rows;
+    int cols;
+    /* rows * cols elements in row-major order */
+    const void *values;
+} cdal_matrix;
+
+typedef struct cdal_call {
+    /* CDAL_ABI_VERSION */
+    int version;
+
+    /* matrixRead ( "name" ) returns the input of that name, converted to
+       float, instead of reading the file of that name */
+    const cdal_matrix *inputs;
+    int num_inputs;
+
+    /* passed back to the callbacks, which may be NULL */
+    void *context;
+
+    /* what the program prints, in pieces */
+    void (*print)(void *context, const char *text, size_t length);
+
+    /* each matrix declared at top level, once the program has finished;
+       its values are only valid until the callback returns */
+    void (*result)(void *context, const cdal_matrix *matrix);
+
+    /* why the call failed, set when it returns 1 */
+    char error[256];
+} cdal_call;
+
+/* run the program: 0 if it finished, 1 if it failed */
+typedef int (*cdal_entry)(cdal_call *call);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CDAL_H */
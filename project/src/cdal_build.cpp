@@ -0,0 +1,116 @@
+/**
+ * cdal_build: translate a batch of CDAL programs to C++ and write the
+ * build of their translations, see buildGraph.h.
+ *
+ * Usage: cdal_build [--make] [--profile] <directory> <program.dsl>...
+ *
+ * Each program.dsl is translated to <directory>/program.cpp, and
+ * <directory>/build.ninja, or with --make <directory>/Makefile, builds
+ * <directory>/program from it: run ninja -C <directory>, or make -j -C
+ * <directory>. Translations that have not changed are left alone, so only
+ * the programs that changed are rebuilt. The runtime is taken from the
+ * directory named by CDAL_RUNTIME, or ../samples. With --profile the
+ * programs are translated to time themselves, and report where the time
+ * went when they exit; see profileReport in Matrix.h.
+ *
+ * The translations carry #line directives naming the lines of the
+ * programs, so compiler errors, gdb and perf report point into the CDAL
+ * source rather than the generated C++.
+ *
+ * Programs that fail to parse or to translate are reported on stderr with
+ * exit status 1, and no build file is written.
+ */
+
+#include "./buildGraph.h"
+#include "./parser.h"
+#include "./readInput.h"
+#include "./AST.h"
+#include <limits.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+int main(int argc, char **argv) {
+    bool makefile = false, profile = false;
+    int first = 1;
+    for (; first < argc; first++) {
+        if (strcmp(argv[first], "--make") == 0)
+            makefile = true;
+        else if (strcmp(argv[first], "--profile") == 0)
+            profile = true;
+        else
+            break;
+    }
+    if (argc < first + 2) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--make] [--profile] <directory> <program.dsl>..."
+                  << std::endl;
+        return 1;
+    }
+    string directory = argv[first];
+    mkdir(directory.c_str(), 0755);
+
+    const char *runtime = getenv("CDAL_RUNTIME");
+    BuildGraph graph(directory, runtime != NULL ? runtime : "../samples");
+    graph.profile = profile;
+    std::set<string> names;
+    Parser parser;
+    for (int k = first + 1; k < argc; k++) {
+        const char *filename = argv[k];
+        char *text = readInputFromFile(filename);
+        if (text == NULL) {
+            std::cerr << "ERROR, cannot open " << filename << std::endl;
+            return 1;
+        }
+        ParseResult result = parser.parse(text);
+        if (!result.ok) {
+            std::cerr << "ERROR, " << filename << " failed to parse:\n"
+                      << result.errors << std::endl;
+            return 1;
+        }
+
+        // the name of the file, without its directory or extension
+        string name = filename;
+        name = name.substr(name.find_last_of('/') + 1);
+        name = name.substr(0, name.find_last_of('.'));
+        if (!names.insert(name).second) {
+            std::cerr << "ERROR, more than one program is named " << name
+                      << std::endl;
+            return 1;
+        }
+        // #line directives name the file by its full path, so that
+        // debuggers and profilers find it from the build directory
+        Program *program = dynamic_cast<Program *>(result.ast);
+        char absolute[PATH_MAX];
+        program->setSource(
+            realpath(filename, absolute) != NULL ? absolute : filename, text);
+        bool written;
+        try {
+            written = graph.add(name, program);
+        } catch (string error) {
+            std::cerr << "ERROR, " << filename << " failed to translate:\n"
+                      << error << std::endl;
+            return 1;
+        }
+        if (!written) {
+            std::cerr << "ERROR, cannot write " << directory << "/" << name
+                      << ".cpp" << std::endl;
+            return 1;
+        }
+    }
+
+    string buildFile = directory + (makefile ? "/Makefile" : "/build.ninja");
+    std::ofstream out(buildFile.c_str());
+    if (makefile)
+        graph.writeMakefile(out);
+    else
+        graph.writeNinja(out);
+    if (!out) {
+        std::cerr << "ERROR, cannot write " << buildFile << std::endl;
+        return 1;
+    }
+    return 0;
+}
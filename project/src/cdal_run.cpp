@@ -0,0 +1,77 @@
+/**
+ * cdal_run: run a CDAL program straight from its source, instead of
+ * translating it to C++ and compiling it.
+ *
+ * Usage: cdal_run [--ast | --bytecode | --tiered] <program.dsl>
+ *
+ * The program is compiled to bytecode and run by the VirtualMachine; with
+ * --ast it is interpreted from its AST instead, and with --bytecode its
+ * bytecode is listed rather than run. With --tiered it is run by the
+ * VirtualMachine while its translation is compiled, which takes over once
+ * it is built (see tiered.h); the runtime it is built with is taken from
+ * the directory named by CDAL_RUNTIME, or ../samples.
+ *
+ * The program prints what its translation would print. Syntax errors and
+ * errors found while running it are reported on stderr with exit status 1.
+ */
+
+#include "./bytecode.h"
+#include "./interpreter.h"
+#include "./parser.h"
+#include "./readInput.h"
+#include "./tiered.h"
+#include "./AST.h"
+#include <limits.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char **argv) {
+    const char *mode = argc == 3 ? argv[1] : "";
+    if ((argc != 2 && argc != 3) ||
+        (argc == 3 && strcmp(mode, "--ast") != 0 &&
+         strcmp(mode, "--bytecode") != 0 && strcmp(mode, "--tiered") != 0)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--ast | --bytecode | --tiered] <program.dsl>"
+                  << std::endl;
+        return 1;
+    }
+    const char *filename = argv[argc - 1];
+    char *text = readInputFromFile(filename);
+    if (text == NULL) {
+        std::cerr << "ERROR, cannot open " << filename << std::endl;
+        return 1;
+    }
+
+    Parser parser;
+    ParseResult result = parser.parse(text);
+    if (!result.ok) {
+        std::cerr << "ERROR, " << filename << " failed to parse:\n"
+                  << result.errors << std::endl;
+        return 1;
+    }
+    Program *program = dynamic_cast<Program *>(result.ast);
+
+    std::ios_base::sync_with_stdio(false);
+    if (strcmp(mode, "--ast") == 0) return Interpreter(std::cout).run(program);
+    if (strcmp(mode, "--tiered") == 0) {
+        // the compiled translation is attributed to the lines of the
+        // program, wherever it is built
+        char absolute[PATH_MAX];
+        program->setSource(
+            realpath(filename, absolute) != NULL ? absolute : filename, text);
+        const char *runtime = getenv("CDAL_RUNTIME");
+        return TieredRunner(std::cout, runtime != NULL ? runtime : "../samples")
+            .run(program);
+    }
+    if (strcmp(mode, "--bytecode") == 0) {
+        try {
+            BytecodeCompiler().compile(program).disassemble(std::cout);
+        } catch (string error) {
+            std::cerr << "ERROR, " << error << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    return VirtualMachine(std::cout).run(program);
+}
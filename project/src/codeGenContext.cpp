@@ -0,0 +1,382 @@
+/***
+ * CodeGenContext: facts about a CDAL program gathered while translating
+ * it to C++.
+ *
+ * Author: Jingxiang Li, Tanoja Sunkam
+ */
+
+#include "./codeGenContext.h"
+#include "./AST.h"
+
+namespace {
+
+// the context ActiveContext made current on this thread, or NULL
+thread_local CodeGenContext *activeContext = NULL;
+
+}  // namespace
+
+ActiveContext::ActiveContext(CodeGenContext &context)
+    : previous(activeContext) {
+    activeContext = &context;
+}
+
+ActiveContext::~ActiveContext() { activeContext = previous; }
+
+CodeGenContext &codeGenContext() {
+    if (activeContext != NULL) return *activeContext;
+    // analyzing no facts leaves it in the second pass, where it records
+    // nothing
+    thread_local CodeGenContext idle;
+    idle.analyze();
+    return idle;
+}
+
+// the largest fixedMatrix, in elements; larger matrices stay on the heap
+const int maxFixedElements = 1024;
+
+CodeGenContext::CodeGenContext(const SourceLines *source) {
+    reset();
+    this->source = source;
+}
+
+void CodeGenContext::reset() {
+    recording = true;
+    resumeStatement = -1;
+    library = false;
+    exporting = false;
+    exported.clear();
+    profiling = false;
+    profileSites.clear();
+    source = NULL;
+    names.clear();
+    assigned.clear();
+    streamed.clear();
+    sparse.clear();
+    fixed.clear();
+    products.clear();
+    rowVars.clear();
+    comprehensions.clear();
+    loopDepth = 0;
+    numComprehensions = 0;
+}
+
+void CodeGenContext::analyze() {
+    recording = false;
+    comprehensions.clear();
+    loopDepth = 0;
+    numComprehensions = 0;
+    findFixed();
+
+    map<string, nameFacts>::iterator it;
+    for (it = names.begin(); it != names.end(); it++) {
+        nameFacts &facts = it->second;
+        // only float matrices are streamed or made sparse, and a small
+        // fixedMatrix is better than an inferred sparse one
+        if (facts.otherElements || facts.keptDense || fixed.count(it->first))
+            continue;
+
+        // a sparseMatrix is filled by its one declaration and never changes
+        // element by element; a matrix declared sparse is made dense where
+        // it is sliced or used other than by the sparse kernels
+        if (facts.annotatedSparse && facts.numDecls > 1)
+            throw((string) "Sparse matrix " + it->first +
+                  " is declared more than once");
+        if (facts.annotatedSparse && facts.elementsAssigned)
+            throw((string) "Elements of sparse matrix " + it->first +
+                  " are assigned, so it cannot be declared sparse");
+        if (facts.numDecls == 1 &&
+            (facts.annotatedSparse ||
+             (facts.inferredSparse && facts.wholeUses == 0))) {
+            sparse.insert(it->first);
+            continue;
+        }
+        if (library || facts.numDecls != 1 || !facts.fromFile ||
+            !facts.declRunsOnce || facts.otherUse ||
+            facts.rowComprehensions.size() > 1)
+            continue;
+
+        // the rows are only visited in order if nothing else assigns the
+        // row variable of the comprehension
+        if (facts.rowComprehensions.size() == 1 &&
+            assigned.count(rowVars[*facts.rowComprehensions.begin()]))
+            continue;
+
+        streamed.insert(it->first);
+    }
+}
+
+void CodeGenContext::findFixed() {
+    map<string, nameFacts>::iterator it;
+    for (it = names.begin(); it != names.end(); it++) {
+        nameFacts &facts = it->second;
+        int rows, cols;
+        if (facts.numDecls != 1 || facts.rows == NULL ||
+            facts.annotatedSparse || facts.keptDense ||
+            facts.wholeUses != facts.productUses ||
+            !constantValue(facts.rows, rows) ||
+            !constantValue(facts.cols, cols))
+            continue;
+        if (rows < 1 || cols < 1 || rows > maxFixedElements ||
+            cols > maxFixedElements || rows * cols > maxFixedElements)
+            continue;
+        fixed[it->first] = make_pair(rows, cols);
+    }
+
+    // products of two fixed-size matrices are checked by the C++ compiler,
+    // so keep the run time error of mismatched ones; a matrix scaled by a
+    // scalar variable is left to the element-wise operators of basicMatrix
+    for (size_t k = 0; k != products.size(); k++) {
+        if (names[products[k].first].numDecls == 0)
+            fixed.erase(products[k].second);
+        if (names[products[k].second].numDecls == 0)
+            fixed.erase(products[k].first);
+        map<string, pair<int, int> >::iterator left =
+            fixed.find(products[k].first);
+        map<string, pair<int, int> >::iterator right =
+            fixed.find(products[k].second);
+        if (left == fixed.end() || right == fixed.end() ||
+            left->second.second == right->second.first)
+            continue;
+        fixed.erase(products[k].first);
+        fixed.erase(products[k].second);
+    }
+}
+
+int CodeGenContext::takeResumeStatement() {
+    int statement = resumeStatement;
+    resumeStatement = -1;
+    return statement;
+}
+
+void CodeGenContext::noteResumable(const string &name) {
+    if (!recording) return;
+    names[name].keptDense = true;
+}
+
+bool CodeGenContext::takeExporting() {
+    bool taken = exporting;
+    exporting = false;
+    return taken;
+}
+
+void CodeGenContext::noteExported(const string &name) {
+    if (!recording) return;
+    names[name].keptDense = true;
+    exported.push_back(name);
+}
+
+string CodeGenContext::profileSite(const string &kind, const string &source,
+                                   int offset) {
+    if (!profiling || recording) return "";
+    profiledSite site;
+    site.kind = kind;
+    site.source = source;
+    if (this->source != NULL && offset >= 0) {
+        const string &filename = this->source->filename;
+        site.location = filename.substr(filename.find_last_of('/') + 1) +
+                        ":" + to_string(this->source->line(offset)) + ":" +
+                        to_string(this->source->column(offset));
+    }
+    profileSites.push_back(site);
+    return "cdalSites[" + to_string(profileSites.size() - 1) + "]";
+}
+
+string CodeGenContext::lineDirective(int offset) {
+    if (source == NULL || offset < 0 || recording) return "";
+    string filename;
+    for (size_t k = 0; k != source->filename.size(); k++) {
+        char c = source->filename[k];
+        if (c == '"' || c == '\\') filename += '\\';
+        filename += c;
+    }
+    return "#line " + to_string(source->line(offset)) + " \"" + filename +
+           "\"\n";
+}
+
+void CodeGenContext::beginComprehension(const string &rowVar) {
+    comprehension c;
+    c.id = numComprehensions++;
+    c.rowVar = rowVar;
+    c.runsOnce = runsOnce();
+    comprehensions.push_back(c);
+    if (recording) rowVars.push_back(rowVar);
+}
+
+void CodeGenContext::endComprehension() { comprehensions.pop_back(); }
+
+void CodeGenContext::beginLoop() { loopDepth++; }
+
+void CodeGenContext::endLoop() { loopDepth--; }
+
+void CodeGenContext::noteMatrixDecl(const string &name, bool fromFile,
+                                    const string &elementType) {
+    if (!recording) return;
+    nameFacts &facts = names[name];
+    if (facts.numDecls > 0 && !hasElementType(name, elementType))
+        facts.mixedElements = true;
+    facts.numDecls++;
+    facts.fromFile = fromFile;
+    facts.declRunsOnce = runsOnce();
+    facts.elementType = elementType;
+    if (!elementType.empty() && elementType != "float")
+        facts.otherElements = true;
+    if (elementType == "int8") facts.narrowElements = true;
+}
+
+void CodeGenContext::noteSparseDecl(const string &name, bool annotated,
+                                    bool inferred) {
+    if (!recording) return;
+    nameFacts &facts = names[name];
+    facts.annotatedSparse = facts.annotatedSparse || annotated;
+    facts.inferredSparse = inferred;
+}
+
+void CodeGenContext::noteMatrixDims(const string &name, Expr *rows,
+                                    Expr *cols) {
+    if (!recording) return;
+    names[name].rows = rows;
+    names[name].cols = cols;
+}
+
+void CodeGenContext::noteScalarDecl(const string &name, const string &type) {
+    if (!recording) return;
+    if (type == "int")
+        names[name].intDecls++;
+    else
+        names[name].otherDecls++;
+    if (type == "float") names[name].floatDecls++;
+}
+
+void CodeGenContext::noteIndexVariable(const string &name) {
+    if (!recording) return;
+    names[name].numAssignments++;
+}
+
+void CodeGenContext::noteElementAccess(const string &name,
+                                       const string &rowIndex) {
+    if (!recording) return;
+    nameFacts &facts = names[name];
+
+    // find the comprehension whose row variable indexes the row
+    for (int k = comprehensions.size() - 1; k >= 0; k--) {
+        if (comprehensions[k].rowVar == rowIndex) {
+            if (comprehensions[k].runsOnce)
+                facts.rowComprehensions.insert(comprehensions[k].id);
+            else
+                facts.otherUse = true;
+            return;
+        }
+    }
+    facts.otherUse = true;
+}
+
+void CodeGenContext::noteOtherUse(const string &name) {
+    if (!recording) return;
+    names[name].otherUse = true;
+    names[name].wholeUses++;
+}
+
+void CodeGenContext::noteSlice(const string &name) {
+    if (!recording) return;
+    noteOtherUse(name);
+    names[name].sliced = true;
+}
+
+void CodeGenContext::noteElementAssignment(const string &name) {
+    if (!recording) return;
+    noteOtherUse(name);
+    names[name].elementsAssigned = true;
+}
+
+void CodeGenContext::notePrint(const string &name) {
+    if (!recording) return;
+    names[name].otherUse = true;
+}
+
+void CodeGenContext::noteProduct(const string &left, const string &right) {
+    if (!recording) return;
+    noteOtherUse(left);
+    noteOtherUse(right);
+    names[left].productUses++;
+    names[right].productUses++;
+    products.push_back(make_pair(left, right));
+}
+
+void CodeGenContext::noteAssignment(const string &name, Expr *value) {
+    if (!recording) return;
+    nameFacts &facts = names[name];
+    facts.otherUse = true;
+    facts.wholeUses++;
+    facts.numAssignments++;
+    facts.definition = value;
+    assigned.insert(name);
+}
+
+Expr *CodeGenContext::constantDefinition(const string &name) {
+    map<string, nameFacts>::iterator it = names.find(name);
+    if (it == names.end()) return NULL;
+    nameFacts &facts = it->second;
+    if (facts.intDecls != 1 || facts.otherDecls != 0 || facts.numDecls != 0 ||
+        facts.numAssignments != 1)
+        return NULL;
+    return facts.definition;
+}
+
+bool CodeGenContext::isStreamed(const string &name) {
+    return streamed.count(name) > 0;
+}
+
+bool CodeGenContext::isSparse(const string &name) {
+    return sparse.count(name) > 0;
+}
+
+bool CodeGenContext::isDenseOperand(const string &name) {
+    return hasElementType(name, "float") && !isSparse(name) &&
+           !isStreamed(name) && !fixed.count(name);
+}
+
+bool CodeGenContext::hasNarrowElements(const string &name) {
+    map<string, nameFacts>::iterator it = names.find(name);
+    return it != names.end() && it->second.narrowElements;
+}
+
+bool CodeGenContext::hasElementType(const string &name,
+                                    const string &elementType) {
+    map<string, nameFacts>::iterator it = names.find(name);
+    if (it == names.end() || it->second.numDecls == 0 ||
+        it->second.mixedElements)
+        return false;
+    string declared = it->second.elementType;
+    return (declared.empty() ? "float" : declared) ==
+           (elementType.empty() ? "float" : elementType);
+}
+
+string CodeGenContext::elementType(const string &name) {
+    map<string, nameFacts>::iterator it = names.find(name);
+    if (it == names.end() || it->second.numDecls == 0 ||
+        it->second.mixedElements)
+        return "";
+    return it->second.elementType.empty() ? "float" : it->second.elementType;
+}
+
+bool CodeGenContext::isFloatScalar(const string &name) {
+    map<string, nameFacts>::iterator it = names.find(name);
+    return it != names.end() && it->second.floatDecls != 0;
+}
+
+bool CodeGenContext::isMatrix(const string &name) {
+    map<string, nameFacts>::iterator it = names.find(name);
+    return it != names.end() && it->second.numDecls != 0;
+}
+
+bool CodeGenContext::isFixed(const string &name, int &rows, int &cols) {
+    map<string, pair<int, int> >::iterator it = fixed.find(name);
+    if (it == fixed.end()) return false;
+    rows = it->second.first;
+    cols = it->second.second;
+    return true;
+}
+
+bool CodeGenContext::runsOnce() {
+    return loopDepth == 0 && comprehensions.empty();
+}
@@ -0,0 +1,446 @@
+/***
+ * CodeGenContext: facts about a CDAL program gathered while translating
+ * it to C++.
+ *
+ * Program::cppCode translates the tree twice. During the first pass the
+ * nodes record here how each matrix is declared and used; the second pass
+ * reads those facts back to choose specialized runtime types for the
+ * generated code. The facts only ever make the translation faster, never
+ * change what the program prints.
+ *
+ * Author: Jingxiang Li, Tanoja Sunkam
+ */
+
+#ifndef CODEGENCONTEXT_H
+#define CODEGENCONTEXT_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Expr;
+class SourceLines;
+
+class CodeGenContext {
+public:
+    /**
+     * a context for one translation, in its first pass
+     * @param source the lines of the file being translated, or NULL if it
+     * is not known
+     */
+    explicit CodeGenContext(const SourceLines *source = NULL);
+
+    /**
+     * forget all facts and start the first pass of a new translation
+     */
+    void reset();
+
+    /**
+     * finish the first pass: stop recording and make the decisions the
+     * second pass asks for
+     */
+    void analyze();
+
+    // true during the first pass
+    bool recording;
+
+    /**
+     * the index of the top-level statement being translated, when it is
+     * a declaration in a translation that can take over from an
+     * interpreter (see Program::resumableCppCode), or -1
+     */
+    int resumeStatement;
+
+    /**
+     * take resumeStatement, resetting it to -1 so that declarations
+     * nested in the expressions of a top-level one do not see it
+     */
+    int takeResumeStatement();
+
+    /**
+     * record that a matrix is declared at top level in a resumable
+     * translation, where it stays a dense basicMatrix that a resumePoint
+     * can restore
+     * @param name the name of the matrix
+     */
+    void noteResumable(const string &name);
+
+    /**
+     * true in a translation to a shared object (see
+     * Program::libraryCppCode), where matrixRead may take its matrix from
+     * the host rather than the file, so that none is streamed
+     */
+    bool library;
+
+    /**
+     * true while a top-level declaration of a translation to a shared
+     * object is translated
+     */
+    bool exporting;
+
+    /**
+     * take exporting, resetting it to false so that declarations nested in
+     * the expressions of a top-level one do not see it
+     */
+    bool takeExporting();
+
+    /**
+     * record that a matrix declared at top level is handed to the host of
+     * a shared object, so that it stays a dense basicMatrix
+     * @param name the name of the matrix
+     */
+    void noteExported(const string &name);
+
+    // the matrices noteExported recorded, in the order they are declared
+    vector<string> exported;
+
+    /**
+     * true in a translation made for profiling (see
+     * Program::profiledCppCode), which times statements, comprehensions
+     * and calls of matrix kernels
+     */
+    bool profiling;
+
+    /**
+     * add a site to time, in the second pass of a profiling translation
+     * @param  kind   "statement", "comprehension" or "kernel"
+     * @param  source its CDAL source
+     * @param  offset the offset of the source in the file it came from
+     * @return        the C++ naming its profileSite, or the empty string
+     * if nothing is timed
+     */
+    string profileSite(const string &kind, const string &source, int offset);
+
+    // a site profileSite added
+    struct profiledSite {
+        string kind;
+        // file:line:column, or empty if the source file is not known
+        string location;
+        string source;
+    };
+
+    // the sites profileSite added, in order
+    vector<profiledSite> profileSites;
+
+    // the lines of the file being translated, or NULL if it is not known
+    const SourceLines *source;
+
+    /**
+     * the #line directive attributing the C++ that follows to the line of
+     * an offset in the source, in the second pass
+     * @param  offset the offset of a node in the file it came from
+     * @return        the directive and a newline, or the empty string if
+     * the source file is not known
+     */
+    string lineDirective(int offset);
+
+    /**
+     * mark the start and end of a comprehension, the loops generated for
+     * 'matrix' varName '[' Expr ':' Expr ']' varName ':' varName '=' Expr
+     * @param rowVar the name of the row index variable
+     */
+    void beginComprehension(const string &rowVar);
+    void endComprehension();
+
+    // mark the start and end of the body of a repeat or while loop
+    void beginLoop();
+    void endLoop();
+
+    /**
+     * record the declaration of a matrix
+     * @param name        the name of the matrix
+     * @param fromFile    true if it is initialized by matrixRead of a file
+     * @param elementType its CDAL element type, empty for float
+     */
+    void noteMatrixDecl(const string &name, bool fromFile,
+                        const string &elementType);
+
+    /**
+     * record whether a matrix declaration asks for a sparse matrix
+     * @param name      the name of the matrix
+     * @param annotated true if it is declared 'sparse' 'matrix'
+     * @param inferred  true if its definition shows it is mostly zeros
+     */
+    void noteSparseDecl(const string &name, bool annotated, bool inferred);
+
+    /**
+     * record the dimensions of a matrix declared by a comprehension
+     * @param name the name of the matrix
+     * @param rows the expression for its number of rows
+     * @param cols the expression for its number of columns
+     */
+    void noteMatrixDims(const string &name, Expr *rows, Expr *cols);
+
+    /**
+     * record the declaration of a variable that is not a matrix
+     * @param name the variable name
+     * @param type the type it is declared with: "int", "float", "string"
+     * or "boolean"
+     */
+    void noteScalarDecl(const string &name, const string &type);
+
+    /**
+     * record the index variables of a comprehension, which take many values
+     * @param name the variable name
+     */
+    void noteIndexVariable(const string &name);
+
+    /**
+     * record an access to an element of a matrix, name[rowIndex : ...]
+     * @param name     the name of the matrix
+     * @param rowIndex the row index when it is a plain variable, otherwise
+     * the empty string
+     */
+    void noteElementAccess(const string &name, const string &rowIndex);
+
+    /**
+     * record a use of a name other than reading an element or asking for
+     * its dimensions, such as passing it to an operator
+     * @param name the variable name
+     */
+    void noteOtherUse(const string &name);
+
+    /**
+     * record taking a view of a matrix, a slice name[a to b : c to d],
+     * transpose(name) or a reduction like sum(name), which needs it to be
+     * dense
+     * @param name the variable name
+     */
+    void noteSlice(const string &name);
+
+    /**
+     * record an assignment to an element of a matrix, name[a : b] = value
+     * @param name the name of the matrix
+     */
+    void noteElementAssignment(const string &name);
+
+    /**
+     * record printing a whole matrix, print ( name )
+     * @param name the variable name
+     */
+    void notePrint(const string &name);
+
+    /**
+     * record the product of two named matrices, left * right
+     * @param left  the name of the left operand
+     * @param right the name of the right operand
+     */
+    void noteProduct(const string &left, const string &right);
+
+    /**
+     * record an assignment to a variable
+     * @param name  the variable name
+     * @param value the expression assigned, or NULL if it is assigned some
+     * other way, like the variable of a repeat loop
+     */
+    void noteAssignment(const string &name, Expr *value = NULL);
+
+    /**
+     * the value of an int variable that is declared only as an int and is
+     * assigned exactly once, so every read of it that is not undefined
+     * behaviour sees that value
+     * @param  name the variable name
+     * @return      the expression it is assigned, or NULL if there is none
+     * such
+     */
+    Expr *constantDefinition(const string &name);
+
+    /**
+     * whether a matrix can be read as a matrixStream: it is read from a
+     * file once, and the program only asks for its dimensions and reads
+     * its elements row by row from a single comprehension that runs once.
+     * Only meaningful in the second pass.
+     * @param  name the name of the matrix
+     * @return      true if the matrix should be streamed
+     */
+    bool isStreamed(const string &name);
+
+    /**
+     * whether a matrix is stored as a sparseMatrix: it is declared once,
+     * and either declared sparse or inferred to be sparse and only used by
+     * reading its elements or asking for its dimensions. A matrix declared
+     * sparse is made dense where it is used in a way no sparse kernel
+     * supports. Only meaningful in the second pass.
+     * @param  name the name of the matrix
+     * @return      true if the matrix should be sparse
+     */
+    bool isSparse(const string &name);
+
+    /**
+     * whether a matrix is a dense matrix of floats, which the sparse
+     * kernels take as the other operand of a sparseMatrix. Only
+     * meaningful in the second pass.
+     * @param  name the name of the matrix
+     * @return      true if the matrix is a plain matrix
+     */
+    bool isDenseOperand(const string &name);
+
+    /**
+     * whether a matrix may hold int8 elements, which must be promoted to
+     * int when read so that C++ does not treat them as characters
+     * @param  name the name of the matrix
+     * @return      true if some declaration of it has int8 elements
+     */
+    bool hasNarrowElements(const string &name);
+
+    /**
+     * whether every declaration of a matrix so far has the given element
+     * type, where float and the empty string are the same
+     * @param  name        the name of the matrix
+     * @param  elementType the element type
+     * @return             true if the matrix is declared with that type
+     */
+    bool hasElementType(const string &name, const string &elementType);
+
+    /**
+     * the element type of a matrix
+     * @param  name the name of the matrix
+     * @return      its CDAL element type, "float" when none is given, or
+     * the empty string if it is not a matrix or is declared with more than
+     * one element type
+     */
+    string elementType(const string &name);
+
+    /**
+     * whether a variable is declared a float, which the translation may
+     * not broadcast to a matrix with integer elements
+     * @param  name the name of the variable
+     * @return      true if it has a float declaration
+     */
+    bool isFloatScalar(const string &name);
+
+    /**
+     * whether a name is declared as a matrix
+     * @param  name the variable name
+     * @return      true if some declaration of it is a matrix
+     */
+    bool isMatrix(const string &name);
+
+    /**
+     * whether a matrix is a fixedMatrix: it is declared once by a
+     * comprehension whose dimensions are small constants, and it is only
+     * used by reading its elements, asking for its dimensions, printing it
+     * or multiplying it by another fixed-size matrix. Only meaningful in
+     * the second pass.
+     * @param  name the name of the matrix
+     * @param  rows set to its number of rows
+     * @param  cols set to its number of columns
+     * @return      true if the matrix should be a fixedMatrix
+     */
+    bool isFixed(const string &name, int &rows, int &cols);
+
+private:
+    // what the first pass learned about a name
+    struct nameFacts {
+        int numDecls;
+        bool fromFile;
+        bool declRunsOnce;
+        // some declaration has elements other than float
+        bool otherElements;
+        // declared with more than one element type
+        bool mixedElements;
+        bool narrowElements;
+        string elementType;
+        // the dimensions of its comprehension, if it has one
+        Expr *rows;
+        Expr *cols;
+        // declarations as an int and as other scalars, of which floats
+        int intDecls;
+        int otherDecls;
+        int floatDecls;
+        // assignments, and the value of the last one
+        int numAssignments;
+        Expr *definition;
+        bool otherUse;
+        // uses other than reading elements, asking for dimensions or
+        // printing, and how many of those are products
+        int wholeUses;
+        int productUses;
+        bool annotatedSparse;
+        bool inferredSparse;
+        bool sliced;
+        bool elementsAssigned;
+        // declared at top level in a resumable translation, or handed to
+        // the host of a shared object, so kept a dense basicMatrix
+        bool keptDense;
+        // the comprehensions reading rows of it
+        set<int> rowComprehensions;
+
+        nameFacts()
+            : numDecls(0),
+              fromFile(false),
+              declRunsOnce(false),
+              otherElements(false),
+              mixedElements(false),
+              narrowElements(false),
+              rows(NULL),
+              cols(NULL),
+              intDecls(0),
+              otherDecls(0),
+              floatDecls(0),
+              numAssignments(0),
+              definition(NULL),
+              otherUse(false),
+              wholeUses(0),
+              productUses(0),
+              annotatedSparse(false),
+              inferredSparse(false),
+              sliced(false),
+              elementsAssigned(false),
+              keptDense(false) {}
+    };
+
+    // a comprehension being translated
+    struct comprehension {
+        int id;
+        string rowVar;
+        bool runsOnce;
+    };
+
+    // true if the code being translated runs at most once
+    bool runsOnce();
+
+    // decide which matrices are fixedMatrix
+    void findFixed();
+
+    map<string, nameFacts> names;
+    set<string> assigned;
+    set<string> streamed;
+    set<string> sparse;
+    // the dimensions of each fixedMatrix
+    map<string, pair<int, int> > fixed;
+    // the operands of products of named matrices
+    vector<pair<string, string> > products;
+    // the row variable of each comprehension, by id
+    vector<string> rowVars;
+    vector<comprehension> comprehensions;
+    int loopDepth;
+    int numComprehensions;
+};
+
+/**
+ * ActiveContext: makes a CodeGenContext the one codeGenContext() returns
+ * while it exists. Each of Program's translations makes a context of its
+ * own, so no facts outlive the translation that gathered them.
+ */
+class ActiveContext {
+public:
+    explicit ActiveContext(CodeGenContext &context);
+    ~ActiveContext();
+
+private:
+    // the context active before, restored when this one ends
+    CodeGenContext *previous;
+};
+
+/**
+ * the context of the translation in progress on this thread. Outside any
+ * translation it is a context that records nothing and knows no facts,
+ * so that a node translated on its own gets its plainest translation.
+ */
+CodeGenContext &codeGenContext();
+
+#endif  // CODEGENCONTEXT_H
@@ -2,11 +2,22 @@
 #include <iostream>
 #include "parser.h"
 #include "readInput.h"
+#include "AST.h"
+#include "buildGraph.h"
+#include "cdal.h"
 
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
 #include <string>
+#include <thread>
 #include <cstring>
 #include <fstream>
+#include <sstream>
 
 using namespace std ;
 
@@ -17,6 +28,10 @@ public:
     Parser p ;
     ParseResult pr ;
 
+    // generated code is compiled with the flags the runtime target of the
+    // Makefile builds ../samples/libcdal.a and Matrix.h.gch with
+    static const string runtimeCompile ;
+
     char **makeArgs ( const char *a0, const char *a1) {
         char **aa = (char **) malloc (sizeof(char *) * 2) ;
         aa[0] = (char *) malloc ( sizeof(char) * (strlen(a0) + 1) ) ;
@@ -63,9 +78,9 @@ public:
 
         writeFile ( cpp1, cppfile ) ;
 
-        // 4. Compile generated C++ file
-        string compile = "g++ ../samples/Matrix.cpp " + cppfile +
-                         " -o " + cppexec ;
+        // 4. Compile generated C++ file, with the prebuilt runtime
+        string compile = runtimeCompile + cppfile + " -o " + cppexec +
+                         " -L../samples -lcdal" ;
         rc = system ( compile.c_str() ) ;
         TSM_ASSERT_EQUALS ( "translation of " + file +
                             " failed to compile.", rc, 0 ) ;
@@ -102,8 +117,497 @@ public:
     void test_your_code_2 ( void ) { codegen_tests ( "my_code_2", true ) ; }
 
     void test_forest_loss ( void ) { codegen_tests ( "forest_loss_v2", true ); }
-} ;
 
+    void test_row_sums ( void ) { codegen_tests ( "row_sums", true ); }
+
+    void test_sparse_masks ( void ) { codegen_tests ( "sparse_masks", true ); }
+
+    void test_sparse_operations ( void ) {
+        codegen_tests ( "sparse_operations", true );
+    }
+
+    void test_element_types ( void ) { codegen_tests ( "element_types", true ); }
+
+    // Matrices with different element types are not combined, as there is
+    // no operator for them; they are converted only when stored.
+    void test_mixed_element_types ( void ) {
+        ParseResult pr1 = p.parse ( "main () { matrix<int8> a [ 2 : 2 ] "
+                                    "i : j = i ; matrix b [ 2 : 2 ] i : j = "
+                                    "j ; print ( a * b ) ; }" ) ;
+        TS_ASSERT ( pr1.ok ) ;
+        TS_ASSERT_THROWS_EQUALS ( pr1.ast->cppCode(), string &e, e,
+                                  "matrices with int8 and float elements "
+                                  "cannot be multiplied" ) ;
+        ParseResult pr2 = p.parse ( "main () { matrix<double> a [ 2 : 2 ] "
+                                    "i : j = i ; matrix b [ 2 : 2 ] i : j = "
+                                    "j ; print ( b - transpose(a) ) ; }" ) ;
+        TS_ASSERT ( pr2.ok ) ;
+        TS_ASSERT_THROWS ( pr2.ast->cppCode(), string ) ;
+        TS_ASSERT ( translationContains ( "element_types",
+                        "matrix total(basicMatrix<int32_t>(a * b));" ) ) ;
+    }
+
+    // Floating scalars are not truncated to integer elements.
+    void test_narrowing_scalars ( void ) {
+        ParseResult pr1 = p.parse ( "main () { float f ; f = 0.5 ; "
+                                    "matrix<int8> a [ 2 : 2 ] i : j = i ; "
+                                    "print ( a * ( f + 1 ) ) ; }" ) ;
+        TS_ASSERT ( pr1.ok ) ;
+        TS_ASSERT_THROWS_EQUALS ( pr1.ast->cppCode(), string &e, e,
+                                  "a float cannot be combined with a matrix "
+                                  "with int8 elements" ) ;
+        ParseResult pr2 = p.parse ( "main () { matrix<int> a [ 2 : 2 ] "
+                                    "i : j = i ; "
+                                    "print ( mean ( a ) - a ) ; }" ) ;
+        TS_ASSERT ( pr2.ok ) ;
+        TS_ASSERT_THROWS ( pr2.ast->cppCode(), string ) ;
+        ParseResult pr3 = p.parse ( "main () { int k ; k = 2 ; "
+                                    "matrix<int> a [ 2 : 2 ] i : j = i ; "
+                                    "print ( a / k ) ; }" ) ;
+        TS_ASSERT ( pr3.ok ) ;
+        TS_ASSERT_THROWS_NOTHING ( pr3.ast->cppCode() ) ;
+    }
+
+    void test_fixed_sizes ( void ) { codegen_tests ( "fixed_sizes", true ); }
+
+    void test_matrix_views ( void ) { codegen_tests ( "matrix_views", true ); }
+
+    void test_reductions ( void ) { codegen_tests ( "reductions", true ); }
+
+    void test_fused_expressions ( void ) {
+        codegen_tests ( "fused_expressions", true );
+    }
+
+    void test_elementwise ( void ) { codegen_tests ( "elementwise", true ); }
+
+    // Check whether the translation of a sample contains some code.
+    bool translationContains ( string filebase, string code ) {
+        string path = "../samples/" + filebase + ".dsl" ;
+        ParseResult pr1 = p.parse ( readFile ( path.c_str() ) ) ;
+        TSM_ASSERT ( filebase + " failed to parse.", pr1.ok ) ;
+        return pr1.ast->cppCode().find ( code ) != string::npos ;
+    }
+
+    // Matrices only read row by row from one comprehension are streamed.
+    void test_streamed_matrices ( void ) {
+        TS_ASSERT ( translationContains ( "row_sums", "matrixStream data(" ) ) ;
+        TS_ASSERT ( translationContains ( "forest_loss_v2",
+                                          "matrixStream data(" ) ) ;
+        TS_ASSERT ( ! translationContains ( "sample_8", "matrixStream" ) ) ;
+        TS_ASSERT ( ! translationContains ( "my_code_1", "matrixStream" ) ) ;
+    }
+
+    // Matrices declared sparse, or zero off their diagonal, are sparse.
+    void test_sparse_matrices ( void ) {
+        TS_ASSERT ( translationContains ( "sparse_masks",
+                                          "sparseMatrix weights(" ) ) ;
+        TS_ASSERT ( translationContains ( "sparse_masks",
+                                          "sparseMatrix upper(" ) ) ;
+        TS_ASSERT ( translationContains ( "sparse_masks",
+                                          "matrix scaled(" ) ) ;
+        TS_ASSERT ( ! translationContains ( "forest_loss_v2",
+                                            "sparseMatrix" ) ) ;
+
+        // without a sparse kernel for the pair, the right operand is dense
+        TS_ASSERT ( translationContains ( "sparse_operations",
+                                          "upper * diagonal.toDense()" ) ) ;
+        TS_ASSERT ( translationContains ( "sparse_operations",
+                                          "m * upper - m" ) ) ;
+        TS_ASSERT ( translationContains ( "sparse_operations",
+                                          "upper.toDense() * 2" ) ) ;
+
+        // a sparse matrix is declared once and not assigned element-wise
+        ParseResult pr1 = p.parse ( "main () { sparse matrix s [ 2 : 2 ] "
+                                    "i : j = 0 ; s [ 0 : 1 ] = 1 ; }" ) ;
+        TS_ASSERT ( pr1.ok ) ;
+        TS_ASSERT_THROWS ( pr1.ast->cppCode(), string ) ;
+        ParseResult pr2 = p.parse ( "main () { sparse matrix s [ 2 : 2 ] "
+                                    "i : j = 0 ; { matrix s [ 2 : 2 ] "
+                                    "i : j = 1 ; } }" ) ;
+        TS_ASSERT ( pr2.ok ) ;
+        TS_ASSERT_THROWS ( pr2.ast->cppCode(), string ) ;
+    }
+
+    // Small matrices of constant size, only printed or multiplied, are fixed.
+    void test_fixed_matrices ( void ) {
+        TS_ASSERT ( translationContains ( "fixed_sizes",
+                                          "fixedMatrix<3, 4> corners;" ) ) ;
+        TS_ASSERT ( translationContains ( "fixed_sizes",
+                                          "for (int j = 0; j != 4; j++)" ) ) ;
+        TS_ASSERT ( translationContains ( "element_types",
+                                          "fixedMatrix<4, 4, int8_t> a;" ) ) ;
+        TS_ASSERT ( translationContains ( "sparse_masks",
+                                          "matrix scaled(" ) ) ;
+        TS_ASSERT ( ! translationContains ( "sample_8", "fixedMatrix" ) ) ;
+    }
+
+    // Slices and transposes are views rather than copies.
+    void test_matrix_slices ( void ) {
+        TS_ASSERT ( translationContains ( "matrix_views",
+                                          "slice(m, 0, 2, 1, 1)" ) ) ;
+        TS_ASSERT ( translationContains ( "matrix_views",
+                                          "transpose(m) * m" ) ) ;
+        TS_ASSERT ( translationContains ( "matrix_views",
+                                          "matrix m = matrixRead(" ) ) ;
+    }
+
+    // Comprehensions that transpose a matrix are copied in tiles.
+    void test_transposes ( void ) {
+        TS_ASSERT ( translationContains ( "matrix_views",
+                        "matrix t = transpose(m).block(0, 0, numCols(m), "
+                        "numRows(m));" ) ) ;
+        TS_ASSERT ( ! translationContains ( "sample_8", "transpose(" ) ) ;
+    }
+
+    // What a program built as a shared object hands its host: what it
+    // prints, and its matrices as "name rowsxcols: values".
+    struct hostState {
+        string printed ;
+        string results ;
+    } ;
+
+    static void hostPrint ( void *context, const char *text, size_t length ) {
+        ( (hostState *) context )->printed.append ( text, length ) ;
+    }
+
+    static void hostResult ( void *context, const cdal_matrix *m ) {
+        stringstream out ;
+        out << m->name << " " << m->rows << "x" << m->cols << ":" ;
+        for ( int k = 0 ; k != m->rows * m->cols ; k++ )
+            out << " " << ( (const float *) m->values )[k] ;
+        ( (hostState *) context )->results += out.str() + "\n" ;
+    }
+
+    // A program built as a shared object runs in this process as often as
+    // it is called, reading matrices passed in memory rather than files.
+    void test_shared_object ( void ) {
+        ParseResult pr1 = p.parse ( readFile ( "../samples/row_sums.dsl" ) ) ;
+        TS_ASSERT ( pr1.ok ) ;
+        string code = ( (Program *) pr1.ast )->libraryCppCode() ;
+        TS_ASSERT ( code.find ( "matrixStream" ) == string::npos ) ;
+        writeFile ( code, "../samples/row_sums_lib.cpp" ) ;
+
+        string compile = runtimeCompile + "-shared "
+                         "../samples/row_sums_lib.cpp "
+                         "-o ../samples/row_sums_lib.so -L../samples -lcdal" ;
+        TS_ASSERT_EQUALS ( system ( compile.c_str() ), 0 ) ;
+        void *library = dlopen ( "../samples/row_sums_lib.so", RTLD_NOW ) ;
+        TSM_ASSERT ( dlerror(), library != NULL ) ;
+        cdal_entry entry = (cdal_entry) dlsym ( library, "cdal_main" ) ;
+        TS_ASSERT ( entry != NULL ) ;
 
+        // without inputs, matrixRead reads the file
+        hostState host ;
+        cdal_call call ;
+        memset ( &call, 0, sizeof(call) ) ;
+        call.version = CDAL_ABI_VERSION ;
+        call.context = &host ;
+        call.print = hostPrint ;
+        TS_ASSERT_EQUALS ( entry ( &call ), 0 ) ;
+        ifstream in ( "../samples/row_sums.expected" ) ;
+        stringstream expected ;
+        expected << in.rdbuf() ;
+        TS_ASSERT_EQUALS ( host.printed, expected.str() ) ;
 
+        // an input of the same name replaces the file
+        double values[] = { 1, 2, 3, 4, 5, 6 } ;
+        cdal_matrix input = { "../samples/sample_8.data", CDAL_FLOAT64, 2, 3,
+                              values } ;
+        call.inputs = &input ;
+        call.num_inputs = 1 ;
+        call.result = hostResult ;
+        host = hostState() ;
+        TS_ASSERT_EQUALS ( entry ( &call ), 0 ) ;
+        TS_ASSERT_EQUALS ( host.printed, "2 1\n6  \n15  \n" ) ;
+        TS_ASSERT_EQUALS ( host.results, "data 2x3: 1 2 3 4 5 6\n"
+                                         "rowSum 2x1: 6 15\n" ) ;
+
+        // errors fail the call rather than the host
+        input.element_type = 9 ;
+        TS_ASSERT_EQUALS ( entry ( &call ), 1 ) ;
+        TS_ASSERT_EQUALS ( string ( call.error ),
+                           "ERROR, input ../samples/sample_8.data has "
+                           "unknown element type 9" ) ;
+        input.element_type = CDAL_FLOAT64 ;
+        TS_ASSERT_EQUALS ( entry ( &call ), 0 ) ;
+        TS_ASSERT_EQUALS ( string ( call.error ), "" ) ;
+
+        dlclose ( library ) ;
+    }
+
+    // SIGUSR1 asks a runtime loaded by a host for a memory report, even on
+    // a thread the host started before loading it.
+    void test_memory_report_signal ( void ) {
+        ParseResult pr1 = p.parse ( readFile ( "../samples/row_sums.dsl" ) ) ;
+        TS_ASSERT ( pr1.ok ) ;
+        writeFile ( ( (Program *) pr1.ast )->libraryCppCode(),
+                    "../samples/memory_lib.cpp" ) ;
+        string compile = runtimeCompile + "-shared ../samples/memory_lib.cpp "
+                         "-o ../samples/memory_lib.so -L../samples -lcdal" ;
+        TS_ASSERT_EQUALS ( system ( compile.c_str() ), 0 ) ;
+
+        atomic<bool> stop ( false ) ;
+        thread host ( [&stop] { while ( ! stop ) usleep ( 1000 ) ; } ) ;
+        remove ( "../samples/memory_lib.memory" ) ;
+        setenv ( "CDAL_MEMORY", "../samples/memory_lib.memory", 1 ) ;
+        void *library = dlopen ( "../samples/memory_lib.so", RTLD_NOW ) ;
+        unsetenv ( "CDAL_MEMORY" ) ;
+        TSM_ASSERT ( dlerror(), library != NULL ) ;
+
+        pthread_kill ( host.native_handle(), SIGUSR1 ) ;
+        string report ;
+        for ( int k = 0 ; k != 500 && report.empty() ; k++ ) {
+            usleep ( 10000 ) ;
+            ifstream in ( "../samples/memory_lib.memory" ) ;
+            stringstream memory ;
+            memory << in.rdbuf() ;
+            report = memory.str() ;
+        }
+        stop = true ;
+        host.join() ;
+        TS_ASSERT ( report.find ( "CDAL memory: " ) == 0 ) ;
+        TS_ASSERT ( report.find ( " bytes held at peak\n" ) != string::npos ) ;
+        dlclose ( library ) ;
+    }
+
+    // A batch of programs is built by one Makefile, which only rebuilds
+    // what changed; its ninja file has the same edges.
+    void test_build_graph ( void ) {
+        string dir = "../samples/batch" ;
+        mkdir ( dir.c_str(), 0755 ) ;
+        BuildGraph graph ( dir, "../samples" ) ;
+        const char *names[] = { "sample_1", "sample_8" } ;
+        for ( int k = 0 ; k != 2 ; k++ ) {
+            string path = string ( "../samples/" ) + names[k] + ".dsl" ;
+            ParseResult pr1 = p.parse ( readFile ( path.c_str() ) ) ;
+            TS_ASSERT ( pr1.ok ) ;
+            TS_ASSERT ( graph.add ( names[k], (Program *) pr1.ast ) ) ;
+        }
+
+        stringstream ninja ;
+        graph.writeNinja ( ninja ) ;
+        TS_ASSERT ( ninja.str().find ( "build sample_8.o: cxx sample_8.cpp "
+                                       "| $runtime/Matrix.h.gch\n" ) !=
+                    string::npos ) ;
+        TS_ASSERT ( ninja.str().find ( "build sample_8: link sample_8.o "
+                                       "cdal_runtime.o\n" ) != string::npos ) ;
+        TS_ASSERT ( ninja.str().find ( "build $runtime/Matrix.h.gch: pch "
+                                       "$runtime/Matrix.h\n" ) !=
+                    string::npos ) ;
+
+        ofstream makefile ( ( dir + "/Makefile" ).c_str() ) ;
+        graph.writeMakefile ( makefile ) ;
+        makefile.close() ;
+        TS_ASSERT_EQUALS ( system ( ( "make -s -C " + dir ).c_str() ), 0 ) ;
+        string run = dir + "/sample_8 > " + dir + "/sample_8.output" ;
+        TS_ASSERT_EQUALS ( system ( run.c_str() ), 0 ) ;
+        string diff = "diff -q " + dir + "/sample_8.output "
+                      "../samples/sample_8.expected" ;
+        TS_ASSERT_EQUALS ( system ( diff.c_str() ), 0 ) ;
+
+        // translations that did not change leave the build up to date
+        ParseResult pr1 = p.parse ( readFile ( "../samples/sample_1.dsl" ) ) ;
+        TS_ASSERT ( graph.add ( "sample_1", (Program *) pr1.ast ) ) ;
+        TS_ASSERT_EQUALS ( system ( ( "make -q -C " + dir ).c_str() ), 0 ) ;
+    }
+
+    // Whether every line of a translation from its first #line directive
+    // to the end of main follows a directive.
+    bool everyLineDirected ( const string &code ) {
+        istringstream lines ( code.substr ( code.find ( "#line" ) ) ) ;
+        string line ;
+        bool directed = false ;
+        while ( getline ( lines, line ) && line != "}" ) {
+            size_t first = line.find_first_not_of ( ' ' ) ;
+            if ( first == string::npos ) continue ;
+            bool directive = line.compare ( first, 6, "#line " ) == 0 ;
+            if ( ! directive && ! directed ) return false ;
+            directed = directive ;
+        }
+        return true ;
+    }
+
+    // A program that knows its source file says which line each line of
+    // its translation comes from, and where each profiling site is.
+    void test_line_directives ( void ) {
+        const char *text = readFile ( "../samples/row_sums.dsl" ) ;
+        ParseResult pr1 = p.parse ( text ) ;
+        TS_ASSERT ( pr1.ok ) ;
+        Program *program = (Program *) pr1.ast ;
+        TS_ASSERT ( program->cppCode().find ( "#line" ) == string::npos ) ;
+
+        program->setSource ( "../samples/row_sums.dsl", text ) ;
+        string code = program->cppCode() ;
+        TS_ASSERT ( code.find ( "    #line 6 \"../samples/row_sums.dsl\"\n"
+                                "    matrixStream data(" ) != string::npos ) ;
+        TS_ASSERT ( code.find ( "#line 19 \"../samples/row_sums.dsl\"\n"
+                                "                    s = s + data[row][k];" ) !=
+                    string::npos ) ;
+        TS_ASSERT ( code.find ( "#line 25 \"../samples/row_sums.dsl\"\n"
+                                "    std::cout << rowSum;" ) != string::npos ) ;
+        TS_ASSERT ( program->libraryCppCode().find ( "#line 25 " ) !=
+                    string::npos ) ;
+        // the lines of the comprehension after the loop within it are on
+        // the lines of the loop and of the comprehension
+        TS_ASSERT ( code.find ( "                    s = s + data[row][k];\n"
+                                "                #line 18 \"../samples/"
+                                "row_sums.dsl\"\n                }\n"
+                                "                #line 13 \"../samples/"
+                                "row_sums.dsl\"\n                s;\n" ) !=
+                    string::npos ) ;
+        TS_ASSERT ( everyLineDirected ( code ) ) ;
+        // and a profiled statement is on its own line, not the one after
+        // where it is entered
+        string profiled = program->profiledCppCode() ;
+        TS_ASSERT ( profiled.find ( "#line 9 \"../samples/row_sums.dsl\"\n"
+                                    "    profileEnter(cdalSites[2]);\n"
+                                    "    #line 9 \"../samples/row_sums.dsl\"\n"
+                                    "    rows = numRows(data);\n" ) !=
+                    string::npos ) ;
+        TS_ASSERT ( everyLineDirected ( profiled ) ) ;
+        TS_ASSERT ( program->profiledCppCode().find (
+                        "{\"statement\", \"row_sums.dsl:19:9\", "
+                        "\"s = s + data [ row : k ];\"}" ) != string::npos ) ;
+
+        // the translation still builds and prints what it did
+        writeFile ( code, "../samples/row_sums_lines.cpp" ) ;
+        string compile = runtimeCompile + "../samples/row_sums_lines.cpp "
+                         "-o ../samples/row_sums_lines -L../samples -lcdal" ;
+        TS_ASSERT_EQUALS ( system ( compile.c_str() ), 0 ) ;
+        TS_ASSERT_EQUALS ( system ( "../samples/row_sums_lines | "
+                                    "diff -q - ../samples/row_sums.expected" ),
+                           0 ) ;
+    }
+
+    // A profiling translation prints what the program prints, and reports
+    // the calls of and time in each statement, comprehension and kernel.
+    void test_profile ( void ) {
+        ParseResult pr1 = p.parse ( readFile ( "../samples/row_sums.dsl" ) ) ;
+        TS_ASSERT ( pr1.ok ) ;
+        writeFile ( ( (Program *) pr1.ast )->profiledCppCode(),
+                    "../samples/row_sums_profiled.cpp" ) ;
+        string compile = runtimeCompile + "../samples/row_sums_profiled.cpp "
+                         "-o ../samples/row_sums_profiled -L../samples -lcdal" ;
+        TS_ASSERT_EQUALS ( system ( compile.c_str() ), 0 ) ;
+        string run = "CDAL_PROFILE=../samples/row_sums.profile "
+                     "../samples/row_sums_profiled > "
+                     "../samples/row_sums_profiled.output" ;
+        TS_ASSERT_EQUALS ( system ( run.c_str() ), 0 ) ;
+        TS_ASSERT_EQUALS ( system ( "diff -q ../samples/row_sums_profiled.output "
+                                    "../samples/row_sums.expected" ), 0 ) ;
+
+        ifstream in ( "../samples/row_sums.profile" ) ;
+        stringstream profile ;
+        profile << in.rdbuf() ;
+        string report = profile.str() ;
+        TS_ASSERT ( report.find ( "CDAL profile: " ) == 0 ) ;
+        TS_ASSERT ( report.find ( "comprehension matrix rowSum" ) !=
+                    string::npos ) ;
+        // the body of the repeat runs once for each element of sample_8
+        TS_ASSERT ( report.find ( "          20 " ) != string::npos ) ;
+        TS_ASSERT ( report.find ( "statement s = s + data" ) !=
+                    string::npos ) ;
+
+        // hardware counters give rates for each site, or the report says
+        // why there are none
+        run = "CDAL_COUNTERS=1 " + run ;
+        TS_ASSERT_EQUALS ( system ( run.c_str() ), 0 ) ;
+        TS_ASSERT_EQUALS ( system ( "diff -q ../samples/row_sums_profiled.output "
+                                    "../samples/row_sums.expected" ), 0 ) ;
+        ifstream counted ( "../samples/row_sums.profile" ) ;
+        stringstream withCounters ;
+        withCounters << counted.rdbuf() ;
+        report = withCounters.str() ;
+        TS_ASSERT ( report.find ( "     IPC  LLC miss/ki  br miss/ki  site\n" ) !=
+                        string::npos ||
+                    report.find ( "CDAL profile: no hardware counters, " ) !=
+                        string::npos ) ;
+        TS_ASSERT ( report.find ( "statement s = s + data" ) !=
+                    string::npos ) ;
+
+        // the memory report says which statement allocated each matrix
+        remove ( "../samples/row_sums.memory" ) ;
+        string memoryRun = "CDAL_MEMORY=../samples/row_sums.memory "
+                           "../samples/row_sums_profiled > /dev/null" ;
+        TS_ASSERT_EQUALS ( system ( memoryRun.c_str() ), 0 ) ;
+        ifstream memoryIn ( "../samples/row_sums.memory" ) ;
+        stringstream memory ;
+        memory << memoryIn.rdbuf() ;
+        TS_ASSERT ( memory.str().find ( "CDAL memory: " ) == 0 ) ;
+        TS_ASSERT ( memory.str().find ( " 0 bytes live, " ) != string::npos ) ;
+        TS_ASSERT ( memory.str().find ( "           1              16"
+                                        "               0  "
+                                        "statement matrix rowSum" ) !=
+                    string::npos ) ;
+
+        // products and reductions of matrices are timed as kernels
+        ParseResult pr2 = p.parse ( readFile ( "../samples/matrix_views.dsl" ) ) ;
+        string code = ( (Program *) pr2.ast )->profiledCppCode() ;
+        TS_ASSERT ( code.find ( "{\"kernel\", \"\", \"transpose( m ) * m\"}" ) !=
+                    string::npos ) ;
+        TS_ASSERT ( code.find ( "[&] { return transpose(m) * m; })" ) !=
+                    string::npos ) ;
+    }
+
+    // The self milliseconds of the site of a profile report with this
+    // label, or -1 if it is not there.
+    double selfMs ( const string &report, const string &label ) {
+        istringstream lines ( report ) ;
+        string line ;
+        while ( getline ( lines, line ) ) {
+            istringstream fields ( line ) ;
+            double calls, total, self ;
+            string site ;
+            if ( fields >> calls >> total >> self && getline ( fields, site ) &&
+                 site == "  " + label )
+                return self ;
+        }
+        return -1 ;
+    }
+
+    // A product is timed where its elements are computed, so its kernel
+    // takes the time rather than the statement storing it.
+    void test_kernel_profile ( void ) {
+        ParseResult pr1 = p.parse (
+            "main () { matrix a [ 400 : 400 ] i : j = i + j ; "
+            "matrix b [ 400 : 400 ] i : j = i - j ; "
+            "matrix c = a * b ; print ( c [ 1 : 2 ] ) ; }" ) ;
+        TS_ASSERT ( pr1.ok ) ;
+        writeFile ( ( (Program *) pr1.ast )->profiledCppCode(),
+                    "../samples/kernel_profiled.cpp" ) ;
+        string compile = runtimeCompile + "../samples/kernel_profiled.cpp "
+                         "-o ../samples/kernel_profiled -L../samples -lcdal" ;
+        TS_ASSERT_EQUALS ( system ( compile.c_str() ), 0 ) ;
+        TS_ASSERT_EQUALS ( system ( "CDAL_PROFILE=../samples/kernel.profile "
+                                    "../samples/kernel_profiled > /dev/null" ),
+                           0 ) ;
+
+        ifstream in ( "../samples/kernel.profile" ) ;
+        stringstream profile ;
+        profile << in.rdbuf() ;
+        double kernel = selfMs ( profile.str(), "kernel a * b" ) ;
+        double statement = selfMs ( profile.str(),
+                                    "statement matrix c = a * b;" ) ;
+        TSM_ASSERT ( profile.str(), kernel >= 0 && statement >= 0 ) ;
+        TSM_ASSERT ( profile.str(), kernel > 10 * statement ) ;
+
+        // the counters of the product include its workers' where the kernel
+        // inherits them, and the report says when it does not
+        TS_ASSERT_EQUALS ( system ( "CDAL_COUNTERS=1 CDAL_THREADS=3 "
+                                    "CDAL_PROFILE=../samples/kernel.profile "
+                                    "../samples/kernel_profiled > /dev/null" ),
+                           0 ) ;
+        ifstream counted ( "../samples/kernel.profile" ) ;
+        stringstream withCounters ;
+        withCounters << counted.rdbuf() ;
+        string report = withCounters.str() ;
+        TSM_ASSERT ( report,
+                     report.find ( "CDAL profile: no hardware counters, " ) !=
+                             string::npos ||
+                         report.find ( "     IPC  LLC miss/ki  br miss/ki" ) !=
+                             string::npos ) ;
+    }
+} ;
 
+const string CodeGenTestSuite::runtimeCompile =
+    "g++ -O2 -std=c++0x -pthread -fPIC -I../samples " ;
@@ -39,6 +39,7 @@ ExtToken *extendToken (Parser *p, Token *tokens) {
     case falseKwd: return new FalseKwdToken(p,tokens) ;
     case matrixKwd: return new ExtToken(p,tokens,"'matrix'") ;
     case toKwd: return new ExtToken(p,tokens,"'to'") ;
+    case sparseKwd: return new ExtToken(p,tokens,"'sparse'") ;
     //case booleanKwd: return new ExtToken(p,tokens,"'boolean'") ;
 
     // Constants
@@ -15,9 +15,11 @@
 class ExtToken {
 public:
     ExtToken (Parser *p, Token *t) 
-        : lexeme(t->lexeme), terminal(t->terminal), parser(p) { }
+        : lexeme(t->lexeme), terminal(t->terminal), offset(t->offset),
+          parser(p) { }
     ExtToken (Parser *p, Token *t, std::string d) 
-        : lexeme(t->lexeme), terminal(t->terminal), parser(p), descStr(d) { }
+        : lexeme(t->lexeme), terminal(t->terminal), offset(t->offset),
+          parser(p), descStr(d) { }
 
     virtual ~ExtToken () { } ;
 
@@ -30,6 +32,7 @@ public:
     }
     std::string lexeme ;
     tokenType terminal ;
+    int offset ;
     ExtToken *next ;
     Parser *parser;
 
@@ -37,7 +40,7 @@ public:
     virtual std::string description() { return descStr ; }
 
 private:
-    ExtToken () : parser(NULL) { } 
+    ExtToken () : offset(-1), parser(NULL) { } 
     std::string descStr ;
 } ;
 
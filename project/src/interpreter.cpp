@@ -0,0 +1,868 @@
+/***
+ * Interpreter: runs a CDAL program from its AST; see interpreter.h.
+ *
+ * The execute and evaluate members of the AST nodes are defined here,
+ * next to the values they work on, rather than in AST.cpp.
+ */
+
+#include "./interpreter.h"
+#include "./AST.h"
+#include "./Matrix.h"
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <type_traits>
+
+string typeName(ValueType type) {
+    switch (type) {
+        case boolType: return "boolean";
+        case intType: return "int";
+        case longType: return "long";
+        case floatType: return "float";
+        case doubleType: return "double";
+        case stringType: return "string";
+        default: return "matrix";
+    }
+}
+
+namespace {
+
+// the element type of a matrix, where no type means float
+string elementName(const string &elementType) {
+    return elementType.empty() ? "float" : elementType;
+}
+
+}  // namespace
+
+
+//===================================================================
+// Value
+
+Value Value::ofBool(bool b) {
+    Value v;
+    v.type = boolType;
+    v.integer = b;
+    return v;
+}
+
+// ints wrap around like the int of generated code
+Value Value::ofInt(long long i) {
+    Value v;
+    v.type = intType;
+    v.integer = static_cast<int32_t>(i);
+    return v;
+}
+
+Value Value::ofLong(long long i) {
+    Value v;
+    v.type = longType;
+    v.integer = i;
+    return v;
+}
+
+Value Value::ofFloat(double f) {
+    Value v;
+    v.type = floatType;
+    v.real = static_cast<float>(f);
+    return v;
+}
+
+Value Value::ofDouble(double d) {
+    Value v;
+    v.type = doubleType;
+    v.real = d;
+    return v;
+}
+
+Value Value::ofString(const string &s) {
+    Value v;
+    v.type = stringType;
+    v.text = s;
+    return v;
+}
+
+Value Value::ofMatrix(const shared_ptr<MatrixValue> &m) {
+    Value v;
+    v.type = matrixType;
+    v.matrix = m;
+    return v;
+}
+
+double Value::toDouble() const {
+    if (!isNumber())
+        throw "a " + typeName(type) + " is used where a number is expected";
+    return type >= floatType ? real : static_cast<double>(integer);
+}
+
+long long Value::toInteger() const {
+    if (!isNumber())
+        throw "a " + typeName(type) + " is used where a number is expected";
+    return type >= floatType ? static_cast<long long>(real) : integer;
+}
+
+bool Value::toBool() const {
+    if (!isNumber())
+        throw "a " + typeName(type) + " is used as a condition";
+    return type >= floatType ? real != 0 : integer != 0;
+}
+
+Value Value::convertTo(ValueType to) const {
+    if (to == type) return *this;
+    if (!isNumber() || to == stringType || to == matrixType)
+        throw "cannot convert a " + typeName(type) + " to a " + typeName(to);
+    switch (to) {
+        case boolType: return ofBool(toBool());
+        case intType: return ofInt(toInteger());
+        case longType: return ofLong(toInteger());
+        // an int converts to float directly, not through double
+        case floatType:
+            return type >= floatType ? ofFloat(real)
+                                     : ofFloat(static_cast<float>(integer));
+        default: return ofDouble(toDouble());
+    }
+}
+
+
+//===================================================================
+// Matrices
+
+namespace {
+
+// the value of a matrix element; int8 elements are promoted to int, as
+// generated code does so that they print as numbers
+Value elementValue(float e) { return Value::ofFloat(e); }
+Value elementValue(double e) { return Value::ofDouble(e); }
+Value elementValue(int8_t e) { return Value::ofInt(e); }
+Value elementValue(int32_t e) { return Value::ofInt(e); }
+Value elementValue(int64_t e) { return Value::ofLong(e); }
+
+// a value converted to an element of type T, as C++ converts on assignment
+template <class T>
+T elementOf(const Value &v) {
+    if (!v.isNumber())
+        throw "cannot store a " + typeName(v.type) + " in a matrix";
+    if (v.type < floatType) return static_cast<T>(v.integer);
+    if (std::is_integral<T>::value)
+        return static_cast<T>(static_cast<long long>(v.real));
+    return static_cast<T>(v.real);
+}
+
+template <class T>
+string elementTypeOf();
+template <>
+string elementTypeOf<float>() { return "float"; }
+template <>
+string elementTypeOf<double>() { return "double"; }
+template <>
+string elementTypeOf<int32_t>() { return "int"; }
+template <>
+string elementTypeOf<int8_t>() { return "int8"; }
+
+/**
+ * a matrix of elements of type T, kept in a basicMatrix of the runtime
+ */
+template <class T>
+class typedMatrix : public MatrixValue {
+public:
+    typedMatrix(int rows, int cols) : m(rows, cols) {}
+    explicit typedMatrix(basicMatrix<T> &&values) : m(std::move(values)) {}
+
+    string elementType() const { return elementTypeOf<T>(); }
+    int numRows() const { return m.numRows(); }
+    int numCols() const { return m.numCols(); }
+
+    Value get(int i, int j) const {
+        checkIndex(i, j);
+        return elementValue(m[i][j]);
+    }
+
+    void set(int i, int j, const Value &v) {
+        checkIndex(i, j);
+        m[i][j] = elementOf<T>(v);
+    }
+
+    void *values() { return m.numRows() * m.numCols() == 0 ? NULL : m[0]; }
+
+    shared_ptr<MatrixValue> copy() const {
+        return make(basicMatrix<T>(m));
+    }
+
+    shared_ptr<MatrixValue> convertTo(const string &type) const {
+        string to = elementName(type);
+        if (to == "double") return converted<double>();
+        if (to == "int") return converted<int32_t>();
+        if (to == "int8") return converted<int8_t>();
+        return converted<float>();
+    }
+
+    void print(ostream &os) const { os << m; }
+
+    void write(ostream &os) const { matrixWrite(m, os, binaryFormat); }
+
+    shared_ptr<MatrixValue> multiply(const MatrixValue &right) const {
+        basicMatrix<typename elementTraits<T>::product> product =
+            m * same(right, "multiplied").m;
+        return make(std::move(product));
+    }
+
+    shared_ptr<MatrixValue> combine(char op, const MatrixValue &right) const {
+        const basicMatrix<T> &r = same(right, "combined").m;
+        switch (op) {
+            case '+': return make(basicMatrix<T>(m + r));
+            case '-': return make(basicMatrix<T>(m - r));
+            case '*': return make(basicMatrix<T>(hadamard(m, r)));
+            default: return make(basicMatrix<T>(m / r));
+        }
+    }
+
+    shared_ptr<MatrixValue> combine(char op, const Value &scalar,
+                                    bool scalarLeft) const {
+        // as the runtime's operators, which reject the narrowing at compile
+        // time, a floating scalar is not truncated to integer elements
+        if (std::is_integral<T>::value &&
+            (scalar.type == floatType || scalar.type == doubleType))
+            throw "a " + typeName(scalar.type) +
+                " cannot be combined with a matrix with " + elementType() +
+                " elements";
+        T s = elementOf<T>(scalar);
+        switch (op) {
+            case '+':
+                return make(scalarLeft ? basicMatrix<T>(s + m)
+                                       : basicMatrix<T>(m + s));
+            case '-':
+                return make(scalarLeft ? basicMatrix<T>(s - m)
+                                       : basicMatrix<T>(m - s));
+            case '*':
+                return make(scalarLeft ? basicMatrix<T>(s * m)
+                                       : basicMatrix<T>(m * s));
+            default:
+                return make(scalarLeft ? basicMatrix<T>(s / m)
+                                       : basicMatrix<T>(m / s));
+        }
+    }
+
+    shared_ptr<MatrixValue> transpose() const {
+        return make(basicMatrix<T>(wholeView(m).transposed()));
+    }
+
+    shared_ptr<MatrixValue> slice(int firstRow, int lastRow, int firstCol,
+                                  int lastCol) const {
+        return make(basicMatrix<T>(
+            wholeView(m).block(firstRow, firstCol, lastRow - firstRow + 1,
+                               lastCol - firstCol + 1)));
+    }
+
+    Value reduce(const string &name) const {
+        if (name == "sum") return elementValue(sum(m));
+        if (name == "mean") return Value::ofDouble(mean(m));
+        if (name == "min") return elementValue(min(m));
+        if (name == "max") return elementValue(max(m));
+        return Value::ofDouble(norm(m));
+    }
+
+private:
+    basicMatrix<T> m;
+
+    template <class U>
+    static shared_ptr<MatrixValue> make(basicMatrix<U> &&values) {
+        return make_shared<typedMatrix<U> >(std::move(values));
+    }
+
+    template <class U>
+    shared_ptr<MatrixValue> converted() const {
+        return make(basicMatrix<U>(m));
+    }
+
+    // the other operand of a binary operation, which must have elements
+    // of the same type, as the operators of the runtime require
+    const typedMatrix &same(const MatrixValue &other, const char *verb) const {
+        const typedMatrix *o = dynamic_cast<const typedMatrix *>(&other);
+        if (o == NULL)
+            throw "matrices with " + elementType() + " and " +
+                other.elementType() + " elements cannot be " + verb;
+        return *o;
+    }
+
+    void checkIndex(int i, int j) const {
+        if (i < 0 || j < 0 || i >= m.numRows() || j >= m.numCols())
+            throw "element (" + to_string(i) + ", " + to_string(j) +
+                ") is outside a matrix with dimensions " +
+                to_string(m.numRows()) + "x" + to_string(m.numCols());
+    }
+};
+
+}  // namespace
+
+shared_ptr<MatrixValue> makeMatrix(const string &elementType, int rows,
+                                   int cols) {
+    string type = elementName(elementType);
+    if (type == "double") return make_shared<typedMatrix<double> >(rows, cols);
+    if (type == "int") return make_shared<typedMatrix<int32_t> >(rows, cols);
+    if (type == "int8") return make_shared<typedMatrix<int8_t> >(rows, cols);
+    return make_shared<typedMatrix<float> >(rows, cols);
+}
+
+shared_ptr<MatrixValue> readMatrixFile(const string &filename) {
+    return make_shared<typedMatrix<float> >(matrixRead(filename.c_str()));
+}
+
+string literalText(const string &lexeme) {
+    string text;
+    for (size_t k = 1; k + 1 < lexeme.size(); k++) {
+        char c = lexeme[k];
+        if (c == '\\' && k + 2 < lexeme.size()) {
+            c = lexeme[++k];
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+            }
+        }
+        text += c;
+    }
+    return text;
+}
+
+mathFunction findMathFunction(const string &name) {
+    static const struct {
+        const char *name;
+        mathFunction function;
+    } functions[] = {{"sqrt", ::sqrt},   {"exp", ::exp},   {"log", ::log},
+                     {"log10", ::log10}, {"fabs", ::fabs}, {"ceil", ::ceil},
+                     {"floor", ::floor}, {"round", ::round}, {"sin", ::sin},
+                     {"cos", ::cos},     {"tan", ::tan}};
+    for (size_t k = 0; k != sizeof(functions) / sizeof(functions[0]); k++)
+        if (name == functions[k].name) return functions[k].function;
+    return NULL;
+}
+
+
+//===================================================================
+// Operators
+
+namespace {
+
+/**
+ * a + b, a - b, a * b or a / b. Numbers are converted to the larger of
+ * their types, and at least to int, as C++ does; matrices are multiplied,
+ * combined element by element, or combined with a scalar.
+ */
+Value arithmetic(char op, const Value &a, const Value &b) {
+    if (a.type == matrixType && b.type == matrixType)
+        return Value::ofMatrix(op == '*' ? a.matrix->multiply(*b.matrix)
+                                         : a.matrix->combine(op, *b.matrix));
+    if (a.type == matrixType && b.isNumber())
+        return Value::ofMatrix(a.matrix->combine(op, b, false));
+    if (a.isNumber() && b.type == matrixType)
+        return Value::ofMatrix(b.matrix->combine(op, a, true));
+    if (op == '+' && a.type == stringType && b.type == stringType)
+        return Value::ofString(a.text + b.text);
+    if (!a.isNumber() || !b.isNumber())
+        throw string("cannot apply ") + op + " to a " + typeName(a.type) +
+            " and a " + typeName(b.type);
+
+    ValueType type = std::max(std::max(a.type, b.type), intType);
+    if (type >= floatType) {
+        double x = a.convertTo(type).real, y = b.convertTo(type).real, r;
+        switch (op) {
+            case '+': r = x + y; break;
+            case '-': r = x - y; break;
+            case '*': r = x * y; break;
+            default: r = x / y;
+        }
+        return type == floatType ? Value::ofFloat(r) : Value::ofDouble(r);
+    }
+
+    // unsigned arithmetic wraps around where signed overflow is undefined
+    unsigned long long x = a.integer, y = b.integer, r;
+    switch (op) {
+        case '+': r = x + y; break;
+        case '-': r = x - y; break;
+        case '*': r = x * y; break;
+        default:
+            if (b.integer == 0) throw string("integer division by zero");
+            r = a.integer / b.integer;
+    }
+    long long result = static_cast<long long>(r);
+    return type == intType ? Value::ofInt(result) : Value::ofLong(result);
+}
+
+/**
+ * compare two numbers in the larger of their types, or two strings
+ * @return negative, zero or positive as a is less than, equal to or
+ * greater than b
+ */
+int compare(const Value &a, const Value &b) {
+    if (a.type == stringType && b.type == stringType)
+        return a.text.compare(b.text);
+    if (!a.isNumber() || !b.isNumber())
+        throw "cannot compare a " + typeName(a.type) + " and a " +
+            typeName(b.type);
+
+    ValueType type = std::max(std::max(a.type, b.type), intType);
+    if (type >= floatType) {
+        double x = a.convertTo(type).real, y = b.convertTo(type).real;
+        return x < y ? -1 : x > y ? 1 : 0;
+    }
+    return a.integer < b.integer ? -1 : a.integer > b.integer ? 1 : 0;
+}
+
+/**
+ * the type of an expression without evaluating it, where it can be told
+ * from the expression and the variables in scope
+ * @return false if the type is not known
+ */
+bool staticType(Expr *ex, Interpreter &interpreter, ValueType &type) {
+    if (dynamic_cast<IntExpr *>(ex) != NULL) {
+        type = intType;
+        return true;
+    }
+    if (dynamic_cast<FloatExpr *>(ex) != NULL) {
+        type = doubleType;
+        return true;
+    }
+    if (dynamic_cast<StringExpr *>(ex) != NULL) {
+        type = stringType;
+        return true;
+    }
+    if (dynamic_cast<TrueExpr *>(ex) || dynamic_cast<FalseExpr *>(ex) ||
+        dynamic_cast<GreaterExpr *>(ex) ||
+        dynamic_cast<GreaterEqualExpr *>(ex) || dynamic_cast<LessExpr *>(ex) ||
+        dynamic_cast<LessEqualExpr *>(ex) ||
+        dynamic_cast<EqualEqualExpr *>(ex) ||
+        dynamic_cast<NotEqualExpr *>(ex) || dynamic_cast<AndExpr *>(ex) ||
+        dynamic_cast<OrExpr *>(ex) || dynamic_cast<NotExpr *>(ex)) {
+        type = boolType;
+        return true;
+    }
+    if (dynamic_cast<MatrixSliceExpr *>(ex) != NULL) {
+        type = matrixType;
+        return true;
+    }
+    if (NestedExpr *nested = dynamic_cast<NestedExpr *>(ex))
+        return staticType(nested->inner(), interpreter, type);
+    if (VarNameExpr *var = dynamic_cast<VarNameExpr *>(ex)) {
+        Value *slot = interpreter.find(var->name());
+        if (slot != NULL) type = slot->type;
+        return slot != NULL;
+    }
+    if (MatrixExpr *element = dynamic_cast<MatrixExpr *>(ex)) {
+        Value *slot = interpreter.find(element->name());
+        if (slot == NULL || slot->type != matrixType) return false;
+        string elements = slot->matrix->elementType();
+        type = elements == "float"
+                   ? floatType
+                   : elements == "double" ? doubleType : intType;
+        return true;
+    }
+    if (NestedOrFunctionCallExpr *call =
+            dynamic_cast<NestedOrFunctionCallExpr *>(ex)) {
+        string name = call->functionName();
+        if (name == "numRows" || name == "numCols") {
+            type = intType;
+            return true;
+        }
+        if (name == "matrixRead" || name == "transpose") {
+            type = matrixType;
+            return true;
+        }
+        // the reductions of int matrices sum to long, so only mean and
+        // norm are known to be double
+        if (name == "sum" || name == "min" || name == "max") return false;
+        type = doubleType;
+        return true;
+    }
+
+    Expr *left = NULL, *right = NULL;
+    if (AddExpr *add = dynamic_cast<AddExpr *>(ex)) {
+        left = add->left(), right = add->right();
+    } else if (SubtractExpr *sub = dynamic_cast<SubtractExpr *>(ex)) {
+        left = sub->left(), right = sub->right();
+    } else if (MultiplyExpr *mul = dynamic_cast<MultiplyExpr *>(ex)) {
+        left = mul->left(), right = mul->right();
+    } else if (DevideExpr *div = dynamic_cast<DevideExpr *>(ex)) {
+        left = div->left(), right = div->right();
+    } else if (IfExpr *ifExpr = dynamic_cast<IfExpr *>(ex)) {
+        left = ifExpr->thenExpr(), right = ifExpr->elseExpr();
+    }
+    ValueType l, r;
+    if (left == NULL || !staticType(left, interpreter, l) ||
+        !staticType(right, interpreter, r))
+        return false;
+    if (l == matrixType || r == matrixType)
+        type = matrixType;
+    else if (l == r && dynamic_cast<IfExpr *>(ex) != NULL)
+        type = l;
+    else
+        type = std::max(std::max(l, r), intType);
+    return true;
+}
+
+/**
+ * a matrix to store in a variable with the given element type: the value
+ * converted to it, or a copy if it is shared with other values
+ */
+shared_ptr<MatrixValue> storedMatrix(const Value &value,
+                                     const string &elementType) {
+    if (value.type != matrixType)
+        throw "cannot convert a " + typeName(value.type) + " to a matrix";
+    if (value.matrix->elementType() != elementName(elementType))
+        return value.matrix->convertTo(elementType);
+    if (value.matrix.use_count() > 1) return value.matrix->copy();
+    return value.matrix;
+}
+
+// the index of a row or column
+int indexOf(Expr *ex, Interpreter &interpreter) {
+    return static_cast<int>(ex->evaluate(interpreter).toInteger());
+}
+
+// the matrix held by a variable
+MatrixValue &matrixNamed(const string &name, Interpreter &interpreter) {
+    Value &slot = interpreter.lookup(name);
+    if (slot.type != matrixType) throw name + " is not a matrix";
+    return *slot.matrix;
+}
+
+}  // namespace
+
+
+//===================================================================
+// Interpreter
+
+Interpreter::Interpreter(ostream &output) : out(output) {}
+
+int Interpreter::run(Program *program) {
+    slots.clear();
+    names.clear();
+    scopes.clear();
+    try {
+        program->execute(*this);
+    } catch (string error) {
+        out.flush();
+        cerr << "ERROR, " << error << endl;
+        return 1;
+    }
+    out.flush();
+    return 0;
+}
+
+void Interpreter::beginScope() { scopes.push_back(slots.size()); }
+
+void Interpreter::endScope() {
+    size_t first = scopes.back();
+    scopes.pop_back();
+    slots.resize(first);
+    names.resize(first);
+}
+
+Value &Interpreter::declare(const string &name, const Value &value) {
+    size_t first = scopes.empty() ? 0 : scopes.back();
+    for (size_t k = first; k != names.size(); k++)
+        if (names[k].first == name) throw name + " is declared twice";
+    slots.push_back(value);
+    names.push_back(make_pair(name, slots.size() - 1));
+    return slots.back();
+}
+
+Value *Interpreter::find(const string &name) {
+    for (size_t k = names.size(); k != 0; k--)
+        if (names[k - 1].first == name) return &slots[names[k - 1].second];
+    return NULL;
+}
+
+Value &Interpreter::lookup(const string &name) {
+    Value *slot = find(name);
+    if (slot == NULL) throw name + " is not declared";
+    return *slot;
+}
+
+void Interpreter::assign(Value &slot, const Value &value) {
+    if (slot.type == matrixType)
+        slot.matrix = storedMatrix(value, slot.matrix->elementType());
+    else if (slot.type == stringType && value.type == stringType)
+        slot.text = value.text;
+    else
+        slot = value.convertTo(slot.type);
+}
+
+
+//===================================================================
+// Execution of the AST
+
+void Program::execute(Interpreter &interpreter) {
+    interpreter.beginScope();
+    stmts->execute(interpreter);
+    interpreter.endScope();
+}
+
+void EmptyStmts::execute(Interpreter &) {}
+
+void SeqStmts::execute(Interpreter &interpreter) {
+    st1->execute(interpreter);
+    stmts->execute(interpreter);
+}
+
+void DeclStmt::execute(Interpreter &interpreter) {
+    decl->execute(interpreter);
+}
+
+void NestedStmt::execute(Interpreter &interpreter) {
+    interpreter.beginScope();
+    stmts->execute(interpreter);
+    interpreter.endScope();
+}
+
+void IfStmt::execute(Interpreter &interpreter) {
+    if (ex1->evaluate(interpreter).toBool()) st1->execute(interpreter);
+}
+
+void IfElseStmt::execute(Interpreter &interpreter) {
+    if (ex1->evaluate(interpreter).toBool())
+        st1->execute(interpreter);
+    else
+        st2->execute(interpreter);
+}
+
+void AssignStmt::execute(Interpreter &interpreter) {
+    Value value = ex1->evaluate(interpreter);
+    interpreter.assign(interpreter.lookup(varName), value);
+}
+
+void RangeAssignStmt::execute(Interpreter &interpreter) {
+    Value &slot = interpreter.lookup(varName);
+    if (slot.type != matrixType) throw varName + " is not a matrix";
+    int i = indexOf(ex1, interpreter);
+    int j = indexOf(ex2, interpreter);
+    Value value = ex3->evaluate(interpreter);
+    if (slot.matrix.use_count() > 1) slot.matrix = slot.matrix->copy();
+    slot.matrix->set(i, j, value);
+}
+
+void PrintStmt::execute(Interpreter &interpreter) {
+    Value value = ex1->evaluate(interpreter);
+    ostream &out = interpreter.out;
+    switch (value.type) {
+        case boolType: out << (value.integer != 0); break;
+        case intType:
+        case longType: out << value.integer; break;
+        case floatType:
+        case doubleType: out << value.real; break;
+        case stringType: out << value.text; break;
+        default: value.matrix->print(out);
+    }
+}
+
+// for (k = ex1; k <= ex2; k++), with ex2 evaluated before each iteration
+void RepeatStmt::execute(Interpreter &interpreter) {
+    Value &k = interpreter.lookup(varName);
+    interpreter.assign(k, ex1->evaluate(interpreter));
+    while (compare(k, ex2->evaluate(interpreter)) <= 0) {
+        st1->execute(interpreter);
+        interpreter.assign(k, arithmetic('+', k, Value::ofInt(1)));
+    }
+}
+
+void WhileStmt::execute(Interpreter &interpreter) {
+    while (ex1->evaluate(interpreter).toBool()) st1->execute(interpreter);
+}
+
+void SemicolonStmt::execute(Interpreter &) {}
+
+void IntDecl::execute(Interpreter &interpreter) {
+    interpreter.declare(varName, Value::ofInt(0));
+}
+
+void FloatDecl::execute(Interpreter &interpreter) {
+    interpreter.declare(varName, Value::ofFloat(0));
+}
+
+void StringDecl::execute(Interpreter &interpreter) {
+    interpreter.declare(varName, Value::ofString(""));
+}
+
+void BooleanDecl::execute(Interpreter &interpreter) {
+    interpreter.declare(varName, Value::ofBool(false));
+}
+
+// sparse matrices hold the same values as dense ones, so they are dense
+void MatrixLongDecl::execute(Interpreter &interpreter) {
+    int rows = indexOf(ex1, interpreter);
+    int cols = indexOf(ex2, interpreter);
+    Value &m = interpreter.declare(
+        varName1, Value::ofMatrix(makeMatrix(elementType, rows, cols)));
+
+    interpreter.beginScope();
+    Value &i = interpreter.declare(varName2, Value::ofInt(0));
+    for (; i.integer != rows; i.integer++) {
+        interpreter.beginScope();
+        Value &j = interpreter.declare(varName3, Value::ofInt(0));
+        for (; j.integer != cols; j.integer++) {
+            Value value = ex3->evaluate(interpreter);
+            m.matrix->set(i.integer, j.integer, value);
+        }
+        interpreter.endScope();
+    }
+    interpreter.endScope();
+}
+
+void MatrixShortDecl::execute(Interpreter &interpreter) {
+    Value value = ex1->evaluate(interpreter);
+    interpreter.declare(varName, Value::ofMatrix(storedMatrix(
+                                     value, sparse ? "" : elementType)));
+}
+
+
+//===================================================================
+// Evaluation of the AST
+
+Value VarNameExpr::evaluate(Interpreter &interpreter) {
+    return interpreter.lookup(varName);
+}
+
+Value IntExpr::evaluate(Interpreter &) { return Value::ofInt(val); }
+
+// the constant is read back as generated code writes it, with six digits
+// after the point
+Value FloatExpr::evaluate(Interpreter &) {
+    return Value::ofDouble(stod(to_string(val)));
+}
+
+Value StringExpr::evaluate(Interpreter &) {
+    return Value::ofString(literalText(val));
+}
+
+Value TrueExpr::evaluate(Interpreter &) { return Value::ofBool(true); }
+
+Value FalseExpr::evaluate(Interpreter &) { return Value::ofBool(false); }
+
+Value MultiplyExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return arithmetic('*', a, ex2->evaluate(interpreter));
+}
+
+Value DevideExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return arithmetic('/', a, ex2->evaluate(interpreter));
+}
+
+Value AddExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return arithmetic('+', a, ex2->evaluate(interpreter));
+}
+
+Value SubtractExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return arithmetic('-', a, ex2->evaluate(interpreter));
+}
+
+Value GreaterExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return Value::ofBool(compare(a, ex2->evaluate(interpreter)) > 0);
+}
+
+Value GreaterEqualExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return Value::ofBool(compare(a, ex2->evaluate(interpreter)) >= 0);
+}
+
+Value LessExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return Value::ofBool(compare(a, ex2->evaluate(interpreter)) < 0);
+}
+
+Value LessEqualExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return Value::ofBool(compare(a, ex2->evaluate(interpreter)) <= 0);
+}
+
+Value EqualEqualExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return Value::ofBool(compare(a, ex2->evaluate(interpreter)) == 0);
+}
+
+Value NotEqualExpr::evaluate(Interpreter &interpreter) {
+    Value a = ex1->evaluate(interpreter);
+    return Value::ofBool(compare(a, ex2->evaluate(interpreter)) != 0);
+}
+
+Value AndExpr::evaluate(Interpreter &interpreter) {
+    return Value::ofBool(ex1->evaluate(interpreter).toBool() &&
+                         ex2->evaluate(interpreter).toBool());
+}
+
+Value OrExpr::evaluate(Interpreter &interpreter) {
+    return Value::ofBool(ex1->evaluate(interpreter).toBool() ||
+                         ex2->evaluate(interpreter).toBool());
+}
+
+Value MatrixExpr::evaluate(Interpreter &interpreter) {
+    MatrixValue &m = matrixNamed(varName, interpreter);
+    int i = indexOf(ex1, interpreter);
+    return m.get(i, indexOf(ex2, interpreter));
+}
+
+// slices are copied, which generated code only does when it stores them
+Value MatrixSliceExpr::evaluate(Interpreter &interpreter) {
+    MatrixValue &m = matrixNamed(varName, interpreter);
+    int rowFirst = indexOf(firstRow, interpreter);
+    int colFirst = indexOf(firstCol, interpreter);
+    int rowLast = lastRow != NULL ? indexOf(lastRow, interpreter) : rowFirst;
+    int colLast = lastCol != NULL ? indexOf(lastCol, interpreter) : colFirst;
+    return Value::ofMatrix(m.slice(rowFirst, rowLast, colFirst, colLast));
+}
+
+// the builtins of generated code: the dimensions, transpose and
+// reductions of matrices, matrixRead, and functions of <cmath>
+Value NestedOrFunctionCallExpr::evaluate(Interpreter &interpreter) {
+    Value arg = ex1->evaluate(interpreter);
+    if (varName == "matrixRead") {
+        if (arg.type != stringType)
+            throw string("matrixRead needs a file name");
+        return Value::ofMatrix(readMatrixFile(arg.text));
+    }
+    if (varName == "numRows" || varName == "numCols" ||
+        varName == "transpose" || varName == "sum" || varName == "mean" ||
+        varName == "min" || varName == "max" || varName == "norm") {
+        if (arg.type != matrixType)
+            throw varName + " needs a matrix, not a " + typeName(arg.type);
+        if (varName == "numRows") return Value::ofInt(arg.matrix->numRows());
+        if (varName == "numCols") return Value::ofInt(arg.matrix->numCols());
+        if (varName == "transpose")
+            return Value::ofMatrix(arg.matrix->transpose());
+        return arg.matrix->reduce(varName);
+    }
+
+    mathFunction function = findMathFunction(varName);
+    if (function != NULL) return Value::ofDouble(function(arg.toDouble()));
+    throw varName + " is not a function";
+}
+
+Value NestedExpr::evaluate(Interpreter &interpreter) {
+    return ex1->evaluate(interpreter);
+}
+
+Value LetExpr::evaluate(Interpreter &interpreter) {
+    interpreter.beginScope();
+    stmts->execute(interpreter);
+    Value value = ex1->evaluate(interpreter);
+    interpreter.endScope();
+    return value;
+}
+
+// c ? a : b converts the value of either branch to the type of both
+Value IfExpr::evaluate(Interpreter &interpreter) {
+    bool condition = ex1->evaluate(interpreter).toBool();
+    Value value = (condition ? ex2 : ex3)->evaluate(interpreter);
+    ValueType other;
+    if (value.isNumber() &&
+        staticType(condition ? ex3 : ex2, interpreter, other) &&
+        other <= doubleType && other != value.type)
+        return value.convertTo(std::max(std::max(value.type, other), intType));
+    return value;
+}
+
+Value NotExpr::evaluate(Interpreter &interpreter) {
+    return Value::ofBool(!ex1->evaluate(interpreter).toBool());
+}
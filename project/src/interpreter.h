@@ -0,0 +1,208 @@
+/***
+ * Interpreter: runs a CDAL program straight from its AST, without
+ * translating it to C++ and compiling it first.
+ *
+ * The nodes of the AST execute and evaluate themselves against an
+ * Interpreter, which holds the variables in typed slots. Values follow
+ * the C++ that Program::cppCode would generate for the same program: ints
+ * wrap like int, float variables round like float, and mixed arithmetic
+ * is done in the wider type, so a program prints the same whether it is
+ * interpreted or compiled. Matrix operations call the kernels of the
+ * matrix runtime in Matrix.h, so run time errors like mismatched
+ * dimensions are reported in the same words.
+ *
+ * Errors that the C++ compiler would report, like an undeclared variable
+ * or adding a string to a matrix, are thrown as strings and reported by
+ * run.
+ */
+
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+class Program;
+class MatrixValue;
+
+/**
+ * the types of values; the numeric ones are in the order of C++'s usual
+ * arithmetic conversions, so mixed arithmetic is done in the larger type
+ */
+enum ValueType {
+    boolType,
+    intType,
+    longType,
+    floatType,
+    doubleType,
+    stringType,
+    matrixType
+};
+
+// the CDAL name of a type, for error messages
+string typeName(ValueType type);
+
+/**
+ * a value of any CDAL type. Matrices are shared between values until
+ * they are stored in a variable, which copies them if they are shared.
+ */
+struct Value {
+    ValueType type;
+    // bool, int and long values
+    long long integer;
+    // float and double values; floats are always rounded to float
+    double real;
+    string text;
+    shared_ptr<MatrixValue> matrix;
+
+    Value() : type(intType), integer(0), real(0) {}
+
+    static Value ofBool(bool b);
+    static Value ofInt(long long i);
+    static Value ofLong(long long i);
+    static Value ofFloat(double f);
+    static Value ofDouble(double d);
+    static Value ofString(const string &s);
+    static Value ofMatrix(const shared_ptr<MatrixValue> &m);
+
+    bool isNumber() const { return type <= doubleType; }
+
+    // the value as a C++ number of type double, long long or bool
+    double toDouble() const;
+    long long toInteger() const;
+    bool toBool() const;
+
+    /**
+     * the value converted to type, as C++ converts on assignment
+     */
+    Value convertTo(ValueType to) const;
+};
+
+/**
+ * a matrix of one of the element types of the runtime, float, double,
+ * int32 or int8; see typedMatrix in interpreter.cpp
+ */
+class MatrixValue {
+public:
+    virtual ~MatrixValue() {}
+
+    // the CDAL element type: "float", "double", "int" or "int8"
+    virtual string elementType() const = 0;
+    virtual int numRows() const = 0;
+    virtual int numCols() const = 0;
+
+    // element (i, j), promoted like generated code promotes int8 elements
+    virtual Value get(int i, int j) const = 0;
+    virtual void set(int i, int j, const Value &v) = 0;
+
+    // the elements in row-major order, as the C++ type of elementType()
+    virtual void *values() = 0;
+
+    virtual shared_ptr<MatrixValue> copy() const = 0;
+    virtual shared_ptr<MatrixValue> convertTo(const string &type) const = 0;
+    virtual void print(ostream &os) const = 0;
+    // write the matrix in the binary format of matrixWrite
+    virtual void write(ostream &os) const = 0;
+
+    /**
+     * the matrix product, or an element-wise operation op, one of + - * /,
+     * with another matrix of the same element type
+     */
+    virtual shared_ptr<MatrixValue> multiply(const MatrixValue &right) const = 0;
+    virtual shared_ptr<MatrixValue> combine(char op,
+                                            const MatrixValue &right) const = 0;
+
+    /**
+     * the element-wise operation op with a scalar, which is converted to
+     * the element type; scalarLeft is true for scalar op matrix
+     */
+    virtual shared_ptr<MatrixValue> combine(char op, const Value &scalar,
+                                            bool scalarLeft) const = 0;
+
+    virtual shared_ptr<MatrixValue> transpose() const = 0;
+    // a copy of the rows firstRow to lastRow and columns firstCol to lastCol
+    virtual shared_ptr<MatrixValue> slice(int firstRow, int lastRow,
+                                          int firstCol, int lastCol) const = 0;
+
+    /**
+     * sum, mean, min, max or norm of the elements
+     */
+    virtual Value reduce(const string &name) const = 0;
+};
+
+/**
+ * a new matrix of rows x cols zeros of the given CDAL element type
+ */
+shared_ptr<MatrixValue> makeMatrix(const string &elementType, int rows,
+                                   int cols);
+
+// a float matrix read from a file by matrixRead
+shared_ptr<MatrixValue> readMatrixFile(const string &filename);
+
+// the characters of a string literal, without its quotes and escapes
+string literalText(const string &lexeme);
+
+/**
+ * the function of <cmath> that generated code calls for a builtin like
+ * sqrt or floor, or NULL if there is no such builtin
+ */
+typedef double (*mathFunction)(double);
+mathFunction findMathFunction(const string &name);
+
+class Interpreter {
+public:
+    /**
+     * @param output where print statements write
+     */
+    Interpreter(ostream &output = cout);
+
+    /**
+     * run a program, reporting errors found while running it on cerr
+     * @return 0, or 1 if the program could not be run to its end
+     */
+    int run(Program *program);
+
+    ostream &out;
+
+    // mark the start and end of a C++ scope, a block or a let
+    void beginScope();
+    void endScope();
+
+    /**
+     * make a variable in the innermost scope
+     * @param  name  the variable name
+     * @param  value its type and initial value
+     * @return       its slot, which stays in place until its scope ends
+     */
+    Value &declare(const string &name, const Value &value);
+
+    /**
+     * the slot of the innermost variable with the given name, throwing an
+     * error if there is none
+     */
+    Value &lookup(const string &name);
+
+    // the slot of a variable, or NULL if none is in scope
+    Value *find(const string &name);
+
+    /**
+     * store a value in a slot, converting it to the slot's type and
+     * copying a matrix that other values share
+     */
+    void assign(Value &slot, const Value &value);
+
+private:
+    // the slots of all variables in scope, innermost last
+    deque<Value> slots;
+    vector<pair<string, size_t> > names;
+    // the number of slots when each open scope began
+    vector<size_t> scopes;
+};
+
+#endif  // INTERPRETER_H
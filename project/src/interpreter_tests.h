@@ -0,0 +1,227 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include "parser.h"
+#include "readInput.h"
+#include "interpreter.h"
+#include "bytecode.h"
+#include "tiered.h"
+#include "AST.h"
+
+#include <string>
+#include <sstream>
+#include <fstream>
+
+using namespace std ;
+
+class InterpreterTestSuite : public CxxTest::TestSuite
+{
+public:
+
+    Parser p ;
+
+    // Run a CDAL program given as text, returning what it prints.
+    string run ( const char *text, int expectedStatus = 0 ) {
+        ParseResult pr = p.parse ( text ) ;
+        TSM_ASSERT ( text, pr.ok ) ;
+        stringstream out ;
+        Interpreter interpreter ( out ) ;
+        TS_ASSERT_EQUALS ( interpreter.run ( (Program *) pr.ast ),
+                           expectedStatus ) ;
+        return out.str() ;
+    }
+
+    // Run a CDAL program given as text on the VirtualMachine.
+    string runBytecode ( const char *text, int expectedStatus = 0 ) {
+        ParseResult pr = p.parse ( text ) ;
+        TSM_ASSERT ( text, pr.ok ) ;
+        stringstream out ;
+        VirtualMachine machine ( out ) ;
+        TS_ASSERT_EQUALS ( machine.run ( (Program *) pr.ast ),
+                           expectedStatus ) ;
+        return out.str() ;
+    }
+
+    // The bytecode of a CDAL program given as text.
+    string disassemble ( const char *text ) {
+        ParseResult pr = p.parse ( text ) ;
+        TSM_ASSERT ( text, pr.ok ) ;
+        stringstream out ;
+        BytecodeCompiler().compile ( (Program *) pr.ast ).disassemble ( out ) ;
+        return out.str() ;
+    }
+
+    // Interpret a sample, and run its bytecode, and check that both print
+    // what its translation prints, as recorded in its .expected file.
+    void interpret_tests ( string filebase ) {
+        string path = "../samples/" + filebase + ".dsl" ;
+        char *text = readInputFromFile ( path.c_str() ) ;
+        TSM_ASSERT ( path + " not found.", text != NULL ) ;
+
+        ifstream in ( ( "../samples/" + filebase + ".expected" ).c_str() ) ;
+        stringstream expected ;
+        expected << in.rdbuf() ;
+
+        TSM_ASSERT_EQUALS ( filebase + " did not produce expected output.",
+                            run ( text ), expected.str() ) ;
+        TSM_ASSERT_EQUALS ( filebase + " bytecode did not produce expected "
+                            "output.", runBytecode ( text ), expected.str() ) ;
+    }
+
+    void test_sample_1 ( void ) { interpret_tests ( "sample_1" ); }
+    void test_sample_2 ( void ) { interpret_tests ( "sample_2" ); }
+    void test_sample_3 ( void ) { interpret_tests ( "sample_3" ); }
+    void test_sample_7 ( void ) { interpret_tests ( "sample_7" ); }
+    void test_sample_8 ( void ) { interpret_tests ( "sample_8" ); }
+    void test_my_code_1 ( void ) { interpret_tests ( "my_code_1" ); }
+    void test_my_code_2 ( void ) { interpret_tests ( "my_code_2" ); }
+    void test_row_sums ( void ) { interpret_tests ( "row_sums" ); }
+    void test_sparse_masks ( void ) { interpret_tests ( "sparse_masks" ); }
+    void test_sparse_operations ( void ) {
+        interpret_tests ( "sparse_operations" );
+    }
+    void test_element_types ( void ) { interpret_tests ( "element_types" ); }
+    void test_fixed_sizes ( void ) { interpret_tests ( "fixed_sizes" ); }
+    void test_matrix_views ( void ) { interpret_tests ( "matrix_views" ); }
+    void test_reductions ( void ) { interpret_tests ( "reductions" ); }
+    void test_fused_expressions ( void ) {
+        interpret_tests ( "fused_expressions" );
+    }
+    void test_elementwise ( void ) { interpret_tests ( "elementwise" ); }
+
+    // Scalars are converted as in the generated C++.
+    void test_scalar_types ( void ) {
+        TS_ASSERT_EQUALS ( run ( "main () { int a ; a = 2147483647 ; "
+                                 "a = a + 1 ; print ( a ) ; }" ),
+                           "-2147483648" ) ;
+        TS_ASSERT_EQUALS ( run ( "main () { float f ; f = 1 / 3 ; "
+                                 "print ( f ) ; f = 1.0 / 3 ; "
+                                 "print ( f ) ; }" ),
+                           "00.333333" ) ;
+        TS_ASSERT_EQUALS ( run ( "main () { int k ; k = 3 ; "
+                                 "print ( if k > 0 then k else 0.5 ) ; }" ),
+                           "3" ) ;
+        TS_ASSERT_EQUALS ( run ( "main () { print ( \"a\\tb\" ) ; }" ),
+                           "a\tb" ) ;
+    }
+
+    // Storing a matrix in another variable copies it.
+    void test_matrix_copies ( void ) {
+        TS_ASSERT_EQUALS ( run ( "main () { matrix m [ 1 : 2 ] i : j = j ; "
+                                 "matrix n = m ; n [ 0 : 0 ] = 7 ; "
+                                 "print ( m [ 0 : 0 ] ) ; "
+                                 "print ( n [ 0 : 0 ] ) ; }" ),
+                           "07" ) ;
+    }
+
+    // Loops and scopes: the bound of repeat is evaluated before each
+    // iteration, and variables declared in blocks go out of scope.
+    void test_loops ( void ) {
+        TS_ASSERT_EQUALS ( run ( "main () { int k ; int n ; n = 2 ; "
+                                 "repeat ( k = 0 to n ) { print ( k ) ; "
+                                 "if ( k == 0 ) n = 3 ; } }" ),
+                           "0123" ) ;
+        TS_ASSERT_EQUALS ( run ( "main () { int k ; k = 0 ; "
+                                 "while ( k < 3 ) { int t ; t = k * 2 ; "
+                                 "print ( t ) ; k = k + 1 ; } }" ),
+                           "024" ) ;
+    }
+
+    // Errors stop the program, keeping what it printed before them.
+    void test_errors ( void ) {
+        TS_ASSERT_EQUALS ( run ( "main () { print ( 1 ) ; x = 2 ; }", 1 ),
+                           "1" ) ;
+        run ( "main () { matrix m [ 2 : 2 ] i : j = 0 ; "
+              "print ( m [ 2 : 0 ] ) ; }", 1 ) ;
+        run ( "main () { int a ; int a ; }", 1 ) ;
+        run ( "main () { print ( 1 / 0 ) ; }", 1 ) ;
+        TS_ASSERT_EQUALS ( run ( "main () { matrix<int8> m [ 2 : 2 ] i : j = "
+                                 "i ; print ( 1 ) ; print ( m * 0.5 ) ; }",
+                                 1 ), "1" ) ;
+    }
+
+    // The bytecode gets the same results as the interpreter, and reports
+    // errors the C++ compiler would report before running anything.
+    void test_bytecode ( void ) {
+        const char *programs[] = {
+            "main () { int a ; a = 2147483647 ; a = a + 1 ; print ( a ) ; }",
+            "main () { float f ; f = 1.0 / 3 ; print ( f ) ; "
+            "print ( f * 3 == 1 ) ; }",
+            "main () { int k ; print ( if k > 0 then k else 0.5 ) ; }",
+            "main () { int k ; int n ; n = 2 ; repeat ( k = 0 to n ) { "
+            "print ( k ) ; if ( k == 0 ) n = 3 ; } }",
+            "main () { float x ; x = 0.5 ; repeat ( x = x to 3 ) "
+            "print ( x ) ; }",
+            "main () { boolean b ; b = ! ( 2 < 1 ) ; print ( b ) ; "
+            "print ( \"ab\" < \"b\" ) ; }",
+            "main () { matrix<int> m [ 2 : 3 ] i : j = i * 3 + j ; "
+            "print ( m [ 1 : 2 ] + sum ( m ) ) ; print ( m * 2 ) ; }",
+            "main () { matrix m [ 1 : 2 ] i : j = j ; matrix n = m ; "
+            "n [ 0 : 0 ] = 7 ; print ( m [ 0 : 0 ] ) ; print ( n ) ; }",
+            "main () { print ( let int t ; t = 4 ; in sqrt ( t ) end ) ; }"
+        } ;
+        for ( size_t k = 0 ; k != sizeof programs / sizeof *programs ; k++ )
+            TSM_ASSERT_EQUALS ( programs[k], runBytecode ( programs[k] ),
+                                run ( programs[k] ) ) ;
+
+        TS_ASSERT_EQUALS ( runBytecode ( "main () { print ( 1 ) ; x = 2 ; }",
+                                         1 ), "" ) ;
+        TS_ASSERT_EQUALS ( runBytecode ( "main () { print ( 1 ) ; "
+                                         "print ( 1 / 0 ) ; }", 1 ), "1" ) ;
+        runBytecode ( "main () { matrix m [ 2 : 2 ] i : j = 0 ; "
+                      "print ( m [ 2 : 0 ] ) ; }", 1 ) ;
+        runBytecode ( "main () { int a ; int a ; }", 1 ) ;
+        TS_ASSERT_EQUALS ( runBytecode ( "main () { matrix<int> m [ 2 : 2 ] "
+                                         "i : j = i ; print ( 1 ) ; "
+                                         "print ( 0.5 + m ) ; }", 1 ), "" ) ;
+    }
+
+    // Element reads, loop back edges and comparisons in branches are
+    // fused into superinstructions.
+    void test_superinstructions ( void ) {
+        string code = disassemble (
+            "main () { matrix m [ 4 : 4 ] i : j = i + j ; "
+            "float s ; int k ; "
+            "repeat ( k = 0 to 3 ) { s = s + m [ k : k ] ; } "
+            "if ( s > 2.0 ) print ( s ) ; }" ) ;
+        TS_ASSERT ( code.find ( "addFloatElement" ) != string::npos ) ;
+        TS_ASSERT ( code.find ( "incrementJumpIfLessEqualInt" ) !=
+                    string::npos ) ;
+        TS_ASSERT ( code.find ( "incrementJumpIfLessInt" ) != string::npos ) ;
+        TS_ASSERT ( code.find ( "jumpUnlessGreaterReal" ) != string::npos ) ;
+        TS_ASSERT ( code.find ( "loadFloatElement" ) == string::npos ) ;
+    }
+
+    // A program handed over from the VirtualMachine to its compiled
+    // translation in the middle of a comprehension carries on with the
+    // variables and rows the machine has made, and prints what it would.
+    void test_tiered ( void ) {
+        const char *text =
+            "main () { int n ; n = 4 ; float f ; f = 1.0 / 3 ; "
+            "string s ; s = \"tiered\\n\" ; boolean b ; b = n > 3 ; "
+            "matrix<int> k [ 2 : 2 ] i : j = i * 2 + j + 2147483000 ; "
+            "matrix<double> d = k ; "
+            "matrix m [ n : 3 ] i : j = f * ( i * 3 + j ) ; "
+            "print ( m ) ; print ( s ) ; print ( b ) ; print ( d ) ; "
+            "print ( f ) ; }" ;
+        ParseResult pr = p.parse ( text ) ;
+        TSM_ASSERT ( text, pr.ok ) ;
+
+        stringstream out ;
+        TieredRunner runner ( out, "../samples" ) ;
+        // statements 0 to 10 reach safe points 0 to 8, 11 and 12, the
+        // rows of k safe points 9 and 10, and those of m 13 to 16
+        runner.switchAt = 15 ;
+        TS_ASSERT_EQUALS ( runner.run ( (Program *) pr.ast ), 0 ) ;
+        TS_ASSERT_EQUALS ( runner.switchedStatement, 10 ) ;
+        TS_ASSERT_EQUALS ( runner.switchedRow, 2 ) ;
+        TS_ASSERT_EQUALS ( out.str(), runBytecode ( text ) ) ;
+
+        // a short program finishes before its build
+        stringstream shortOut ;
+        TieredRunner quick ( shortOut, "../samples" ) ;
+        pr = p.parse ( "main () { print ( 1 + 2 ) ; }" ) ;
+        TS_ASSERT_EQUALS ( quick.run ( (Program *) pr.ast ), 0 ) ;
+        TS_ASSERT_EQUALS ( quick.switchedStatement, -1 ) ;
+        TS_ASSERT_EQUALS ( shortOut.str(), "3" ) ;
+    }
+};
@@ -0,0 +1,96 @@
+/**
+ * matrix_bench: time square float products of increasing size with the
+ * standard product and with the Strassen-Winograd recursion, to find the
+ * size from which the recursion is faster on this machine and the base
+ * size it should stop at. Set the threshold it finds with
+ * CDAL_STRASSEN_THRESHOLD or setStrassenSizes.
+ *
+ * Usage: matrix_bench [--base <size>] [<size> ...]
+ *
+ * The sizes default to 256 512 1024 2048 4096. For each size it prints
+ * the seconds each product took and the largest difference between their
+ * elements, relative to n * max|A| * max|B|, the scale of the error
+ * bounds of both.
+ *
+ * Both products run on as many threads as CDAL_THREADS asks for, or one
+ * per hardware thread, so run it with the threads the programs will use:
+ * the standard product splits its rows over all of them, while the
+ * recursion splits its seven sub-products, so more than seven threads
+ * favour the standard product.
+ *
+ * On the machine it was written on, with one thread, built with -O2 and
+ * base size 256, the recursion broke even near 512 and was 1.2x faster
+ * at 1024 and 2x faster at 2048; base sizes of 128 and 512 were slower at
+ * 2048. The default threshold is 2048, so that smaller products, where
+ * the gain is small, keep the elementwise accuracy of the standard
+ * product.
+ */
+
+#include "./Matrix.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// a matrix of values in [-1, 1)
+matrix randomMatrix(int n, unsigned &seed) {
+    matrix m(n, n);
+    for (int i = 0; i != n; i++)
+        for (int j = 0; j != n; j++) {
+            seed = seed * 1103515245 + 12345;
+            m[i][j] = static_cast<float>((seed >> 8) % 65536) / 32768 - 1;
+        }
+    return m;
+}
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    int baseSize = 256;
+    std::vector<int> sizes;
+    for (int k = 1; k < argc; k++) {
+        if (strcmp(argv[k], "--base") == 0 && k + 1 < argc)
+            baseSize = atoi(argv[++k]);
+        else
+            sizes.push_back(atoi(argv[k]));
+    }
+    if (sizes.empty()) {
+        for (int n = 256; n <= 4096; n *= 2) sizes.push_back(n);
+    }
+    setStrassenSizes(0, baseSize);
+
+    std::cout << "base size " << baseSize << "\n"
+              << "n\tstandard\tstrassen\tspeedup\trelative difference\n";
+    unsigned seed = 1;
+    for (size_t k = 0; k != sizes.size(); k++) {
+        int n = sizes[k];
+        matrix a = randomMatrix(n, seed), b = randomMatrix(n, seed);
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        matrix standard = multiply(a, b, standardProduct);
+        double standardTime = seconds(start);
+
+        start = std::chrono::steady_clock::now();
+        matrix fast = multiply(a, b, strassenProduct);
+        double strassenTime = seconds(start);
+
+        double difference = max(fast - standard);
+        difference = std::max(difference, -double(min(fast - standard)));
+        double scale = n * double(max(a)) * max(b);
+        std::cout << n << "\t" << standardTime << "\t" << strassenTime
+                  << "\t" << standardTime / strassenTime << "\t"
+                  << difference / scale << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+/**
+ * matrix_convert: convert matrix files between the text format read by
+ * matrixRead, like ../samples/sample_8.data, and the binary format that
+ * matrixRead maps in constant time.
+ *
+ * Usage: matrix_convert [--text] <from> <to>
+ *
+ * The input may be in either format. The output is binary unless --text
+ * is given.
+ */
+
+#include "./Matrix.h"
+#include <string.h>
+#include <iostream>
+
+int main(int argc, char **argv) {
+    matrixFormat format = binaryFormat;
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "--text") == 0) {
+        format = textFormat;
+        first++;
+    }
+    if (argc - first != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--text] <from> <to>"
+                  << std::endl;
+        return 1;
+    }
+
+    matrixConvert(argv[first], argv[first + 1], format);
+    return 0;
+}
@@ -0,0 +1,979 @@
+/***
+ * This file contains test suites for the matrix runtime used by the
+ * translated programs, in ../samples/Matrix.cpp
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "Matrix.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class MatrixTestSuite : public CxxTest::TestSuite {
+public:
+    /**
+     * write text to file
+     * @param text     string of text
+     * @param filename path to the target file
+     */
+    void writeFile(const string text, const string filename) {
+        ofstream out(filename.c_str());
+        out << text;
+    }
+
+    /**
+     * parse a matrix from a string
+     * @param  text  the matrix in text format
+     * @param  error the error reported by matrixParse
+     * @return       the parsed matrix
+     */
+    matrix parse(const string &text, string &error) {
+        return matrixParse(text.c_str(), text.size(), error);
+    }
+
+    /**
+     * test parsing the usual layout, one row per line
+     */
+    void test_parse_rows(void) {
+        string error;
+        matrix m = parse("2 3\n1 2 3\n4 5 6\n", error);
+        TS_ASSERT_EQUALS(error, "");
+        TS_ASSERT_EQUALS(m.numRows(), 2);
+        TS_ASSERT_EQUALS(m.numCols(), 3);
+        TS_ASSERT_EQUALS(m[0][0], 1.0f);
+        TS_ASSERT_EQUALS(m[1][2], 6.0f);
+    }
+
+    /**
+     * test parsing values that are not laid out one row per line
+     */
+    void test_parse_free_layout(void) {
+        string error;
+        matrix m = parse("2 2 1\n2 3\n\n 4", error);
+        TS_ASSERT_EQUALS(error, "");
+        TS_ASSERT_EQUALS(m[0][0], 1.0f);
+        TS_ASSERT_EQUALS(m[0][1], 2.0f);
+        TS_ASSERT_EQUALS(m[1][0], 3.0f);
+        TS_ASSERT_EQUALS(m[1][1], 4.0f);
+    }
+
+    /**
+     * test that numbers are converted exactly like strtof does
+     */
+    void test_parse_numbers(void) {
+        const char *values[] = {"0",       "-0",        "3.38503",
+                                "-25",     "+7.5",      "1e3",
+                                "2.5E-4",  "0.1",       "16777217",
+                                "1.17549435e-38", "123456789012345678901234",
+                                "0.000000000000000000001"};
+        int n = sizeof(values) / sizeof(values[0]);
+
+        stringstream ss;
+        ss << "1 " << n << "\n";
+        for (int j = 0; j != n; j++) ss << values[j] << " ";
+
+        string error;
+        matrix m = parse(ss.str(), error);
+        TS_ASSERT_EQUALS(error, "");
+        for (int j = 0; j != n; j++)
+            TSM_ASSERT_EQUALS(values[j], m[0][j], strtof(values[j], NULL));
+    }
+
+    /**
+     * test that a malformed value is reported with its line
+     */
+    void test_parse_malformed_value(void) {
+        string error;
+        parse("2 2\n1 2\n3 x4\n", error);
+        TS_ASSERT_EQUALS(error,
+                         "expected the value at row 2, column 2 at line 3 "
+                         "but found 'x4'");
+    }
+
+    /**
+     * test that missing values are reported
+     */
+    void test_parse_missing_values(void) {
+        string error;
+        parse("2 2\n1 2\n3\n", error);
+        TS_ASSERT_EQUALS(error,
+                         "expected the value at row 2, column 2 at line 4 "
+                         "but reached the end of the file");
+    }
+
+    /**
+     * test that values beyond the declared size are reported
+     */
+    void test_parse_extra_values(void) {
+        string error;
+        parse("1 2\n1 2 3\n", error);
+        TS_ASSERT_EQUALS(error,
+                         "expected no more values at line 2 but found '3'");
+    }
+
+    /**
+     * test that a bad header is reported
+     */
+    void test_parse_bad_header(void) {
+        string error;
+        parse("two 2\n1 2\n", error);
+        TS_ASSERT_EQUALS(error,
+                         "expected the number of rows at line 1 but found "
+                         "'two'");
+    }
+
+    /**
+     * test parsing an input large enough to be split over threads
+     */
+    void test_parse_parallel(void) {
+        int nrows = 20000, ncols = 16;
+        stringstream ss;
+        ss << nrows << " " << ncols << "\n";
+        for (int i = 0; i != nrows; i++) {
+            for (int j = 0; j != ncols; j++) ss << i * 0.25 + j << " ";
+            ss << "\n";
+        }
+
+        string error;
+        matrix m = parse(ss.str(), error);
+        TS_ASSERT_EQUALS(error, "");
+        TS_ASSERT_EQUALS(m.numRows(), nrows);
+        for (int i = 0; i < nrows; i += 997)
+            for (int j = 0; j != ncols; j++)
+                TS_ASSERT_EQUALS(m[i][j], static_cast<float>(i * 0.25 + j));
+        TS_ASSERT_EQUALS(m[nrows - 1][ncols - 1],
+                         static_cast<float>((nrows - 1) * 0.25 + ncols - 1));
+    }
+
+    /**
+     * test reading a matrix from a file
+     */
+    void test_matrixRead(void) {
+        string file = "../samples/matrix_tests.data";
+        writeFile("3 2\n1.5 2\n3 4\n5 -6\n", file);
+        matrix m = matrixRead(file);
+        TS_ASSERT_EQUALS(m.numRows(), 3);
+        TS_ASSERT_EQUALS(m.numCols(), 2);
+        TS_ASSERT_EQUALS(m[0][0], 1.5f);
+        TS_ASSERT_EQUALS(m[2][1], -6.0f);
+    }
+
+    /**
+     * test that a matrix written in the binary format reads back the same
+     */
+    void test_binary_round_trip(void) {
+        string file = "../samples/matrix_tests.bin";
+        matrix m(3, 4);
+        for (int i = 0; i != 3; i++)
+            for (int j = 0; j != 4; j++) m[i][j] = i * 10 + j + 0.125f;
+
+        matrixWrite(m, file);
+        matrix r = matrixRead(file);
+        TS_ASSERT_EQUALS(r.numRows(), 3);
+        TS_ASSERT_EQUALS(r.numCols(), 4);
+        for (int i = 0; i != 3; i++)
+            for (int j = 0; j != 4; j++) TS_ASSERT_EQUALS(r[i][j], m[i][j]);
+
+        // the payload is aligned for vector loads
+        TS_ASSERT_EQUALS(reinterpret_cast<size_t>(r[0]) % 64, 0u);
+    }
+
+    /**
+     * test that writing to a mapped matrix leaves the file unchanged
+     */
+    void test_binary_copy_on_write(void) {
+        string file = "../samples/matrix_tests.bin";
+        matrix m(2, 2);
+        m[1][1] = 7;
+        matrixWrite(m, file);
+
+        matrix r = matrixRead(file);
+        r[1][1] = 8;
+        matrix copy = r;
+        TS_ASSERT_EQUALS(copy[1][1], 8.0f);
+        TS_ASSERT_EQUALS(matrixRead(file)[1][1], 7.0f);
+    }
+
+    /**
+     * test converting a text matrix file to binary and back
+     */
+    void test_convert(void) {
+        string text = "../samples/matrix_tests.data";
+        string bin = "../samples/matrix_tests.bin";
+        matrixConvert("../samples/sample_8.data", bin.c_str());
+
+        ifstream in(bin.c_str());
+        TS_ASSERT_EQUALS(in.get(), 'C');
+
+        matrixConvert(bin.c_str(), text.c_str(), textFormat);
+        matrix m = matrixRead(text);
+        TS_ASSERT_EQUALS(m.numRows(), 4);
+        TS_ASSERT_EQUALS(m.numCols(), 5);
+        TS_ASSERT_EQUALS(m[3][4], 8.0f);
+    }
+
+    /**
+     * test that matrices can be assigned and moved
+     */
+    void test_assignment(void) {
+        matrix a(1, 2);
+        a[0][1] = 3;
+        matrix b(5, 5);
+        b = a;
+        a[0][1] = 4;
+        TS_ASSERT_EQUALS(b.numRows(), 1);
+        TS_ASSERT_EQUALS(b[0][1], 3.0f);
+        b = matrix(2, 3);
+        TS_ASSERT_EQUALS(b.numCols(), 3);
+        TS_ASSERT_EQUALS(b[1][2], 0.0f);
+    }
+
+    /**
+     * check that every row of a stream matches the matrix
+     * @param s the stream
+     * @param m the expected values
+     */
+    void checkStream(matrixStream &s, const matrix &m) {
+        TS_ASSERT_EQUALS(s.numRows(), m.numRows());
+        TS_ASSERT_EQUALS(s.numCols(), m.numCols());
+        for (int i = 0; i != m.numRows(); i++)
+            for (int j = 0; j != m.numCols(); j++)
+                TS_ASSERT_EQUALS(s[i][j], m[i][j]);
+    }
+
+    /**
+     * test streaming a text matrix in bands of two rows
+     */
+    void test_stream_text(void) {
+        matrixStream s("../samples/sample_8.data", 2);
+        checkStream(s, matrixRead("../samples/sample_8.data"));
+    }
+
+    /**
+     * test streaming a text matrix that is not one row per line
+     */
+    void test_stream_free_layout(void) {
+        string file = "../samples/matrix_tests.data";
+        writeFile("3 2 1 2\n3\n\n4 5 6", file);
+        matrixStream s(file, 1);
+        checkStream(s, matrixRead(file));
+    }
+
+    /**
+     * test streaming a binary matrix, skipping some rows
+     */
+    void test_stream_binary(void) {
+        string file = "../samples/matrix_tests.bin";
+        matrix m(100, 7);
+        for (int i = 0; i != 100; i++)
+            for (int j = 0; j != 7; j++) m[i][j] = i * 7 + j;
+        matrixWrite(m, file);
+
+        matrixStream s(file, 3);
+        TS_ASSERT_EQUALS(s.numRows(), 100);
+        TS_ASSERT_EQUALS(s[0][6], 6.0f);
+        TS_ASSERT_EQUALS(s[1][0], 7.0f);
+        TS_ASSERT_EQUALS(s[50][3], 353.0f);
+        TS_ASSERT_EQUALS(s[50][4], 354.0f);
+        TS_ASSERT_EQUALS(s[99][6], 699.0f);
+
+        matrixStream all(file);
+        checkStream(all, m);
+    }
+
+    /**
+     * test that printing gives exactly the text the stream itself would
+     * format, for a matrix spanning several output chunks
+     */
+    void test_print(void) {
+        const float values[] = {0.0f,      -0.0f,    1.0f,     -25.0f,
+                                999999.0f, 1e6f,     -1e6f,    3.38503f,
+                                0.1f,      1e-5f,    2.5e-4f,  123456.7f,
+                                1e30f,     -7.5e-20f, 16777217.0f};
+        int n = sizeof(values) / sizeof(values[0]);
+        matrix m(3000, n);
+        for (int i = 0; i != 3000; i++)
+            for (int j = 0; j != n; j++)
+                m[i][j] = values[j] * (1 + (i % 7) * 0.25f);
+
+        stringstream expected;
+        expected << m.numRows() << " " << m.numCols() << "\n";
+        for (int i = 0; i != m.numRows(); i++) {
+            for (int j = 0; j != m.numCols(); j++)
+                expected << m[i][j] << "  ";
+            expected << "\n";
+        }
+
+        stringstream printed;
+        printed << m;
+        TS_ASSERT(printed.str() == expected.str());
+    }
+
+    /**
+     * test that printing respects the formatting set on the stream
+     */
+    void test_print_formatted(void) {
+        matrix m(1, 2);
+        m[0][0] = 1.5f;
+        m[0][1] = 2;
+        stringstream ss;
+        ss.precision(3);
+        ss << fixed << m;
+        TS_ASSERT_EQUALS(ss.str(), "1 2\n1.500  2.000  \n");
+    }
+
+    /**
+     * test dumping matrices in the binary format when printing
+     */
+    void test_print_binary(void) {
+        string file = "../samples/matrix_tests.bin";
+        matrix m(4, 3);
+        for (int i = 0; i != 4; i++)
+            for (int j = 0; j != 3; j++) m[i][j] = i - j * 0.5f;
+
+        setPrintFormat(binaryFormat);
+        {
+            ofstream out(file.c_str(), ofstream::binary);
+            out << m;
+        }
+        setPrintFormat(textFormat);
+
+        matrix n = matrixRead(file);
+        TS_ASSERT_EQUALS(n.numRows(), 4);
+        TS_ASSERT_EQUALS(n.numCols(), 3);
+        TS_ASSERT_EQUALS(memcmp(n[0], m[0], 12 * sizeof(float)), 0);
+    }
+
+    /**
+     * make a matrix that is mostly zeros
+     */
+    matrix sparseValues(int rows, int cols) {
+        matrix m(rows, cols);
+        for (int i = 0; i != rows; i++)
+            for (int j = 0; j != cols; j++)
+                if ((i * 7 + j * 3) % 5 == 0) m[i][j] = i - j + 0.5f;
+        return m;
+    }
+
+    /**
+     * make a dense matrix with no zeros
+     */
+    matrix denseValues(int rows, int cols) {
+        matrix m(rows, cols);
+        for (int i = 0; i != rows; i++)
+            for (int j = 0; j != cols; j++) m[i][j] = i * 0.25f + j + 1;
+        return m;
+    }
+
+    /**
+     * check that two matrices hold the same values
+     */
+    void checkSame(const matrix &a, const matrix &b) {
+        TS_ASSERT_EQUALS(a.numRows(), b.numRows());
+        TS_ASSERT_EQUALS(a.numCols(), b.numCols());
+        for (int i = 0; i != a.numRows(); i++)
+            for (int j = 0; j != a.numCols(); j++)
+                TS_ASSERT_DELTA(a[i][j], b[i][j], 1e-4);
+    }
+
+    /**
+     * test converting between dense and both sparse layouts
+     */
+    void test_sparse_conversion(void) {
+        matrix m = sparseValues(9, 6);
+        sparseMatrix rows(m);
+        sparseMatrix cols(m, compressedColumns);
+        TS_ASSERT_EQUALS(rows.numNonZeros(), 11);
+        TS_ASSERT_EQUALS(cols.numNonZeros(), 11);
+        TS_ASSERT_EQUALS(rows.at(0, 0), 0.5f);
+        TS_ASSERT_EQUALS(rows.at(0, 1), 0.0f);
+        TS_ASSERT_EQUALS(cols.at(4, 4), 0.5f);
+        checkSame(rows.toDense(), m);
+        checkSame(cols.toDense(), m);
+        checkSame(rows.toLayout(compressedColumns).toDense(), m);
+        checkSame(cols.toLayout(compressedRows).toDense(), m);
+
+        stringstream dense, sparse;
+        dense << m;
+        sparse << cols;
+        TS_ASSERT_EQUALS(sparse.str(), dense.str());
+    }
+
+    /**
+     * test filling a sparse matrix with append, which drops zeros
+     */
+    void test_sparse_append(void) {
+        sparseMatrix s(3, 4);
+        s.append(0, 1, 2);
+        s.append(0, 3, 0);
+        s.append(2, 0, -1);
+        s.append(2, 2, 4);
+        TS_ASSERT_EQUALS(s.numNonZeros(), 3);
+        TS_ASSERT_EQUALS(s.at(0, 1), 2.0f);
+        TS_ASSERT_EQUALS(s.at(1, 1), 0.0f);
+        TS_ASSERT_EQUALS(s.at(2, 2), 4.0f);
+        TS_ASSERT_EQUALS(s.at(2, 3), 0.0f);
+    }
+
+    /**
+     * test the sparse-dense products against the dense product
+     */
+    void test_sparse_products(void) {
+        matrix a = sparseValues(7, 9);
+        matrix b = denseValues(9, 5);
+        matrix v = denseValues(9, 1);
+        matrix c = denseValues(4, 7);
+        for (int layout = compressedRows; layout <= compressedColumns;
+             layout++) {
+            sparseMatrix s(a, static_cast<sparseLayout>(layout));
+            checkSame(s * b, a * b);
+            checkSame(s * v, a * v);
+            checkSame(c * s, c * a);
+        }
+    }
+
+    /**
+     * test the element-wise sparse-dense operations
+     */
+    void test_sparse_elementwise(void) {
+        matrix a = sparseValues(6, 5);
+        matrix b = denseValues(6, 5);
+        sparseMatrix s(a, compressedColumns);
+
+        matrix sum = s + b, difference = s - b, reversed = b - s;
+        sparseMatrix product = hadamard(b, s);
+        TS_ASSERT_EQUALS(product.numNonZeros(), s.numNonZeros());
+        for (int i = 0; i != 6; i++) {
+            for (int j = 0; j != 5; j++) {
+                TS_ASSERT_EQUALS(sum[i][j], a[i][j] + b[i][j]);
+                TS_ASSERT_EQUALS(difference[i][j], a[i][j] - b[i][j]);
+                TS_ASSERT_EQUALS(reversed[i][j], b[i][j] - a[i][j]);
+                TS_ASSERT_EQUALS(product.at(i, j), a[i][j] * b[i][j]);
+            }
+        }
+    }
+
+    /**
+     * test products of integer matrices, which are summed in wider types
+     */
+    void test_integer_products(void) {
+        basicMatrix<int8_t> a(5, 37), b(37, 3);
+        for (int i = 0; i != 5; i++)
+            for (int k = 0; k != 37; k++) a[i][k] = (i * 37 + k) % 255 - 127;
+        for (int k = 0; k != 37; k++)
+            for (int j = 0; j != 3; j++) b[k][j] = 127 - (k + j) % 3;
+
+        basicMatrix<int32_t> c = a * b;
+        for (int i = 0; i != 5; i++) {
+            for (int j = 0; j != 3; j++) {
+                int32_t sum = 0;
+                for (int k = 0; k != 37; k++) sum += a[i][k] * b[k][j];
+                TS_ASSERT_EQUALS(c[i][j], sum);
+            }
+        }
+
+        // the partial sums exceed int32, but the result does not
+        basicMatrix<int32_t> x(1, 3), y(3, 1);
+        x[0][0] = 2000000000;
+        x[0][1] = 2000000000;
+        x[0][2] = -2000000000;
+        y[0][0] = y[1][0] = y[2][0] = 1;
+        TS_ASSERT_EQUALS((x * y)[0][0], 2000000000);
+    }
+
+    /**
+     * test that float products are summed in the same order as before
+     */
+    void test_float_products(void) {
+        matrix a = denseValues(6, 11), b = denseValues(11, 4);
+        a[2][3] = 1e8f;
+        matrix c = a * b;
+        for (int i = 0; i != 6; i++) {
+            for (int j = 0; j != 4; j++) {
+                float sum = 0;
+                for (int k = 0; k != 11; k++) sum += a[i][k] * b[k][j];
+                TS_ASSERT_EQUALS(c[i][j], sum);
+            }
+        }
+    }
+
+    /**
+     * test that fixed-size matrices multiply and print like matrices
+     */
+    void test_fixed_matrices(void) {
+        fixedMatrix<2, 3> a;
+        fixedMatrix<3, 2> b;
+        TS_ASSERT_EQUALS(a[1][2], 0);
+        for (int i = 0; i != 2; i++) {
+            for (int j = 0; j != 3; j++) {
+                a[i][j] = i * 3 + j;
+                b[j][i] = j - i;
+            }
+        }
+        fixedMatrix<2, 2> c = a * b;
+        matrix dense = a, expected = dense * matrix(b);
+        for (int i = 0; i != 2; i++) {
+            for (int j = 0; j != 2; j++) TS_ASSERT_EQUALS(c[i][j], expected[i][j]);
+        }
+        TS_ASSERT_EQUALS(numRows(c), 2);
+        matrix mixed = a * matrix(b);
+        TS_ASSERT_EQUALS(numCols(mixed), 2);
+        TS_ASSERT_EQUALS(mixed[1][1], c[1][1]);
+
+        stringstream fixed, heap;
+        fixed << c;
+        heap << expected;
+        TS_ASSERT_EQUALS(fixed.str(), heap.str());
+
+        // int8 products are summed in int32
+        fixedMatrix<1, 2, int8_t> x;
+        fixedMatrix<2, 1, int8_t> y;
+        x[0][0] = x[0][1] = 100;
+        y[0][0] = y[1][0] = 100;
+        TS_ASSERT_EQUALS((x * y)[0][0], 20000);
+    }
+
+    /**
+     * test that views read and write the matrix they view in place
+     */
+    void test_matrix_views(void) {
+        matrix m = denseValues(4, 5);
+        matrixView block = slice(m, 1, 2, 2, 4);
+        TS_ASSERT_EQUALS(numRows(block), 2);
+        TS_ASSERT_EQUALS(numCols(block), 3);
+        TS_ASSERT_EQUALS(block[1][2], m[2][4]);
+        block[0][0] = 99;
+        TS_ASSERT_EQUALS(m[1][2], 99);
+
+        matrixView t = transpose(m);
+        TS_ASSERT_EQUALS(numRows(t), 5);
+        TS_ASSERT_EQUALS(t[4][1], m[1][4]);
+        TS_ASSERT_EQUALS(t.row(3)[0][2], m[2][3]);
+        TS_ASSERT_EQUALS(block.column(1)[1][0], m[2][3]);
+        TS_ASSERT_EQUALS(block.transposed().block(1, 0, 2, 2)[1][1], m[2][4]);
+
+        // products and printing of views match those of copies
+        matrix copy = block, transposed = t;
+        matrixView corner = t.block(0, 0, 3, 2);
+        checkSame(t * m, transposed * m);
+        checkSame(block * corner, copy * matrix(corner));
+        checkSame(m * t, m * transposed);
+        stringstream viewed, copied;
+        viewed << block;
+        copied << copy;
+        TS_ASSERT_EQUALS(viewed.str(), copied.str());
+
+        basicMatrix<int8_t> small(3, 2);
+        for (int i = 0; i != 3; i++)
+            for (int j = 0; j != 2; j++) small[i][j] = i * 2 - j;
+        basicMatrix<int32_t> gram = transpose(small) * small;
+        TS_ASSERT_EQUALS(gram[1][1], 1 + 1 + 9);
+    }
+
+    /**
+     * test copying transposes in tiles and multiplying by them in place
+     */
+    void test_transposes(void) {
+        // larger than a tile in both directions, and not a multiple of it
+        matrix m = denseValues(70, 45);
+        matrix t = transpose(m);
+        TS_ASSERT_EQUALS(t.numRows(), 45);
+        TS_ASSERT_EQUALS(t.numCols(), 70);
+        for (int i = 0; i != 45; i++)
+            for (int j = 0; j != 70; j++) TS_ASSERT_EQUALS(t[i][j], m[j][i]);
+
+        // the products sum each element in the same order either way
+        matrix b = denseValues(30, 45);
+        matrix product = m * transpose(b), copied = m * matrix(transpose(b));
+        for (int i = 0; i != 70; i++)
+            for (int j = 0; j != 30; j++)
+                TS_ASSERT_EQUALS(product[i][j], copied[i][j]);
+        matrix c = denseValues(20, 70);
+        checkSame(transpose(m) * transpose(c), t * matrix(transpose(c)));
+
+        // transposes and slices of expressions and of constant matrices
+        // copy the values they would view
+        checkSame(transpose(m * transpose(b)), b * t);
+        const matrix &constant = m;
+        checkSame(transpose(constant), t);
+        checkSame(slice(constant, 3, 9, 2, 40), slice(m, 3, 9, 2, 40));
+
+        basicMatrix<int8_t> x(5, 9), y(6, 9);
+        for (int i = 0; i != 9; i++) {
+            for (int j = 0; j != 5; j++) x[j][i] = i * 7 - j * 3;
+            for (int j = 0; j != 6; j++) y[j][i] = j * 11 - i;
+        }
+        basicMatrix<int32_t> viewed = x * transpose(y),
+                             copy = x * basicMatrix<int8_t>(transpose(y));
+        for (int i = 0; i != 5; i++)
+            for (int j = 0; j != 6; j++)
+                TS_ASSERT_EQUALS(viewed[i][j], copy[i][j]);
+    }
+
+    /**
+     * test that the storage of freed matrices is reused
+     */
+    void test_allocation_cache(void) {
+        { matrix warm(30, 40); }
+        allocationStats before = matrixAllocationStats();
+        for (int n = 0; n != 10; n++) {
+            matrix m(30, 40);
+            TS_ASSERT_EQUALS(m[29][39], 0);
+            m[29][39] = 1;
+        }
+        allocationStats after = matrixAllocationStats();
+        TS_ASSERT_EQUALS(after.requests - before.requests, 10u);
+        TS_ASSERT_EQUALS(after.hits - before.hits, 10u);
+
+        // a slightly different size shares the class
+        { matrix close(31, 40); }
+        TS_ASSERT_EQUALS(matrixAllocationStats().hits - after.hits, 1u);
+
+        // matrices larger than every class are never cached
+        allocationStats large = matrixAllocationStats();
+        for (int n = 0; n != 2; n++) matrix m(2048, 2560);
+        TS_ASSERT_EQUALS(matrixAllocationStats().hits, large.hits);
+        TS_ASSERT_EQUALS(matrixAllocationStats().cachedBytes,
+                         large.cachedBytes);
+    }
+
+    /**
+     * test that the bytes matrices hold are counted, live and at peak, with
+     * the sizes of their buffers
+     */
+    void test_memory_accounting(void) {
+        memoryStats before = matrixMemoryStats();
+        allocationStats cacheBefore = matrixAllocationStats();
+        {
+            matrix m(100, 100);
+            matrix copy(m);
+            memoryStats during = matrixMemoryStats();
+            TS_ASSERT_EQUALS(during.liveBytes - before.liveBytes, 80000u);
+            TS_ASSERT_EQUALS(during.allocations - before.allocations, 2u);
+            TS_ASSERT(during.peakBytes >= during.liveBytes);
+            // 40000 bytes, more than 2^15 and at most 2^16, in buffers of
+            // the class of 2^16
+            TS_ASSERT_EQUALS(during.sizes[16] - before.sizes[16], 2u);
+            TS_ASSERT_EQUALS(during.bufferBytes - before.bufferBytes,
+                             131072u);
+            TS_ASSERT(during.peakHeldBytes >=
+                      during.bufferBytes + during.cachedBytes);
+        }
+        memoryStats after = matrixMemoryStats();
+        TS_ASSERT_EQUALS(after.liveBytes, before.liveBytes);
+        TS_ASSERT(after.peakBytes >= before.liveBytes + 80000);
+        // the buffers went back to this thread's cache, or were freed
+        TS_ASSERT_EQUALS(after.bufferBytes, before.bufferBytes);
+        TS_ASSERT_EQUALS(after.cachedBytes - before.cachedBytes,
+                         matrixAllocationStats().cachedBytes -
+                             cacheBefore.cachedBytes);
+
+        // moving a matrix takes no buffer
+        matrix moved(std::move(matrix(3, 3)));
+        TS_ASSERT_EQUALS(matrixMemoryStats().allocations,
+                         after.allocations + 1);
+
+        std::stringstream report;
+        writeMemoryReport(report);
+        TS_ASSERT(report.str().find("CDAL memory: ") == 0);
+        TS_ASSERT(report.str().find(" bytes cached, ") != std::string::npos);
+        TS_ASSERT(report.str().find(" 64 KB\n") != std::string::npos);
+    }
+
+    /**
+     * test that large matrices start on a huge page and are zeroed and
+     * copied whole when their rows are split over threads
+     */
+    void test_huge_pages(void) {
+        matrix big(1500, 1400);
+        if (getenv("CDAL_HUGE_PAGES") == NULL)
+            TS_ASSERT_EQUALS(reinterpret_cast<uintptr_t>(big[0]) % (2 << 20),
+                             0u);
+        TS_ASSERT_EQUALS(big[0][0], 0);
+        TS_ASSERT_EQUALS(big[1499][1399], 0);
+        for (int i = 0; i != 1500; i++) big[i][i % 1400] = i;
+        matrix copy(big);
+        for (int i = 0; i != 1500; i++)
+            TS_ASSERT_EQUALS(copy[i][i % 1400], i);
+        TS_ASSERT_EQUALS(sum(copy), sum(big));
+
+        // a cached buffer of the same length is zeroed again; it is 8.4 MB
+        // rounded to 5 huge pages rather than to the class of 16 MB
+        for (int i = 0; i != 1500; i++) big[i][0] = 1;
+        allocationStats before = matrixAllocationStats();
+        { matrix drop(std::move(big)); }
+        if (getenv("CDAL_HUGE_PAGES") == NULL)
+            TS_ASSERT_EQUALS(
+                matrixAllocationStats().cachedBytes - before.cachedBytes,
+                5u << 21);
+        matrix reused(1500, 1400);
+        TS_ASSERT_EQUALS(sum(reused), 0);
+    }
+
+    /**
+     * test that each band of rows runs on the same thread every time, so
+     * that the thread that first touched a band's pages computes on them
+     */
+    void test_row_band_owners(void) {
+        vector<thread::id> first(1500), second(1500);
+        forRowBands(1500, 64 << 20, [&first](int begin, int end) {
+            for (int i = begin; i != end; i++)
+                first[i] = this_thread::get_id();
+        });
+        forRowBands(1500, 64 << 20, [&second](int begin, int end) {
+            for (int i = begin; i != end; i++)
+                second[i] = this_thread::get_id();
+        });
+        for (int i = 0; i != 1500; i++) TS_ASSERT_EQUALS(first[i], second[i]);
+
+        // a call within a band keeps to its thread
+        forRowBands(4, 64 << 20, [](int, int) {
+            thread::id owner = this_thread::get_id();
+            forRowBands(100, 64 << 20, [owner](int, int) {
+                TS_ASSERT_EQUALS(this_thread::get_id(), owner);
+            });
+        });
+    }
+
+    /**
+     * test reductions of matrices, rows, columns and other views
+     */
+    void test_reductions(void) {
+        matrix m = denseValues(37, 41);
+        double total = 0, squares = 0;
+        float low = m[0][0], high = m[0][0];
+        for (int i = 0; i != 37; i++) {
+            for (int j = 0; j != 41; j++) {
+                total += m[i][j];
+                squares += m[i][j] * m[i][j];
+                low = std::min(low, m[i][j]);
+                high = std::max(high, m[i][j]);
+            }
+        }
+        TS_ASSERT_DELTA(sum(m), total, 1e-2);
+        TS_ASSERT_DELTA(sum(transpose(m)), total, 1e-2);
+        TS_ASSERT_DELTA(mean(m), total / (37 * 41), 1e-5);
+        TS_ASSERT_EQUALS(min(m), low);
+        TS_ASSERT_EQUALS(max(transpose(m)), high);
+        TS_ASSERT_DELTA(norm(m), sqrt(squares), 1e-2);
+        TS_ASSERT_DELTA(dot(m, m), squares, 1e-1);
+
+        // a row, a column and a block that is neither
+        matrixView row = slice(m, 5, 5, 0, 40), col = slice(m, 0, 36, 7, 7);
+        matrixView block = slice(m, 2, 9, 3, 20);
+        TS_ASSERT_DELTA(sum(row), sum(matrix(row)), 1e-3);
+        TS_ASSERT_DELTA(sum(col), sum(matrix(col)), 1e-3);
+        TS_ASSERT_DELTA(sum(block), sum(matrix(block)), 1e-3);
+        TS_ASSERT_EQUALS(max(block), max(matrix(block)));
+        matrix t = transpose(m);
+        TS_ASSERT_DELTA(dot(transpose(col), slice(t, 7, 7, 0, 36)),
+                        dot(matrix(col), matrix(col)), 1e-3);
+
+        // pairwise sums of many equal values lose nothing
+        matrix ones(1000, 1000);
+        for (int i = 0; i != 1000; i++)
+            for (int j = 0; j != 1000; j++) ones[i][j] = 0.1f;
+        TS_ASSERT_DELTA(sum(ones), 100000, 1);
+
+        // integer sums are exact, in the accumulator type
+        basicMatrix<int8_t> small(3, 100);
+        for (int i = 0; i != 3; i++)
+            for (int j = 0; j != 100; j++) small[i][j] = 100;
+        TS_ASSERT_EQUALS(sum(small), 30000);
+        TS_ASSERT_EQUALS(min(small), 100);
+    }
+
+    /**
+     * test that sums and differences of products, evaluated a row at a
+     * time, match the same operations done one matrix at a time
+     */
+    void test_fused_expressions(void) {
+        matrix a = denseValues(13, 9), b = denseValues(9, 11);
+        matrix c = denseValues(13, 11), d = denseValues(11, 13);
+        matrix product = a * b;
+        matrix fused = a * b + c - transpose(d);
+        for (int i = 0; i != 13; i++)
+            for (int j = 0; j != 11; j++)
+                TS_ASSERT_EQUALS(fused[i][j],
+                                 (product[i][j] + c[i][j]) - d[j][i]);
+
+        // an element of an expression is computed from its row alone
+        TS_ASSERT_EQUALS((a * b + c - transpose(d))[5][7], fused[5][7]);
+        TS_ASSERT_EQUALS((a * b)[12][0], product[12][0]);
+
+        // products of transposes and of expressions
+        matrix both = transpose(b) * transpose(a) - transpose(product);
+        TS_ASSERT_EQUALS(max(both), 0);
+        TS_ASSERT_EQUALS(min(both), 0);
+        matrix chained = a * b * d;
+        matrix staged = product * d;
+        TS_ASSERT_EQUALS(max(chained - staged), 0);
+        TS_ASSERT_DELTA(sum(a * b - product + c), sum(c), 1e-3);
+
+        // int8 products add in int32
+        basicMatrix<int8_t> x(2, 2);
+        basicMatrix<int32_t> y(2, 2);
+        x[0][0] = x[1][1] = 100;
+        y[0][1] = 5;
+        basicMatrix<int32_t> z = x * transpose(x) + y;
+        TS_ASSERT_EQUALS(z[0][0], 10000);
+        TS_ASSERT_EQUALS(z[0][1], 5);
+        TS_ASSERT_EQUALS(z[1][0], 0);
+
+        stringstream os;
+        os << x * x - z;
+        TS_ASSERT_EQUALS(os.str(), "2 2\n0  -5  \n0  0  \n");
+    }
+
+    /**
+     * test that the bands of an expression share the operand copies made
+     * for it rather than making their own
+     */
+    void test_shared_operands(void) {
+        matrix x = denseValues(8, 1024), y = denseValues(1024, 8);
+        memoryStats before = matrixMemoryStats();
+        // a 4 MB result, with transpose(x) copied so its rows are contiguous
+        matrix product = transpose(x) * transpose(y);
+        memoryStats after = matrixMemoryStats();
+        TS_ASSERT_EQUALS(after.allocations - before.allocations, 2u);
+        double sum = 0;
+        for (int k = 0; k != 8; k++) sum += x[k][1000] * y[5][k];
+        TS_ASSERT_DELTA(product[1000][5], sum, 1);
+    }
+
+    /**
+     * test element-wise operations on matrices, views and scalars
+     */
+    void test_elementwise_operations(void) {
+        matrix a = denseValues(7, 5), b = denseValues(5, 7);
+        matrix sum = a + transpose(b);
+        matrix difference = a - 1;
+        matrix product = hadamard(a, transpose(b));
+        matrix quotient = 1 / (a + 1);
+        matrix scaled = 2 * a / 4 + slice(a, 0, 6, 0, 4);
+        for (int i = 0; i != 7; i++) {
+            for (int j = 0; j != 5; j++) {
+                TS_ASSERT_EQUALS(sum[i][j], a[i][j] + b[j][i]);
+                TS_ASSERT_EQUALS(difference[i][j], a[i][j] - 1);
+                TS_ASSERT_EQUALS(product[i][j], a[i][j] * b[j][i]);
+                TS_ASSERT_EQUALS(quotient[i][j], 1 / (a[i][j] + 1));
+                TS_ASSERT_EQUALS(scaled[i][j], 2 * a[i][j] / 4 + a[i][j]);
+            }
+        }
+
+        // the other operand's element type, so int matrices stay exact
+        basicMatrix<int32_t> x(2, 3);
+        x[1][2] = 7;
+        basicMatrix<int32_t> y = x * 3 - x / 2;
+        TS_ASSERT_EQUALS(y[1][2], 18);
+        TS_ASSERT_EQUALS(y[0][0], 0);
+        // but a floating scalar, which would be truncated, is rejected
+        TS_ASSERT((narrowingScalar<basicMatrix<int32_t>, double>::value));
+        TS_ASSERT((narrowingScalar<basicMatrix<int8_t>, float>::value));
+        TS_ASSERT(!(narrowingScalar<basicMatrix<int32_t>, long>::value));
+        TS_ASSERT(!(narrowingScalar<matrix, double>::value));
+
+        // large results are split into bands of rows
+        matrix big = denseValues(1200, 1000);
+        matrix doubled = big + big;
+        TS_ASSERT_EQUALS(max(doubled - 2 * big), 0);
+        TS_ASSERT_EQUALS(min(doubled - 2 * big), 0);
+        matrix tall = denseValues(1200, 3);
+        matrix wide = tall * transpose(tall) - 1;
+        matrix eager = tall * transpose(tall);
+        TS_ASSERT_EQUALS(wide[1199][0], eager[1199][0] - 1);
+        TS_ASSERT_EQUALS(wide[600][601], eager[600][601] - 1);
+    }
+
+    /**
+     * test Strassen-Winograd products against standard ones, with a base
+     * size small enough for several levels of recursion and padding
+     */
+    void test_strassen_products(void) {
+        setStrassenSizes(0, 16);
+        matrix a = denseValues(101, 70), b = denseValues(70, 93);
+        matrix standard = multiply(a, b, standardProduct);
+        matrix fast = multiply(a, b, strassenProduct);
+        TS_ASSERT_EQUALS(fast.numRows(), 101);
+        TS_ASSERT_EQUALS(fast.numCols(), 93);
+        double scale = 70 * max(a) * max(b);
+        TS_ASSERT_DELTA(max(fast - standard) / scale, 0, 1e-5);
+        TS_ASSERT_DELTA(min(fast - standard) / scale, 0, 1e-5);
+
+        // the operators use it above the threshold, and views work
+        setStrassenSizes(64, 16);
+        TS_ASSERT_EQUALS((a * b).algorithm(), strassenProduct);
+        TS_ASSERT_EQUALS((slice(a, 0, 39, 0, 69) * b).algorithm(),
+                         standardProduct);
+        matrix automatic = a * b + 1;
+        TS_ASSERT_DELTA(max(automatic - fast), 1, 1e-3);
+        matrix t = transpose(b) * transpose(a);
+        TS_ASSERT_DELTA(max(t - transpose(standard)) / scale, 0, 1e-5);
+
+        // integer products stay exact
+        basicMatrix<int32_t> x(70, 70);
+        for (int i = 0; i != 70; i++) x[i][(i * 7) % 70] = i;
+        basicMatrix<int32_t> y = multiply(x, x, strassenProduct);
+        basicMatrix<int32_t> z = multiply(x, x, standardProduct);
+        TS_ASSERT_EQUALS(max(y - z), 0);
+        TS_ASSERT_EQUALS(min(y - z), 0);
+        TS_ASSERT_EQUALS((x * x).algorithm(), standardProduct);
+
+        // large enough for the seven sub-products to be split over threads
+        setStrassenSizes(0, 16);
+        matrix tall = denseValues(1100, 32), wide = denseValues(32, 1000);
+        matrix split = multiply(tall, wide, strassenProduct);
+        matrix rows = multiply(tall, wide, standardProduct);
+        scale = 32 * max(tall) * max(wide);
+        TS_ASSERT_DELTA(max(split - rows) / scale, 0, 1e-5);
+        TS_ASSERT_DELTA(min(split - rows) / scale, 0, 1e-5);
+        setStrassenSizes(2048, 256);
+    }
+
+    /**
+     * test converting between element types and printing them
+     */
+    void test_element_types(void) {
+        basicMatrix<double> d(1, 3);
+        d[0][0] = 1.0 / 3;
+        d[0][1] = -2.5;
+        d[0][2] = 100;
+        basicMatrix<int8_t> small(d);
+        TS_ASSERT_EQUALS(small[0][1], -2);
+
+        stringstream doubles, ints;
+        doubles << d;
+        ints << small;
+        TS_ASSERT_EQUALS(doubles.str(), "1 3\n0.333333  -2.5  100  \n");
+        TS_ASSERT_EQUALS(ints.str(), "1 3\n0  -2  100  \n");
+    }
+
+    /**
+     * test that matrixRead converts binary files of other element types
+     */
+    void test_binary_element_types(void) {
+        string file = "../samples/matrix_tests.bin";
+        basicMatrix<double> d(2, 2);
+        d[0][0] = 0.1;
+        d[1][1] = -3;
+        matrixWrite(d, file);
+        matrix m = matrixRead(file);
+        TS_ASSERT_EQUALS(m[0][0], 0.1f);
+        TS_ASSERT_EQUALS(m[1][1], -3.0f);
+
+        basicMatrix<int8_t> b(40, 3);
+        for (int i = 0; i != 40; i++)
+            for (int j = 0; j != 3; j++) b[i][j] = i - j;
+        matrixWrite(b, file);
+        matrixStream s(file, 7);
+        TS_ASSERT_EQUALS(s[0][2], -2.0f);
+        TS_ASSERT_EQUALS(s[39][1], 38.0f);
+    }
+};
@@ -91,6 +91,7 @@ ParseResult Parser::parse(const char *text) {
 // Program
 ParseResult Parser::parseProgram() {
     ParseResult pr;
+    int offset = currToken->offset;
     // root
     // Program ::= varName '(' ')' '{' Stmts '}'
     match(variableName);
@@ -102,6 +103,7 @@ ParseResult Parser::parseProgram() {
     match(rightCurly);
     match(endOfFile);
     pr.ast = new Program(varName, dynamic_cast<Stmts *>(prStmts.ast));
+    locate(pr, offset);
     return pr;
 }
 
@@ -110,7 +112,29 @@ ParseResult Parser::parseProgram() {
 // identical purpose of parseDecl, handles special matrix syntax.
 ParseResult Parser::parseMatrixDecl() {
     ParseResult pr;
+    // 'sparse' asks for a matrix that stores only its nonzeros
+    bool sparse = attemptMatch(sparseKwd);
     match(matrixKwd);
+
+    // MatrixType ::= 'matrix' | 'matrix' '<' ElementType '>'
+    // ElementType ::= 'float' | 'int' | 'double' | 'int8'
+    string elementType;
+    if (attemptMatch(lessThan)) {
+        if (attemptMatch(floatKwd) || attemptMatch(intKwd)) {
+            elementType = prevToken->lexeme;
+        } else {
+            match(variableName);
+            elementType = prevToken->lexeme;
+            if (elementType != "double" && elementType != "int8")
+                throw((string) "Bad element type " + elementType +
+                      " in parseMatrixDecl");
+        }
+        match(greaterThan);
+        if (sparse && elementType != "float")
+            throw((string) "Sparse matrices hold float elements, not " +
+                  elementType + ", in parseMatrixDecl");
+    }
+
     match(variableName);
     string varName(prevToken->lexeme);
 
@@ -133,14 +157,14 @@ ParseResult Parser::parseMatrixDecl() {
             dynamic_cast<VarNameExpr *>(result4.ast)->unparse(),
             dynamic_cast<Expr *>(result1.ast),
             dynamic_cast<Expr *>(result2.ast),
-            dynamic_cast<Expr *>(result5.ast));
+            dynamic_cast<Expr *>(result5.ast), sparse, elementType);
     }
     // Decl ::= 'matrix' varName '=' Expr ';'
     else if (attemptMatch(assign)) {
         ParseResult result1 = parseExpr(0);
         match(semiColon);
-        pr.ast =
-            new MatrixShortDecl(varName, dynamic_cast<Expr *>(result1.ast));
+        pr.ast = new MatrixShortDecl(
+            varName, dynamic_cast<Expr *>(result1.ast), sparse, elementType);
     } else {
         throw((string) "Bad Syntax of Matrix Decl in in parseMatrixDecl");
     }
@@ -199,14 +223,17 @@ ParseResult Parser::parseStandardDecl() {
 // Decl
 ParseResult Parser::parseDecl() {
     ParseResult pr;
+    int offset = currToken->offset;
     // Decl :: matrix variableName ....
-    if (nextIs(matrixKwd)) {
+    // Decl :: sparse matrix variableName ....
+    if (nextIs(matrixKwd) || nextIs(sparseKwd)) {
         pr = parseMatrixDecl();
     }
     // Decl ::= Type variableName semiColon
     else {
         pr = parseStandardDecl();
     }
+    locate(pr, offset);
     return pr;
 }
 
@@ -214,6 +241,7 @@ ParseResult Parser::parseDecl() {
 // Stmts
 ParseResult Parser::parseStmts() {
     ParseResult pr;
+    int offset = currToken->offset;
     if (!nextIs(rightCurly) && !nextIs(inKwd)) {
         // Stmts ::= Stmt Stmts
         ParseResult prStmt = parseStmt();
@@ -225,6 +253,7 @@ ParseResult Parser::parseStmts() {
         // nothing to match.
         pr.ast = new EmptyStmts();
     }
+    locate(pr, offset);
     return pr;
 }
 
@@ -232,9 +261,10 @@ ParseResult Parser::parseStmts() {
 // Stmt
 ParseResult Parser::parseStmt() {
     ParseResult pr;
+    int offset = currToken->offset;
     // Stmt ::= Decl
     if (nextIs(intKwd) || nextIs(floatKwd) || nextIs(matrixKwd) ||
-        nextIs(stringKwd) || nextIs(boolKwd)) {
+        nextIs(sparseKwd) || nextIs(stringKwd) || nextIs(boolKwd)) {
         ParseResult result1 = parseDecl();
         pr.ast = new DeclStmt(dynamic_cast<Decl *>(result1.ast));
     }
@@ -325,6 +355,7 @@ ParseResult Parser::parseStmt() {
     } else {
         throw(makeErrorMsg(currToken->terminal) + " while parsing a statement");
     }
+    locate(pr, offset);
     return pr;
 }
 
@@ -335,10 +366,14 @@ ParseResult Parser::parseExpr(int rbp) {
        associated parse methods.  The ExtToken objects have 'nud' and
        'led' methods that are dispatchers that call the appropriate
        parse methods.*/
+    int offset = currToken->offset;
     ParseResult left = currToken->nud();
+    locate(left, offset);
 
+    // an infix expression starts where its left operand does
     while (rbp < currToken->lbp()) {
         left = currToken->led(left);
+        locate(left, offset);
     }
 
     return left;
@@ -399,13 +434,26 @@ ParseResult Parser::parseVariableName() {
     match(variableName);
     string varName(prevToken->lexeme);
     // Expr ::= varName '[' Expr ':' Expr ']'
+    // Expr ::= varName '[' Expr [ 'to' Expr ] ':' Expr [ 'to' Expr ] ']'
     if (attemptMatch(leftSquare)) {
         ParseResult result1 = parseExpr(0);
+        Expr *lastRow = NULL;
+        if (attemptMatch(toKwd))
+            lastRow = dynamic_cast<Expr *>(parseExpr(0).ast);
         match(colon);
         ParseResult result2 = parseExpr(0);
+        Expr *lastCol = NULL;
+        if (attemptMatch(toKwd))
+            lastCol = dynamic_cast<Expr *>(parseExpr(0).ast);
         match(rightSquare);
-        pr.ast = new MatrixExpr(varName, dynamic_cast<Expr *>(result1.ast),
-                                dynamic_cast<Expr *>(result2.ast));
+        if (lastRow == NULL && lastCol == NULL)
+            pr.ast = new MatrixExpr(varName,
+                                    dynamic_cast<Expr *>(result1.ast),
+                                    dynamic_cast<Expr *>(result2.ast));
+        else
+            pr.ast = new MatrixSliceExpr(
+                varName, dynamic_cast<Expr *>(result1.ast), lastRow,
+                dynamic_cast<Expr *>(result2.ast), lastCol);
     }
     // Expr ::= varableName '(' Expr ')'        //NestedOrFunctionCall
     else if (attemptMatch(leftParen)) {
@@ -597,6 +645,10 @@ void Parser::nextToken() {
     }
 }
 
+void Parser::locate(ParseResult &pr, int offset) {
+    if (pr.ast != NULL) pr.ast->offset = offset;
+}
+
 string Parser::terminalDescription(tokenType terminal) {
     Token *dummyToken = new Token("", terminal, NULL);
     ExtToken *dummyExtToken = extendToken(this, dummyToken);
@@ -71,6 +71,8 @@ public:
     bool attemptMatch (tokenType tt) ;
     bool nextIs (tokenType tt) ;
     void nextToken () ;
+    // give the node parsed from the token at offset onwards that offset
+    void locate ( ParseResult &pr, int offset ) ;
 
     std::string terminalDescription ( tokenType terminal ) ;
     std::string makeErrorMsg ( tokenType terminal ) ;
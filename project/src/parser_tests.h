@@ -91,4 +91,27 @@ public:
         TSM_ASSERT ( msg , pr.ok );
     }
 
+    void test_parse_element_types ( ) {
+        const char *filename = "../samples/element_types.dsl" ;
+        const char *text = readInputFromFile ( filename )  ;
+        TS_ASSERT ( text ) ;
+        ParseResult pr = p->parse ( text ) ;
+        string msg (filename) ;
+        msg += "\n" + pr.errors ; 
+        TSM_ASSERT ( msg , pr.ok );
+    }
+
+    void test_parse_slices ( ) {
+        TS_ASSERT ( p->parse ( "main () { print ( m [ 0 to n : 1 ] ) ; }" ).ok ) ;
+        TS_ASSERT ( p->parse ( "main () { print ( m [ i : 0 to 2 ] ) ; }" ).ok ) ;
+        TS_ASSERT ( ! p->parse ( "main () { print ( m [ 0 to : 1 ] ) ; }" ).ok ) ;
+        TS_ASSERT ( ! p->parse ( "main () { print ( m [ 0 to 1 ] ) ; }" ).ok ) ;
+    }
+
+    void test_parse_bad_element_types ( ) {
+        TS_ASSERT ( ! p->parse ( "main () { matrix<boolean> m = a ; }" ).ok ) ;
+        TS_ASSERT ( ! p->parse ( "main () { matrix<long> m = a ; }" ).ok ) ;
+        TS_ASSERT ( ! p->parse ( "main () { sparse matrix<int> m = a ; }" ).ok ) ;
+    }
+
 } ;
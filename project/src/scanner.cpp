@@ -10,16 +10,33 @@
 #include "./regex.h"
 #include "./scanner.h"
 #include "./string.h"
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
 
-// Constructor for Token, initialize lexeme, terminal and next pointer
-Token::Token(string lexeme, tokenType terminal, Token *next) {
+// Constructor for Token, initialize lexeme, terminal, next pointer and offset
+Token::Token(string lexeme, tokenType terminal, Token *next, int offset) {
     // cout << "Token is created, lexeme is " << lexeme << endl;
     this->lexeme = lexeme;
     this->terminal = terminal;
     this->next = next;
+    this->offset = offset;
+}
+
+SourceLines::SourceLines(const string &filename, const char *text)
+    : filename(filename) {
+    starts.push_back(0);
+    for (int k = 0; text[k] != '\0'; k++)
+        if (text[k] == '\n') starts.push_back(k + 1);
+}
+
+int SourceLines::line(int offset) const {
+    return upper_bound(starts.begin(), starts.end(), offset) - starts.begin();
+}
+
+int SourceLines::column(int offset) const {
+    return offset - starts[line(offset) - 1] + 1;
 }
 
 /**
@@ -152,9 +169,10 @@ int Scanner::matchToken(const char *text, Token *&matchedToken) {
     int maxNumMatchedChars = -1;
     tokenType matchedType = lexicalError;
 
-    for (int tokenTypeIndex = 0; tokenTypeIndex != lexicalError;
-         tokenTypeIndex++) {
-        tokenType currentType = static_cast<tokenType>(tokenTypeIndex);
+    // the keywords after lexicalError are tried first, so that like the
+    // keywords before variableName they win a tie with it
+    for (int k = lexicalError + 1; k != numTokenTypes + lexicalError; k++) {
+        tokenType currentType = static_cast<tokenType>(k % numTokenTypes);
         int numMatchedChars = matchTokenType(text, currentType);
 
         if (numMatchedChars > maxNumMatchedChars) {
@@ -201,6 +219,7 @@ Token *Scanner::makeTokenList(const char *text) {
     // int totalLength = strlen(text);
     head = NULL;
     tail = NULL;
+    const char *start = text;
     Token *matchedToken;
     do {
         int skipLength = consumeWhiteSpaceAndComments(text);
@@ -211,6 +230,7 @@ Token *Scanner::makeTokenList(const char *text) {
         int matchedLength = matchToken(text, matchedToken);
 
         if (matchedToken == NULL) return NULL;
+        matchedToken->offset = text - start;
 
         if (head == NULL && tail == NULL) {
             head = matchedToken;
@@ -239,12 +259,12 @@ Token *Scanner::scan(const char *text) { return makeTokenList(text); }
  * in the constructor of Scanner
  */
 void Scanner::initializeRegex() {
-    this->regex_array = new regex_t *[lexicalError];
+    this->regex_array = new regex_t *[numTokenTypes];
 
     // a temporary pointer re
     regex_t *re = NULL;
 
-    for (int tokenTypeIndex = 0; tokenTypeIndex != lexicalError;
+    for (int tokenTypeIndex = 0; tokenTypeIndex != numTokenTypes;
          tokenTypeIndex++) {
         tokenType currentType = static_cast<tokenType>(tokenTypeIndex);
 
@@ -298,6 +318,9 @@ void Scanner::initializeRegex() {
             case printKwd:
                 re = makeRegex("^print");
                 break;
+            case sparseKwd:
+                re = makeRegex("^sparse");
+                break;
             case toKwd:
                 re = makeRegex("^to");
                 break;
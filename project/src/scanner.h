@@ -12,6 +12,7 @@
 
 #include "./regex.h"
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -75,15 +76,21 @@ enum tokenEnumType {
 
     // Special terminal types
     endOfFile,
-    lexicalError
+    lexicalError,
+
+    // Keywords added since, kept last so the values above do not change
+    sparseKwd
 };
 typedef enum tokenEnumType tokenType;
 
+// one more than the largest tokenType, the length of arrays indexed by it
+const int numTokenTypes = sparseKwd + 1;
+
 /**
  * Below is a class Token used for storing information of a single
  * token parsed from the text. A Token instance contains the a lexeme
- * (matched string), a terminal (type of the matched string) and a
- * next pointer pointing to the next Token.
+ * (matched string), a terminal (type of the matched string), the offset
+ * of the lexeme in the text and a next pointer pointing to the next Token.
  */
 class Token {
 public:
@@ -91,8 +98,41 @@ public:
     tokenType terminal;
     Token *next;
 
-    // Constructor for Token, initialize lexeme, terminal and next pointer
-    Token(string lexeme, tokenType terminal, Token *next);
+    // the offset of the first character of the lexeme in the scanned
+    // text, or -1; see SourceLines for its line and column
+    int offset;
+
+    /**
+     * Constructor for Token, initialize lexeme, terminal, next pointer and
+     * offset
+     */
+    Token(string lexeme, tokenType terminal, Token *next, int offset = -1);
+};
+
+/**
+ * The lines of a source file, to turn the offsets kept by Tokens and AST
+ * nodes into lines and columns. Only the offset at which each line starts
+ * is kept, so a lookup is a binary search.
+ */
+class SourceLines {
+public:
+    /**
+     * @param filename the name of the file, as #line directives give it
+     * @param text     its text
+     */
+    SourceLines(const string &filename, const char *text);
+
+    string filename;
+
+    // the line of an offset in the text, from 1
+    int line(int offset) const;
+
+    // the column of an offset in the text, from 1
+    int column(int offset) const;
+
+private:
+    // the offset of the first character of each line
+    vector<int> starts;
 };
 
 /**
@@ -136,7 +176,7 @@ private:
 
     /**
      * array of regular expressions for each tokenType,
-     * with length "lexicalError", it will be initialized
+     * with length "numTokenTypes", it will be initialized
      * in the constructor of Scanner by calling function
      * initializeRegex()
      */
@@ -135,6 +135,11 @@ public:
 
     void test_terminal_toKwd() { tokenMaker_tester("to ", toKwd, "to"); }
 
+    void test_terminal_sparseKwd() {
+        tokenMaker_tester("sparse ", sparseKwd, "sparse");
+        tokenMaker_tester("sparsely ", variableName, "sparsely");
+    }
+
     void test_terminal_intConst() {
         tokenMaker_tester("132169080;", intConst, "132169080");
     }
@@ -330,6 +335,33 @@ public:
         TS_ASSERT(sameTerminals(tks, 4, ts));
     }
 
+    // Tokens record where their lexemes start, which SourceLines turns
+    // into lines and columns.
+    void test_scan_offsets() {
+        const char *text = "x = 12 ;\n  /* a comment */\n\tprint(x) ;";
+        Token *tks = s->scan(text);
+        TS_ASSERT(tks != NULL);
+        int offsets[] = {0, 2, 4, 7, 28, 33, 34, 35, 37, 38};
+        for (int k = 0; k != 10; k++, tks = tks->next) {
+            TS_ASSERT(tks != NULL);
+            TS_ASSERT_EQUALS(tks->offset, offsets[k]);
+        }
+
+        SourceLines lines("text.dsl", text);
+        TS_ASSERT_EQUALS(lines.filename, "text.dsl");
+        TS_ASSERT_EQUALS(lines.line(0), 1);
+        TS_ASSERT_EQUALS(lines.column(0), 1);
+        TS_ASSERT_EQUALS(lines.line(7), 1);
+        TS_ASSERT_EQUALS(lines.column(7), 8);
+        TS_ASSERT_EQUALS(lines.line(8), 1);
+        TS_ASSERT_EQUALS(lines.line(9), 2);
+        TS_ASSERT_EQUALS(lines.column(9), 1);
+        TS_ASSERT_EQUALS(lines.line(28), 3);
+        TS_ASSERT_EQUALS(lines.column(28), 2);
+        TS_ASSERT_EQUALS(lines.line(38), 3);
+        TS_ASSERT_EQUALS(lines.column(38), 12);
+    }
+
     /* This test checks that the scanner returns a list of tokens with
        the correct terminal fields.  It doesn't check that the lexemes
        are correct.
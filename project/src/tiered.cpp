@@ -0,0 +1,226 @@
+/***
+ * Tiered: runs a CDAL program in the VirtualMachine while its translation
+ * is compiled, then hands it over; see tiered.h.
+ */
+
+#include "./tiered.h"
+#include "./AST.h"
+#include "./bytecode.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+/**
+ * the translation of a program being compiled by g++ in a child process,
+ * which a thread waits for
+ */
+class backgroundBuild {
+public:
+    backgroundBuild() : pid(-1), done(false), succeeded(false) {}
+
+    ~backgroundBuild() { abandon(); }
+
+    // start compiling source to executable, returning false if g++ could
+    // not be started
+    bool start(const string &runtime, const string &source,
+               const string &executable, const string &log) {
+        // the prebuilt runtime if there is one, else its source
+        string library = runtime + "/libcdal.a";
+        bool prebuilt = access(library.c_str(), R_OK) == 0;
+        string matrixSource = runtime + "/Matrix.cpp";
+        int output = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (output < 0) return false;
+        pid = fork();
+        if (pid == 0) {
+            // its own process group, so that abandoning the build also
+            // stops the compiler passes g++ runs, and a lower priority,
+            // so that it takes only the time the machine leaves idle
+            setpgid(0, 0);
+            int niceness = nice(10);
+            (void)niceness;
+            dup2(output, STDOUT_FILENO);
+            dup2(output, STDERR_FILENO);
+            if (prebuilt)
+                execlp("g++", "g++", "-O2", "-std=c++0x", "-pthread", "-fPIC",
+                       "-I", runtime.c_str(), "-o", executable.c_str(),
+                       source.c_str(), library.c_str(), (char *)NULL);
+            else
+                execlp("g++", "g++", "-O2", "-std=c++0x", "-pthread", "-I",
+                       runtime.c_str(), "-o", executable.c_str(),
+                       matrixSource.c_str(), source.c_str(), (char *)NULL);
+            _exit(127);
+        }
+        close(output);
+        if (pid < 0) return false;
+        waiter = thread([this]() {
+            int status;
+            bool ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+                      WEXITSTATUS(status) == 0;
+            lock_guard<mutex> lock(m);
+            succeeded = ok;
+            done = true;
+            finished.notify_all();
+        });
+        return true;
+    }
+
+    // whether the build has finished successfully, without waiting
+    bool ready() { return succeeded; }
+
+    // wait for the build to finish, returning whether it succeeded
+    bool wait() {
+        if (pid < 0) return false;
+        unique_lock<mutex> lock(m);
+        finished.wait(lock, [this]() { return done.load(); });
+        return succeeded;
+    }
+
+    // stop the build if it is still running
+    void abandon() {
+        if (pid < 0) return;
+        if (!done) kill(-pid, SIGKILL);
+        // the child may not have made its own group yet
+        if (!done) kill(pid, SIGKILL);
+        waiter.join();
+        pid = -1;
+    }
+
+private:
+    pid_t pid;
+    thread waiter;
+    mutex m;
+    condition_variable finished;
+    atomic<bool> done;
+    atomic<bool> succeeded;
+};
+
+// the row a program stopped before, or -1 if it is not in a comprehension
+int rowOf(const VirtualMachine &machine, const SafePoint &point) {
+    if (point.row < 0) return -1;
+    Operand index;
+    index.type = intType;
+    index.reg = point.row;
+    index.temporary = false;
+    return machine.value(index).integer;
+}
+
+/**
+ * write the state of a program stopped at a safe point, in the format
+ * resumePoint reads
+ */
+void writeState(ostream &os, const VirtualMachine &machine,
+                const SafePoint &point) {
+    os << "CDAL state " << point.statement << " " << rowOf(machine, point)
+       << "\n" << setprecision(17);
+    for (size_t k = 0; k != point.variables.size(); k++) {
+        const string &name = point.variables[k].first;
+        Value value = machine.value(point.variables[k].second);
+        if (value.type == matrixType) {
+            os << name << " m\n";
+            value.matrix->write(os);
+        } else if (value.type == stringType) {
+            os << name << " s " << value.text.size() << "\n"
+               << value.text << "\n";
+        } else if (value.type <= longType) {
+            os << name << " n " << value.integer << "\n";
+        } else {
+            os << name << " n " << value.real << "\n";
+        }
+    }
+}
+
+/**
+ * run the compiled translation from the given state, copying what it
+ * prints to out
+ * @return its exit status
+ */
+int resume(const string &executable, const string &state, ostream &out) {
+    string command = "'" + executable + "' --resume '" + state + "'";
+    FILE *child = popen(command.c_str(), "r");
+    if (child == NULL) throw string("cannot run the compiled program");
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), child)) > 0)
+        out.write(buffer, n);
+    int status = pclose(child);
+    out.flush();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+}  // namespace
+
+TieredRunner::TieredRunner(ostream &output, const string &runtime)
+    : out(output),
+      runtime(runtime),
+      switchAt(-1),
+      switchedStatement(-1),
+      switchedRow(-1) {}
+
+int TieredRunner::run(Program *program) {
+    switchedStatement = switchedRow = -1;
+    char directory[] = "/tmp/cdal_tieredXXXXXX";
+    string dir, source, executable, log, state;
+    backgroundBuild build;
+
+    int status = 0;
+    try {
+        BytecodeCompiler compiler;
+        Bytecode code = compiler.compile(program, true);
+
+        if (mkdtemp(directory) != NULL) {
+            dir = directory;
+            source = dir + "/program.cpp";
+            executable = dir + "/program";
+            log = dir + "/build.log";
+            state = dir + "/state";
+            ofstream(source.c_str()) << program->resumableCppCode() << "\n";
+            build.start(runtime, source, executable, log);
+        }
+
+        int reached = 0;
+        VirtualMachine machine(out);
+        const SafePoint *stopped = machine.execute(
+            code, [&](const SafePoint &) {
+                if (reached++ == switchAt) return build.wait();
+                return build.ready();
+            });
+        if (stopped != NULL) {
+            {
+                ofstream os(state.c_str(), ofstream::binary);
+                writeState(os, machine, *stopped);
+                if (!os) throw string("cannot write ") + state;
+            }
+            switchedStatement = stopped->statement;
+            switchedRow = rowOf(machine, *stopped);
+            out.flush();
+            status = resume(executable, state, out);
+        }
+    } catch (string error) {
+        out.flush();
+        cerr << "ERROR, " << error << endl;
+        status = 1;
+    }
+    out.flush();
+
+    build.abandon();
+    if (!dir.empty()) {
+        unlink(source.c_str());
+        unlink(executable.c_str());
+        unlink(log.c_str());
+        unlink(state.c_str());
+        rmdir(dir.c_str());
+    }
+    return status;
+}
@@ -0,0 +1,62 @@
+/***
+ * Tiered: runs a CDAL program in the VirtualMachine straight away while
+ * its translation is compiled in the background, and hands the program
+ * over to the compiled translation once the build is done.
+ *
+ * The program is compiled to bytecode with safe points, before each
+ * top-level statement of main and before each row of a comprehension at
+ * top level. At the first safe point reached after the build succeeds, the
+ * machine stops, the top-level variables are written to a state file, and
+ * the translation, made by Program::resumableCppCode, carries on from
+ * there with --resume. Short programs finish in the machine before the
+ * build does, which is then abandoned; long ones run at compiled speed
+ * without waiting for the compiler first. If the build fails, the machine
+ * runs the program to its end.
+ */
+
+#ifndef TIERED_H
+#define TIERED_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+class Program;
+
+class TieredRunner {
+public:
+    /**
+     * @param output  where print statements write
+     * @param runtime the directory holding Matrix.h and Matrix.cpp, and
+     * the prebuilt libcdal.a and Matrix.h.gch if the runtime target of the
+     * Makefile has made them
+     */
+    TieredRunner(ostream &output = cout, const string &runtime = "../samples");
+
+    /**
+     * run a program, reporting errors on cerr as Interpreter::run does
+     * @return 0, or 1 if the program could not be run to its end
+     */
+    int run(Program *program);
+
+    ostream &out;
+    string runtime;
+
+    /**
+     * the safe point, counted from 0, at which the machine waits for the
+     * build to finish so that the program is handed over there, or -1 to
+     * hand it over at whichever safe point follows the build
+     */
+    int switchAt;
+
+    /**
+     * where the last run was handed over: the top-level statement and the
+     * row of its comprehension, or -1; switchedStatement is -1 if the
+     * machine ran the program to its end
+     */
+    int switchedStatement;
+    int switchedRow;
+};
+
+#endif  // TIERED_H